@@ -2,24 +2,76 @@
 #include <blue.h>
 #include <pins.h>
 #include <uart.h>
+#include <udma.h>
 #include <assert.h>
 #include <core.h>
+#include <serial.h>
+#include <link.h>
+#include <util.h>
 #include <gpio.h>
 #include <ioc.h>
+#include <interrupt.h>
+#include <hw_ints.h>
 #include <hw_ioc.h>
+#include <hw_uart.h>
 #include <sys_ctrl.h>
+#include <sleepmode.h>
 
 #define UART_INT 0xF0  // Interrupts handled by uart
 
-static uint8_t  inpacket[PACKET_BYTES];
-static unsigned inbytes;
-static uint8_t *outpacket;
+// Framed link with retransmit on top of the UART, 0 for bare packets
+#ifndef BLUE_LINK
+#define BLUE_LINK 1
+#endif
+
+//
+// Both directions run through rings the uDMA fills and drains, the CPU only
+// steps in between transfers. Rx transfers stop at the next chunk boundary so
+// they never wrap. They only take whole bursts from the FIFO, so when the line
+// goes idle the last few bytes are still in the FIFO and the receive timeout
+// picks them up by hand.
+//
+#define RX_RING_BYTES    512   // Power of two, whole chunks
+#define RX_CHUNK_BYTES   64
+#define RX_PAUSE_BYTES   128   // Hold the sender off below this much room
+#define RX_RESUME_BYTES  256   // and let it go again above this much
+#define TX_RING_BYTES    256   // Power of two
+
+#define RX_DMA           UDMA_CH8_UART0RX
+#define TX_DMA           UDMA_CH9_UART0TX
+#define UART_DATA        ((void *) (UART0_BASE + UART_O_DR))
+
+static uint8_t           rx_ring[RX_RING_BYTES];
+static volatile uint32_t rx_head;       // Free running, written by the DMA and timeout side
+static uint32_t          rx_tail;       // Free running, what the core has taken
+static uint32_t          rx_armed;      // Size of the running transfer, 0 when none
+static bool              rx_paused;
+static volatile bool     rx_stalled;    // Core had no room, blue_process_events kicks us again
+
+static uint8_t           tx_ring[TX_RING_BYTES];
+static volatile uint32_t tx_head;       // Free running, what tx_fill put in
+static volatile uint32_t tx_tail;       // Free running, what the DMA took out
+static uint32_t          tx_armed;      // Size of the running transfer, 0 when none
+
+#if BLUE_LINK
+static link_t            link;
+#else
+static serial_t          serial;
+#endif
+static bool              active;
+
+// Control table, only the primary structures up to the tx channel are used
+#pragma DATA_ALIGN(dma_table, 1024)
+static uint8_t           dma_table[(TX_DMA + 1) * 16];
 
 static void     blue_isr  (void);
-static void     send      (uint8_t *buff, unsigned bytes);
-
-static void     rx_pause  (void);
-static void     rx_resume (void);
+static void     rx_arm    (void);
+static void     rx_idle   (void);
+static void     rx_drain  (void);
+static void     rx_flow   (void);
+static void     tx_arm    (void);
+static void     tx_fill   (void);
+static uint32_t link_ms   (void);
 
 
 static void blue_isr(void)
@@ -33,78 +85,214 @@ static void blue_isr(void)
     UARTIntClear(UART0_BASE, (int_stat & UART_INT));
 
     //
-    // RX or RX timeout
+    // RX, a transfer finished or the line went idle part way into a burst
     //
-    if (int_stat & (UART_INT_RX | UART_INT_RT))
+    if (rx_armed && !uDMAChannelIsEnabled(RX_DMA))
     {
-        // Put received bytes into buffer
+        rx_head  += rx_armed;
+        rx_armed  = 0;
+    }
 
-        while (UARTCharsAvail(UART0_BASE))
-        {
-            inpacket[inbytes++] = UARTCharGetNonBlocking(UART0_BASE);
+    if (int_stat & UART_INT_RT)  rx_idle();
 
-            if (inbytes == PACKET_BYTES)
-            {
-                rx_pause();
+    rx_drain();
 
-                //
-                // Assumes every time rx data is available, it is packetized appropriately
-                // with a flow control and byte count, thus no byte count is necessary.
-                //
-                core_inpacket(inpacket);
+    //
+    // TX, a transfer finished or the main loop queued more
+    //
+    if (tx_armed && !uDMAChannelIsEnabled(TX_DMA))
+    {
+        tx_tail  += tx_armed;
+        tx_armed  = 0;
+    }
 
-                inbytes = 0;
+    // Only the interrupt takes from the core queue, and only while this transport
+    // owns it. The link keeps all its state here, acks and resends go out too.
+    tx_fill();
 
-                break;
-            }
-        }
-    }
+    tx_arm();
+}
 
-    //
-    // TX
-    //
-    if (int_stat & UART_INT_TX)
+static void rx_arm(void)
+{
+    uint32_t size = RX_CHUNK_BYTES - (rx_head % RX_CHUNK_BYTES);
+
+    if (rx_armed)  return;
+
+    // Only happens if the sender ignores flow control, the FIFO has to hold it
+    if (RX_RING_BYTES - (rx_head - rx_tail) < size)
     {
-        // Do nothing for now.
+        UARTIntDisable(UART0_BASE, UART_INT_RT);
+        return;
     }
 
-    //
-    // Send back responses from the core
-    //
-    while (core_outpacket_ready())
+    uDMAChannelTransferSet(RX_DMA | UDMA_PRI_SELECT, UDMA_MODE_BASIC, UART_DATA, &rx_ring[rx_head % RX_RING_BYTES], size);
+    uDMAChannelEnable(RX_DMA);
+
+    rx_armed = size;
+
+    UARTIntEnable(UART0_BASE, UART_INT_RT);
+}
+
+static void rx_idle(void)
+{
+    uint32_t room;
+
+    // Take what the transfer got so far, the rest of the chunk is for the FIFO leftovers
+    if (rx_armed)
     {
-        outpacket = core_outpacket();
-        send(outpacket, PACKET_BYTES);
+        uDMAChannelDisable(RX_DMA);
+
+        rx_head  += rx_armed - uDMAChannelSizeGet(RX_DMA | UDMA_PRI_SELECT);
+        rx_armed  = 0;
     }
 
-    rx_resume();
+    room = min(RX_CHUNK_BYTES - (rx_head % RX_CHUNK_BYTES), RX_RING_BYTES - (rx_head - rx_tail));
+
+    while (room > 0 && UARTCharsAvail(UART0_BASE))
+    {
+        rx_ring[rx_head % RX_RING_BYTES] = UARTCharGetNonBlocking(UART0_BASE);
+        rx_head++;
+        room--;
+    }
 }
 
-static void rx_pause(void)
+static void rx_drain(void)
 {
-    GPIOPinWrite(UART_BT_BASE, UART_BT_RTS, UART_BT_RTS);
+    uint32_t n;
+#if !BLUE_LINK
+    uint32_t taken;
+#endif
+
+    rx_stalled = false;
+
+#if BLUE_LINK
+    // The link takes everything, frames it cannot hold are sent again later
+    while (rx_tail != rx_head)
+    {
+        n = min(rx_head - rx_tail, RX_RING_BYTES - (rx_tail % RX_RING_BYTES));
+
+        link_rx(&link, &rx_ring[rx_tail % RX_RING_BYTES], n);
+
+        rx_tail += n;
+    }
+#else
+    // Hand the core what it has room for, in packet sized pieces or whatever came in
+    while (rx_tail != rx_head)
+    {
+        n     = min(rx_head - rx_tail, RX_RING_BYTES - (rx_tail % RX_RING_BYTES));
+        taken = serial_rx(&serial, &rx_ring[rx_tail % RX_RING_BYTES], n);
+
+        rx_tail += taken;
+
+        if (taken < n)
+        {
+            rx_stalled = true;
+            break;
+        }
+    }
+#endif
+
+    rx_arm();
+    rx_flow();
 }
 
-static void rx_resume(void)
+static void rx_flow(void)
 {
-    GPIOPinWrite(UART_BT_BASE, UART_BT_RTS, 0);
+    uint32_t room = RX_RING_BYTES - (rx_head - rx_tail);
+
+    // Flow control follows the ring, not each packet
+    if (!rx_paused && room < RX_PAUSE_BYTES)
+    {
+        GPIOPinWrite(UART_BT_BASE, UART_BT_RTS, UART_BT_RTS);
+        rx_paused = true;
+    }
+    else if (rx_paused && room >= RX_RESUME_BYTES)
+    {
+        GPIOPinWrite(UART_BT_BASE, UART_BT_RTS, 0);
+        rx_paused = false;
+    }
 }
 
+static void tx_arm(void)
+{
+    uint32_t size;
+
+    if (tx_armed || tx_head == tx_tail)  return;
+
+    // Up to the end of the ring, the rest goes with the next transfer
+    size = min(tx_head - tx_tail, TX_RING_BYTES - (tx_tail % TX_RING_BYTES));
+
+    uDMAChannelTransferSet(TX_DMA | UDMA_PRI_SELECT, UDMA_MODE_BASIC, &tx_ring[tx_tail % TX_RING_BYTES], UART_DATA, size);
+    uDMAChannelEnable(TX_DMA);
+
+    tx_armed = size;
+}
 
-static void send(uint8_t *buff, unsigned bytes)
+static void tx_fill(void)
 {
-    unsigned i;
+    uint32_t room, pos, n;
 
-    for (i = 0; i < bytes; i++)
+    // Responses from the core go into the ring in whatever pieces fit
+    while ((room = TX_RING_BYTES - (tx_head - tx_tail)) > 0)
     {
-        UARTCharPut(UART0_BASE, buff[i]);
+        pos = tx_head % TX_RING_BYTES;
+#if BLUE_LINK
+        n   = link_tx(&link, &tx_ring[pos], min(room, TX_RING_BYTES - pos), link_ms());
+#else
+        n   = serial_tx(&serial, &tx_ring[pos], min(room, TX_RING_BYTES - pos));
+#endif
+
+        if (0 == n)  break;
+
+        tx_head += n;
     }
 }
 
+//
+// Sleep timer runs off the 32 kHz oscillator, 32 ticks are close enough to a
+// millisecond. Shifting the count down would wrap at 2^27 ms, which breaks the
+// differences the link takes, so the milliseconds are counted here instead
+// and wrap at 2^32. Called from both the main loop and the interrupt.
+//
+static uint32_t link_ms(void)
+{
+    static uint32_t last, ms, ticks;
+    bool            intDisabled = IntMasterDisable();
+    uint32_t        now         = SleepModeTimerCountGet();
+
+    ticks += now - last;
+    last   = now;
+    ms    += ticks >> 5;
+    ticks &= 31;
+    now    = ms;
+
+    if (!intDisabled)  IntMasterEnable();
+
+    return now;
+}
+
 
 void blue_process_events(void)
 {
-    // Nothing for now
+    if (!active)  return;
+
+#if BLUE_LINK
+    // Responses, acks, resends and held frames are all moved by the interrupt,
+    // reading the link state from here is only a hint when to kick it
+    if ((!tx_armed && tx_head != tx_tail) || link_due(&link, link_ms()))
+    {
+        IntPendSet(INT_UART0);
+    }
+#else
+    // The interrupt fills and starts transfers, and takes in what the core had no room for
+    if ((!tx_armed && tx_head != tx_tail) ||
+        (tx_head - tx_tail < TX_RING_BYTES && serial_tx_ready(&serial)) ||
+        (rx_stalled && serial_rx_room(&serial)))
+    {
+        IntPendSet(INT_UART0);
+    }
+#endif
 }
 
 void blue_init(void)
@@ -112,7 +300,17 @@ void blue_init(void)
     //const int BAUD_RATE = 115200;
     const int BAUD_RATE = 460800;
 
-    inbytes = 0;
+    rx_head   = rx_tail = 0;
+    tx_head   = tx_tail = 0;
+    rx_armed  = tx_armed = 0;
+    rx_paused = rx_stalled = false;
+    active    = true;
+
+#if BLUE_LINK
+    link_init(&link, &link_core_queue);
+#else
+    serial_init(&serial);
+#endif
 
     // Enable UART peripheral module
     SysCtrlPeripheralEnable(SYS_CTRL_PERIPH_UART0);
@@ -135,30 +333,44 @@ void blue_init(void)
     IOCPinConfigPeriphInput  (UART_BT_BASE, UART_BT_RXD, IOC_UARTRXD_UART0);
     GPIOPinTypeUARTInput     (UART_BT_BASE, UART_BT_RXD);
 
-    // Manually controlling the flow control signal
+    // UART0 has no flow control of its own, RTS is driven from the rx ring level
     GPIOPinTypeGPIOOutput    (UART_BT_BASE, UART_BT_RTS);
     GPIOPinWrite             (UART_BT_BASE, UART_BT_RTS, 0);
 
-    // Register UART interrupt handler
+    //
+    // uDMA channels, rx takes bursts of 8 at the half full FIFO level and
+    // ignores single requests so leftovers stay for the receive timeout
+    //
+    uDMAEnable();
+    uDMAControlBaseSet(dma_table);
+
+    uDMAChannelAssign(RX_DMA);
+    uDMAChannelAttributeDisable(RX_DMA, UDMA_ATTR_ALL);
+    uDMAChannelAttributeEnable (RX_DMA, UDMA_ATTR_USEBURST);
+    uDMAChannelControlSet(RX_DMA | UDMA_PRI_SELECT, UDMA_SIZE_8 | UDMA_SRC_INC_NONE | UDMA_DST_INC_8 | UDMA_ARB_8);
+
+    uDMAChannelAssign(TX_DMA);
+    uDMAChannelAttributeDisable(TX_DMA, UDMA_ATTR_ALL);
+    uDMAChannelControlSet(TX_DMA | UDMA_PRI_SELECT, UDMA_SIZE_8 | UDMA_SRC_INC_8 | UDMA_DST_INC_NONE | UDMA_ARB_8);
+
+    // Register UART interrupt handler, it also gets the uDMA done events for both channels
     UARTIntRegister(UART0_BASE, &blue_isr);
 
     // Configure and enable UART module
     UARTConfigSetExpClk(UART0_BASE, SysCtrlClockGet(), BAUD_RATE,
                         (UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE));
 
-    // TX interrupts occur on FIFO threshold
-    UARTTxIntModeSet(UART0_BASE, UART_TXINT_MODE_FIFO);
-
-    // Configure FIFO interrupt threshold (half full)
+    // Configure FIFO levels (half full), the DMA requests follow them
     UARTFIFOLevelSet(UART0_BASE, UART_FIFO_TX4_8, UART_FIFO_RX4_8);
 
+    UARTDMAEnable(UART0_BASE, UART_DMA_RX | UART_DMA_TX);
+
     // Clear all UART module interrupt flags
     UARTIntClear(UART0_BASE, 0x17FF);
 
-    // Enable UART module interrupts (RX, TX, RX timeout)
-    UARTIntEnable(UART0_BASE, (UART_INT_RX | UART_INT_TX | UART_INT_RT));
+    // Only the receive timeout, everything else is done by the DMA
+    rx_arm();
 
     // Enable UART function
     UARTEnable(UART0_BASE);
-
 }
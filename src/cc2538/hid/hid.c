@@ -40,7 +40,10 @@
 #include <hid.h>
 #include <usb_firmware_library_headers.h>
 #include <core.h>
+#include <usbpipe.h>
 #include <assert.h>
+#include <interrupt.h>
+#include <hw_ints.h>
 
 //
 // Constants specifying HID Class requests (bRequest)
@@ -110,7 +113,7 @@ const USB_DESCRIPTOR usbDescriptor =
         USB_EP0_PACKET_SIZE,            // bMaxPacketSize0
         0x0451,                         // idVendor (Texas Instruments)
         0x16C9,                         // idProduct (CC2538 HID)
-        0x0100,                         // bcdDevice (v1.0)
+        0x0101,                         // bcdDevice (v1.01, Windows asks for the MS OS descriptors again)
         0x01,                           // iManufacturer
         0x02,                           // iProduct
         0x00,                           // iSerialNumber
@@ -120,7 +123,7 @@ const USB_DESCRIPTOR usbDescriptor =
             sizeof(USB_CONFIGURATION_DESCRIPTOR),
             USB_DESC_TYPE_CONFIG,           // bDescriptorType
             SIZEOF_CONFIGURATION0_DESC,     // wTotalLength
-            0x01,                           // bNumInterfaces
+            0x02,                           // bNumInterfaces
             0x01,                           // bConfigurationValue
             0x00,                           // iConfiguration
             0xA0,                           // bmAttributes (7,4-0: res, 6: self-powered, 5: remote wakeup)
@@ -152,7 +155,7 @@ const USB_DESCRIPTOR usbDescriptor =
                     0x83,                           // bEndpointAddress
                     USB_EP_ATTR_INT,                // bmAttributes (INT)
                     0x0040,                         // wMaxPacketSize
-                    0x02                            // bInterval (10 full-speed frames = 10 ms)
+                    0x01                            // bInterval (every full-speed frame = 1 ms)
                 },
                 { // endpoint2 out
                     sizeof(USB_ENDPOINT_DESCRIPTOR),
@@ -162,6 +165,33 @@ const USB_DESCRIPTOR usbDescriptor =
                     0x0040,                         // wMaxPacketSize
                     0x02                            // bInterval (10 full-speed frames = 10 ms)
                 },
+            { // interface1, same packets as interface0 but several go each frame
+                sizeof(USB_INTERFACE_DESCRIPTOR),
+                USB_DESC_TYPE_INTERFACE,        // bDescriptorType
+                0x01,                           // bInterfaceNumber
+                0x00,                           // bAlternateSetting (none)
+                0x02,                           // bNumEndpoints
+                0xFF,                           // bInterfaceClass (vendor specific)
+                0x00,                           // bInterfaceSubClass
+                0x00,                           // bInterfaceProcotol
+                0x00                            // iInterface
+            },
+                { // endpoint4 out
+                    sizeof(USB_ENDPOINT_DESCRIPTOR),
+                    USB_DESC_TYPE_ENDPOINT,         // bDescriptorType
+                    0x04,                           // bEndpointAddress
+                    USB_EP_ATTR_BULK,               // bmAttributes (BULK)
+                    0x0040,                         // wMaxPacketSize
+                    0x00                            // bInterval (unused for bulk)
+                },
+                { // endpoint5 in
+                    sizeof(USB_ENDPOINT_DESCRIPTOR),
+                    USB_DESC_TYPE_ENDPOINT,         // bDescriptorType
+                    0x85,                           // bEndpointAddress
+                    USB_EP_ATTR_BULK,               // bmAttributes (BULK)
+                    0x0040,                         // wMaxPacketSize
+                    0x00                            // bInterval (unused for bulk)
+                },
     { // strings
         { // langIds
             sizeof(USB_STRING_0_DESCRIPTOR),
@@ -186,6 +216,47 @@ const USB_DESCRIPTOR usbDescriptor =
 //
 USB_STRING_3_DESCRIPTOR usbSerialNumberStringDesc;
 
+//
+// Microsoft OS descriptors, WinUSB on interface1 under a fixed interface GUID
+//
+static const USB_MS_OS_STRING_DESCRIPTOR usbMsOsStringDesc =
+{
+    sizeof(USB_MS_OS_STRING_DESCRIPTOR),
+    USB_DESC_TYPE_STRING,
+    { 'M', 'S', 'F', 'T', '1', '0', '0' },
+    MS_OS_VENDOR_CODE,
+    0x00
+};
+
+static const USB_MS_COMPAT_ID_DESCRIPTOR usbMsCompatIdDesc =
+{
+    sizeof(USB_MS_COMPAT_ID_DESCRIPTOR),
+    0x0100,                             // bcdVersion (1.0)
+    MS_OS_COMPAT_ID,                    // wIndex
+    0x01,                               // bCount (function sections)
+    { 0 },
+    0x01,                               // bFirstInterfaceNumber (interface1)
+    0x01,
+    { 'W', 'I', 'N', 'U', 'S', 'B', 0, 0 },
+    { 0 },
+    { 0 }
+};
+
+static const USB_MS_PROPERTIES_DESCRIPTOR usbMsPropertiesDesc =
+{
+    sizeof(USB_MS_PROPERTIES_DESCRIPTOR),
+    0x0100,                             // bcdVersion (1.0)
+    MS_OS_PROPERTIES,                   // wIndex
+    0x0001,                             // wCount (properties)
+    sizeof(USB_MS_PROPERTIES_DESCRIPTOR) - 10,
+    0x00000001,                         // dwPropertyDataType (REG_SZ)
+    sizeof(usbMsPropertiesDesc.bPropertyName),
+    { 'D', 'e', 'v', 'i', 'c', 'e', 'I', 'n', 't', 'e', 'r', 'f', 'a', 'c', 'e', 'G', 'U', 'I', 'D', 0 },
+    sizeof(usbMsPropertiesDesc.bPropertyData),
+    { '{', '6', '3', 'B', '1', 'E', '0', 'A', '4', '-', '9', 'C', '2', '7', '-', '4', 'F', '5', 'D', '-',
+      '8', 'E', '3', '1', '-', '5', 'A', '7', '0', 'C', '4', 'D', '2', '9', 'B', '1', '8', '}', 0 }
+};
+
 
 //
 // Look-up table for descriptors other than device and configuration (table is NULL-terminated)
@@ -197,6 +268,7 @@ const USB_DESCRIPTOR_LUT pUsbDescriptorLut[] =
     { 0x0301, 0x0409, sizeof(USB_STRING_1_DESCRIPTOR), &usbDescriptor.strings.manufacturer },
     { 0x0302, 0x0409, sizeof(USB_STRING_2_DESCRIPTOR), &usbDescriptor.strings.product },
     { 0x0303, 0x0409, sizeof(USB_STRING_3_DESCRIPTOR), &usbSerialNumberStringDesc },
+    { 0x03EE, 0x0000, sizeof(USB_MS_OS_STRING_DESCRIPTOR), &usbMsOsStringDesc },
     { 0x2100, 0x0000, sizeof(USBHID_DESCRIPTOR),       &usbDescriptor.hid0 },
     { 0x2200, 0x0000, sizeof(pHid0ReportDesc),         &pHid0ReportDesc },
     { 0x0000, 0x0000, 0,                               NULL }
@@ -209,11 +281,25 @@ const USB_DESCRIPTOR_LUT pUsbDescriptorLut[] =
 const USB_INTERFACE_EP_DBLBUF_LUT pUsbInterfaceEpDblbufLut[] = 
 {
 //    pInterface                 inMask  outMask
-    { &usbDescriptor.interface0, 0x0000, 0x0000 },
+    { &usbDescriptor.interface0, 0x0008, 0x0000 },  // EP3 IN, one packet loads while the other goes out
+    { &usbDescriptor.interface1, 0x0020, 0x0010 },  // EP5 IN and EP4 OUT, both ways back to back
 };
 
-static uint8_t  inpacket[PACKET_BYTES];
-static uint8_t *outpacket;
+static bool hid_out_ready (unsigned *bytes);
+static void hid_out_read  (uint8_t *d, const unsigned bytes);
+static bool hid_in_free   (void);
+static void hid_in_write  (const uint8_t *d);
+static bool bulk_out_ready(unsigned *bytes);
+static void bulk_out_read (uint8_t *d, const unsigned bytes);
+static bool bulk_in_free  (void);
+static void bulk_in_write (const uint8_t *d);
+
+static const usbEpOps_t hidOps  = { hid_out_ready,  hid_out_read,  hid_in_free,  hid_in_write  };
+static const usbEpOps_t bulkOps = { bulk_out_ready, bulk_out_read, bulk_in_free, bulk_in_write };
+
+// Interface0 on EP2 OUT and EP3 IN, interface1 on EP4 OUT and EP5 IN
+static usbPipe_t hidPipe;
+static usbPipe_t bulkPipe;
 
 //
 // USB library hooks
@@ -236,7 +322,39 @@ void usbvrHookProcessOut(void)
 
 void usbvrHookProcessIn(void)
 {
-    usbfwData.ep0Status = EP_STALL;
+    //
+    // Only the Microsoft OS feature descriptors, device or interface recipient
+    //
+    if (MS_OS_VENDOR_CODE != usbSetupHeader.request)
+    {
+        usbfwData.ep0Status = EP_STALL;
+        return;
+    }
+
+    switch (usbSetupHeader.index)
+    {
+        case MS_OS_COMPAT_ID:
+            usbSetupData.pBuffer   = (void*) &usbMsCompatIdDesc;
+            usbSetupData.bytesLeft = sizeof(usbMsCompatIdDesc);
+            break;
+
+        case MS_OS_PROPERTIES:
+            usbSetupData.pBuffer   = (void*) &usbMsPropertiesDesc;
+            usbSetupData.bytesLeft = sizeof(usbMsPropertiesDesc);
+            break;
+
+        default:
+            usbfwData.ep0Status = EP_STALL;
+            return;
+    }
+
+    // Windows asks for the header alone first
+    if (usbSetupData.bytesLeft > usbSetupHeader.length)
+    {
+        usbSetupData.bytesLeft = usbSetupHeader.length;
+    }
+
+    usbfwData.ep0Status = EP_TX;
 }
 
 void usbsrHookSetDescriptor(void)
@@ -330,8 +448,6 @@ void usbirqHookProcessEvents(void)
     // Handle events that require immediate processing here
     //
 
-    unsigned bytes;
-
     //
     // Handle USB reset
     //
@@ -339,6 +455,8 @@ void usbirqHookProcessEvents(void)
     {
         USBIRQ_CLEAR_EVENTS(USBIRQ_EVENT_RESET);
         usbfwResetHandler();
+        usbpipe_init(&hidPipe,  &hidOps);
+        usbpipe_init(&bulkPipe, &bulkOps);
     }
 
     //
@@ -351,54 +469,78 @@ void usbirqHookProcessEvents(void)
     }
 
     //
-    // Handle USB IN events on EP1
+    // Handle USB OUT data on EP2 and EP4, or retry one the core had no room for
     //
-    if (USBIRQ_GET_EVENT_MASK() & USBIRQ_EVENT_EP1IN)
+    if ((USBIRQ_GET_EVENT_MASK() & USBIRQ_EVENT_EP2OUT) || hidPipe.rxDeferred)
+    {
+        USBIRQ_CLEAR_EVENTS(USBIRQ_EVENT_EP2OUT);
+        usbpipe_out(&hidPipe);
+    }
+
+    if ((USBIRQ_GET_EVENT_MASK() & USBIRQ_EVENT_EP4OUT) || bulkPipe.rxDeferred)
     {
-        USBIRQ_CLEAR_EVENTS(USBIRQ_EVENT_EP1IN);
+        USBIRQ_CLEAR_EVENTS(USBIRQ_EVENT_EP4OUT);
+        usbpipe_out(&bulkPipe);
     }
 
     //
-    // Handle USB OUT data on EP2
+    // Send back responses from the core via USB IN on EP3 or EP5, whichever
+    // interface the command came in on, either a packet went out or the main
+    // loop queued more
     //
-    if (USBIRQ_GET_EVENT_MASK() & USBIRQ_EVENT_EP2OUT)
-    {
-        USBIRQ_CLEAR_EVENTS(USBIRQ_EVENT_EP2OUT);
-        USBFW_SELECT_ENDPOINT(2);
+    USBIRQ_CLEAR_EVENTS(USBIRQ_EVENT_EP3IN | USBIRQ_EVENT_EP5IN);
+    usbpipe_in(&hidPipe);
+    usbpipe_in(&bulkPipe);
+}
 
-        if (USBFW_OUT_ENDPOINT_DISARMED())
-        {
-            bytes = USBFW_GET_OUT_ENDPOINT_COUNT_LOW();
+//
+// Endpoint access for the pipes, double buffered IN endpoints take up to two
+// packets and double buffered OUT ones can hold a second behind the first
+//
 
-            if (bytes > 0)
-            {
-                assert(PACKET_BYTES == bytes);
+static bool ep_out_ready(const uint32_t ep, unsigned *bytes)
+{
+    USBFW_SELECT_ENDPOINT(ep);
 
-                usbfwReadFifo(USB_F2, bytes, inpacket);
-                core_inpacket(inpacket);
+    if (!USBFW_OUT_ENDPOINT_DISARMED())  return false;
 
-            }
+    *bytes = USBFW_GET_OUT_ENDPOINT_COUNT_LOW();
 
-            USBFW_ARM_OUT_ENDPOINT();
-        }
-    }
+    return true;
+}
 
-    //
-    // Send back responses from the core via USB IN on EP3
-    //
-    while (core_outpacket_ready())
-    {
-        USBFW_SELECT_ENDPOINT(3);
+static void ep_out_read(const uint32_t ep, const uint32_t fifo, uint8_t *d, const unsigned bytes)
+{
+    USBFW_SELECT_ENDPOINT(ep);
 
-        if (USBFW_IN_ENDPOINT_DISARMED())
-        {
-            outpacket = core_outpacket();
-            usbfwWriteFifo(USB_F3, PACKET_BYTES, outpacket);
-            USBFW_ARM_IN_ENDPOINT();
-        }
-    }
+    if (NULL != d)  usbfwReadFifo(fifo, bytes, d);
+
+    USBFW_ARM_OUT_ENDPOINT();
+}
+
+static bool ep_in_free(const uint32_t ep)
+{
+    USBFW_SELECT_ENDPOINT(ep);
+
+    return USBFW_IN_ENDPOINT_DISARMED();
+}
+
+static void ep_in_write(const uint32_t ep, const uint32_t fifo, const uint8_t *d)
+{
+    USBFW_SELECT_ENDPOINT(ep);
+    usbfwWriteFifo(fifo, PACKET_BYTES, (void*) d);
+    USBFW_ARM_IN_ENDPOINT();
 }
 
+static bool hid_out_ready (unsigned *bytes)                      { return ep_out_ready(2, bytes); }
+static void hid_out_read  (uint8_t *d, const unsigned bytes)     { ep_out_read(2, USB_F2, d, bytes); }
+static bool hid_in_free   (void)                                 { return ep_in_free(3); }
+static void hid_in_write  (const uint8_t *d)                     { ep_in_write(3, USB_F3, d); }
+static bool bulk_out_ready(unsigned *bytes)                      { return ep_out_ready(4, bytes); }
+static void bulk_out_read (uint8_t *d, const unsigned bytes)     { ep_out_read(4, USB_F4, d, bytes); }
+static bool bulk_in_free  (void)                                 { return ep_in_free(5); }
+static void bulk_in_write (const uint8_t *d)                     { ep_in_write(5, USB_F5, d); }
+
 void usbsuspHookEnteringSuspend(bool remoteWakeupAllowed)
 {
     /*
@@ -440,8 +582,12 @@ void hid_init(void)
     // Initialize the USB library
     usbfwInit();
 
+    usbpipe_init(&hidPipe,  &hidOps);
+    usbpipe_init(&bulkPipe, &bulkOps);
+
     // Initialize the USB interrupt handler with bit mask containing all processed USBIRQ events
-    usbirqInit(USBIRQ_EVENT_RESET | USBIRQ_EVENT_SETUP | USBIRQ_EVENT_SUSPEND | USBIRQ_EVENT_RESUME | USBIRQ_EVENT_EP1IN | USBIRQ_EVENT_EP2OUT);
+    usbirqInit(USBIRQ_EVENT_RESET | USBIRQ_EVENT_SETUP | USBIRQ_EVENT_SUSPEND | USBIRQ_EVENT_RESUME |
+               USBIRQ_EVENT_EP3IN | USBIRQ_EVENT_EP2OUT | USBIRQ_EVENT_EP5IN | USBIRQ_EVENT_EP4OUT);
 
     // Activate the USB D+ pull-up resistor
     UsbDplusPullUpEnable();
@@ -449,6 +595,14 @@ void hid_init(void)
 
 void hid_process_events(void)
 {
+    //
+    // Run the interrupt handler for anything the core queued up or made room for
+    //
+    if (usbpipe_kick(&hidPipe) | usbpipe_kick(&bulkPipe))
+    {
+        IntPendSet(INT_USB2538);
+    }
+
     //
     // Handle USB resume
     //
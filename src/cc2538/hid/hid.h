@@ -59,6 +59,53 @@ typedef struct
     USB_STRING_2_DESCRIPTOR product;
 } __attribute__((packed)) USB_STRING_DESCRIPTORS;
 
+//
+// Microsoft OS 1.0 descriptors, they bind WinUSB to the bulk interface so
+// Windows hosts need no driver install. The string at index 0xEE names the
+// vendor request that returns the two feature descriptors.
+//
+#define MS_OS_STRING_INDEX      0xEE
+#define MS_OS_VENDOR_CODE       0x50    // bRequest of the feature descriptor requests
+#define MS_OS_COMPAT_ID         0x0004  // wIndex of the extended compat ID request
+#define MS_OS_PROPERTIES        0x0005  // wIndex of the extended properties request
+
+typedef struct
+{
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint16_t qwSignature[7];          // "MSFT100"
+    uint8_t  bMS_VendorCode;
+    uint8_t  bPad;
+} __attribute__((packed)) USB_MS_OS_STRING_DESCRIPTOR;
+
+typedef struct
+{
+    uint32_t dwLength;
+    uint16_t bcdVersion;
+    uint16_t wIndex;
+    uint8_t  bCount;
+    uint8_t  reserved0[7];
+    uint8_t  bFirstInterfaceNumber;
+    uint8_t  reserved1;
+    uint8_t  compatibleID[8];
+    uint8_t  subCompatibleID[8];
+    uint8_t  reserved2[6];
+} __attribute__((packed)) USB_MS_COMPAT_ID_DESCRIPTOR;
+
+typedef struct
+{
+    uint32_t dwLength;
+    uint16_t bcdVersion;
+    uint16_t wIndex;
+    uint16_t wCount;
+    uint32_t dwSize;
+    uint32_t dwPropertyDataType;
+    uint16_t wPropertyNameLength;
+    uint16_t bPropertyName[20];       // "DeviceInterfaceGUID"
+    uint32_t dwPropertyDataLength;
+    uint16_t bPropertyData[39];       // "{GUID}"
+} __attribute__((packed)) USB_MS_PROPERTIES_DESCRIPTOR;
+
 //
 // Defines the static USB descriptor set
 //
@@ -70,6 +117,9 @@ typedef struct
             USBHID_DESCRIPTOR hid0;
             USB_ENDPOINT_DESCRIPTOR endpoint0;
             USB_ENDPOINT_DESCRIPTOR endpoint1;
+        USB_INTERFACE_DESCRIPTOR interface1;
+            USB_ENDPOINT_DESCRIPTOR endpoint2;
+            USB_ENDPOINT_DESCRIPTOR endpoint3;
     USB_STRING_DESCRIPTORS strings;
 } __attribute__((packed)) USB_DESCRIPTOR;
 
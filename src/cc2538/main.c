@@ -74,6 +74,17 @@ void board_init(void)
 
 }
 
+// Keeps the transports and command parser moving while the UI blocks on the user
+static void service(void)
+{
+    core_poll();
+    core_background();
+
+    blue_process_events();
+    hid_process_events();
+}
+
+
 #pragma DATA_SECTION(hdr, ".header")
 const fw_header_t hdr = { .f.id = STANDARD_ID };
 
@@ -109,6 +120,8 @@ int main(void)
     hid_init    ();
     touch_init  ();
 
+    touch_wait_hook(service);
+
     // Re-enable global interrupts
     IntMasterEnable();
 
@@ -123,10 +136,12 @@ int main(void)
     {
         //SysCtrlSleep();
 
+        core_process();
+
         blue_process_events();
         hid_process_events();
 
-        core_process();
+        core_idle();
 
         // while(1) screen_captouch_debug();
 
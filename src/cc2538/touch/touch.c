@@ -31,6 +31,10 @@ const int TICK_PERIOD = 0x1000000;
 const uint32_t KEY[BUTTONS] = {TOUCH_KEY_1, TOUCH_KEY_2, TOUCH_KEY_3, TOUCH_KEY_4};
 
 static touch_type_e get(unsigned *down, unsigned *up, bool slide_only);
+static void         wait(void);
+
+// Called over and over while waiting for a touch
+static void       (*wait_hook)(void);
 
 
 #if TOUCH_CAPACITIVE
@@ -118,6 +122,16 @@ void touch_init()
     pressed_button = 0;
 }
 
+void touch_wait_hook(void (*hook)(void))
+{
+    wait_hook = hook;
+}
+
+static void wait(void)
+{
+    if (NULL != wait_hook)  wait_hook();
+}
+
 touch_type_e touch_get(unsigned *down, unsigned *up)
 {
     return get(down, up, false);
@@ -158,6 +172,7 @@ static touch_type_e get(unsigned *down, unsigned *up, bool slide_only)
         // Checking for an initial touch
         while (0 == *down)
         {
+            wait();
             *down = touch_cap_read(false);
         }
 
@@ -202,6 +217,7 @@ static touch_type_e get(unsigned *down, unsigned *up, bool slide_only)
     {
         // Wait for an interrupt 
         //SysCtrlSleep();
+        wait();
     }
 
     // Capture the pressed button
@@ -14,6 +14,7 @@ typedef enum
 } touch_type_e;
 
 void          touch_init          (void);
+void          touch_wait_hook     (void (*hook)(void));
 touch_type_e  touch_get_slide     (void);
 touch_type_e  touch_get_any       (void);
 touch_type_e  touch_get           (unsigned *down, unsigned *up);
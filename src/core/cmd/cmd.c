@@ -10,6 +10,12 @@
 #include <linker.h>
 #include <fw_header.h>
 #include <flash.h>
+#include <ctx.h>
+#include <prevtx.h>
+
+#if !HW_CC2538
+#include <stdlib.h>
+#endif
 
 typedef enum
 {
@@ -21,33 +27,8 @@ typedef enum
     SIGN_FLOW_SIGN_TX_ERROR,
 } signFlow_e;
 
-typedef enum
-{
-    PTX_HEADER,
-    PTX_VERSION,
-    PTX_IN_COUNT,
-    PTX_IN_PREV_HASH,
-    PTX_IN_PREV_INDEX,
-    PTX_IN_SCRIPT_LEN,
-    PTX_IN_SCRIPT,
-    PTX_IN_SEQUENCE,
-    PTX_OUT_COUNT,
-    PTX_OUT_VALUE,
-    PTX_OUT_SCRIPT_LEN,
-    PTX_OUT_SCRIPT,
-    PTX_LOCK_TIME,
-    PTX_DONE,
-} prevTxChunk_e;
-
 #pragma pack(1)
 
-typedef struct
-{
-    uint8_t  inputIdx;   // Index into the 'input' array of signInfo_t
-    uint32_t outputIdx;  // Output index in the current prev tx
-} prevTxHeader_t;
-
-
 typedef struct
 {
     uint8_t   account;
@@ -65,22 +46,10 @@ typedef struct
 
 typedef struct
 {
-    uint16_t        totalBytes;          // Total bytes
-    bool            hashCalc;            // When true, do a running SHA 256 operation over the prev tx
-    sha256ctx_t    *hashCtx;             // Context for hash operations
-    prevTxChunk_e   field;               // What chunk are we in
-    uint32_t        fieldByte;           // Current chunk byte
-    uint32_t        fieldTotalBytes;     // Current chunk total bytes
-    uint8_t         headerEntries;       // How many entries in the header are valid
-    prevTxHeader_t  header[MAX_INPUTS];  // The current prev tx header
-    uint64_t        inputsLeft;          // Inputs left to process
-    uint64_t        inputScriptBytes;    // Signature length of the current input being processed
-    uint64_t        outputsTotal;        // Outputs left to process
-    uint64_t        outputIndex;         // Current output index being processed
-    bool            outputSave;          // Should we be saving the current output?
-    uint8_t         outputSaveToIndex;   // If outputSave is true, this is the index into cmdi.signi.input[]
-    uint64_t        outputScriptBytes;   // Signature length of the current output being processed
-} prevTxInfo_t;
+    uint8_t   version;
+    uint8_t   addr[HASH_ADDR_BYTES];
+    uint64_t  satoshis;
+} signOutput_t;
 
 typedef struct
 {
@@ -90,7 +59,7 @@ typedef struct
     // and the final signed transaction (GET_SIGN_TX cmd)
     //
     signFlow_e    sign_flow;
-    uint8_t      *txbuff;
+    uint32_t      session;              // Handed out by SIGN_TX, 0 when there is none
 
     //
     // Information from the SIGN_TX command
@@ -98,11 +67,12 @@ typedef struct
     bool           giveChange;
     uint8_t        totalInputs;
     int            inputsLeftToVerify;
+    uint32_t       inputsVerified;      // Bit n set once input n has its prev output
     signInputs_t   input[MAX_INPUTS];
     
-    uint8_t        output_version;
-    uint8_t        output_addr[HASH_ADDR_BYTES];
-    uint64_t       output_satoshis;
+    uint8_t        totalOutputs;
+    signOutput_t   output[MAX_PAY_OUTPUTS];
+    uint64_t       output_satoshis;     // All outputs together, not counting change
     
     uint8_t        change_account;
     uint8_t        change_chain;
@@ -110,14 +80,53 @@ typedef struct
     uint8_t        change_addr[HASH_ADDR_BYTES];
     uint64_t       change_satoshis;
 
-    //
-    // Tracking info for PREV_TX commands
-    //
-    prevTxInfo_t   ptx;
-
 } sign_info_t;
 
-#define FW_WRITE_CHUNK  256
+#define HASH_BLOCK_BYTES  64
+
+typedef struct
+{
+    // Buffer sink, bytes [skip, skip + room) of the tx land in dest
+    uint8_t      *dest;
+    unsigned      skip;
+    unsigned      room;
+    unsigned      written;
+
+    // Hash sink, every byte when set
+    sha256ctx_t  *hash;
+    uint8_t       block[HASH_BLOCK_BYTES];
+    unsigned      blockBytes;
+
+    unsigned      pos;       // Tx bytes so far
+} txWriter_t;
+
+//
+// SIGN_TX is taken a record at a time, the same whether it came whole or
+// as a stream
+//
+typedef enum
+{
+    SIGNTX_HEAD,       // Command byte and input count
+    SIGNTX_INPUT,
+    SIGNTX_OUTPUTS,    // Output count
+    SIGNTX_OUTPUT,
+    SIGNTX_CHANGE,
+    SIGNTX_DONE,
+} signTxStage_e;
+
+typedef struct
+{
+    signTxStage_e stage;
+    bool          failed;                       // The rest is only counted off, answered at the end
+    bool          busy;                         // A job of another family holds the arena
+    unsigned      left;                         // Request bytes still to come
+    uint8_t       index;                        // Input or output of the next record
+    uint8_t       rec[SIGN_TX_INPUT_BYTES];     // Largest record
+    unsigned      recBytes;
+    txWriter_t    id;                           // Hashes the request for the session id
+} signTxParse_t;
+
+#define FW_WRITE_CHUNK  FLASH_ERASE_SIZE  // A whole flash page per erase and program
 
 typedef struct
 {
@@ -134,16 +143,11 @@ typedef struct
     // Response
     cmdResp_t   *resp;
     unsigned     respBytes;
+    resp_gen_f   respGen;    // Set when the response is generated instead of held in resp
     
     // Current command
     cmd_e        currCmd;
     
-    // Signature flow info
-    sign_info_t  signi;
-
-    // Firmware download info
-    fwdl_info_t  fwdl;
-    
 } cmdInfo_t;
 
 typedef enum
@@ -157,6 +161,8 @@ typedef enum
 {
     CP_CMD_NONE,
     CP_CMD_SIGN,
+    CP_CMD_BATCH,
+    CP_CMD_DIGESTS,
 } cp_cmd_e;
 
 typedef struct
@@ -165,22 +171,213 @@ typedef struct
     cp_state_e state;
 } cp_t;
 
+//
+// Prev outputs verified by hashing their whole tx, kept across signing
+// sessions so later sessions can claim them with PREV_TX_CACHED
+//
+#define UTXO_CACHE_ENTRIES  16
+#define UTXO_STAGE_ENTRIES  4   // Cache only outputs per prev tx
+
+typedef struct
+{
+    bool      used;
+    uint32_t  stamp;                     // Last use, oldest is replaced first
+    uint8_t   txid[TX_HASH_BYTES];
+    uint32_t  vout;
+    uint64_t  value;
+    uint8_t   pkScript[PK_SCRIPT_BYTES];
+} utxo_t;
+
+typedef struct
+{
+    utxo_t    entry[UTXO_CACHE_ENTRIES];
+    uint32_t  stamp;
+    uint32_t  hits;
+    uint32_t  misses;
+
+    // Outputs of the prev tx being parsed, held until its hash checks out
+    utxo_t    stage[UTXO_STAGE_ENTRIES];
+    uint8_t   staged;
+} utxoCache_t;
+
 #pragma pack()
 
+//
+// Signing runs as a job, one step per core_process call so commands are
+// still answered between steps. Each input takes a hash, a key and a sign step.
+//
+typedef enum
+{
+    SIGN_STEP_CONFIRM,
+    SIGN_STEP_HASH,
+    SIGN_STEP_KEY,
+    SIGN_STEP_SIGN,
+} signStep_e;
+
+typedef struct
+{
+    signStep_e  step;
+    bool        cancelled;               // Sign state was reset under the job
+    bool        speculate;               // User is reviewing, inputs are signed in the background
+    bool        failed;                  // An input failed in the background
+    uint8_t     input;                   // Input being signed
+    uint8_t     hash[SHA256_BYTES];      // Its sighash
+    uint8_t     privKey[KEY_BYTES];      // Its key, wiped once it has signed
+    txWriter_t  prefix;                  // Sighash up to this input, see SIGN_STEP_HASH
+    uint32_t    sliceMax;                // Longest step so far, in CPU cycles
+} signJob_t;
+
+//
+// A run of txs the user approved together, each one signed is taken off
+// what is left
+//
+typedef enum
+{
+    BATCH_NONE,
+    BATCH_USER,      // Waiting on the user
+    BATCH_OPEN,      // Approved, txs are signed without asking
+    BATCH_DONE,      // Every tx signed
+    BATCH_DENIED,    // Declined, or a tx did not fit
+} batchState_e;
+
+typedef struct
+{
+    batchState_e  state;
+    signBatch_t   asked;                 // What the user was shown
+    uint8_t       txsSigned;
+    uint16_t      outputsLeft;
+    uint64_t      satoshisLeft;
+    uint64_t      feeLeft;
+} batch_t;
+
+//
+// A run of raw digests the user approved together, signed a group at a
+// time. Every digest in the group gets its nonce and r in a step of its own,
+// then the group is finished with one shared nonce inversion.
+//
+typedef enum
+{
+    DIGESTS_NONE,
+    DIGESTS_USER,    // Waiting on the user
+    DIGESTS_OPEN,    // Approved, groups are signed without asking
+    DIGESTS_DENIED,  // Declined
+} digestsState_e;
+
+typedef enum
+{
+    GROUP_EMPTY,
+    GROUP_SIGNING,
+    GROUP_SIGNED,
+    GROUP_FAILED,
+} groupState_e;
+
+typedef struct
+{
+    digestsState_e  state;
+    uint16_t        asked;                           // What the user was shown
+    uint16_t        left;                            // Approved, not handed over yet
+    bool            compact;
+
+    groupState_e    group;
+    uint8_t         count;
+    uint8_t         next;                            // Next digest to commit
+    wallet_path_t   path[DIGESTS_GROUP];
+    uint8_t         hash[DIGESTS_GROUP * DIGEST_BYTES];
+    uint8_t         key[DIGESTS_GROUP][KEY_BYTES];   // Only the first digest of each path derives it
+    const uint8_t  *keyOf[DIGESTS_GROUP];
+    uint8_t         rs[DIGESTS_GROUP * 2 * KEY_BYTES]; // r then k, r then s once signed
+    uint8_t         work[DIGESTS_GROUP * KEY_BYTES];
+} digestRun_t;
+
+//
+// Working sets of the command families. Only one is alive at a time, so they
+// share the arena: a tx signing session, a firmware download or a digest
+// run. The family that starts takes the arena over from whichever had it,
+// unless that one has a job running. What lasts across families, the utxo
+// cache, the batch and the job timing, stays out of it.
+//
+typedef enum
+{
+    PHASE_NONE,
+    PHASE_SIGN,
+    PHASE_FWDL,
+    PHASE_DIGESTS,
+} cmdPhase_e;
+
+typedef struct
+{
+    sign_info_t   info;
+    prevtx_t      prevtx;     // PREV_TX parser, kept out of the packed structs
+    sha256ctx_t   ptxHash;    // Kept out of the packed structs, the SHA engine wants it aligned
+    sha256ctx_t   txHash;     // Sighashes and the signed txid
+    sha256ctx_t   prefixHash; // Sighash prefix, inputs already signed
+} signPhase_t;
+
+typedef union
+{
+    signPhase_t   sign;
+    fwdl_info_t   fwdl;
+    digestRun_t   digests;
+} cmdArena_t;
+
+// RAM budget of the arena, a family that outgrows it stops the build here.
+// tools/host/arena_layout prints what each one takes.
+#define ARENA_BYTES_MAX  7168
+
+STATIC_ASSERT(sizeof(signPhase_t) <= ARENA_BYTES_MAX, arena_sign);
+STATIC_ASSERT(sizeof(fwdl_info_t) <= ARENA_BYTES_MAX, arena_fwdl);
+STATIC_ASSERT(sizeof(digestRun_t) <= ARENA_BYTES_MAX, arena_digests);
+
+struct cmd_ctx
+{
+    cmdInfo_t     info;
+    signTxParse_t signtx;
+    cp_t          cp;
+    signJob_t     job;
+    utxoCache_t   utxo;
+    batch_t       batch;
+    uint32_t      sessions; // SIGN_TX commands since boot, goes into the session id
+    cmdPhase_e    phase;    // Family the arena belongs to
+    cmdArena_t    arena;
+};
+
 // Prototypes
-static void        cp_sign           (void);
+static bool        cp_sign           (void);
+static bool        sign_step         (void);
+static bool        cp_batch          (void);
+static bool        batch_take        (const uint64_t fee);
+static bool        cp_digests        (void);
+static void        digests_wipe      (void);
+static bool        review            (const uint64_t fee);
+static void        cp_sign_wipe      (void);
 static cp_state_e  cp_state          (void);
+static bool        phase_borrow      (const cmdPhase_e family);
 static void        cp_set_state      (cp_state_e state);
 static void        cp_set_cmd        (cp_cmd_e cmd);
 static void        cp_end_cmd        (void);
 
 static void        identify          (const cmd_t *cmd, const unsigned total_bytes);
-static void        sign_tx           (const cmd_t *cmd, const unsigned cmdBytes);
+static void        sign_tx           (const cmd_t *cmd, unsigned chunk_bytes, const unsigned total_bytes, const bool start);
+static bool        sign_tx_record    (void);
 static void        prev_tx           (const cmd_t *cmd, unsigned chunk_bytes, unsigned total_bytes, bool start);
+static void        prev_tx_cached    (const cmd_t *cmd, const unsigned total_bytes);
 static void        fw_download       (const cmd_t *cmd, unsigned chunk_bytes, unsigned total_bytes, bool start);
 static void        get_signed_tx     (const cmd_t *cmd, const unsigned total_bytes);
+static void        sign_progress     (const cmd_t *cmd, const unsigned total_bytes);
+static void        sign_progress_get (signProgressResp_t *progress);
+static void        status            (const cmd_t *cmd, const unsigned total_bytes);
+static void        status_publish    (void);
+static void        get_input_sig     (const cmd_t *cmd, const unsigned total_bytes);
+static void        sign_session      (const cmd_t *cmd, const unsigned total_bytes);
+static void        sign_batch        (const cmd_t *cmd, const unsigned total_bytes);
+static void        batch_progress    (const cmd_t *cmd, const unsigned total_bytes);
+static void        sign_digests      (const cmd_t *cmd, const unsigned total_bytes);
+static void        digests           (const cmd_t *cmd, const unsigned total_bytes);
+static unsigned    digests_gen       (uint8_t *dest, const unsigned offset, const unsigned bytes);
 static void        get_public_key    (const cmd_t *cmd, const unsigned total_bytes);
+static void        get_public_key_path(const cmd_t *cmd, const unsigned total_bytes);
 static void        set_master_seed   (const cmd_t *cmd, const unsigned total_bytes);
+static void        stats             (const cmd_t *cmd, const unsigned total_bytes);
 static void        small_resp        (const cmd_e cmd);
 static void        reset_sign_state  (void);
 static void        reset_ptx_state   (void);
@@ -189,86 +386,439 @@ static void        reset_fwdl_state  (void);
 static bool        fw_write_chunk    (const uint8_t *d, unsigned bytes);
 static bool        fw_verify         (void);
 
-static unsigned    process_header    (const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes);
-static unsigned    process_skip      (const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes, const unsigned totalBytes);
-static unsigned    process_var_int   (const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes, void *dest);
-static unsigned    process_field     (const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes, void *dest, const unsigned totalBytes);
+static bool        prev_tx_save      (const uint8_t inputIdx, const uint32_t outputIdx, const uint64_t value, const uint8_t *script, const unsigned script_bytes);
+static void        input_verified    (const uint8_t inputIdx);
+static utxo_t*     utxo_find         (const uint8_t *txid, const uint32_t vout);
+static void        utxo_put          (const uint8_t *txid, const uint32_t vout, const uint64_t value, const uint8_t *pkScript);
 
 static uint64_t    calc_fee          (void);
-static unsigned    build_tx          (const bool forSigning, const unsigned inputIdx, uint8_t *dest);
-static bool        save_curr_output  (const uint64_t outputIdx, uint8_t * const inputIdx);
-static unsigned    output_script     (const uint8_t *hash160, uint8_t *script);
-static unsigned    sign_tx_for_input (const uint8_t inputIdx, uint8_t *tx);
+static unsigned    build_tx          (const bool forSigning, const unsigned inputIdx, txWriter_t *w);
+static void        tx_head           (txWriter_t *w);
+static void        tx_input          (txWriter_t *w, const bool forSigning, const unsigned i, const unsigned inputIdx);
+static unsigned    tx_tail           (txWriter_t *w, const bool forSigning);
+static unsigned    signed_tx_gen     (uint8_t *dest, const unsigned offset, const unsigned bytes);
+static void        output_script     (txWriter_t *w, const uint8_t *hash160);
 
-static void        memcpy_r          (void *dst, const void *src, const unsigned bytes);
+static void        writer_init       (txWriter_t *w, uint8_t *dest, const unsigned skip, const unsigned room, sha256ctx_t *hash);
+static void        writer_put        (txWriter_t *w, const void *src, const unsigned bytes);
+static void        writer_byte       (txWriter_t *w, const uint8_t b);
+static void        writer_put_r      (txWriter_t *w, const uint8_t *src, const unsigned bytes);
+static void        writer_hash       (txWriter_t *w, uint8_t *hash);
+
+static uint32_t    cycles            (void);
 
 // Constants
 static const char     MODEL[MODEL_NAME_BYTES] = "Polly v0.3";
 static const uint64_t MAX_SATOSHIS = 2100000000000000ULL;
-static const unsigned ACCT_MAX  = 0;
+static const unsigned ACCT_MAX  = 0xFF;
 static const unsigned CHAIN_MAX = 1;
 
 
 // Globals
-#pragma DATA_SECTION(cmdi, ".nonretenvar")
-static cmdInfo_t     cmdi;
-static prevTxInfo_t *ptx;
-static cp_t          cp;
+#if HW_CC2538
+#pragma DATA_SECTION(cmd_fw_ctx, ".nonretenvar")
+cmd_ctx_t cmd_fw_ctx;
+#endif
+
+// Per-context command state, see ctx.h
+#define cmdi  (polly_ctx()->cmd->info)
+#define stx   (polly_ctx()->cmd->signtx)
+#define ptx   (&polly_ctx()->cmd->arena.sign.prevtx)
+#define signi (polly_ctx()->cmd->arena.sign.info)
+#define fwdl  (polly_ctx()->cmd->arena.fwdl)
+#define cp    (polly_ctx()->cmd->cp)
+#define utxo  (polly_ctx()->cmd->utxo)
+#define job   (polly_ctx()->cmd->job)
+#define batch (polly_ctx()->cmd->batch)
+#define dig   (polly_ctx()->cmd->arena.digests)
+#define phase (polly_ctx()->cmd->phase)
+
+#if HW_CC2538
+// Cortex-M3 DWT cycle counter, used to time the signing steps
+#define DEMCR       (*(volatile uint32_t *) 0xE000EDFC)
+#define DWT_CTRL    (*(volatile uint32_t *) 0xE0001000)
+#define DWT_CYCCNT  (*(volatile uint32_t *) 0xE0001004)
+#endif
+
+// Commands this firmware handles, reported by identify
+static const cmd_e CMDS_SUPPORTED[] =
+{
+    CMD_RESET,
+    CMD_IDENTIFY,
+    CMD_GET_PUBLIC_KEY,
+    CMD_SIGN_TX,
+    CMD_PREV_TX,
+    CMD_GET_SIGNED_TX,
+    CMD_FW_DOWNLOAD,
+    CMD_GET_PUBLIC_KEY_PATH,
+    CMD_SET_MASTER_SEED,
+    CMD_VAL_STATS,
+    CMD_PREV_TX_CACHED,
+    CMD_SIGN_PROGRESS,
+    CMD_GET_INPUT_SIG,
+    CMD_STATUS,
+    CMD_SIGN_SESSION,
+    CMD_SIGN_BATCH,
+    CMD_BATCH_PROGRESS,
+    CMD_SIGN_DIGESTS,
+    CMD_DIGESTS,
+};
+
+
+//
+// One step of the signing job, true once the job is over either way
+//
+static bool cp_sign(void)
+{
+    uint64_t      fee;
+    bool          approved;
+    signFlow_e    error;
+
+    if (job.cancelled)
+    {
+        // A new SIGN_TX or an error took the sign state away
+        cp_sign_wipe();
+        return true;
+    }
+
+    if (SIGN_STEP_CONFIRM == job.step)
+    {
+        assert(signi.sign_flow == SIGN_FLOW_SIGN_TX_READY);
 
-static const unsigned PTX_VERSION_B       = 4;
-static const unsigned PTX_IN_PREV_HASH_B  = 32;
-static const unsigned PTX_IN_PREV_INDEX_B = 4;
-static const unsigned PTX_IN_SEQUENCE_B   = 4;
-static const unsigned PTX_OUT_VALUE_B     = 8;
-static const unsigned PTX_LOCK_TIME_B     = 4;
+        fee = calc_fee();
+        if (fee > MAX_SATOSHIS)
+        {
+            error = SIGN_FLOW_SIGN_TX_DENIED;
+            goto error;
+        }
 
+        job.input = 0;
+        job.step  = SIGN_STEP_HASH;
 
-void cp_sign(void)
-{
-    unsigned    i;
-    uint64_t    fee;
-    signFlow_e  error;
+        if (BATCH_OPEN == batch.state)
+        {
+            // The user approved this one with the batch, if it fits
+            approved = batch_take(fee);
+        }
+        else
+        {
+            cp_set_state(CP_USER);
+
+            // Inputs are signed while the user reviews, see core_background
+            job.speculate = true;
+            approved      = review(fee);
+            job.speculate = false;
+        }
+
+        // Commands were served while the user decided, one may have reset the sign state
+        if (job.cancelled)
+        {
+            cp_sign_wipe();
+            return true;
+        }
+
+        if (!approved)
+        {
+            // Signatures made in the meantime go with the sign state
+            error = SIGN_FLOW_SIGN_TX_DENIED;
+            goto error;
+        }
+
+        if (job.failed)
+        {
+            error = SIGN_FLOW_SIGN_TX_ERROR;
+            goto error;
+        }
 
-    assert(cmdi.signi.sign_flow == SIGN_FLOW_SIGN_TX_READY);
+        cp_set_state(CP_BUSY);
 
-    fee = calc_fee();
-    if (fee > MAX_SATOSHIS)
+        if (job.input > 0)  screen_signing_progress(job.input, signi.totalInputs);
+    }
+    else if (!sign_step())
     {
-        error = SIGN_FLOW_SIGN_TX_DENIED;
+        error = SIGN_FLOW_SIGN_TX_ERROR;
         goto error;
     }
 
+    if (job.input < signi.totalInputs)  return false;
+
+    signi.sign_flow = SIGN_FLOW_SIGN_TX_DONE;
+    cp_sign_wipe();
+
+    return true;
+
+error:
+    cp_sign_wipe();
+    reset_sign_state();
+
+    // Preserve the sign flow state for error reporting
+    signi.sign_flow = error;
+
+    return true;
+}
+
+//
+// Hash, key or sign step of the input being signed, false if it could not be
+// signed
+//
+static bool sign_step(void)
+{
+    signInputs_t *in;
+    uint32_t      start;
+    txWriter_t    w;
+    unsigned      i;
+
+    start = cycles();
+    in    = &signi.input[job.input];
+
+    switch (job.step)
+    {
+        case SIGN_STEP_HASH:
+            //
+            // Inputs before this one are in every later sighash the same way,
+            // with an empty script. They are hashed once into the prefix, and
+            // the tx for this input goes into a copy of it from here on.
+            //
+            if (0 == job.input)
+            {
+                writer_init(&job.prefix, NULL, 0, 0, &polly_ctx()->cmd->arena.sign.prefixHash);
+                tx_head(&job.prefix);
+            }
+
+            w        = job.prefix;
+            w.hash   = &polly_ctx()->cmd->arena.sign.txHash;
+            *w.hash  = polly_ctx()->cmd->arena.sign.prefixHash;
+
+            for (i = job.input; i < signi.totalInputs; i++)
+            {
+                tx_input(&w, true, i, job.input);
+            }
+
+            tx_tail(&w, true);
+            writer_hash(&w, job.hash);
+
+            tx_input(&job.prefix, true, job.input, MAX_INPUTS);
+
+            job.step = SIGN_STEP_KEY;
+            break;
+
+        case SIGN_STEP_KEY:
+            wallet_address_private_key_get(in->account, in->chain, in->keyid, job.privKey, NULL);
+
+            job.step = SIGN_STEP_SIGN;
+            break;
+
+        case SIGN_STEP_SIGN:
+            if (crypto_ecdsa_sign(job.privKey, job.hash, in->sig, &in->sigBytes) > 0)  return false;
+
+            memset(job.privKey, 0, KEY_BYTES);
+
+            job.input++;
+
+            // The confirmation is still on the screen while speculating
+            if (!job.speculate)  screen_signing_progress(job.input, signi.totalInputs);
+
+            job.step = SIGN_STEP_HASH;
+            break;
+
+        default:
+            assert(0);
+            break;
+    }
+
+    job.sliceMax = max(job.sliceMax, cycles() - start);
+
+    return true;
+}
+
+//
+// Takes the tx about to be signed off the batch, a tx that does not fit
+// ends the batch
+//
+static bool batch_take(const uint64_t fee)
+{
+    const unsigned outputs = signi.totalOutputs;  // Change stays in the wallet, it does not count
+
+    if (batch.txsSigned    >= batch.asked.txs)             goto error;
+    if (batch.outputsLeft  <  outputs)                     goto error;
+    if (batch.satoshisLeft <  signi.output_satoshis)  goto error;
+    if (batch.feeLeft      <  fee)                         goto error;
+
+    batch.txsSigned++;
+    batch.outputsLeft  -= outputs;
+    batch.satoshisLeft -= signi.output_satoshis;
+    batch.feeLeft      -= fee;
+
+    if (batch.txsSigned == batch.asked.txs)  batch.state = BATCH_DONE;
+
+    return true;
+
+error:
+    batch.state = BATCH_DENIED;
+    return false;
+}
+
+//
+// The user pages through every output, then the total with the fee.
+// Commands are served while the user decides, one may reset the sign state.
+//
+static bool review(const uint64_t fee)
+{
+    const signOutput_t *out = signi.output;
+    const unsigned      n   = signi.totalOutputs;
+    unsigned            i;
+
+    // version is the starting byte of the output address
+    if (1 == n)  return screen_send(&out[0].version, out[0].satoshis, fee);
+
+    for (i = 0; i < n; i++)
+    {
+        if (!screen_send_output(i + 1, n, &out[i].version, out[i].satoshis))  return false;
+        if (job.cancelled)                                                     return false;
+    }
+
+    return screen_send_total(n, signi.output_satoshis, fee);
+}
+
+//
+// The batch confirmation, one step as the user wait blocks anyway
+//
+static bool cp_batch(void)
+{
+    bool approved;
+
     cp_set_state(CP_USER);
 
-    // signi.output_version is the starting byte of the output_address.
-    if (!screen_send(&cmdi.signi.output_version, cmdi.signi.output_satoshis, fee))
+    approved = screen_send_batch(batch.asked.txs, batch.asked.outputs, batch.asked.satoshis, batch.asked.fee);
+
+    // Ended or replaced while the user decided
+    if (BATCH_USER != batch.state)  return true;
+
+    batch.state = approved ? BATCH_OPEN : BATCH_DENIED;
+
+    return true;
+}
+
+//
+// One step of a digest run, the confirmation, a commit per digest of the
+// group, or the finish of the whole group. True once the step leaves
+// nothing to do.
+//
+static bool cp_digests(void)
+{
+    bool     approved;
+    unsigned i, j;
+
+    if (DIGESTS_USER == dig.state)
     {
-        error = SIGN_FLOW_SIGN_TX_DENIED;
-        goto error;
+        cp_set_state(CP_USER);
+
+        approved = screen_sign_digests(dig.asked);
+
+        // Ended or replaced while the user decided
+        if (DIGESTS_USER != dig.state)  return true;
+
+        dig.state = approved ? DIGESTS_OPEN : DIGESTS_DENIED;
+        return true;
     }
 
-    cp_set_state(CP_BUSY);
+    // The run was ended under the group
+    if (DIGESTS_OPEN != dig.state || GROUP_SIGNING != dig.group)
+    {
+        digests_wipe();
+        return true;
+    }
 
-    // Have each input sign the tx
-    for (i = 0; i < cmdi.signi.totalInputs; i++)
+    if (dig.next < dig.count)
     {
-        if (sign_tx_for_input(i, cmdi.signi.txbuff) > 0)
+        i = dig.next;
+
+        // A path seen earlier in the group has its key already
+        for (j = 0; j < i; j++)
         {
-            error = SIGN_FLOW_SIGN_TX_ERROR;
-            goto error;
+            if (dig.path[j].depth == dig.path[i].depth &&
+                !memcmp(dig.path[j].index, dig.path[i].index, dig.path[i].depth * sizeof(uint32_t)))  break;
+        }
+
+        if (j < i)
+        {
+            dig.keyOf[i] = dig.keyOf[j];
+        }
+        else
+        {
+            wallet_path_private_key_get(&dig.path[i], dig.key[i], NULL);
+            dig.keyOf[i] = dig.key[i];
         }
-        screen_signing_progress(i + 1, cmdi.signi.totalInputs);
+
+        if (!crypto_ecdsa_sign_commit(dig.keyOf[i], &dig.hash[i * DIGEST_BYTES],
+                                      &dig.rs[(2 * i + 1) * KEY_BYTES], &dig.rs[2 * i * KEY_BYTES]))  goto error;
+
+        dig.next++;
+        return false;
     }
 
-    cmdi.signi.sign_flow = SIGN_FLOW_SIGN_TX_DONE;
+    if (!crypto_ecdsa_sign_finish(dig.keyOf, dig.hash, dig.count, dig.rs, dig.work))  goto error;
 
-    return;
+    memset(dig.key, 0, sizeof(dig.key));
+    dig.group = GROUP_SIGNED;
+
+    return true;
 
 error:
-    reset_sign_state();
+    // The host may hand the group over again
+    dig.left += dig.count;
 
-    // Preserve the sign flow state for error reporting
-    cmdi.signi.sign_flow = error;
+    digests_wipe();
+    dig.group = GROUP_FAILED;
+
+    return true;
+}
+
+// Keys and nonces of the group, and whatever it signed
+static void digests_wipe(void)
+{
+    memset(dig.key,  0, sizeof(dig.key));
+    memset(dig.rs,   0, sizeof(dig.rs));
+    memset(dig.hash, 0, sizeof(dig.hash));
+
+    dig.group = GROUP_EMPTY;
+    dig.count = 0;
+    dig.next  = 0;
+}
+
+static void cp_sign_wipe(void)
+{
+    memset(job.hash,    0, SHA256_BYTES);
+    memset(job.privKey, 0, KEY_BYTES);
+
+    job.step      = SIGN_STEP_CONFIRM;
+    job.cancelled = false;
+    job.speculate = false;
+    job.failed    = false;
+}
+
+//
+// Hands the arena to a command family, wiping what the last one left in it.
+// False while the family holding it has a job running.
+//
+static bool phase_borrow(const cmdPhase_e family)
+{
+    if (family == phase)  return true;
+
+    if ((PHASE_SIGN    == phase && CP_CMD_SIGN    == cp.cmd) ||
+        (PHASE_DIGESTS == phase && CP_CMD_DIGESTS == cp.cmd))  return false;
+
+    memset(&polly_ctx()->cmd->arena, 0, sizeof(cmdArena_t));
+    phase = family;
+
+    switch (family)
+    {
+        case PHASE_SIGN:  reset_sign_state();  break;
+        case PHASE_FWDL:  reset_fwdl_state();  break;
+        default:          break;   // Zeroed is DIGESTS_NONE
+    }
+
+    return true;
 }
 
 static cp_state_e cp_state(void)
@@ -279,6 +829,9 @@ static cp_state_e cp_state(void)
 static void cp_set_state(cp_state_e state)
 {
     cp.state = state;
+
+    // The user wait blocks the main loop, status has to be current before it
+    status_publish();
 }
 
 static void cp_set_cmd(cp_cmd_e cmd)
@@ -286,6 +839,18 @@ static void cp_set_cmd(cp_cmd_e cmd)
     assert(cp.cmd == CP_CMD_NONE);
     cp.cmd   = cmd;
     cp.state = CP_BUSY;
+
+    job.step      = SIGN_STEP_CONFIRM;
+    job.cancelled = false;
+    job.speculate = false;
+    job.failed    = false;
+    job.input     = 0;
+
+#if HW_CC2538
+    // Start the cycle counter for the step timing
+    DEMCR    |= 1UL << 24;
+    DWT_CTRL |= 1;
+#endif
 }
 
 static void cp_end_cmd(void)
@@ -296,57 +861,86 @@ static void cp_end_cmd(void)
 
 void core_process(void)
 {
-    if (cp.cmd == CP_CMD_NONE)  return;
+    // Commands and responses queued by the transports
+    core_poll();
 
+    // Commands that came in were answered above, one step between them
     switch (cp.cmd)
     {
         case CP_CMD_SIGN:
-            cp_sign();
+            if (cp_sign())  cp_end_cmd();
+            break;
+
+        case CP_CMD_BATCH:
+            if (cp_batch())  cp_end_cmd();
+            break;
+
+        case CP_CMD_DIGESTS:
+            if (cp_digests())  cp_end_cmd();
+            break;
+
+        default:
             break;
     }
 
-    cp_end_cmd();
+    status_publish();
 }
 
-
-void memcpy_r(void *dst, const void *src, const unsigned bytes)
+//
+// Called while the user looks at the tx, one sign step each time. The
+// signatures stay in the sign state until the user approves, and go with it
+// when the user declines or a command resets it.
+//
+void core_background(void)
 {
-   unsigned i;
-   uint8_t *d = dst;
-   const uint8_t *s = src;
-   
-   for (i = 0; i < bytes; i++)
-   {
-       d[i] = s[bytes - 1 - i];
-   } 
+    if (cp.cmd != CP_CMD_SIGN || !job.speculate)           return;
+    if (job.cancelled || job.failed)                        return;
+    if (job.input >= signi.totalInputs)                return;
+
+    // Told once the user has decided
+    if (!sign_step())  job.failed = true;
 }
 
 
+static uint32_t cycles(void)
+{
+#if HW_CC2538
+    return DWT_CYCCNT;
+#else
+    return 0;
+#endif
+}
+
 void reset_sign_state(void)
 {
-    memset(&cmdi.signi, 0, sizeof(sign_info_t));
+    // There is no sign state while another family has the arena
+    if (PHASE_SIGN != phase)  return;
+
+    // A signing job still running stops at its next step
+    if (cp.cmd == CP_CMD_SIGN)  job.cancelled = true;
 
-    cmdi.signi.sign_flow  = SIGN_FLOW_SETUP;
+    memset(&signi, 0, sizeof(sign_info_t));
+
+    signi.sign_flow  = SIGN_FLOW_SETUP;
     reset_ptx_state();
 }
 
 
 void reset_ptx_state(void)
 {
-    ptx = &cmdi.signi.ptx;
-
-    memset(ptx, 0, sizeof(prevTxInfo_t));
+    prevtx_reset(ptx, &polly_ctx()->cmd->arena.sign.ptxHash, prev_tx_save);
 
-    ptx->field = PTX_HEADER;
-    crypto_sha256_reset(&ptx->hashCtx);
+    utxo.staged = 0;
 }
 
 void reset_fwdl_state(void)
 {
-    cmdi.fwdl.total_bytes  = 0;
-    cmdi.fwdl.rx_bytes     = 0;
-    cmdi.fwdl.write_offset = 0;
-    cmdi.fwdl.chunk_offset = 0;
+    if (PHASE_FWDL != phase)  return;
+
+    fwdl.total_bytes  = 0;
+    fwdl.rx_bytes     = 0;
+    fwdl.write_offset = 0;
+    fwdl.chunk_offset = 0;
 }
 
 /*
@@ -369,7 +963,7 @@ bool cmd_handler_quick(cmd_t *cmd, const unsigned cmd_bytes, cmdResp_t *resp, un
 }
 */
 
-resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes)
+resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes, resp_gen_f *resp_gen)
 {
     // Response is constructed by the code/functions below and must be cleared first.
     cmdi.resp = resp;
@@ -379,9 +973,18 @@ resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_byte
         cmdi.currCmd = cmd->cmd;
     }
     
-    if (!core_unlocked() && cmdi.currCmd != CMD_IDENTIFY)
+    if (!core_unlocked() && cmdi.currCmd != CMD_IDENTIFY && cmdi.currCmd != CMD_STATUS)
+    {
+        // If we're locked, only identify and status are allowed
+        cmdi.currCmd = CMD_NONE;
+    }
+
+    if ((PHASE_SIGN != phase && (cmdi.currCmd == CMD_PREV_TX       || cmdi.currCmd == CMD_PREV_TX_CACHED ||
+                                 cmdi.currCmd == CMD_GET_SIGNED_TX || cmdi.currCmd == CMD_GET_INPUT_SIG  ||
+                                 cmdi.currCmd == CMD_SIGN_SESSION)) ||
+        (PHASE_DIGESTS != phase && cmdi.currCmd == CMD_DIGESTS))
     {
-        // If we're locked, only identify is allowed
+        // Nothing to work on, another family has the arena
         cmdi.currCmd = CMD_NONE;
     }
 
@@ -398,18 +1001,59 @@ resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_byte
         case CMD_GET_PUBLIC_KEY:
             get_public_key(cmd, total_bytes);
             break;
+
+        case CMD_GET_PUBLIC_KEY_PATH:
+            get_public_key_path(cmd, total_bytes);
+            break;
             
         case CMD_SIGN_TX:
-            sign_tx(cmd, total_bytes);
+            // Taken whole, or as a stream when the outputs do not fit in the command buffer
+            sign_tx(cmd, chunk_bytes, total_bytes, start || !streaming);
             break;
 
         case CMD_PREV_TX:
             prev_tx(cmd, chunk_bytes, total_bytes, start);
             break;
+
+        case CMD_PREV_TX_CACHED:
+            prev_tx_cached(cmd, total_bytes);
+            break;
         
         case CMD_GET_SIGNED_TX:
             get_signed_tx(cmd, total_bytes);
             break;
+
+        case CMD_SIGN_PROGRESS:
+            sign_progress(cmd, total_bytes);
+            break;
+
+        case CMD_GET_INPUT_SIG:
+            get_input_sig(cmd, total_bytes);
+            break;
+
+        case CMD_STATUS:
+            status(cmd, total_bytes);
+            break;
+
+        case CMD_SIGN_SESSION:
+            sign_session(cmd, total_bytes);
+            break;
+
+        case CMD_SIGN_BATCH:
+            sign_batch(cmd, total_bytes);
+            break;
+
+        case CMD_BATCH_PROGRESS:
+            batch_progress(cmd, total_bytes);
+            break;
+
+        case CMD_SIGN_DIGESTS:
+            sign_digests(cmd, total_bytes);
+            break;
+
+        case CMD_DIGESTS:
+            digests(cmd, total_bytes);
+            break;
         
         case CMD_FW_DOWNLOAD:
             fw_download(cmd, chunk_bytes, total_bytes, start);
@@ -418,6 +1062,10 @@ resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_byte
         case CMD_SET_MASTER_SEED:
             set_master_seed(cmd, total_bytes);
             break;
+
+        case CMD_VAL_STATS:
+            stats(cmd, total_bytes);
+            break;
             
         default:
             small_resp(CMD_ACK_INVALID);
@@ -427,8 +1075,10 @@ resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_byte
     if (cmdi.respBytes > 0)
     {
         *resp_bytes = cmdi.respBytes;
+        *resp_gen   = cmdi.respGen;
         
         cmdi.respBytes = 0;
+        cmdi.respGen   = NULL;
         cmdi.resp      = NULL;
         cmdi.currCmd   = CMD_NONE;
         return RESP_NEW;
@@ -447,11 +1097,24 @@ static void small_resp(const cmd_e cmd)
 
 static void identify(const cmd_t *cmd, const unsigned total_bytes)
 {
+    unsigned i;
+
     // Parameter checking
     if (cmd->cmd != CMD_IDENTIFY)   goto error;
     if (total_bytes != SMALL_BYTES) goto error;
     
     memcpy(cmdi.resp->id.model, MODEL, MODEL_NAME_BYTES);
+
+    cmdi.resp->id.protocol         = PROTOCOL_VERSION;
+    cmdi.resp->id.stream_max_bytes = STREAM_MAX_BYTES;
+    cmdi.resp->id.pipeline_depth   = PACKET_QUEUE_DEPTH;
+
+    memset(cmdi.resp->id.cmds, 0, CMD_BITMAP_BYTES);
+
+    for (i = 0; i < sizeof(CMDS_SUPPORTED) / sizeof(CMDS_SUPPORTED[0]); i++)
+    {
+        cmdi.resp->id.cmds[CMDS_SUPPORTED[i] / 8] |= 1 << (CMDS_SUPPORTED[i] % 8);
+    }
     
     cmdi.resp->cmd = CMD_ACK_SUCCESS;
     cmdi.respBytes = ID_RESP_BYTES;
@@ -461,557 +1124,577 @@ error:
     small_resp(CMD_ACK_INVALID);
 }
 
-static void sign_tx(const cmd_t *cmd, const unsigned cmdBytes)
+static void sign_tx(const cmd_t *cmd, unsigned chunk_bytes, const unsigned total_bytes, const bool start)
 {
-    unsigned pos = 0, i;
-    uint8_t *cmdData = (uint8_t*)cmd;
-    uint8_t pubKeyX[KEY_BYTES], pubKeyY[KEY_BYTES];
-    
-    // Parameter checking
-    if (cmd->cmd != CMD_SIGN_TX)      goto error;
-    if (cmdBytes > SIGN_TX_MAX_BYTES) goto error;
-
-    // No matter the previous state, start fresh when this command is received
-    reset_sign_state();
+    static const uint8_t RECORD_BYTES[] =
+    {
+        [SIGNTX_HEAD]    = 2,
+        [SIGNTX_INPUT]   = SIGN_TX_INPUT_BYTES,
+        [SIGNTX_OUTPUTS] = 1,
+        [SIGNTX_OUTPUT]  = SIGN_TX_OUTPUT_BYTES,
+        [SIGNTX_CHANGE]  = SIGN_TX_CHANGE_BYTES,
+    };
 
-    // Skip over the command byte
-    pos++;
-    
-    // Grab the number of input key ids
-    cmdi.signi.totalInputs = (unsigned)cmdData[pos];
-    cmdi.signi.inputsLeftToVerify = cmdi.signi.totalInputs;
-    
-    if (cmdi.signi.totalInputs > MAX_INPUTS) goto error;
+    const uint8_t *cd = (const uint8_t*) cmd;
+    uint8_t        hash[SHA256_BYTES];
+    unsigned       n;
 
-    // Input key ids;
-    pos++;
-    
-    for (i = 0; i < cmdi.signi.totalInputs; i++)
+    if (start)
     {
-        // Only support a limited number of accounts
-        cmdi.signi.input[i].account = cmdData[pos];
-        if (cmdi.signi.input[i].account > ACCT_MAX) goto error;
-        pos += 1;
+        memset(&stx, 0, sizeof(signTxParse_t));
 
-        // Only support a limited number of chains
-        cmdi.signi.input[i].chain = cmdData[pos];
-        if (cmdi.signi.input[i].chain > CHAIN_MAX) goto error;
-        pos += 1;
+        stx.stage  = SIGNTX_HEAD;
+        stx.left   = total_bytes;
+        stx.busy   = !phase_borrow(PHASE_SIGN);
+        stx.failed = (cmd->cmd != CMD_SIGN_TX) || (total_bytes > SIGN_TX_MAX_BYTES) || stx.busy;
 
-        // Upper key ID bit is reserved for derivation type
-        cmdi.signi.input[i].keyid = *((uint32_t *)&cmdData[pos]);
-        if (cmdi.signi.input[i].keyid & HARDENED_KEY) goto error;
-        pos += 4; 
+        // No matter the previous state, start fresh when this command is received
+        reset_sign_state();
 
-        memcpy(cmdi.signi.input[i].pubKeyCompress, &cmdData[pos], COMPRESS_KEY_BYTES);
-        pos += COMPRESS_KEY_BYTES;
+        writer_init(&stx.id, NULL, 0, 0, stx.busy ? NULL : &polly_ctx()->cmd->arena.sign.txHash);
     }
-    
-    // Output
-    cmdi.signi.output_version = 0;
-    memcpy(cmdi.signi.output_addr, &cmdData[pos], HASH_ADDR_BYTES);
-    pos += HASH_ADDR_BYTES;
-    
-    memcpy(&cmdi.signi.output_satoshis, &cmdData[pos], sizeof(uint64_t));
 
-    if (cmdi.signi.output_satoshis > MAX_SATOSHIS)  goto error;
+    // Parameter checking
+    if (chunk_bytes > stx.left)  goto error;
+
+    writer_put(&stx.id, cd, chunk_bytes);
 
-    pos += sizeof(uint64_t);
-    
-    // See if we have any change (a key id + satoshis)
-    if (cmdBytes - pos == 1 + 1 + 4 + 8)
+    while (chunk_bytes > 0)
     {
-        cmdi.signi.giveChange = true;
-        
-        // Only support a limited number of accounts
-        cmdi.signi.change_account = cmdData[pos];
-        if (cmdi.signi.change_account > ACCT_MAX) goto error;
-        pos += 1;
+        // After a bad record, or past the end, the rest is only counted off
+        if (stx.failed || SIGNTX_DONE == stx.stage)
+        {
+            stx.failed  = true;
+            stx.left   -= chunk_bytes;
+            break;
+        }
+
+        n = min(chunk_bytes, RECORD_BYTES[stx.stage] - stx.recBytes);
+
+        memcpy(&stx.rec[stx.recBytes], cd, n);
+
+        stx.recBytes += n;
+        stx.left     -= n;
+        cd           += n;
+        chunk_bytes  -= n;
 
-        // Only support a limited number of chains
-        cmdi.signi.change_chain = cmdData[pos];
-        if (cmdi.signi.change_chain > CHAIN_MAX) goto error;
-        pos += 1;
+        if (stx.recBytes == RECORD_BYTES[stx.stage])
+        {
+            stx.recBytes = 0;
+            stx.failed   = !sign_tx_record();
+        }
+    }
+
+    // A stream is answered once, at its end
+    if (stx.left > 0)  return;
+
+    if (stx.failed || SIGNTX_DONE != stx.stage)  goto error;
 
-        cmdi.signi.change_keyid = *((uint32_t*)&cmdData[pos]);
-        if (cmdi.signi.change_keyid & HARDENED_KEY) goto error;
-        pos += 4;
+    //
+    // Session id from the request and a count, so a host holding the id of
+    // an earlier session, even of the same tx, does not match this one
+    //
+    polly_ctx()->cmd->sessions++;
 
-        memcpy(&cmdi.signi.change_satoshis, &cmdData[pos], 8);
-        if (cmdi.signi.change_satoshis > MAX_SATOSHIS)  goto error;
+    writer_put (&stx.id, &polly_ctx()->cmd->sessions, sizeof(uint32_t));
+    writer_hash(&stx.id, hash);
 
-        pos += 8;
+    memcpy(&signi.session, hash, sizeof(uint32_t));
 
-        // Get the public key for this id, and calculate its hash 160
-        wallet_public_key_get(KEY_ADDRESS,
-                              cmdi.signi.change_account,
-                              cmdi.signi.change_chain,
-                              cmdi.signi.change_keyid,
-                              pubKeyX,
-                              pubKeyY,
-                              NULL);
+    if (0 == signi.session)  signi.session = 1;
 
-        wallet_public_key_to_hash160(pubKeyX, pubKeyY, cmdi.signi.change_addr);
-    }
-    
-    if (pos != cmdBytes) goto error;
-    
     // Next state should be all the previous transactions
-    cmdi.signi.sign_flow = SIGN_FLOW_PREV_TX;
-    small_resp(CMD_ACK_SUCCESS);
+    signi.sign_flow = SIGN_FLOW_PREV_TX;
+
+    cmdi.resp->cmd            = CMD_ACK_SUCCESS;
+    cmdi.resp->signtx.session = signi.session;
+    cmdi.respBytes            = SIGN_TX_RESP_BYTES;
     return;
     
 error:
+    small_resp(stx.busy ? CMD_ACK_BUSY : CMD_ACK_INVALID);
+
+    memset(&stx, 0, sizeof(signTxParse_t));
     reset_sign_state();
-    small_resp(CMD_ACK_INVALID);
 }
 
-static unsigned process_header(const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes)
+//
+// One whole record of the SIGN_TX request, false if it is bad
+//
+static bool sign_tx_record(void)
 {
-    unsigned proc_bytes  = 0;
-    unsigned copy_bytes = 0;
-    
+    const uint8_t *r = stx.rec;
+    signInputs_t  *in;
+    signOutput_t  *out;
 
-    if (ptx->fieldByte == 0)
+    switch (stx.stage)
     {
-        // The first 2 bytes of the header must come together to know how long the rest is
-        assert(bytes >= 2);
+        case SIGNTX_HEAD:
+            // Skip over the command byte, then the number of input key ids
+            signi.totalInputs        = r[1];
+            signi.inputsLeftToVerify = signi.totalInputs;
 
-        assert(0 != cmdi.signi.totalInputs);
-        assert(0 == ptx->headerEntries);
-        assert(0 == ptx->fieldByte);
-        assert(0 == ptx->fieldTotalBytes);
-        assert(0 == ptx->inputsLeft);
-        assert(0 == ptx->outputsTotal);
+            if (signi.totalInputs > MAX_INPUTS)  return false;
 
-        // Checking the command bytes
-        assert(cd[0] == CMD_PREV_TX);
-        proc_bytes += 1;
-        
-        // Get the number of entries in the header
-        ptx->headerEntries = cd[1];
-        proc_bytes += 1;
+            stx.stage = (0 == signi.totalInputs) ? SIGNTX_OUTPUTS : SIGNTX_INPUT;
+            break;
 
-        // For the header, fieldTotalBytes represents header bytes only
-        ptx->fieldTotalBytes = ptx->headerEntries * sizeof(prevTxHeader_t);
+        case SIGNTX_INPUT:
+            in = &signi.input[stx.index];
 
-        copy_bytes = min(bytes - 2, ptx->fieldTotalBytes);
-    }
-    else
-    {
-        copy_bytes = min(bytes, ptx->fieldTotalBytes - ptx->fieldByte);
-    }
-        
-    memcpy(&ptx->header[ptx->fieldByte], &cd[proc_bytes], copy_bytes);
+            // Only support a limited number of accounts and chains
+            in->account = r[0];
+            in->chain   = r[1];
 
-    ptx->fieldByte += copy_bytes;
-    proc_bytes     += copy_bytes;
+            if (in->account > ACCT_MAX)   return false;
+            if (in->chain   > CHAIN_MAX)  return false;
 
-    *ateBytes = proc_bytes;
+            // Upper key ID bit is reserved for derivation type
+            memcpy(&in->keyid, &r[2], 4);
+            if (in->keyid & HARDENED_KEY)  return false;
 
-    if (ptx->fieldByte == ptx->fieldTotalBytes)
-    {
-        // Done
-        ptx->fieldByte = 0;
-        return true;
+            memcpy(in->pubKeyCompress, &r[6], COMPRESS_KEY_BYTES);
+
+            if (++stx.index < signi.totalInputs)  break;
+
+            stx.index = 0;
+            stx.stage = SIGNTX_OUTPUTS;
+            break;
+
+        case SIGNTX_OUTPUTS:
+            signi.totalOutputs = r[0];
+
+            if (0 == signi.totalOutputs)               return false;
+            if (signi.totalOutputs > MAX_PAY_OUTPUTS)  return false;
+
+            stx.stage = SIGNTX_OUTPUT;
+            break;
+
+        case SIGNTX_OUTPUT:
+            out = &signi.output[stx.index];
+
+            out->version = 0;
+            memcpy( out->addr,     r,                   HASH_ADDR_BYTES);
+            memcpy(&out->satoshis, &r[HASH_ADDR_BYTES], sizeof(uint64_t));
+
+            // Each on its own first, so the sum cannot wrap
+            if (out->satoshis > MAX_SATOSHIS)  return false;
+
+            signi.output_satoshis += out->satoshis;
+            if (signi.output_satoshis > MAX_SATOSHIS)  return false;
+
+            if (++stx.index < signi.totalOutputs)  break;
+
+            // See if we have any change (a key id + satoshis)
+            if      (stx.left == SIGN_TX_CHANGE_BYTES)  stx.stage = SIGNTX_CHANGE;
+            else if (stx.left == 0)                     stx.stage = SIGNTX_DONE;
+            else                                        return false;
+            break;
+
+        case SIGNTX_CHANGE:
+            signi.giveChange = true;
+
+            // Only support a limited number of accounts and chains
+            signi.change_account = r[0];
+            signi.change_chain   = r[1];
+
+            if (signi.change_account > ACCT_MAX)   return false;
+            if (signi.change_chain   > CHAIN_MAX)  return false;
+
+            memcpy(&signi.change_keyid, &r[2], 4);
+            if (signi.change_keyid & HARDENED_KEY)  return false;
+
+            memcpy(&signi.change_satoshis, &r[6], 8);
+            if (signi.change_satoshis > MAX_SATOSHIS)  return false;
+
+            // Get the hash 160 for this id, usually straight from the address pool
+            wallet_address_hash160_get(signi.change_account,
+                                       signi.change_chain,
+                                       signi.change_keyid,
+                                       signi.change_addr);
+
+            stx.stage = SIGNTX_DONE;
+            break;
+
+        default:
+            return false;
     }
 
-    return false;
+    return true;
 }
 
-static unsigned process_skip(const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes, const unsigned totalBytes)
+static bool prev_tx_save(const uint8_t inputIdx, const uint32_t outputIdx, const uint64_t value, const uint8_t *script, const unsigned script_bytes)
 {
-    unsigned procBytes = 0;
+    signInputs_t *in;
+    utxo_t       *u;
+
+    if (value > MAX_SATOSHIS)  return false;
 
-    if (0 == ptx->fieldByte)
+    if (PREVTX_CACHE_ONLY == inputIdx)
     {
-        // Start
-        ptx->fieldTotalBytes = totalBytes;
+        // Only a hint for later sessions, drop what does not fit
+        if (utxo.staged == UTXO_STAGE_ENTRIES)  return true;
+
+        u = &utxo.stage[utxo.staged++];
+
+        u->vout  = outputIdx;
+        u->value = value;
+        memcpy(u->pkScript, script, PK_SCRIPT_BYTES);
+
+        return true;
     }
-        
-    procBytes = min(bytes, ptx->fieldTotalBytes - ptx->fieldByte);
-    ptx->fieldByte += procBytes;
-    
-    *ateBytes = procBytes;
-    
-    if (ptx->fieldByte == ptx->fieldTotalBytes)
+
+    if (inputIdx >= signi.totalInputs)  return false;
+
+    in = &signi.input[inputIdx];
+
+    // Verified already, only the same outpoint may be named again, the txid is checked once hashed
+    if (signi.inputsVerified & (1UL << inputIdx))
     {
-        // Done
-        ptx->fieldByte = 0;        
-        return true;
+        return in->prevTxOutputIndex == outputIdx && in->valueSatoshis == value;
     }
-    
-    return false;
-}    
 
-static unsigned getVarIntBytes(uint8_t firstByte)
-{
-    if      (firstByte <  0xFD)  return 1;
-    else if (firstByte == 0xFD)  return 3;
-    else if (firstByte == 0xFE)  return 5;
-    else                         return 9;
+    in->valueSatoshis       = value;
+    in->prevTxOutputIndex   = outputIdx;
+    in->prevTxPkScriptBytes = script_bytes;
+    memcpy(in->prevTxPkScript, script, script_bytes);
 
+    return true;
 }
 
-static unsigned process_var_int(const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes, void *dest)
+
+static void input_verified(const uint8_t inputIdx)
 {
-    unsigned procBytes = 0, cdPos = 0;
-    uint8_t *d = dest;
+    // Inputs named twice only count once
+    if (signi.inputsVerified & (1UL << inputIdx))  return;
 
-    if (0 == ptx->fieldByte)
-    {
-        ptx->fieldTotalBytes = getVarIntBytes(cd[0]);
-        
-        if (ptx->fieldTotalBytes == 1)
-        {
-            d[0] = cd[cdPos];
-        }
-        
-        // We've processed the first byte at least (and likely will be the last)
-        ptx->fieldByte += 1;
-        procBytes      += 1;
-        cdPos          += 1;
-    }
-    
-    procBytes += min(bytes, ptx->fieldTotalBytes - ptx->fieldByte);
+    signi.inputsVerified |= 1UL << inputIdx;
+    signi.inputsLeftToVerify--;
 
-    if (procBytes > 1)
-    {
-        //
-        // This case will always be when the varint is > 1 byte
-        // Therefore, we want to ignore the first field byte when copying
-        // in data.
-        //
-        assert(ptx->fieldByte >= 1);
-        
-        memcpy(&d[ptx->fieldByte - 1], &cd[cdPos], procBytes);
-        ptx->fieldByte += procBytes;    
-    }
-    
-    *ateBytes = procBytes;
-    
-    if (ptx->fieldByte == ptx->fieldTotalBytes)
+    if (signi.inputsLeftToVerify == 0)
     {
-        ptx->fieldByte = 0;
-        return true;
+        // This is the last one, transition the state
+        signi.sign_flow = SIGN_FLOW_SIGN_TX_READY;
     }
-    
-    return false;
 }
 
 
-static unsigned process_field(const uint8_t *cd, const unsigned bytes, unsigned * const ateBytes, void *dest, const unsigned totalBytes)
+static utxo_t* utxo_find(const uint8_t *txid, const uint32_t vout)
 {
-    unsigned procBytes = 0;
-    uint8_t *d = dest;
+    unsigned i;
 
-    if (0 == ptx->fieldByte)
+    for (i = 0; i < UTXO_CACHE_ENTRIES; i++)
     {
-        // Start
-        ptx->fieldTotalBytes = totalBytes;
+        if (utxo.entry[i].used && utxo.entry[i].vout == vout &&
+            0 == memcmp(utxo.entry[i].txid, txid, TX_HASH_BYTES))
+        {
+            utxo.entry[i].stamp = ++utxo.stamp;
+            utxo.hits++;
+            return &utxo.entry[i];
+        }
     }
-        
-    procBytes += min(bytes, ptx->fieldTotalBytes - ptx->fieldByte);
-      
-    memcpy(&d[ptx->fieldByte], cd, procBytes);
 
-    ptx->fieldByte += procBytes;
-    *ateBytes = procBytes;
-    
-    if (ptx->fieldByte == ptx->fieldTotalBytes)
-    {
-        // Done
-        ptx->fieldByte = 0;
-        return true;
-    }
-    
-    return false;
+    utxo.misses++;
+    return NULL;
 }
 
 
-static bool save_curr_output(const uint64_t outputIdx, uint8_t * const inputIdx)
+static void utxo_put(const uint8_t *txid, const uint32_t vout, const uint64_t value, const uint8_t *pkScript)
 {
-    unsigned i;
-    
-    for (i = 0; i < ptx->headerEntries; i++)
+    utxo_t   *u = NULL;
+    unsigned  i;
+
+    for (i = 0; i < UTXO_CACHE_ENTRIES; i++)
     {
-        if (ptx->header[i].outputIdx == outputIdx)
+        // Already there, just refresh it
+        if (utxo.entry[i].used && utxo.entry[i].vout == vout &&
+            0 == memcmp(utxo.entry[i].txid, txid, TX_HASH_BYTES))
         {
-            *inputIdx = ptx->header[i].inputIdx;
-            return true;
+            u = &utxo.entry[i];
+            break;
+        }
+
+        // Otherwise a free slot, or the least recently used one
+        if (NULL == u || !utxo.entry[i].used ||
+            (u->used && utxo.entry[i].stamp < u->stamp))
+        {
+            u = &utxo.entry[i];
         }
     }
-    
-    *inputIdx = 0;
-    return false;
+
+    u->used  = true;
+    u->stamp = ++utxo.stamp;
+    u->vout  = vout;
+    u->value = value;
+    memcpy(u->txid, txid, TX_HASH_BYTES);
+    memcpy(u->pkScript, pkScript, PK_SCRIPT_BYTES);
 }
 
 
 static void prev_tx(const cmd_t *cmd, unsigned chunk_bytes, unsigned total_bytes, bool start)
 {
-    uint8_t   *cd       = (uint8_t*) cmd;
-    unsigned   ateBytes = 0;
-    unsigned   i; 
-    bool       done     = false;
-    
+    const uint8_t *cd       = (const uint8_t*) cmd;
+    unsigned       ateBytes = 0;
+    unsigned       i;
+    uint8_t        idx;
+    signInputs_t  *in;
+
     // Parameter checking
     if (chunk_bytes > STREAM_CHUNK_BYTES)                          goto error;
-    if (cmdi.signi.sign_flow != SIGN_FLOW_PREV_TX)                 goto error;
-    if (ptx->field == PTX_HEADER && ptx->fieldByte == 0 && !start) goto error;
+    if (signi.sign_flow != SIGN_FLOW_PREV_TX)                 goto error;
+    if (prevtx_idle(ptx) && !start)                                goto error;
+
+    // A stream cut off by a lost link left a prev tx half parsed, it is sent again whole
+    if (start && !prevtx_idle(ptx))  reset_ptx_state();
 
     //
-    // This function is called many times when processing the prev tx chunks
-    // The state can change mid function, therefore the if statements below
-    // are all checked individually (no if else)
+    // A stream may carry several prev txs back to back, each starting with
+    // its own command byte and header
     //
-
     while (chunk_bytes > 0)
     {
-        switch (ptx->field)
+        switch (prevtx_input(ptx, cd, chunk_bytes, &ateBytes))
         {
-            case PTX_HEADER:
-                if (process_header(cd, chunk_bytes, &ateBytes))
-                {
-                    ptx->field = PTX_VERSION;
-                }                    
-                break;
-                
-            case PTX_VERSION:
-                if (process_skip(cd, chunk_bytes, &ateBytes, PTX_VERSION_B))
-                {
-                    ptx->field = PTX_IN_COUNT;
-                }
-                
-                //
-                // Turn on hash calculations at the version - may get set a couple times
-                // if the version is split across chunks, but thats not as big deal.
-                //
-                ptx->hashCalc = true;
-                break;
-                     
-            case PTX_IN_COUNT:
-                if (process_var_int(cd, chunk_bytes, &ateBytes, &ptx->inputsLeft))
-                {
-                    ptx->field = PTX_IN_PREV_HASH;
-                }
-                break;
-                
-            case PTX_IN_PREV_HASH:
-                if (process_skip(cd, chunk_bytes, &ateBytes, PTX_IN_PREV_HASH_B))
-                {
-                    ptx->field = PTX_IN_PREV_INDEX;
-                }
-                break;
-                
-            case PTX_IN_PREV_INDEX:
-                if (process_skip(cd, chunk_bytes, &ateBytes, PTX_IN_PREV_INDEX_B))
-                {
-                    ptx->field = PTX_IN_SCRIPT_LEN;
-                }                    
-                break;
-                
-            case PTX_IN_SCRIPT_LEN:
-                if (process_var_int(cd, chunk_bytes, &ateBytes, &ptx->inputScriptBytes))
-                {
-                    ptx->field = PTX_IN_SCRIPT;
-                }
-                break;
-        
-            case PTX_IN_SCRIPT:
-                if (process_skip(cd, chunk_bytes, &ateBytes, ptx->inputScriptBytes))
-                {
-                    ptx->field = PTX_IN_SEQUENCE;
-                }
-                break;
-                
-            case PTX_IN_SEQUENCE:
-                if (process_skip(cd, chunk_bytes, &ateBytes, PTX_IN_SEQUENCE_B))
-                {
-                    ptx->inputsLeft--; 
-                    ptx->field = ptx->inputsLeft > 0 ? PTX_IN_PREV_HASH : PTX_OUT_COUNT;
-                }                    
+            case PREVTX_MORE:
                 break;
 
-            case PTX_OUT_COUNT:
-                if (process_var_int(cd, chunk_bytes, &ateBytes, &ptx->outputsTotal))
+            case PREVTX_DONE:
+                // Every input named has to have had its output in this tx, or the session is over
+                for (i = 0; i < ptx->headerEntries; i++)
                 {
-                    ptx->outputIndex = 0;
-                    ptx->outputSave = save_curr_output(ptx->outputIndex, &ptx->outputSaveToIndex);
-                    ptx->field = PTX_OUT_VALUE;
-                }
-                break;
+                    idx = ptx->header[i].inputIdx;
 
-            case PTX_OUT_VALUE:
-                if (ptx->outputSave)
-                {
-                    if (ptx->outputSaveToIndex > cmdi.signi.totalInputs) goto error;
-                    
-                    if (process_field(cd,
-                                     chunk_bytes,
-                                     &ateBytes, 
-                                     &cmdi.signi.input[ptx->outputSaveToIndex].valueSatoshis, 
-                                     PTX_OUT_VALUE_B))
-                    {
-                        ptx->field = PTX_OUT_SCRIPT_LEN;
-                    }
+                    if (PREVTX_CACHE_ONLY == idx)                          continue;
+                    if (idx >= signi.totalInputs)                          goto fail;
+                    if (!(ptx->found & (1UL << i)))                        goto fail;
 
-                    if (cmdi.signi.input[ptx->outputSaveToIndex].valueSatoshis > MAX_SATOSHIS)  goto error;
-                }
-                else
-                {
-                    if (process_skip(cd, chunk_bytes, &ateBytes, PTX_OUT_VALUE_B))
-                    {
-                        ptx->field = PTX_OUT_SCRIPT_LEN;
-                    }
-                    
-                }                    
-                break;
+                    in = &signi.input[idx];
 
-            case PTX_OUT_SCRIPT_LEN:
-                if (process_var_int(cd, chunk_bytes, &ateBytes, &ptx->outputScriptBytes))
-                {
-                    ptx->field = PTX_OUT_SCRIPT;
-                }
-                break;
+                    // Two entries for one input that name different outputs
+                    if (in->prevTxOutputIndex != ptx->header[i].outputIdx)  goto fail;
 
-            case PTX_OUT_SCRIPT:
-                if (ptx->outputSave)
-                {
-                    if (ptx->outputSaveToIndex > cmdi.signi.totalInputs) goto error;
-                    if (ptx->outputScriptBytes != PK_SCRIPT_BYTES)       goto error;
-
-                    if (process_field(cd,
-                                     chunk_bytes,
-                                     &ateBytes,
-                                     &cmdi.signi.input[ptx->outputSaveToIndex].prevTxPkScript,
-                                     ptx->outputScriptBytes))
+                    // A verified input named again, from another tx
+                    if ((signi.inputsVerified & (1UL << idx)) &&
+                        0 != memcmp(in->prevTxHash, ptx->hash, TX_HASH_BYTES))
                     {
-                        // Also save off additional details on this transaction
-                        cmdi.signi.input[ptx->outputSaveToIndex].prevTxOutputIndex   = ptx->outputIndex;
-                        cmdi.signi.input[ptx->outputSaveToIndex].prevTxPkScriptBytes = ptx->outputScriptBytes;
-
-                        ptx->outputIndex++;
-                        
-                        if (ptx->outputIndex == ptx->outputsTotal)
-                        {
-                            ptx->field = PTX_LOCK_TIME;
-                        }
-                        else
-                        {
-                            ptx->outputSave = save_curr_output(ptx->outputIndex, &ptx->outputSaveToIndex);
-                            ptx->field = PTX_OUT_VALUE;
-                        }                        
+                        goto error;
                     }
                 }
-                else
+
+                // Every input spending from this tx gets its hash
+                for (i = 0; i < ptx->headerEntries; i++)
                 {
-                    if (process_skip(cd, chunk_bytes, &ateBytes, ptx->outputScriptBytes))
-                    {
-                        ptx->outputIndex++;
-                        
-                        if (ptx->outputIndex == ptx->outputsTotal)
-                        {
-                            ptx->field = PTX_LOCK_TIME;
-                        }
-                        else
-                        {
-                            ptx->outputSave = save_curr_output(ptx->outputIndex, &ptx->outputSaveToIndex);
-                            ptx->field = PTX_OUT_VALUE;
-                        }
-                    }
-                
+                    idx = ptx->header[i].inputIdx;
+
+                    if (PREVTX_CACHE_ONLY == idx)  continue;
+
+                    in = &signi.input[idx];
+
+                    memcpy(in->prevTxHash, ptx->hash, TX_HASH_BYTES);
+                    utxo_put(ptx->hash, in->prevTxOutputIndex, in->valueSatoshis, in->prevTxPkScript);
+                    input_verified(idx);
                 }
-                break;
 
-            case PTX_LOCK_TIME:
-                if (process_skip(cd, chunk_bytes, &ateBytes, PTX_LOCK_TIME_B))
-                {                   
-                    if (0 != ateBytes)
-                    {
-                        done = true;
-                        small_resp(CMD_ACK_SUCCESS);
-                    }
-                    
+                // The hash checks out, outputs kept for later sessions can go in
+                for (i = 0; i < utxo.staged; i++)
+                {
+                    utxo_put(ptx->hash, utxo.stage[i].vout, utxo.stage[i].value, utxo.stage[i].pkScript);
                 }
+
+                small_resp(CMD_ACK_SUCCESS);
+                reset_ptx_state();
                 break;
 
             default:
-                ateBytes = 0;
-                break;
+                goto error;
         }
-        
-        //
-        // Either a processing function encountered an error, or there 
-        // was more data to process than we expected
-        //
-        if (0 == ateBytes) goto error;
-        
-        // Calculate hash on the chunk eaten?
-        if (true == ptx->hashCalc)
+
+        cd          += ateBytes;
+        chunk_bytes -= ateBytes;
+    }
+
+    return;
+
+error:
+    // Only this prev tx is lost, inputs already verified stay with the session
+    reset_ptx_state();
+    small_resp(CMD_ACK_INVALID);
+    return;
+
+fail:
+    reset_sign_state();
+    small_resp(CMD_ACK_INVALID);
+}
+
+
+static void prev_tx_cached(const cmd_t *cmd, const unsigned total_bytes)
+{
+    const prevTxClaim_t *claim;
+    const utxo_t        *u;
+    signInputs_t        *in;
+    uint32_t             missed = 0;
+    unsigned             i;
+
+    // Parameter checking
+    if (cmd->cmd != CMD_PREV_TX_CACHED)                           goto error;
+    if (signi.sign_flow != SIGN_FLOW_PREV_TX)                goto error;
+    if (total_bytes < PREV_TX_CACHED_BYTES(1))                    goto error;
+    if (cmd->ptxc.count > signi.totalInputs)                 goto error;
+    if (total_bytes != PREV_TX_CACHED_BYTES(cmd->ptxc.count))     goto error;
+
+    for (i = 0; i < cmd->ptxc.count; i++)
+    {
+        claim = &cmd->ptxc.claim[i];
+
+        if (claim->inputIdx >= signi.totalInputs)  goto error;
+
+        u = utxo_find(claim->txid, claim->vout);
+
+        if (NULL == u)
         {
-            crypto_sha256_input(ptx->hashCtx, cd, ateBytes);
+            missed |= 1UL << claim->inputIdx;
+            continue;
         }
-        
-        // See if we're done processing this prev tx
-        if (done)
-        {
-            // Finish out the hash and copy the results to the various inputs
-            crypto_sha256_result (ptx->hashCtx, cmdi.signi.input[ptx->header[0].inputIdx].prevTxHash);
-            crypto_sha256_reset  (&ptx->hashCtx);
-            crypto_sha256_input  (ptx->hashCtx, cmdi.signi.input[ptx->header[0].inputIdx].prevTxHash, TX_HASH_BYTES);
-            crypto_sha256_result (ptx->hashCtx, cmdi.signi.input[ptx->header[0].inputIdx].prevTxHash);
-
-            cmdi.signi.inputsLeftToVerify--;
-            
-            for (i = 1; i < ptx->headerEntries; i++)
-            {
-                memcpy(cmdi.signi.input[ptx->header[i].inputIdx].prevTxHash, 
-                       cmdi.signi.input[ptx->header[0].inputIdx].prevTxHash,
-                       TX_HASH_BYTES);
-                
-                cmdi.signi.inputsLeftToVerify--;
-            }
 
-            if (cmdi.signi.inputsLeftToVerify < 0)  goto error;
+        in = &signi.input[claim->inputIdx];
 
-            if (cmdi.signi.inputsLeftToVerify == 0)
+        // Verified already, only the same outpoint may be claimed again
+        if (signi.inputsVerified & (1UL << claim->inputIdx))
+        {
+            if (in->prevTxOutputIndex != u->vout || in->valueSatoshis != u->value ||
+                0 != memcmp(in->prevTxHash, u->txid, TX_HASH_BYTES))
             {
-                // This is the last one, transition the state
-                cmdi.signi.sign_flow = SIGN_FLOW_SIGN_TX_READY;
+                goto error;
             }
-            
-            reset_ptx_state();        
+
+            continue;
         }
-        
-        cd         += ateBytes;
-        chunk_bytes -= ateBytes;
+
+        memcpy(in->prevTxHash, u->txid, TX_HASH_BYTES);
+        memcpy(in->prevTxPkScript, u->pkScript, PK_SCRIPT_BYTES);
+
+        in->prevTxOutputIndex   = u->vout;
+        in->prevTxPkScriptBytes = PK_SCRIPT_BYTES;
+        in->valueSatoshis       = u->value;
+
+        input_verified(claim->inputIdx);
     }
-    
+
+    if (0 == missed)
+    {
+        small_resp(CMD_ACK_SUCCESS);
+    }
+    else
+    {
+        cmdi.resp->cmd         = CMD_ACK_MISS;
+        cmdi.resp->ptxc.missed = missed;
+        cmdi.respBytes         = PREV_TX_CACHED_RESP_BYTES;
+    }
+
     return;
-    
+
 error:
-    reset_sign_state();
+    // The session carries on, claims made before the bad one still count
     small_resp(CMD_ACK_INVALID);
 }
 
 
-static unsigned output_script(const uint8_t *hash160, uint8_t *script)
+//
+// Tx bytes are written through a writer instead of into a whole tx buffer.
+// The buffer sink keeps only a window of the tx, the hash sink hashes all
+// of it in whole blocks.
+//
+static void writer_init(txWriter_t *w, uint8_t *dest, const unsigned skip, const unsigned room, sha256ctx_t *hash)
 {
-    // Set the script length and stack push ops
-    *script++ = 0x19;
-    *script++ = 0x76;
-    *script++ = 0xa9;
-    *script++ = 0x14;
-   
-    // The output address in hash 160 form
-    memcpy(script, hash160, HASH_ADDR_BYTES);
-    script += HASH_ADDR_BYTES;
-    
-    // Set the script calculation bytes
-    *script++ = 0x88;
-    *script++ = 0xac;
-    
-    return 4 + HASH_ADDR_BYTES + 2;
+    memset(w, 0, sizeof(txWriter_t));
+
+    w->dest = dest;
+    w->skip = skip;
+    w->room = room;
+    w->hash = hash;
+
+    if (NULL != w->hash)  crypto_sha256_reset(w->hash);
+}
+
+static void writer_put(txWriter_t *w, const void *src, const unsigned bytes)
+{
+    const uint8_t *s    = src;
+    unsigned       left = bytes;
+    unsigned       from, to, n;
+
+    // The part of these bytes that falls in the window
+    from = max(w->pos, w->skip);
+    to   = min(w->pos + bytes, w->skip + w->room);
+
+    if (NULL != w->dest && from < to)
+    {
+        memcpy(&w->dest[from - w->skip], &s[from - w->pos], to - from);
+        w->written += to - from;
+    }
+
+    w->pos += bytes;
+
+    if (NULL == w->hash)  return;
+
+    while (left > 0)
+    {
+        n = min(left, HASH_BLOCK_BYTES - w->blockBytes);
+
+        memcpy(&w->block[w->blockBytes], s, n);
+
+        w->blockBytes += n;
+        s             += n;
+        left          -= n;
+
+        if (w->blockBytes == HASH_BLOCK_BYTES)
+        {
+            crypto_sha256_input(w->hash, w->block, HASH_BLOCK_BYTES);
+            w->blockBytes = 0;
+        }
+    }
+}
+
+static void writer_byte(txWriter_t *w, const uint8_t b)
+{
+    writer_put(w, &b, 1);
+}
+
+static void writer_put_r(txWriter_t *w, const uint8_t *src, const unsigned bytes)
+{
+    unsigned i;
+
+    for (i = 0; i < bytes; i++)
+    {
+        writer_byte(w, src[bytes - 1 - i]);
+    }
+}
+
+static void writer_hash(txWriter_t *w, uint8_t *hash)
+{
+    assert(NULL != w->hash);
+
+    if (w->blockBytes > 0)
+    {
+        crypto_sha256_input(w->hash, w->block, w->blockBytes);
+        w->blockBytes = 0;
+    }
+
+    // Tx hashes are double SHA256
+    crypto_sha256_result (w->hash, hash);
+    crypto_sha256_reset  (w->hash);
+    crypto_sha256_input  (w->hash, hash, SHA256_BYTES);
+    crypto_sha256_result (w->hash, hash);
+}
+
+static void output_script(txWriter_t *w, const uint8_t *hash160)
+{
+    static const uint8_t HEAD[] = { 0x19, 0x76, 0xa9, 0x14 };
+    static const uint8_t TAIL[] = { 0x88, 0xac };
+
+    // Script length and stack push ops, the output address in hash 160 form, then the script calculation bytes
+    writer_put(w, HEAD, sizeof(HEAD));
+    writer_put(w, hash160, HASH_ADDR_BYTES);
+    writer_put(w, TAIL, sizeof(TAIL));
 }
 
 uint64_t calc_fee()
@@ -1019,146 +1702,133 @@ uint64_t calc_fee()
     unsigned i;
     uint64_t input_satoshis = 0;
 
-    for (i = 0; i < cmdi.signi.totalInputs; i++)
+    for (i = 0; i < signi.totalInputs; i++)
     {
-        input_satoshis += cmdi.signi.input[i].valueSatoshis;
+        input_satoshis += signi.input[i].valueSatoshis;
 
         if (input_satoshis > MAX_SATOSHIS)  return MAX_SATOSHIS + 1;
     }
 
-    if (input_satoshis < cmdi.signi.output_satoshis + cmdi.signi.change_satoshis)  return MAX_SATOSHIS + 1;
+    if (input_satoshis < signi.output_satoshis + signi.change_satoshis)  return MAX_SATOSHIS + 1;
 
-    return input_satoshis - cmdi.signi.output_satoshis - cmdi.signi.change_satoshis;
+    return input_satoshis - signi.output_satoshis - signi.change_satoshis;
 }
 
-unsigned build_tx(const bool forSigning, const unsigned inputIdx, uint8_t *dest)
+unsigned build_tx(const bool forSigning, const unsigned inputIdx, txWriter_t *w)
 {
     unsigned i;
-    uint8_t *tx = dest;
+
+    tx_head(w);
+
+    for (i = 0; i < signi.totalInputs; i++)
+    {
+        tx_input(w, forSigning, i, inputIdx);
+    }
+
+    return tx_tail(w, forSigning);
+}
+
+static void tx_head(txWriter_t *w)
+{
+    static const uint8_t VERSION[]  = { 0x01, 0x00, 0x00, 0x00 };
 
     // Version
-    *tx++ = 0x01;
-    *tx++ = 0x00;
-    *tx++ = 0x00;
-    *tx++ = 0x00;
-    
+    writer_put(w, VERSION, sizeof(VERSION));
+
     // Input count - no need to do varint as the supported inputs < 0xFD  
-    assert(cmdi.signi.totalInputs < 0xFD);
-    *tx++ = cmdi.signi.totalInputs;
-    
-    // Inputs
-    for (i = 0; i < cmdi.signi.totalInputs; i++)
+    assert(signi.totalInputs < 0xFD);
+    writer_byte(w, signi.totalInputs);
+}
+
+static void tx_input(txWriter_t *w, const bool forSigning, const unsigned i, const unsigned inputIdx)
+{
+    static const uint8_t SEQUENCE[] = { 0xff, 0xff, 0xff, 0xff };
+
+    const signInputs_t *in = &signi.input[i];
+
+    // Prev tx hash and output index
+    writer_put_r(w, in->prevTxHash, TX_HASH_BYTES);
+    writer_put  (w, &in->prevTxOutputIndex, 4);
+   
+    if (forSigning)
     {
-        // Prev tx hash
-        memcpy_r(tx, &cmdi.signi.input[i].prevTxHash, TX_HASH_BYTES);
-        tx += TX_HASH_BYTES;
-        
-        // Prev tx output index
-        memcpy(tx, &cmdi.signi.input[i].prevTxOutputIndex, 4);
-        tx += 4;
-       
-        if (forSigning)
+        // For signing, use the previous output script or 0x00 for the signature slot            
+        if (i == inputIdx)
         {
-            // For signing, use the previous output script or 0x00 for the signature slot            
-            if (i == inputIdx)
-            {
-                // Prev tx output script
-                *tx++ = cmdi.signi.input[i].prevTxPkScriptBytes;
-                memcpy(tx, &cmdi.signi.input[i].prevTxPkScript, PK_SCRIPT_BYTES);
-                tx += PK_SCRIPT_BYTES;
-            }
-            else
-            {
-                // One byte of zeroes 
-                *tx++ = 0x00;
-            }
+            writer_byte(w, in->prevTxPkScriptBytes);
+            writer_put (w, in->prevTxPkScript, PK_SCRIPT_BYTES);
         }
         else
         {
-            // For full tx, use the signature and compressed public key
-            
-            // Total signature script bytes
-            *tx++ = cmdi.signi.input[i].sigBytes + COMPRESS_KEY_BYTES + 2;
-            
-            // Signature bytes
-            *tx++ = cmdi.signi.input[i].sigBytes;
-            
-            // Signature
-            memcpy(tx, cmdi.signi.input[i].sig, cmdi.signi.input[i].sigBytes);
-            tx += cmdi.signi.input[i].sigBytes;
-            
-            // Compressed public key bytes
-            *tx++ = COMPRESS_KEY_BYTES;
-            
-            // Compressed public key
-            memcpy(tx, cmdi.signi.input[i].pubKeyCompress, COMPRESS_KEY_BYTES);
-            tx += COMPRESS_KEY_BYTES;
+            writer_byte(w, 0x00);
         }
-        
-        // Sequence
-        memset(tx, 0xff, 4);
-        tx += 4;
     }
-
-    // Output count - one real output, and potentially one change
-    if (cmdi.signi.giveChange)  *tx++ = 0x02;
-    else                        *tx++ = 0x01;
+    else
+    {
+        // For full tx, use the signature and compressed public key
+        writer_byte(w, in->sigBytes + COMPRESS_KEY_BYTES + 2);
+        writer_byte(w, in->sigBytes);
+        writer_put (w, in->sig, in->sigBytes);
+        writer_byte(w, COMPRESS_KEY_BYTES);
+        writer_put (w, in->pubKeyCompress, COMPRESS_KEY_BYTES);
+    }
     
-    // Output - to destination
-    memcpy(tx, &cmdi.signi.output_satoshis, 8);
-    tx += 8;
+    writer_put(w, SEQUENCE, sizeof(SEQUENCE));
+}
+
+static unsigned tx_tail(txWriter_t *w, const bool forSigning)
+{
+    static const uint8_t LOCK[]     = { 0x00, 0x00, 0x00, 0x00 };
+    static const uint8_t HASHTYPE[] = { 0x01, 0x00, 0x00, 0x00 };  // SIGHASH_ALL
+
+    unsigned i;
+
+    // Output count - the outputs paid, and potentially one change
+    assert(signi.totalOutputs < 0xFD - 1);
+    writer_byte(w, signi.totalOutputs + (signi.giveChange ? 1 : 0));
     
-    tx += output_script(cmdi.signi.output_addr, tx);
+    // Outputs - to destinations
+    for (i = 0; i < signi.totalOutputs; i++)
+    {
+        writer_put(w, &signi.output[i].satoshis, 8);
+        output_script(w, signi.output[i].addr);
+    }
     
     // Output - change
-    if (cmdi.signi.giveChange)
+    if (signi.giveChange)
     {
-        memcpy(tx, &cmdi.signi.change_satoshis, 8);
-        tx += 8;
-        
-        tx += output_script(cmdi.signi.change_addr, tx);
+        writer_put(w, &signi.change_satoshis, 8);
+        output_script(w, signi.change_addr);
     }
 
-    // Lock time
-    memset(tx, 0x00, 4);
-    tx += 4;
+    writer_put(w, LOCK, sizeof(LOCK));
+
+    if (forSigning)
+    {
+        // Hash type field add-on
+        writer_put(w, HASHTYPE, sizeof(HASHTYPE));
+    }
+    
+    assert(w->pos <= SIGNED_TX_MAX_BYTES);
+    return w->pos;
+}    
+
+static unsigned signed_tx_gen(uint8_t *dest, const unsigned offset, const unsigned bytes)
+{
+    txWriter_t w;
+    unsigned   n = 0;
 
-    if (forSigning)
+    // The command byte, then the tx rebuilt up to the end of this piece
+    if (0 == offset)
     {
-        // Hash type field add-on (SIGHASH_ALL)
-        *tx++ = 0x01;
-        *tx++ = 0x00;
-        *tx++ = 0x00;
-        *tx++ = 0x00;
+        dest[n++] = CMD_ACK_SUCCESS;
     }
-    
-    assert(tx - dest <= SIGNED_TX_MAX_BYTES);
-    return tx - dest;
-}    
-        
-static unsigned sign_tx_for_input(const uint8_t inputIdx, uint8_t *tx)
-{
-    unsigned txBytes;
-    uint8_t  hash[SHA256_BYTES];
-    uint8_t  privKey[KEY_BYTES];
-
-    // Build up the tx for this input to sign
-    txBytes = build_tx(true, inputIdx, tx);
-     
-    // Calculate the hash, a double SHA 256
-    crypto_sha256(tx, txBytes, hash);
-    crypto_sha256(hash, SHA256_BYTES, hash);
-
-    // Sign the tx
-    wallet_address_private_key_get(cmdi.signi.input[inputIdx].account,
-                                   cmdi.signi.input[inputIdx].chain,
-                                   cmdi.signi.input[inputIdx].keyid,
-                                   privKey,
-                                   NULL);
-
-    return crypto_ecdsa_sign(privKey, hash, cmdi.signi.input[inputIdx].sig, &cmdi.signi.input[inputIdx].sigBytes);
-}
 
+    writer_init(&w, &dest[n], offset + n - 1, bytes - n, NULL);
+    build_tx(false, 0, &w);
+
+    return n + w.written;
+}
 
 void fw_download(const cmd_t *cmd, const unsigned chunk_bytes, const unsigned total_bytes, bool start)
 {
@@ -1172,8 +1842,11 @@ void fw_download(const cmd_t *cmd, const unsigned chunk_bytes, const unsigned to
 
         if (total_bytes > MAIN_HEADER_BYTES + MAIN_BYTES)  goto error;
 
+        // The new image ends any signing, unless a job is still on it
+        if (!phase_borrow(PHASE_FWDL))                     goto error;
+
         reset_fwdl_state();
-        cmdi.fwdl.total_bytes = total_bytes - 1; // Do not include the command byte
+        fwdl.total_bytes = total_bytes - 1; // Do not include the command byte
 
         done = fw_write_chunk(&d[1], chunk_bytes - 1);
     }
@@ -1207,34 +1880,31 @@ bool fw_write_chunk(const uint8_t *d, unsigned bytes)
 
     while (bytes > 0)
     {
-        copy_bytes = min(bytes, FW_WRITE_CHUNK - cmdi.fwdl.chunk_offset);
+        copy_bytes = min(bytes, FW_WRITE_CHUNK - fwdl.chunk_offset);
 
-        memcpy(&cmdi.fwdl.chunk[cmdi.fwdl.chunk_offset], &d[copy_offset], copy_bytes);
+        memcpy(&fwdl.chunk[fwdl.chunk_offset], &d[copy_offset], copy_bytes);
 
         bytes                  -= copy_bytes;
         copy_offset            += copy_bytes;
-        cmdi.fwdl.chunk_offset += copy_bytes;
-        cmdi.fwdl.rx_bytes     += copy_bytes;
+        fwdl.chunk_offset += copy_bytes;
+        fwdl.rx_bytes     += copy_bytes;
 
-        assert(cmdi.fwdl.chunk_offset <= FW_WRITE_CHUNK);
+        assert(fwdl.chunk_offset <= FW_WRITE_CHUNK);
 
-        if (cmdi.fwdl.chunk_offset == FW_WRITE_CHUNK ||
-            cmdi.fwdl.rx_bytes  == cmdi.fwdl.total_bytes)
+        if (fwdl.chunk_offset == FW_WRITE_CHUNK ||
+            fwdl.rx_bytes  == fwdl.total_bytes)
         {
-            // We've filled up a chunk, push it down
-            if (cmdi.fwdl.write_offset % 0x800 == 0)
-            {
-                FlashMainPageErase(DOWNLOAD_HEADER_BASE + cmdi.fwdl.write_offset);
-            }
+            // We've filled up a page, push it down
+            FlashMainPageErase(DOWNLOAD_HEADER_BASE + fwdl.write_offset);
 
-            FlashMainPageProgram((uint32_t*)cmdi.fwdl.chunk, DOWNLOAD_HEADER_BASE + cmdi.fwdl.write_offset, FW_WRITE_CHUNK);
+            FlashMainPageProgram((uint32_t*)fwdl.chunk, DOWNLOAD_HEADER_BASE + fwdl.write_offset, FW_WRITE_CHUNK);
 
-            cmdi.fwdl.write_offset += FW_WRITE_CHUNK;
-            cmdi.fwdl.chunk_offset = 0;
+            fwdl.write_offset += FW_WRITE_CHUNK;
+            fwdl.chunk_offset = 0;
         }
     }
 
-    if (cmdi.fwdl.write_offset >= cmdi.fwdl.total_bytes)
+    if (fwdl.write_offset >= fwdl.total_bytes)
     {
         return true;
     }
@@ -1259,21 +1929,29 @@ bool fw_verify(void)
 
 static void get_signed_tx(const cmd_t *cmd, const unsigned total_bytes)
 {
+    bool       confirmOnly = false;
+    txWriter_t w;
+
     // Parameter checking
     if (cmd->cmd != CMD_GET_SIGNED_TX)                   goto error;
-    if (total_bytes != SMALL_BYTES)                      goto error;
-    if (cmdi.signi.sign_flow < SIGN_FLOW_SIGN_TX_READY)  goto error;
+    if (signi.sign_flow < SIGN_FLOW_SIGN_TX_READY)  goto error;
+
+    if (total_bytes == GET_SIGNED_TX_CONFIRM_BYTES)
+    {
+        confirmOnly = cmd->gstx.flags & SIGNED_TX_CONFIRM_ONLY;
+    }
+    else if (total_bytes != SMALL_BYTES)
+    {
+        goto error;
+    }
 
 
-    switch (cmdi.signi.sign_flow)
+    switch (signi.sign_flow)
     {
         case SIGN_FLOW_SIGN_TX_READY:
 
             if (cp_state() == CP_IDLE)
             {
-                // Latch the buffer to use for signing. I don't really like this.
-                cmdi.signi.txbuff = (uint8_t*)&cmdi.resp->signedtx;
-
                 cp_set_cmd(CP_CMD_SIGN);
                 small_resp(CMD_ACK_BUSY);
             }
@@ -1294,10 +1972,24 @@ static void get_signed_tx(const cmd_t *cmd, const unsigned total_bytes)
 
         case SIGN_FLOW_SIGN_TX_DONE:
 
-            // Build the final fully signed tx
-            cmdi.respBytes = build_tx(false, 0, cmdi.resp->signedtx);
-            cmdi.respBytes++; // Account for the command byte
-            cmdi.resp->cmd = CMD_ACK_SUCCESS;
+            if (confirmOnly)
+            {
+                // The host put the tx together from the input signatures, it only needs the txid to check against
+                writer_init(&w, NULL, 0, 0, &polly_ctx()->cmd->arena.sign.txHash);
+                build_tx(false, 0, &w);
+                writer_hash(&w, cmdi.resp->confirm.txid);
+
+                cmdi.resp->cmd = CMD_ACK_SUCCESS;
+                cmdi.respBytes = SIGNED_TX_CONFIRM_RESP_BYTES;
+            }
+            else
+            {
+                // The fully signed tx is rebuilt a packet at a time as it goes out, only its size is needed now
+                writer_init(&w, NULL, 0, 0, NULL);
+
+                cmdi.respGen   = signed_tx_gen;
+                cmdi.respBytes = build_tx(false, 0, &w) + 1; // Account for the command byte
+            }
             break;
 
         default:
@@ -1312,6 +2004,386 @@ error:
     small_resp(CMD_ACK_INVALID);
 }
 
+static void sign_progress_get(signProgressResp_t *progress)
+{
+    if (PHASE_SIGN != phase)
+    {
+        memset(progress, 0, sizeof(signProgressResp_t));
+        progress->status = CMD_NONE;
+        return;
+    }
+
+    switch (signi.sign_flow)
+    {
+        case SIGN_FLOW_SIGN_TX_READY:
+            if      (cp_state() == CP_USER)  progress->status = CMD_ACK_USER;
+            else if (cp_state() == CP_BUSY)  progress->status = CMD_ACK_BUSY;
+            else                             progress->status = CMD_NONE;
+            break;
+
+        case SIGN_FLOW_SIGN_TX_DONE:    progress->status = CMD_ACK_SUCCESS;  break;
+        case SIGN_FLOW_SIGN_TX_DENIED:  progress->status = CMD_ACK_DENIED;   break;
+        case SIGN_FLOW_SIGN_TX_ERROR:   progress->status = CMD_ACK_INVALID;  break;
+        default:                        progress->status = CMD_NONE;         break;
+    }
+
+    progress->inputs_total  = signi.totalInputs;
+    progress->inputs_signed = (SIGN_FLOW_SIGN_TX_DONE == signi.sign_flow) ? signi.totalInputs :
+                              (cp.cmd == CP_CMD_SIGN && cp_state() == CP_BUSY) ? job.input : 0;
+}
+
+static void sign_progress(const cmd_t *cmd, const unsigned total_bytes)
+{
+    // Parameter checking
+    if (cmd->cmd != CMD_SIGN_PROGRESS)  goto error;
+    if (total_bytes != SMALL_BYTES)     goto error;
+
+    sign_progress_get(&cmdi.resp->progress);
+
+    cmdi.resp->cmd = CMD_ACK_SUCCESS;
+    cmdi.respBytes = SIGN_PROGRESS_RESP_BYTES;
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+static void status_publish(void)
+{
+    statusResp_t st;
+
+    memset(&st, 0, sizeof(st));
+
+    st.unlocked = core_unlocked();
+    st.cur_job  = (cp.cmd == CP_CMD_SIGN)    ? STATUS_JOB_SIGN    :
+                  (cp.cmd == CP_CMD_BATCH)   ? STATUS_JOB_BATCH   :
+                  (cp.cmd == CP_CMD_DIGESTS) ? STATUS_JOB_DIGESTS : STATUS_JOB_NONE;
+
+    sign_progress_get(&st.sign);
+
+    cmdparser_status_publish(&st);
+}
+
+static void status(const cmd_t *cmd, const unsigned total_bytes)
+{
+    // Normally answered by the transport interrupt, this is for when its reply slot was taken
+    if (cmd->cmd != CMD_STATUS)      goto error;
+    if (total_bytes != SMALL_BYTES)  goto error;
+
+    cmdparser_status_read(&cmdi.resp->status);
+
+    cmdi.resp->cmd = CMD_ACK_STATUS;
+    cmdi.respBytes = STATUS_RESP_BYTES;
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+static void get_input_sig(const cmd_t *cmd, const unsigned total_bytes)
+{
+    const signInputs_t *in;
+    bool                ready;
+
+    // Parameter checking
+    if (cmd->cmd != CMD_GET_INPUT_SIG)                    goto error;
+    if (total_bytes != GET_INPUT_SIG_BYTES)               goto error;
+    if (cmd->isig.inputIdx >= signi.totalInputs)     goto error;
+
+    // Inputs are signed in order, the job is past this one or all are done
+    switch (signi.sign_flow)
+    {
+        case SIGN_FLOW_SIGN_TX_READY:
+            if (cp.cmd != CP_CMD_SIGN)  goto error;  // GET_SIGNED_TX starts the signing
+
+            // Inputs signed while the user reviews are held back until approved
+            ready = cp_state() == CP_BUSY && job.input > cmd->isig.inputIdx;
+            break;
+
+        case SIGN_FLOW_SIGN_TX_DONE:
+            ready = true;
+            break;
+
+        default:
+            goto error;
+    }
+
+    if (!ready)
+    {
+        small_resp(cp_state() == CP_USER ? CMD_ACK_USER : CMD_ACK_BUSY);
+        return;
+    }
+
+    in = &signi.input[cmd->isig.inputIdx];
+
+    cmdi.resp->isig.inputIdx  = cmd->isig.inputIdx;
+    cmdi.resp->isig.sig_bytes = in->sigBytes;
+    memcpy(cmdi.resp->isig.sig, in->sig, in->sigBytes);
+
+    cmdi.resp->cmd = CMD_ACK_SUCCESS;
+    cmdi.respBytes = INPUT_SIG_RESP_BYTES(in->sigBytes);
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+static void sign_session(const cmd_t *cmd, const unsigned total_bytes)
+{
+    signSessionResp_t *r = &cmdi.resp->session;
+
+    // Parameter checking
+    if (cmd->cmd != CMD_SIGN_SESSION)                  goto error;
+    if (total_bytes != SIGN_SESSION_BYTES)             goto error;
+    if (0 == signi.session)                       goto error;
+    if (cmd->session.session != signi.session)    goto error;
+
+    r->session      = signi.session;
+    r->inputs_total = signi.totalInputs;
+    r->verified     = signi.inputsVerified;
+
+    switch (signi.sign_flow)
+    {
+        case SIGN_FLOW_PREV_TX:        r->stage = SIGN_SESSION_PREV_TX;  break;
+        case SIGN_FLOW_SIGN_TX_READY:  r->stage = (cp.cmd == CP_CMD_SIGN) ? SIGN_SESSION_SIGNING : SIGN_SESSION_READY;  break;
+        default:                       r->stage = SIGN_SESSION_SIGNING;  break;
+    }
+
+    cmdi.resp->cmd = CMD_ACK_SUCCESS;
+    cmdi.respBytes = SIGN_SESSION_RESP_BYTES;
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+static void sign_batch(const cmd_t *cmd, const unsigned total_bytes)
+{
+    // Parameter checking
+    if (cmd->cmd != CMD_SIGN_BATCH)         goto error;
+    if (total_bytes != SIGN_BATCH_BYTES)    goto error;
+    if (cmd->sbat.satoshis > MAX_SATOSHIS)  goto error;
+    if (cmd->sbat.fee > MAX_SATOSHIS)       goto error;
+
+    // Whatever batch there was ends here, a new one is only asked for when idle
+    memset(&batch, 0, sizeof(batch_t));
+    batch.state = BATCH_NONE;
+
+    if (0 == cmd->sbat.txs)
+    {
+        small_resp(CMD_ACK_SUCCESS);
+        return;
+    }
+
+    if (cp_state() != CP_IDLE)
+    {
+        small_resp(CMD_ACK_BUSY);
+        return;
+    }
+
+    batch.state        = BATCH_USER;
+    batch.asked        = cmd->sbat;
+    batch.outputsLeft  = cmd->sbat.outputs;
+    batch.satoshisLeft = cmd->sbat.satoshis;
+    batch.feeLeft      = cmd->sbat.fee;
+
+    cp_set_cmd(CP_CMD_BATCH);
+    small_resp(CMD_ACK_USER);
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+static void batch_progress(const cmd_t *cmd, const unsigned total_bytes)
+{
+    batchProgressResp_t *r = &cmdi.resp->bprog;
+
+    // Parameter checking
+    if (cmd->cmd != CMD_BATCH_PROGRESS)  goto error;
+    if (total_bytes != SMALL_BYTES)      goto error;
+
+    switch (batch.state)
+    {
+        case BATCH_USER:    r->status = CMD_ACK_USER;     break;
+        case BATCH_OPEN:
+        case BATCH_DONE:    r->status = CMD_ACK_SUCCESS;  break;
+        case BATCH_DENIED:  r->status = CMD_ACK_DENIED;   break;
+        default:            r->status = CMD_NONE;         break;
+    }
+
+    r->txs_signed    = batch.txsSigned;
+    r->txs_total     = batch.asked.txs;
+    r->outputs_left  = batch.outputsLeft;
+    r->satoshis_left = batch.satoshisLeft;
+    r->fee_left      = batch.feeLeft;
+
+    cmdi.resp->cmd = CMD_ACK_SUCCESS;
+    cmdi.respBytes = BATCH_PROGRESS_RESP_BYTES;
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+static void sign_digests(const cmd_t *cmd, const unsigned total_bytes)
+{
+    // Parameter checking
+    if (cmd->cmd != CMD_SIGN_DIGESTS)                 goto error;
+    if (total_bytes != SIGN_DIGESTS_BYTES)            goto error;
+    if (cmd->sdig.flags & ~DIGEST_SIG_COMPACT)        goto error;
+
+    // Whatever run there was ends here, a job still on it stops at its next step
+    if (PHASE_DIGESTS == phase)
+    {
+        memset(&dig, 0, sizeof(digestRun_t));
+        dig.state = DIGESTS_NONE;
+    }
+
+    if (0 == cmd->sdig.count)
+    {
+        small_resp(CMD_ACK_SUCCESS);
+        return;
+    }
+
+    if (cp_state() != CP_IDLE || !phase_borrow(PHASE_DIGESTS))
+    {
+        small_resp(CMD_ACK_BUSY);
+        return;
+    }
+
+    dig.state   = DIGESTS_USER;
+    dig.asked   = cmd->sdig.count;
+    dig.left    = cmd->sdig.count;
+    dig.compact = cmd->sdig.flags & DIGEST_SIG_COMPACT;
+
+    cp_set_cmd(CP_CMD_DIGESTS);
+    small_resp(CMD_ACK_USER);
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+static void digests(const cmd_t *cmd, const unsigned total_bytes)
+{
+    const digestItem_t *item;
+    unsigned            i;
+
+    // Parameter checking
+    if (cmd->cmd != CMD_DIGESTS)                                goto error;
+    if (total_bytes < DIGESTS_BYTES(0))                         goto error;
+    if (cmd->digests.count > DIGESTS_GROUP)                     goto error;
+    if (total_bytes != DIGESTS_BYTES(cmd->digests.count))       goto error;
+
+    switch (dig.state)
+    {
+        case DIGESTS_USER:    small_resp(CMD_ACK_USER);    return;
+        case DIGESTS_DENIED:  small_resp(CMD_ACK_DENIED);  return;
+        case DIGESTS_OPEN:    break;
+        default:              goto error;
+    }
+
+    if (GROUP_SIGNING == dig.group)
+    {
+        small_resp(CMD_ACK_BUSY);
+        return;
+    }
+
+    if (0 == cmd->digests.count)
+    {
+        if (GROUP_FAILED == dig.group)  goto error;
+
+        // The last group's signatures, as often as the host asks until the next group
+        cmdi.respGen   = digests_gen;
+        cmdi.respBytes = digests_gen(NULL, 0, 0);
+        return;
+    }
+
+    if (cmd->digests.count > dig.left)  goto error;
+
+    // Keys under a tx account are never used for a digest
+    for (i = 0; i < cmd->digests.count; i++)
+    {
+        item = &cmd->digests.item[i];
+
+        if (0 == item->depth || item->depth > WALLET_PATH_DEPTH_MAX)  goto error;
+        if (item->index[0] < DIGEST_PATH_MIN)                         goto error;
+    }
+
+    if (cp_state() != CP_IDLE)
+    {
+        small_resp(CMD_ACK_BUSY);
+        return;
+    }
+
+    digests_wipe();
+
+    for (i = 0; i < cmd->digests.count; i++)
+    {
+        item = &cmd->digests.item[i];
+
+        dig.path[i].depth = item->depth;
+        memcpy(dig.path[i].index, item->index, item->depth * sizeof(uint32_t));
+        memcpy(&dig.hash[i * DIGEST_BYTES], item->hash, DIGEST_BYTES);
+    }
+
+    dig.count  = cmd->digests.count;
+    dig.left  -= cmd->digests.count;
+    dig.group  = GROUP_SIGNING;
+
+    cp_set_cmd(CP_CMD_DIGESTS);
+    small_resp(CMD_ACK_BUSY);
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+//
+// The signed group: ack, count and digests left, then each signature after
+// its length. Pieces are made as the window over them needs them, a NULL
+// dest only sizes the whole response.
+//
+static unsigned digests_gen(uint8_t *dest, const unsigned offset, const unsigned bytes)
+{
+    uint8_t        piece[1 + ECDSA_SIG_BYTES_MAX];
+    const unsigned count = (GROUP_SIGNED == dig.group) ? dig.count : 0;
+    unsigned       pos = 0, n, i, from, to;
+
+    for (i = 0; i <= count; i++)
+    {
+        if (0 == i)
+        {
+            piece[0] = CMD_ACK_SUCCESS;
+            piece[1] = count;
+            piece[2] = dig.left;
+            piece[3] = dig.left >> 8;
+            n        = DIGESTS_RESP_BYTES;
+        }
+        else if (dig.compact)
+        {
+            piece[0] = 2 * KEY_BYTES;
+            memcpy(&piece[1], &dig.rs[2 * (i - 1) * KEY_BYTES], 2 * KEY_BYTES);
+            n        = 1 + piece[0];
+        }
+        else
+        {
+            crypto_ecdsa_der(&dig.rs[2 * (i - 1) * KEY_BYTES], &piece[1], &piece[0]);
+            n        = 1 + piece[0];
+        }
+
+        from = max(pos, offset);
+        to   = min(pos + n, offset + bytes);
+
+        if (dest && from < to)  memcpy(&dest[from - offset], &piece[from - pos], to - from);
+
+        pos += n;
+    }
+
+    return dest ? bytes : pos;
+}
+
 static void get_public_key(const cmd_t *cmd, const unsigned total_bytes)
 {
     // Parameter checking
@@ -1338,6 +2410,42 @@ error:
     small_resp(CMD_ACK_INVALID);
 }
 
+static void get_public_key_path(const cmd_t *cmd, const unsigned total_bytes)
+{
+    wallet_path_t path;
+    unsigned      i;
+
+    // Parameter checking
+    if (cmd->cmd != CMD_GET_PUBLIC_KEY_PATH)                       goto error;
+    if (total_bytes < GET_PUBLIC_KEY_PATH_BYTES(1))                goto error;
+    if (cmd->pkpath.depth > WALLET_PATH_DEPTH_MAX)                 goto error;
+    if (total_bytes != GET_PUBLIC_KEY_PATH_BYTES(cmd->pkpath.depth)) goto error;
+
+    path.depth = cmd->pkpath.depth;
+
+    for (i = 0; i < path.depth; i++)
+    {
+        path.index[i] = cmd->pkpath.index[i];
+    }
+
+    // The master key is refused, chain codes only come with account and chain keys
+    if (!wallet_path_public_key_export(&path,
+                                       cmdi.resp->pk.pubkey_x,
+                                       cmdi.resp->pk.pubkey_y,
+                                       cmdi.resp->pk.chaincode))
+    {
+        goto error;
+    }
+
+    cmdi.resp->cmd = CMD_ACK_SUCCESS;
+    cmdi.respBytes = GET_PUBLIC_KEY_RESP_BYTES;
+
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
 static void set_master_seed(const cmd_t *cmd, const unsigned total_bytes)
 {
     // Parameter checking
@@ -1353,3 +2461,50 @@ static void set_master_seed(const cmd_t *cmd, const unsigned total_bytes)
 error:
     small_resp(CMD_ACK_INVALID);
 }
+
+static void stats(const cmd_t *cmd, const unsigned total_bytes)
+{
+    wallet_pool_stats_t pool;
+
+    // Parameter checking
+    if (cmd->cmd != CMD_VAL_STATS)  goto error;
+    if (total_bytes != SMALL_BYTES) goto error;
+
+    wallet_pool_stats(&pool);
+
+    memcpy(cmdi.resp->stats.pool_depth, pool.depth, sizeof(pool.depth));
+    cmdi.resp->stats.pool_hits   = pool.hits;
+    cmdi.resp->stats.pool_misses = pool.misses;
+    cmdi.resp->stats.utxo_hits   = utxo.hits;
+    cmdi.resp->stats.utxo_misses = utxo.misses;
+
+    cmdi.resp->stats.sign_slice_max = job.sliceMax;
+
+    // The arena is as large as its largest family
+    cmdi.resp->stats.arena_bytes   = sizeof(cmdArena_t);
+    cmdi.resp->stats.arena_sign    = sizeof(signPhase_t);
+    cmdi.resp->stats.arena_fwdl    = sizeof(fwdl_info_t);
+    cmdi.resp->stats.arena_digests = sizeof(digestRun_t);
+    cmdi.resp->stats.arena_phase   = phase;
+
+    cmdi.resp->cmd = CMD_ACK_SUCCESS;
+    cmdi.respBytes = STATS_RESP_BYTES;
+
+    return;
+
+error:
+    small_resp(CMD_ACK_INVALID);
+}
+
+#if !HW_CC2538
+cmd_ctx_t* cmd_ctx_create(void)
+{
+    return calloc(1, sizeof(cmd_ctx_t));
+}
+
+void cmd_ctx_destroy(cmd_ctx_t *ctx)
+{
+    memset(ctx, 0, sizeof(cmd_ctx_t));
+    free(ctx);
+}
+#endif
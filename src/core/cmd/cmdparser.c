@@ -4,6 +4,11 @@
 #include <cmd.h>
 #include <util.h>
 #include <screen.h>
+#include <ctx.h>
+
+#if !HW_CC2538
+#include <stdlib.h>
+#endif
 
 // Defines
 
@@ -22,6 +27,14 @@
 #define CLEAR_OUT_PACKET    memset(outpacket,  0, PACKET_BYTES)
 #define CLEAR_IN_PACKET     memset(inpacket, 0, PACKET_BYTES)
 
+// The queue indices are the only thing shared with the interrupt side, the
+// packet contents must land before the index that publishes them
+#if HW_CC2538
+#define QUEUE_BARRIER()     __asm(" dmb")
+#else
+#define QUEUE_BARRIER()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
 #define SEND_CHUNK_THRESHOLD  PACKET_BYTES
 
 // Types
@@ -37,28 +50,313 @@ typedef struct
 
     // Outbound
     cmdResp_t   outcmd;
+    resp_gen_f  outGen;         // Generates the response in place of outcmd when set
     int         outBytesTotal;
     int         outBytesLeft;
     int         outRespPos;
     resp_e      outPending;
 } parseInfo_t;
 
+//
+// Single producer, single consumer packet queue. The producer only writes
+// head and the consumer only writes tail, both run free and wrap on their
+// own, so no locking is needed between an interrupt and the main loop. On
+// the interrupt side that holds because only the owning transport touches
+// the queues, see core_claim.
+//
+typedef struct
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint8_t           packet[PACKET_QUEUE_DEPTH][PACKET_BYTES];
+} packetQueue_t;
+
+//
+// CMD_STATUS is answered on the interrupt side. The main loop publishes into
+// the snapshot that is not active and then flips, so an interrupt always
+// reads a whole one without waiting on the main loop. The reply goes out
+// ahead of the queue, at the next boundary between responses.
+//
+typedef struct
+{
+    statusResp_t      snap[2];
+    volatile uint8_t  active;
+
+    uint8_t           packet[PACKET_BYTES];
+    volatile bool     ready;       // Reply waiting, set on the rx side and cleared once sent
+    bool              handedOut;   // The transport was given the reply instead of the queue
+    int               txLeft;      // Bytes still to go of the response going out
+} statusInfo_t;
+
+//
+// Transport the queues belong to. It keeps them while a packet is part way
+// into a slot or the core is busy, so a command and its response stay on it.
+//
+typedef struct
+{
+    const void * volatile port;   // NULL until the first claim or after a release
+    volatile bool         held;   // Claimed a slot that has not been pushed yet
+} ownerInfo_t;
+
 // Prototypes
-static void reset_incmd (void);
-static void fill_incmd  (uint8_t* src, int bytes);
+static void     reset_incmd     (void);
+static void     fill_incmd      (uint8_t* src, int bytes);
+static void     parse_inpacket  (uint8_t *inpacket);
+static void     build_outpacket (uint8_t *outpacket);
+static void     out_bytes       (uint8_t *dest, unsigned bytes);
+
+static uint8_t* queue_slot      (packetQueue_t *q);
+static void     queue_push      (packetQueue_t *q);
+static uint8_t* queue_peek      (packetQueue_t *q);
+static void     queue_pop       (packetQueue_t *q);
+
+static int      packet_length   (const uint8_t *packet);
+static bool     status_request  (const uint8_t *packet);
+static void     status_reply    (void);
+static bool     status_due      (void);
+static void     out_done        (void);
+
+struct parser_ctx
+{
+    parseInfo_t   info;
+    packetQueue_t rxq;   // Interrupt -> main loop
+    packetQueue_t txq;   // Main loop -> interrupt
+    statusInfo_t  status;
+    ownerInfo_t   owner;
+};
 
 // Globals
-parseInfo_t     pi;
-static uint8_t  outpacket[PACKET_BYTES];
+#if HW_CC2538
+parser_ctx_t parser_fw_ctx;
+#endif
+
+// Per-context parser state, see ctx.h
+#define pi         (polly_ctx()->parser->info)
+#define rxq        (polly_ctx()->parser->rxq)
+#define txq        (polly_ctx()->parser->txq)
+#define qs         (polly_ctx()->parser->status)
+#define qo         (polly_ctx()->parser->owner)
 
 
 void cmdparser_init(void)
 {
 	memset(&pi, 0x00, sizeof(pi));
+	memset(&qs, 0x00, sizeof(qs));
+	memset(&qo, 0x00, sizeof(qo));
+}
+
+
+bool cmdparser_busy(void)
+{
+    // A command is partially received or a response is still going out
+    return (pi.inBytesLeft > 0) || (pi.outPending != RESP_NONE) ||
+           (rxq.head != rxq.tail) || (txq.head != txq.tail) || qs.ready;
+}
+
+void cmdparser_status_publish(const statusResp_t *status)
+{
+    uint8_t next = !qs.active;
+
+    memcpy(&qs.snap[next], status, sizeof(statusResp_t));
+
+    QUEUE_BARRIER();
+    qs.active = next;
+}
+
+void cmdparser_status_read(statusResp_t *status)
+{
+    memcpy(status, &qs.snap[qs.active], sizeof(statusResp_t));
+
+    status->rx_queued = rxq.head - rxq.tail;
+    status->tx_queued = txq.head - txq.tail;
+}
+
+
+static uint8_t* queue_slot(packetQueue_t *q)
+{
+    if (q->head - q->tail == PACKET_QUEUE_DEPTH)  return NULL;
+
+    return q->packet[q->head % PACKET_QUEUE_DEPTH];
 }
 
+static void queue_push(packetQueue_t *q)
+{
+    QUEUE_BARRIER();
+    q->head++;
+}
+
+static uint8_t* queue_peek(packetQueue_t *q)
+{
+    if (q->head == q->tail)  return NULL;
+
+    QUEUE_BARRIER();
+    return q->packet[q->tail % PACKET_QUEUE_DEPTH];
+}
+
+static void queue_pop(packetQueue_t *q)
+{
+    QUEUE_BARRIER();
+    q->tail++;
+}
+
+
+//
+// Interrupt side, the transports only move packets in and out of the queues
+//
+
+uint8_t* core_inpacket_slot(void)
+{
+    return queue_slot(&rxq);
+}
+
+bool core_claim(const void *port)
+{
+    if (!core_claimable(port))  return false;
+
+    qo.port = port;
+    qo.held = true;
+    return true;
+}
+
+bool core_claimable(const void *port)
+{
+    // Another transport only gets the queues once nothing of the owner's is left in them
+    return (qo.port == port) || (NULL == qo.port) || (!qo.held && !cmdparser_busy());
+}
+
+bool core_owner(const void *port)
+{
+    return qo.port == port;
+}
+
+void core_release(const void *port)
+{
+    if (qo.port != port)  return;
+
+    qo.port = NULL;
+    qo.held = false;
+}
+
+void core_inpacket_push(void)
+{
+    uint8_t *packet = rxq.packet[rxq.head % PACKET_QUEUE_DEPTH];
+
+    qo.held = false;
+
+    // Status requests never reach the main loop, unless the last reply is still waiting
+    if (status_request(packet) && !qs.ready)
+    {
+        status_reply();
+        memset(packet, 0, PACKET_BYTES);
+        return;
+    }
+
+    queue_push(&rxq);
+}
+
+bool core_outpacket_ready(void)
+{
+    return status_due() || (txq.head != txq.tail);
+}
+
+uint8_t* core_outpacket(void)
+{
+    qs.handedOut = status_due();
+
+    if (qs.handedOut)  return qs.packet;
+
+    return queue_peek(&txq);
+}
 
-bool core_inpacket(uint8_t *inpacket)
+void core_outpacket_pop(void)
+{
+    uint8_t *packet;
+
+    if (qs.handedOut)
+    {
+        qs.handedOut = false;
+        qs.ready     = false;
+        return;
+    }
+
+    // Follow the response framing to know where the next boundary is
+    packet = queue_peek(&txq);
+
+    if (packet[POS_CTRL] == CTRL_START)  qs.txLeft  = packet_length(packet) - (PACKET_BYTES - START_HEADER_BYTES);
+    else                                 qs.txLeft -= PACKET_BYTES - CONT_HEADER_BYTES;
+
+    queue_pop(&txq);
+}
+
+
+static int packet_length(const uint8_t *packet)
+{
+    return packet[POS_BYTES] +
+           (packet[POS_BYTES + 1] << 8) +
+           (packet[POS_BYTES + 2] << 16) +
+           (packet[POS_BYTES + 3] << 24);
+}
+
+static bool status_request(const uint8_t *packet)
+{
+    return (packet[POS_CTRL] == CTRL_START) &&
+           (packet_length(packet) == SMALL_BYTES) &&
+           (packet[START_HEADER_BYTES] == CMD_STATUS);
+}
+
+static void status_reply(void)
+{
+    uint8_t *packet = qs.packet;
+
+    memset(packet, 0, PACKET_BYTES);
+
+    packet[POS_CTRL]           = CTRL_START;
+    packet[POS_BYTES]          = STATUS_RESP_BYTES;
+    packet[START_HEADER_BYTES] = CMD_ACK_STATUS;
+
+    cmdparser_status_read((statusResp_t *) &packet[START_HEADER_BYTES + 1]);
+
+    QUEUE_BARRIER();
+    qs.ready = true;
+}
+
+static bool status_due(void)
+{
+    // Never in the middle of a multi packet response
+    return qs.ready && (qs.txLeft <= 0);
+}
+
+
+//
+// Main loop side
+//
+
+void core_poll(void)
+{
+    uint8_t *packet;
+
+    for (;;)
+    {
+        // Queue up as much of the pending response as fits
+        while ((pi.outPending != RESP_NONE) && (NULL != (packet = queue_slot(&txq))))
+        {
+            build_outpacket(packet);
+            queue_push(&txq);
+
+            if (pi.outBytesLeft <= 0)  out_done();
+        }
+
+        // Hold further commands until the whole response is queued
+        if (pi.outPending != RESP_NONE)              break;
+        if (NULL == (packet = queue_peek(&rxq)))     break;
+
+        parse_inpacket(packet);
+        queue_pop(&rxq);
+    }
+}
+
+
+static void parse_inpacket(uint8_t *inpacket)
 {
     int inbytes;
     int ctrl = inpacket[POS_CTRL];
@@ -72,13 +370,13 @@ bool core_inpacket(uint8_t *inpacket)
             case CTRL_START_STREAM:
                 screen_rx(LIGHT_ON);
 
-                pi.inBytesTotal = inpacket[POS_BYTES] +
-                                  (inpacket[POS_BYTES + 1] << 8) +
-                                  (inpacket[POS_BYTES + 2] << 16) +
-                                  (inpacket[POS_BYTES + 3] << 24);
+                pi.inBytesTotal = packet_length(inpacket);
                 pi.inBytesLeft  = pi.inBytesTotal;
                 pi.inBytePos    = 0;
 
+                // Negative lengths and streams past the advertised limit
+                if (pi.inBytesTotal < 0 || pi.inBytesTotal > STREAM_MAX_BYTES)  goto error;
+
                 // Figure out how many bytes to copy
                 inbytes = min(pi.inBytesLeft, PACKET_BYTES - START_HEADER_BYTES);
 
@@ -119,8 +417,6 @@ bool core_inpacket(uint8_t *inpacket)
     {
         screen_rx(LIGHT_OFF);
     }
-
-    return false;
 }
 
 
@@ -147,59 +443,70 @@ void fill_incmd(uint8_t* src, int bytes)
     bool start;
     uint8_t *in = (uint8_t *) &pi.incmd;
 
-    if (bytes + pi.inBytePos > (int)sizeof(cmd_t))
+    if (pi.inBytesLeft - bytes < 0)
     {
-        // Overflowing buffer, do not copy and reset command state
+        // Byte count mismatch, do not copy and reset command state
         reset_incmd();
     }
-    else if (pi.inBytesLeft - bytes < 0)
+    else if (pi.inStreaming)
     {
-        // Byte count mismatch, do not copy and reset command state
+        //
+        // Streamed commands get the payload straight out of the packet, the
+        // handlers carry their own state for fields split across packets.
+        //
+        start = pi.inBytesLeft == pi.inBytesTotal;
+
+        pi.inBytesLeft -= bytes;
+
+        pi.outPending = cmd_handler((const cmd_t *) src, bytes, pi.inBytesTotal, pi.inStreaming, start, &pi.outcmd, &pi.outBytesTotal, &pi.outGen);
+    }
+    else if (bytes + pi.inBytePos > (int)sizeof(cmd_t))
+    {
+        // Overflowing buffer, do not copy and reset command state
         reset_incmd();
     }
     else
     {
-        // Everything checks out, copy over
+        // Regular commands are put back together in incmd before invoking
+        // the command handler
         memcpy(&in[pi.inBytePos], src, bytes);
 
         start = pi.inBytesLeft == pi.inBytesTotal;
 
         pi.inBytesLeft -= bytes;
 
-        if (pi.inStreaming)
+        if (pi.inBytesLeft == 0)
         {
-            pi.outPending = cmd_handler(&pi.incmd, bytes, pi.inBytesTotal, pi.inStreaming, start, &pi.outcmd, &pi.outBytesTotal);
+            // Everything is collected, call the command handler - we always expect a response
+            pi.outPending = cmd_handler(&pi.incmd, pi.inBytesTotal, pi.inBytesTotal, pi.inStreaming, start, &pi.outcmd, &pi.outBytesTotal, &pi.outGen);
         }
         else
         {
-            // Regular commands wait to collect everything before invoking
-            // the command handler.
-            if (pi.inBytesLeft == 0)
-            {
-                // Everything is collected, call the command handler - we always expect a response
-                pi.outPending = cmd_handler(&pi.incmd, pi.inBytesTotal, pi.inBytesTotal, pi.inStreaming, start, &pi.outcmd, &pi.outBytesTotal);
-            }
-            else
-            {
-                assert(pi.inBytesLeft > 0);
-                pi.inBytePos += bytes;
-            }
+            assert(pi.inBytesLeft > 0);
+            pi.inBytePos += bytes;
         }
     }
 }
 
 
-bool core_outpacket_ready(void)
+static void out_bytes(uint8_t *dest, unsigned bytes)
 {
-    return pi.outPending != RESP_NONE;
-}
+    uint8_t *outbytes = (uint8_t *)&pi.outcmd;
+    unsigned n;
 
+    if (NULL == pi.outGen)
+    {
+        memcpy(dest, &outbytes[pi.outRespPos], bytes);
+        return;
+    }
 
-uint8_t* core_outpacket(void)
+    n = pi.outGen(dest, pi.outRespPos, bytes);
+    assert(n == bytes);
+}
+
+static void build_outpacket(uint8_t *outpacket)
 {
-    uint8_t *outbytes = (uint8_t *)&pi.outcmd;
-    uint8_t *ret      = NULL;
-    int      bytes    = 0;
+    int bytes = 0;
 
     CLEAR_OUT_PACKET;
 
@@ -219,12 +526,10 @@ uint8_t* core_outpacket(void)
 
     	bytes = min(pi.outBytesLeft, PACKET_BYTES - START_HEADER_BYTES);
 
-    	memcpy(&outpacket[START_HEADER_BYTES], &outbytes[pi.outRespPos], bytes);
+    	out_bytes(&outpacket[START_HEADER_BYTES], bytes);
 
     	pi.outBytesLeft -= bytes;
     	pi.outRespPos   += bytes;
-
-    	ret = outpacket;
     }
     else if (RESP_CONT == pi.outPending)
     {
@@ -232,23 +537,36 @@ uint8_t* core_outpacket(void)
 
         bytes = min(pi.outBytesLeft, PACKET_BYTES - CONT_HEADER_BYTES);
 
-        memcpy(&outpacket[CONT_HEADER_BYTES], &outbytes[pi.outRespPos], bytes);
+        out_bytes(&outpacket[CONT_HEADER_BYTES], bytes);
 
         pi.outBytesLeft -= bytes;
         pi.outRespPos   += bytes;
-
-        ret = outpacket;
     }
 
     if (pi.outBytesLeft > 0)
     {
     	pi.outPending = RESP_CONT;
     }
-    else
-    {
-        screen_tx(LIGHT_OFF);
-    	pi.outPending = RESP_NONE;
-    }
+}
+
+static void out_done(void)
+{
+    // Only once the last packet is pushed, a transport must never see the core
+    // idle with part of the response still outside the queue
+    screen_tx(LIGHT_OFF);
+    pi.outPending = RESP_NONE;
+    pi.outGen     = NULL;
+}
 
-    return ret;
+#if !HW_CC2538
+parser_ctx_t* parser_ctx_create(void)
+{
+    return calloc(1, sizeof(parser_ctx_t));
+}
+
+void parser_ctx_destroy(parser_ctx_t *ctx)
+{
+    memset(ctx, 0, sizeof(parser_ctx_t));
+    free(ctx);
 }
+#endif
@@ -0,0 +1,357 @@
+#include <string.h>
+#include <assert.h>
+#include <util.h>
+#include <prevtx.h>
+
+#define HASH_BLOCK_BYTES  64u
+
+typedef enum
+{
+    PTX_CMD,
+    PTX_HEADER_COUNT,
+    PTX_HEADER,
+    PTX_VERSION,
+    PTX_IN_COUNT,
+    PTX_IN_PREV_HASH,
+    PTX_IN_PREV_INDEX,
+    PTX_IN_SCRIPT_LEN,
+    PTX_IN_SCRIPT,
+    PTX_IN_SEQUENCE,
+    PTX_OUT_COUNT,
+    PTX_OUT_VALUE,
+    PTX_OUT_SCRIPT_LEN,
+    PTX_OUT_SCRIPT,
+    PTX_LOCK_TIME,
+    PTX_DONE,
+} prevTxField_e;
+
+typedef struct
+{
+    uint8_t bytes;   // Fixed size, 0 when it comes from an earlier field
+    bool    varint;  // Size comes from the first byte instead
+    bool    hashed;  // Part of the tx proper
+} fieldInfo_t;
+
+//
+// Where each field goes is decided by field_dest, what follows it by
+// field_done. Everything else about a field is in this table.
+//
+static const fieldInfo_t FIELDS[PTX_DONE] =
+{
+/* PTX_CMD            */ { 1,  false, false },
+/* PTX_HEADER_COUNT   */ { 1,  false, false },
+/* PTX_HEADER         */ { 0,  false, false },
+/* PTX_VERSION        */ { 4,  false, true  },
+/* PTX_IN_COUNT       */ { 0,  true,  true  },
+/* PTX_IN_PREV_HASH   */ { 32, false, true  },
+/* PTX_IN_PREV_INDEX  */ { 4,  false, true  },
+/* PTX_IN_SCRIPT_LEN  */ { 0,  true,  true  },
+/* PTX_IN_SCRIPT      */ { 0,  false, true  },
+/* PTX_IN_SEQUENCE    */ { 4,  false, true  },
+/* PTX_OUT_COUNT      */ { 0,  true,  true  },
+/* PTX_OUT_VALUE      */ { 8,  false, true  },
+/* PTX_OUT_SCRIPT_LEN */ { 0,  true,  true  },
+/* PTX_OUT_SCRIPT     */ { 0,  false, true  },
+/* PTX_LOCK_TIME      */ { 4,  false, true  },
+};
+
+static unsigned  varint_bytes (const uint8_t first);
+static uint64_t  varint_value (const prevtx_t *p);
+static int       output_find  (const prevtx_t *p, const uint64_t outputIdx);
+static uint32_t  field_size   (const prevtx_t *p, const uint8_t first);
+static uint8_t*  field_dest   (prevtx_t *p);
+static bool      field_done   (prevtx_t *p);
+static void      hash_input   (prevtx_t *p, const uint8_t *d, unsigned bytes);
+static void      hash_result  (prevtx_t *p);
+
+
+void prevtx_reset(prevtx_t *p, sha256ctx_t *hashCtx, prevtx_save_f save)
+{
+    memset(p, 0, sizeof(prevtx_t));
+
+    p->field      = PTX_CMD;
+    p->outputSave = -1;
+    p->save       = save;
+    p->hashCtx    = hashCtx;
+
+    crypto_sha256_reset(p->hashCtx);
+}
+
+bool prevtx_idle(const prevtx_t *p)
+{
+    return (p->field == PTX_CMD) && (p->fieldByte == 0);
+}
+
+prevtx_status_e prevtx_input(prevtx_t *p, const uint8_t *d, const unsigned bytes, unsigned *ateBytes)
+{
+    unsigned  pos      = 0;
+    unsigned  hashFrom = bytes;
+    unsigned  n;
+    uint8_t  *dest;
+
+    *ateBytes = 0;
+
+    if (p->field == PTX_DONE)  return PREVTX_ERROR;
+
+    while (pos < bytes)
+    {
+        if (hashFrom == bytes && FIELDS[p->field].hashed)  hashFrom = pos;
+
+        if (0 == p->fieldByte)
+        {
+            p->fieldBytes = field_size(p, d[pos]);
+        }
+
+        // Whole field when it is all here, whatever there is otherwise
+        n = min(bytes - pos, p->fieldBytes - p->fieldByte);
+
+        if (NULL != (dest = field_dest(p)))
+        {
+            memcpy(&dest[p->fieldByte], &d[pos], n);
+        }
+
+        pos          += n;
+        p->fieldByte += n;
+
+        if (p->fieldByte == p->fieldBytes)
+        {
+            p->fieldByte = 0;
+
+            if (!field_done(p))  return PREVTX_ERROR;
+
+            if (p->field == PTX_DONE)  break;
+        }
+    }
+
+    if (hashFrom < pos)
+    {
+        hash_input(p, &d[hashFrom], pos - hashFrom);
+    }
+
+    *ateBytes = pos;
+
+    if (p->field == PTX_DONE)
+    {
+        hash_result(p);
+        return PREVTX_DONE;
+    }
+
+    return PREVTX_MORE;
+}
+
+
+static unsigned varint_bytes(const uint8_t first)
+{
+    if      (first <  0xFD)  return 1;
+    else if (first == 0xFD)  return 3;
+    else if (first == 0xFE)  return 5;
+    else                     return 9;
+}
+
+static uint64_t varint_value(const prevtx_t *p)
+{
+    uint64_t value = 0;
+    unsigned i;
+
+    if (1 == p->fieldBytes)  return p->varint[0];
+
+    for (i = p->fieldBytes - 1; i >= 1; i--)
+    {
+        value = (value << 8) | p->varint[i];
+    }
+
+    return value;
+}
+
+static int output_find(const prevtx_t *p, const uint64_t outputIdx)
+{
+    unsigned i;
+
+    for (i = 0; i < p->headerEntries; i++)
+    {
+        if (p->header[i].outputIdx == outputIdx)  return i;
+    }
+
+    return -1;
+}
+
+static uint32_t field_size(const prevtx_t *p, const uint8_t first)
+{
+    if (FIELDS[p->field].varint)  return varint_bytes(first);
+
+    switch (p->field)
+    {
+        case PTX_HEADER:      return p->headerEntries * sizeof(prevTxHeader_t);
+        case PTX_IN_SCRIPT:
+        case PTX_OUT_SCRIPT:  return p->count;
+        default:              return FIELDS[p->field].bytes;
+    }
+}
+
+static uint8_t* field_dest(prevtx_t *p)
+{
+    if (FIELDS[p->field].varint)  return p->varint;
+
+    switch (p->field)
+    {
+        case PTX_CMD:           return &p->cmd;
+        case PTX_HEADER_COUNT:  return &p->headerEntries;
+        case PTX_HEADER:        return (uint8_t *) p->header;
+        case PTX_OUT_VALUE:     return (uint8_t *) &p->value;
+        case PTX_OUT_SCRIPT:    return p->outputSave >= 0 ? p->script : NULL;
+        default:                return NULL;  // Only hashed
+    }
+}
+
+static bool field_done(prevtx_t *p)
+{
+    uint64_t value = 0;
+
+    if (FIELDS[p->field].varint)  value = varint_value(p);
+
+    switch (p->field)
+    {
+        case PTX_CMD:
+            if (p->cmd != CMD_PREV_TX)  return false;
+            p->field = PTX_HEADER_COUNT;
+            break;
+
+        case PTX_HEADER_COUNT:
+            if (0 == p->headerEntries || p->headerEntries > MAX_INPUTS)  return false;
+            p->field = PTX_HEADER;
+            break;
+
+        case PTX_HEADER:
+            p->field = PTX_VERSION;
+            break;
+
+        case PTX_VERSION:
+            p->field = PTX_IN_COUNT;
+            break;
+
+        case PTX_IN_COUNT:
+            if (0 == value)  return false;
+            p->inputsLeft = value;
+            p->field      = PTX_IN_PREV_HASH;
+            break;
+
+        case PTX_IN_PREV_HASH:
+            p->field = PTX_IN_PREV_INDEX;
+            break;
+
+        case PTX_IN_PREV_INDEX:
+            p->field = PTX_IN_SCRIPT_LEN;
+            break;
+
+        case PTX_IN_SCRIPT_LEN:
+            if (value > PREVTX_SCRIPT_MAX_BYTES)  return false;
+            p->count = value;
+            p->field = PTX_IN_SCRIPT;
+            break;
+
+        case PTX_IN_SCRIPT:
+            p->field = PTX_IN_SEQUENCE;
+            break;
+
+        case PTX_IN_SEQUENCE:
+            p->inputsLeft--;
+            p->field = p->inputsLeft > 0 ? PTX_IN_PREV_HASH : PTX_OUT_COUNT;
+            break;
+
+        case PTX_OUT_COUNT:
+            p->outputsTotal = value;
+            p->outputIndex  = 0;
+            p->outputSave   = output_find(p, p->outputIndex);
+            p->field        = value > 0 ? PTX_OUT_VALUE : PTX_LOCK_TIME;
+            break;
+
+        case PTX_OUT_VALUE:
+            p->field = PTX_OUT_SCRIPT_LEN;
+            break;
+
+        case PTX_OUT_SCRIPT_LEN:
+            if (value > PREVTX_SCRIPT_MAX_BYTES)                       return false;
+            if (p->outputSave >= 0 && value != PK_SCRIPT_BYTES)        return false;
+            p->count = value;
+            p->field = PTX_OUT_SCRIPT;
+            break;
+
+        case PTX_OUT_SCRIPT:
+            if (p->outputSave >= 0)
+            {
+                if (!p->save(p->header[p->outputSave].inputIdx, p->outputIndex, p->value, p->script, p->count))  return false;
+
+                p->found |= 1UL << p->outputSave;
+            }
+
+            p->outputIndex++;
+
+            if (p->outputIndex == p->outputsTotal)
+            {
+                p->field = PTX_LOCK_TIME;
+            }
+            else
+            {
+                p->outputSave = output_find(p, p->outputIndex);
+                p->field      = PTX_OUT_VALUE;
+            }
+            break;
+
+        case PTX_LOCK_TIME:
+            p->field = PTX_DONE;
+            break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+static void hash_input(prevtx_t *p, const uint8_t *d, unsigned bytes)
+{
+    unsigned n;
+
+    // Top up a partial block first
+    if (p->blockBytes > 0)
+    {
+        n = min(bytes, HASH_BLOCK_BYTES - p->blockBytes);
+
+        memcpy(&p->block[p->blockBytes], d, n);
+
+        p->blockBytes += n;
+        d             += n;
+        bytes         -= n;
+
+        if (p->blockBytes < HASH_BLOCK_BYTES)  return;
+
+        crypto_sha256_input(p->hashCtx, p->block, HASH_BLOCK_BYTES);
+        p->blockBytes = 0;
+    }
+
+    // Whole blocks go straight from the data, the tail waits for more
+    n = bytes - (bytes % HASH_BLOCK_BYTES);
+
+    if (n > 0)
+    {
+        crypto_sha256_input(p->hashCtx, d, n);
+    }
+
+    memcpy(p->block, &d[n], bytes - n);
+    p->blockBytes = bytes - n;
+}
+
+static void hash_result(prevtx_t *p)
+{
+    if (p->blockBytes > 0)
+    {
+        crypto_sha256_input(p->hashCtx, p->block, p->blockBytes);
+        p->blockBytes = 0;
+    }
+
+    // Tx hashes are double SHA256
+    crypto_sha256_result (p->hashCtx, p->hash);
+    crypto_sha256_reset  (p->hashCtx);
+    crypto_sha256_input  (p->hashCtx, p->hash, TX_HASH_BYTES);
+    crypto_sha256_result (p->hashCtx, p->hash);
+}
@@ -134,6 +134,15 @@ void core_ready(void)
     screen_idle();
 }
 
+bool core_idle(void)
+{
+    // Only use spare cycles while nothing is in flight
+    if (cs != STATE_READY)   return false;
+    if (cmdparser_busy())    return false;
+
+    return wallet_pool_fill();
+}
+
 void     core_gather_prevtx (void);
 void     core_ready_to_sign (void);
 bool     core_sign          (void);
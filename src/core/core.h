@@ -4,16 +4,41 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define PACKET_BYTES  64
+#define PACKET_BYTES        64
+#define PACKET_QUEUE_DEPTH  4   // Packets buffered each way, power of two
 
-// Transfer functions
+// Transfer functions, the transport interrupts only fill the inbound queue
+// (slot, then push once the packet is complete) and drain the outbound one
 
-void     core_init           (void);
-bool     core_unlocked       (void);
-bool     core_inpacket       (uint8_t *inpacket);
+uint8_t* core_inpacket_slot  (void);
+void     core_inpacket_push  (void);
 bool     core_outpacket_ready(void);
 uint8_t* core_outpacket      (void);
+void     core_outpacket_pop  (void);
+
+// The queues have one transport at a time, so each side stays a single
+// producer and consumer. A transport claims them before taking a slot and
+// only drains while it is the owner. The claim moves to another transport
+// once the core is idle and no packet is part way in. The transport
+// interrupts share one priority, so a claim and the slot after it are never
+// split by another one. Claims only happen there, the main loop can ask if
+// one would go through. Release drops the claim of a transport that went away.
+
+bool     core_claim          (const void *port);
+bool     core_claimable      (const void *port);
+bool     core_owner          (const void *port);
+void     core_release        (const void *port);
+
+// Main loop functions, core_poll only moves packets through the parser and
+// is safe to call while waiting on the user, as is core_background which
+// gets ahead on the signing the user is asked about
+
+void     core_init           (void);
+bool     core_unlocked       (void);
+void     core_poll           (void);
 void     core_process        (void);
+void     core_background     (void);
+bool     core_idle           (void);
 
 // State transition functions
 
@@ -0,0 +1,34 @@
+#include <ctx.h>
+#include <assert.h>
+#include <stddef.h>
+
+#if HW_CC2538
+
+extern struct wallet_ctx wallet_fw_ctx;
+extern struct cmd_ctx    cmd_fw_ctx;
+extern struct parser_ctx parser_fw_ctx;
+
+polly_ctx_t polly_fw_ctx = {
+    .wallet = &wallet_fw_ctx,
+    .cmd    = &cmd_fw_ctx,
+    .parser = &parser_fw_ctx,
+};
+
+#else
+
+// Each host thread works on its own context
+static __thread polly_ctx_t *current;
+
+polly_ctx_t* polly_ctx(void)
+{
+    assert(NULL != current);
+
+    return current;
+}
+
+void polly_ctx_set(polly_ctx_t *ctx)
+{
+    current = ctx;
+}
+
+#endif
@@ -7,11 +7,29 @@
 // Defines
 #define SMALL_BYTES               1
 #define GET_PUBLIC_KEY_BYTES      (1 + sizeof(getPublicKey_t))
+#define GET_PUBLIC_KEY_PATH_BYTES(depth) (1 + 1 + (4 * (depth)))
 #define SET_MASTER_SEED_MAX_BYTES (1 + sizeof(setMasterSeed_t))
 
 #define SMALL_RESP_BYTES          1
 #define ID_RESP_BYTES             (1 + sizeof(identifyResp_t))
 #define GET_PUBLIC_KEY_RESP_BYTES (1 + sizeof(getPublicKeyResp_t))
+#define STATS_RESP_BYTES          (1 + sizeof(statsResp_t))
+#define PREV_TX_CACHED_BYTES(count) (1 + 1 + (sizeof(prevTxClaim_t) * (count)))
+#define GET_SIGNED_TX_CONFIRM_BYTES (1 + sizeof(getSignedTx_t))
+#define GET_INPUT_SIG_BYTES       (1 + sizeof(getInputSig_t))
+#define SIGN_SESSION_BYTES        (1 + sizeof(signSession_t))
+#define PREV_TX_CACHED_RESP_BYTES (1 + sizeof(prevTxCachedResp_t))
+#define SIGN_PROGRESS_RESP_BYTES  (1 + sizeof(signProgressResp_t))
+#define SIGNED_TX_CONFIRM_RESP_BYTES (1 + sizeof(signedTxConfirmResp_t))
+#define INPUT_SIG_RESP_BYTES(sig_bytes) (1 + 1 + 1 + (sig_bytes))
+#define STATUS_RESP_BYTES         (1 + sizeof(statusResp_t))
+#define SIGN_TX_RESP_BYTES        (1 + sizeof(signTxResp_t))
+#define SIGN_SESSION_RESP_BYTES   (1 + sizeof(signSessionResp_t))
+#define SIGN_BATCH_BYTES          (1 + sizeof(signBatch_t))
+#define BATCH_PROGRESS_RESP_BYTES (1 + sizeof(batchProgressResp_t))
+#define SIGN_DIGESTS_BYTES        (1 + sizeof(signDigests_t))
+#define DIGESTS_BYTES(count)      (1 + 1 + (sizeof(digestItem_t) * (count)))
+#define DIGESTS_RESP_BYTES        (1 + sizeof(digestsResp_t))
 
 #define TX_HASH_BYTES             32
 #define HASH_ADDR_BYTES           20
@@ -30,6 +48,7 @@ typedef enum
     CMD_GET_SIGNED_TX   = 6,
     CMD_ENTROPY         = 7,
     CMD_FW_DOWNLOAD     = 8,
+    CMD_GET_PUBLIC_KEY_PATH = 9,
 
     // Audit commands
     CMD_AUDIT_MODE      = 10,
@@ -37,6 +56,7 @@ typedef enum
 
     // Validation commands
     CMD_VAL_MODE        = 20,
+    CMD_VAL_STATS       = 21,
 
     // Simple responses
     CMD_ACK_SUCCESS     = 32,
@@ -44,11 +64,31 @@ typedef enum
     CMD_ACK_DENIED      = 34,
     CMD_ACK_USER        = 35,
     CMD_ACK_BUSY        = 36,
+    CMD_ACK_MISS        = 37,
+    CMD_ACK_STATUS      = 38,   // Status reply, may come ahead of the response to an earlier command
+
+    // Public commands, continued
+    CMD_PREV_TX_CACHED  = 48,
+    CMD_SIGN_PROGRESS   = 49,
+    CMD_GET_INPUT_SIG   = 50,
+    CMD_STATUS          = 51,
+    CMD_SIGN_SESSION    = 52,
+    CMD_SIGN_BATCH      = 53,
+    CMD_BATCH_PROGRESS  = 54,
+    CMD_SIGN_DIGESTS    = 55,
+    CMD_DIGESTS         = 56,
 
 } cmd_e;
 
 #define MODEL_NAME_BYTES        16
 
+//
+// Reported by CMD_IDENTIFY so hosts can size their transfers. The protocol
+// version goes up whenever a command or response layout changes.
+//
+#define PROTOCOL_VERSION        5
+#define CMD_BITMAP_BYTES        8    // One bit per cmd_e value, bit (n % 8) of byte (n / 8)
+
 //
 // We need to set an arbitrary cap on the signed tx due to
 // memory constraints. This will constrain how many inputs
@@ -66,11 +106,11 @@ typedef enum
 // Input and output count can  be > 1B, but we're going to limit
 // counts to < 252 total.
 //
-// Now, outputs. To make it very clear to the user we're only
-// allowing a single output address so it can be displayed and
-// verified. One more output is allowed to gather back change
-// to an address within the wallet. This address can be one of
-// the inputs or a different address within the wallet. Sizes:
+// Now, outputs. Up to MAX_PAY_OUTPUTS addresses are paid, the
+// user pages through each of them before the total. One more
+// output is allowed to gather back change to an address within
+// the wallet. This address can be one of the inputs or a
+// different address within the wallet. Sizes:
 //
 //  satoshis          8
 //  pk_script length  1
@@ -97,12 +137,13 @@ typedef enum
 // Solve for this equation using our previous data to set the
 // cap on the transaction size:
 //
-// 10 + (34 * 2) + (148 * 32) = 4814 (round up to next dword)
+// 10 + (34 * 17) + (148 * 32) = 5324 (round up to next dword)
 //
 
 #define MAX_INPUTS           32
-#define MAX_OUTPUTS          2
-#define SIGNED_TX_MAX_BYTES  4816
+#define MAX_PAY_OUTPUTS      16
+#define MAX_OUTPUTS          (MAX_PAY_OUTPUTS + 1)
+#define SIGNED_TX_MAX_BYTES  5328
 
 #define PK_SCRIPT_BYTES      25
 #define ECDSA_SIG_BYTES_MAX  73
@@ -117,20 +158,37 @@ typedef enum
 //     input count   1
 //        input id   (1 + 1 + 4) * MAX_INPUTS
 //    input pub key  COMPRESS_KEY_BYTES * MAX_INPUTS
-//  output address   20
-// output satoshis   8
+//    output count   1
+//  output address   20 * MAX_PAY_OUTPUTS
+// output satoshis   8 * MAX_PAY_OUTPUTS
 //       change id   (1 + 1 + 4)
 // change satoshis   8
 // --------------------
+//
+// Each input and each output is one record, the handler takes them as they
+// come. A request with more outputs than the command buffer holds is sent
+// as a stream.
+//
 
-#define SIGN_TX_MAX_BYTES   (1 + 1 + ((1 + 1 + 4) * MAX_INPUTS) + (COMPRESS_KEY_BYTES * MAX_INPUTS) + 20 + 8 + (1 + 1 + 4) + 8)
-#define STREAM_CHUNK_BYTES  256  // Get prev tx streamed in 256 bytes at a time
+#define SIGN_TX_INPUT_BYTES     (1 + 1 + 4 + COMPRESS_KEY_BYTES)
+#define SIGN_TX_OUTPUT_BYTES    (HASH_ADDR_BYTES + 8)
+#define SIGN_TX_CHANGE_BYTES    (1 + 1 + 4 + 8)
+#define SIGN_TX_BYTES(inputs, outputs, change) \
+    (1 + 1 + (SIGN_TX_INPUT_BYTES * (inputs)) + 1 + (SIGN_TX_OUTPUT_BYTES * (outputs)) + ((change) ? SIGN_TX_CHANGE_BYTES : 0))
+#define SIGN_TX_MAX_BYTES       SIGN_TX_BYTES(MAX_INPUTS, MAX_PAY_OUTPUTS, 1)
+#define SIGN_TX_HELD_BYTES      SIGN_TX_BYTES(MAX_INPUTS, 1, 1)
+#define STREAM_CHUNK_BYTES  64            // Streamed commands are handed over a packet payload at a time
+#define STREAM_MAX_BYTES    (512 * 1024)  // Largest single streamed command, a whole prev tx or firmware image
 
 #pragma pack(1)
 
 typedef struct
 {
-    uint8_t model[MODEL_NAME_BYTES];
+    uint8_t  model[MODEL_NAME_BYTES];
+    uint8_t  protocol;                   // PROTOCOL_VERSION
+    uint32_t stream_max_bytes;           // Largest streamed command accepted
+    uint8_t  pipeline_depth;             // Packets the host may have in flight
+    uint8_t  cmds[CMD_BITMAP_BYTES];     // Supported commands
 } identifyResp_t;
 
 typedef struct
@@ -146,6 +204,17 @@ typedef struct
     uint32_t  address;
 } getPublicKey_t;
 
+//
+// Full derivation path, only depth index words are sent. The master key is
+// refused, and as with GET_PUBLIC_KEY the chain code is zero below the chain
+// level, the level under the last hardened one.
+//
+typedef struct
+{
+    uint8_t   depth;
+    uint32_t  index[WALLET_PATH_DEPTH_MAX];
+} getPublicKeyPath_t;
+
 typedef struct
 {
     uint8_t pubkey_x[KEY_BYTES];
@@ -153,16 +222,239 @@ typedef struct
     uint8_t chaincode[KEY_BYTES];
 } getPublicKeyResp_t;
 
+typedef struct
+{
+    uint8_t  pool_depth[WALLET_POOL_CHAINS];
+    uint32_t pool_hits;
+    uint32_t pool_misses;
+    uint32_t utxo_hits;
+    uint32_t utxo_misses;
+    uint32_t sign_slice_max;  // Longest signing step since boot, in CPU cycles
+    uint16_t arena_bytes;     // RAM the command families share, and what each takes of it
+    uint16_t arena_sign;
+    uint16_t arena_fwdl;
+    uint16_t arena_digests;
+    uint8_t  arena_phase;     // Family holding it, 0 none, 1 signing, 2 firmware download, 3 digests
+} statsResp_t;
+
+//
+// Where the signing started by GET_SIGNED_TX is. The status is the ack
+// GET_SIGNED_TX would give right now, or CMD_NONE if nothing was started.
+//
+typedef struct
+{
+    uint8_t  status;
+    uint8_t  inputs_signed;
+    uint8_t  inputs_total;
+} signProgressResp_t;
+
+//
+// Signatures can be read back input by input while the rest are still
+// being signed. A host that builds the tx itself then asks GET_SIGNED_TX
+// for a confirmation only, the txid of the tx the device signed, instead
+// of the whole tx.
+//
+#define SIGNED_TX_CONFIRM_ONLY  0x01
+
+typedef struct
+{
+    uint8_t  flags;
+} getSignedTx_t;
+
+typedef struct
+{
+    uint8_t  txid[TX_HASH_BYTES];  // Double SHA256 of the signed tx, hash output order
+} signedTxConfirmResp_t;
+
+typedef struct
+{
+    uint8_t  inputIdx;
+} getInputSig_t;
+
+//
+// Sent with CMD_ACK_SUCCESS once the input is signed, CMD_ACK_BUSY or
+// CMD_ACK_USER come back alone until then
+//
+typedef struct
+{
+    uint8_t  inputIdx;
+    uint8_t  sig_bytes;
+    uint8_t  sig[ECDSA_SIG_BYTES_MAX];  // DER plus the hash type byte, as it goes in the script
+} inputSigResp_t;
+
+//
+// CMD_STATUS is answered by the transport interrupt from a snapshot the
+// main loop keeps up to date, so it never waits behind a command or a
+// signing job. The reply is CMD_ACK_STATUS, and can go out ahead of the
+// response to a command sent before it, never in the middle of one.
+//
+#define STATUS_JOB_NONE  0
+#define STATUS_JOB_SIGN  1
+#define STATUS_JOB_BATCH 2
+#define STATUS_JOB_DIGESTS 3
+
+typedef struct
+{
+    uint8_t             unlocked;
+    uint8_t             cur_job;    // STATUS_JOB_*
+    signProgressResp_t  sign;
+    uint8_t             rx_queued;  // Packets waiting on the main loop
+    uint8_t             tx_queued;  // Response packets waiting on the transport
+} statusResp_t;
+
+//
+// SIGN_TX answers with a session id. A host that lost the link part way
+// through the prev txs asks SIGN_SESSION with it, and if the session is
+// still the current one it gets back which inputs have their prev output
+// verified and only sends PREV_TX for the rest. Any other id, or no
+// session, gets CMD_ACK_INVALID and the host starts over with SIGN_TX.
+//
+#define SIGN_SESSION_PREV_TX  0   // Waiting on prev txs
+#define SIGN_SESSION_READY    1   // All verified, GET_SIGNED_TX is next
+#define SIGN_SESSION_SIGNING  2   // GET_SIGNED_TX was sent, see SIGN_PROGRESS
+
+typedef struct
+{
+    uint32_t session;
+} signTxResp_t;
+
+typedef struct
+{
+    uint32_t session;
+} signSession_t;
+
+typedef struct
+{
+    uint32_t session;
+    uint8_t  stage;          // SIGN_SESSION_*
+    uint8_t  inputs_total;
+    uint32_t verified;       // Bit n for input n
+} signSessionResp_t;
+
+//
+// A batch asks the user once for a run of signing sessions. SIGN_BATCH
+// declares how many txs there will be, how many outputs they pay to others
+// and what they send and pay in fees all together, and is answered with
+// CMD_ACK_USER while the user looks at that. Once approved, each tx goes
+// through SIGN_TX, PREV_TX and GET_SIGNED_TX as usual but is signed without
+// a screen of its own, as long as it fits in what is left of the batch. A tx
+// that does not fit is denied and ends the batch. SIGN_BATCH with no txs
+// ends a batch early.
+//
+typedef struct
+{
+    uint8_t  txs;
+    uint16_t outputs;        // Not counting change
+    uint64_t satoshis;       // Sent, not counting change
+    uint64_t fee;
+} signBatch_t;
+
+//
+// The status is CMD_ACK_USER while the user decides, CMD_ACK_SUCCESS once
+// approved, CMD_ACK_DENIED if declined or ended by a tx that did not fit,
+// and CMD_NONE with no batch.
+//
+typedef struct
+{
+    uint8_t  status;
+    uint8_t  txs_signed;
+    uint8_t  txs_total;
+    uint16_t outputs_left;
+    uint64_t satoshis_left;
+    uint64_t fee_left;
+} batchProgressResp_t;
+
+//
+// Raw digests, attestations and the like, are signed in a run the user
+// approves once. SIGN_DIGESTS says how many there will be and is answered
+// with CMD_ACK_USER while the user looks at that. DIGESTS then hands over
+// up to DIGESTS_GROUP of them at a time, each with the path of its key, and
+// is answered with CMD_ACK_BUSY while they are signed. A DIGESTS with no
+// digests asks how the run stands: CMD_ACK_USER, CMD_ACK_BUSY,
+// CMD_ACK_DENIED, or CMD_ACK_SUCCESS with the signatures of the last group,
+// which can be asked for again until the next group goes in. SIGN_DIGESTS
+// with no digests ends a run early.
+//
+// The first level of a digest key path is hardened and at least
+// DIGEST_PATH_MIN, so a digest signature can never be an input signature
+// for a tx key (m/account'/chain/index with account up to 255).
+//
+#define DIGESTS_GROUP        8
+#define DIGEST_BYTES         32
+#define DIGEST_PATH_MIN      (HARDENED_KEY | 0x100)
+#define DIGEST_SIG_COMPACT   0x01   // r then s, 32 bytes each, instead of DER
+
+typedef struct
+{
+    uint16_t count;
+    uint8_t  flags;          // DIGEST_SIG_*
+} signDigests_t;
+
+typedef struct
+{
+    uint8_t  depth;
+    uint32_t index[WALLET_PATH_DEPTH_MAX];  // Only depth of them are used
+    uint8_t  hash[DIGEST_BYTES];
+} digestItem_t;
+
+typedef struct
+{
+    uint8_t       count;
+    digestItem_t  item[DIGESTS_GROUP];
+} digests_t;
+
+//
+// Followed by count signatures, each as a length byte then the signature
+//
+typedef struct
+{
+    uint8_t  count;
+    uint16_t left;           // Digests of the run still to come
+} digestsResp_t;
+
+//
+// Claims a prev output the device verified in an earlier PREV_TX, in place
+// of streaming the whole prev tx again. The txid is the double SHA256 of the
+// prev tx in hash output order.
+//
+typedef struct
+{
+    uint8_t  inputIdx;
+    uint8_t  txid[TX_HASH_BYTES];
+    uint32_t vout;
+} prevTxClaim_t;
+
+typedef struct
+{
+    uint8_t       count;
+    prevTxClaim_t claim[MAX_INPUTS];
+} prevTxCached_t;
+
+//
+// Sent back with CMD_ACK_MISS, these inputs still need a PREV_TX
+//
+typedef struct
+{
+    uint32_t missed;  // Bit n for input n
+} prevTxCachedResp_t;
+
 typedef struct
 {
     cmd_e cmd;
 
     union
     {
-        uint8_t         signtx[SIGN_TX_MAX_BYTES];
-        uint8_t         prevtx[STREAM_CHUNK_BYTES];
+        uint8_t         signtx[SIGN_TX_HELD_BYTES];
         getPublicKey_t  pk;
+        getPublicKeyPath_t pkpath;
         setMasterSeed_t seed;
+        prevTxCached_t  ptxc;
+        getSignedTx_t   gstx;
+        getInputSig_t   isig;
+        signSession_t   session;
+        signBatch_t     sbat;
+        signDigests_t   sdig;
+        digests_t       digests;
     };
 } cmd_t;
 
@@ -174,12 +466,27 @@ typedef struct
     {
         identifyResp_t     id;
         getPublicKeyResp_t pk;
-        uint8_t            signedtx[SIGNED_TX_MAX_BYTES];
+        statsResp_t        stats;
+        prevTxCachedResp_t ptxc;
+        signProgressResp_t progress;
+        signedTxConfirmResp_t confirm;
+        inputSigResp_t     isig;
+        statusResp_t       status;
+        signTxResp_t       signtx;
+        signSessionResp_t  session;
+        batchProgressResp_t bprog;
     };
 } cmdResp_t;
 
 #pragma pack()
 
+//
+// Responses too big to hold, the signed tx, are generated as they go out.
+// Writes bytes [offset, offset + bytes) of the response and returns how many
+// were written.
+//
+typedef unsigned (*resp_gen_f)(uint8_t *dest, const unsigned offset, const unsigned bytes);
+
 typedef enum
 {
 	RESP_NONE,
@@ -188,7 +495,7 @@ typedef enum
 } resp_e;
 
 // Functions
-resp_e cmd_handler       (const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes);
+resp_e cmd_handler       (const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes, resp_gen_f *resp_gen);
 bool   cmd_handler_quick (      cmd_t *cmd, const unsigned cmd_bytes, cmdResp_t *resp, unsigned *resp_bytes);
 
 
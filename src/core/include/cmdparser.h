@@ -1,6 +1,12 @@
 #ifndef CMDPARSER_H_
 #define CMDPARSER_H_
 
-void cmdparser_init(void);
+#include <stdbool.h>
+#include <cmd.h>
+
+void cmdparser_init           (void);
+bool cmdparser_busy           (void);
+void cmdparser_status_publish (const statusResp_t *status);
+void cmdparser_status_read    (statusResp_t *status);
 
 #endif
@@ -0,0 +1,47 @@
+#ifndef CTX_H_
+#define CTX_H_
+
+#include <crypto.h>
+
+//
+// Everything the core keeps between calls lives in a context, split per
+// module. The firmware has exactly one context built from statically placed
+// module state (the modules sit in different RAM banks, see the linker command
+// file). Host builds create module state on demand and bind a context to each
+// thread, so independent wallets and signing sessions can run side by side.
+//
+typedef struct wallet_ctx wallet_ctx_t;
+typedef struct cmd_ctx    cmd_ctx_t;
+typedef struct parser_ctx parser_ctx_t;
+
+typedef struct
+{
+    wallet_ctx_t *wallet;
+    cmd_ctx_t    *cmd;
+    parser_ctx_t *parser;
+} polly_ctx_t;
+
+#if HW_CC2538
+
+extern polly_ctx_t polly_fw_ctx;
+
+static inline polly_ctx_t* polly_ctx(void)
+{
+    return &polly_fw_ctx;
+}
+
+#else
+
+polly_ctx_t*  polly_ctx             (void);
+void          polly_ctx_set         (polly_ctx_t *ctx);
+
+wallet_ctx_t* wallet_ctx_create     (void);
+void          wallet_ctx_destroy    (wallet_ctx_t *ctx);
+cmd_ctx_t*    cmd_ctx_create        (void);
+void          cmd_ctx_destroy       (cmd_ctx_t *ctx);
+parser_ctx_t* parser_ctx_create     (void);
+void          parser_ctx_destroy    (parser_ctx_t *ctx);
+
+#endif
+
+#endif // CTX_H_
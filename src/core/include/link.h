@@ -0,0 +1,108 @@
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <core.h>
+
+//
+// Framed link for byte stream transports that can lose or corrupt data. Each
+// packet goes out in a frame with a sequence number and CRC32, the receiver
+// acks what it holds and nacks gaps, and only the missing frames are sent
+// again. Packets still reach the queues whole and in order, so the parser
+// above does not change.
+//
+// Frame: SOF, type, seq, ack, sack, payload (data frames only), CRC32 over
+// type up to the end of the payload, little endian. ack is the next packet
+// the receiver has to hand on, bit n of sack says it already holds ack + n.
+//
+// Rx and tx must be called from the same context, they share the window
+// state. Time is in milliseconds from any free running clock.
+//
+
+#ifndef LINK_WINDOW
+#define LINK_WINDOW          4     // Frames in flight each way, power of two up to 8
+#endif
+#define LINK_RTO_MS          40    // Shortest wait for an ack before resending
+#define LINK_RTO_MAX_MS      1000  // and the longest, it follows the round trips in between
+#define LINK_SOF             0xA5
+
+#define LINK_HEADER_BYTES    5
+#define LINK_CRC_BYTES       4
+#define LINK_CTRL_BYTES      (LINK_HEADER_BYTES + LINK_CRC_BYTES)
+#define LINK_DATA_BYTES      (LINK_HEADER_BYTES + PACKET_BYTES + LINK_CRC_BYTES)
+
+typedef enum
+{
+    LINK_DATA  = 0x01,
+    LINK_ACK   = 0x02,
+    LINK_NACK  = 0x03,   // seq is the frame the receiver is missing
+    LINK_RESET = 0x04,   // Both directions go back to seq 0, seq 0 asks and seq 1 answers
+} linkType_e;
+
+// Where packets come from and go to, the core queues on the device
+typedef struct
+{
+    uint8_t* (*in_slot)  (void);
+    void     (*in_push)  (void);
+    bool     (*out_ready)(void);
+    uint8_t* (*out_peek) (void);
+    void     (*out_pop)  (void);
+} linkQueue_t;
+
+typedef struct
+{
+    uint32_t  frames_in;
+    uint32_t  frames_out;
+    uint32_t  crc_errors;
+    uint32_t  dropped;       // Good frames outside the window or with no room
+    uint32_t  resent;
+    uint32_t  nacks_out;
+} linkStats_t;
+
+typedef struct
+{
+    const linkQueue_t *q;
+
+    // Receive side, slots hold frames from rxNext on that the queue had no room for yet
+    uint8_t   rxFrame[LINK_DATA_BYTES];
+    unsigned  rxBytes;
+    uint8_t   rxNext;
+    uint8_t   rxHeld;                // Bit n, slot for rxNext + n is filled
+    uint8_t   rxSlot[LINK_WINDOW][PACKET_BYTES];
+    bool      ackDue;
+    bool      nackDue;
+    uint8_t   resetDue;              // RESET seq + 1 to send, 0 for none
+    bool      resetWait;             // Asked for a reset, nothing else goes out until answered
+    uint32_t  resetSent;
+
+    // Send side, frames from txBase up to txNext are not acked yet
+    uint8_t   txBase;
+    uint8_t   txNext;
+    uint8_t   txSacked;              // Bit n, peer holds txBase + n already
+    uint8_t   txResend;              // Bit n, peer nacked txBase + n
+    uint8_t   txRetried;             // Bit n, txBase + n went out more than once
+    uint8_t   txSlot[LINK_WINDOW][PACKET_BYTES];
+    uint32_t  txSent[LINK_WINDOW];
+    uint32_t  rtt;                   // Smoothed round trip
+    uint8_t   backoff;               // Timeouts in a row, each doubles the wait
+    uint32_t  now;                   // Time of the last link_tx, for round trips seen by rx
+
+    // Frame going out, handed over in whatever pieces fit
+    uint8_t   txFrame[LINK_DATA_BYTES];
+    unsigned  txBytes;
+    unsigned  txPos;
+
+    linkStats_t stats;
+} link_t;
+
+extern const linkQueue_t link_core_queue;
+
+void     link_init  (link_t *l, const linkQueue_t *q);
+void     link_reset (link_t *l);
+void     link_rx    (link_t *l, const uint8_t *d, const unsigned bytes);
+unsigned link_tx    (link_t *l, uint8_t *d, const unsigned room, const uint32_t now);
+bool     link_due   (const link_t *l, const uint32_t now);
+bool     link_idle  (const link_t *l);
+
+#endif // LINK_H_
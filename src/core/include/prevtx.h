@@ -0,0 +1,82 @@
+#ifndef PREVTX_H_
+#define PREVTX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <crypto.h>
+#include <cmd.h>
+
+//
+// Parser for the PREV_TX stream:
+//
+//   command        1   CMD_PREV_TX
+//   header count   1
+//   header         prevTxHeader_t * header count
+//   tx             raw previous transaction
+//
+// Data can be fed in arbitrary pieces. Fields that sit whole in a piece are
+// skipped or copied in one step, fields split across pieces are resumed on
+// the next call. The tx bytes are hashed in whole 64 byte blocks.
+//
+
+#define PREVTX_SCRIPT_MAX_BYTES  10000  // Consensus limit on any script
+#define PREVTX_CACHE_ONLY        0xFF   // Header input index of outputs that are only verified for later
+
+typedef enum
+{
+    PREVTX_MORE,     // Everything eaten, the tx is not finished yet
+    PREVTX_DONE,     // Tx finished, hash is valid, bytes after it were not eaten
+    PREVTX_ERROR,
+} prevtx_status_e;
+
+#pragma pack(1)
+
+typedef struct
+{
+    uint8_t  inputIdx;   // Index into the signing inputs
+    uint32_t outputIdx;  // Output index in the prev tx
+} prevTxHeader_t;
+
+#pragma pack()
+
+//
+// Called for every output the header asks for, false aborts the parse
+//
+typedef bool (*prevtx_save_f)(const uint8_t inputIdx, const uint32_t outputIdx, const uint64_t value, const uint8_t *script, const unsigned script_bytes);
+
+typedef struct
+{
+    // Parse position
+    uint8_t         field;             // Current field, see prevtx.c
+    uint32_t        fieldByte;         // Bytes of the current field seen so far
+    uint32_t        fieldBytes;        // Size of the current field
+    uint8_t         varint[9];         // Var int being collected
+    uint32_t        count;             // Size of the next script
+
+    // Header
+    uint8_t         cmd;
+    uint8_t         headerEntries;
+    prevTxHeader_t  header[MAX_INPUTS];
+
+    // Transaction
+    uint64_t        inputsLeft;
+    uint64_t        outputsTotal;
+    uint64_t        outputIndex;
+    int             outputSave;        // Header entry for the current output, -1 if not wanted
+    uint32_t        found;             // Bit n, header entry n had its output saved
+    uint64_t        value;
+    uint8_t         script[PK_SCRIPT_BYTES];
+    prevtx_save_f   save;
+
+    // Hashing
+    sha256ctx_t    *hashCtx;
+    uint8_t         block[64];
+    uint8_t         blockBytes;
+    uint8_t         hash[TX_HASH_BYTES];  // Tx hash once PREVTX_DONE
+} prevtx_t;
+
+void            prevtx_reset  (prevtx_t *p, sha256ctx_t *hashCtx, prevtx_save_f save);
+bool            prevtx_idle   (const prevtx_t *p);
+prevtx_status_e prevtx_input  (prevtx_t *p, const uint8_t *d, const unsigned bytes, unsigned *ateBytes);
+
+#endif // PREVTX_H_
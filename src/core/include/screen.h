@@ -15,6 +15,10 @@ void screen_init             (void);
 void screen_banner           (char str[]);
 void screen_idle             (void);
 bool screen_send             (const uint8_t *output_addr, uint64_t btc, uint64_t fee);
+bool screen_send_output      (unsigned n, unsigned outputs, const uint8_t *output_addr, uint64_t btc);
+bool screen_send_total       (unsigned outputs, uint64_t btc, uint64_t fee);
+bool screen_send_batch       (unsigned txs, unsigned outputs, uint64_t btc, uint64_t fee);
+bool screen_sign_digests     (unsigned count);
 void screen_signing_progress (unsigned done, unsigned total);
 void screen_signing          (uint64_t btc, uint64_t fee);
 void screen_tx               (light_e state);
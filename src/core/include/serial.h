@@ -0,0 +1,31 @@
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <core.h>
+
+//
+// Byte stream side of the core packet queues, for transports such as a UART
+// that do not keep packet boundaries. Bytes go in and come out in whatever
+// pieces the transport has, packets are put together directly in the queue
+// slots. Rx and tx run in the transport interrupt, they claim the queues with
+// the serial_t as the port and only send responses while it owns them, see
+// core_claim. The room and ready checks can be made from the main loop.
+//
+
+typedef struct
+{
+    uint8_t  *rxSlot;     // Queue slot being filled, NULL until the first byte
+    unsigned  rxBytes;
+    uint8_t  *txPacket;   // Packet being sent, NULL between packets
+    unsigned  txBytes;
+} serial_t;
+
+void     serial_init     (serial_t *s);
+unsigned serial_rx       (serial_t *s, const uint8_t *d, const unsigned bytes);
+bool     serial_rx_room  (const serial_t *s);
+unsigned serial_tx       (serial_t *s, uint8_t *d, const unsigned room);
+bool     serial_tx_ready (const serial_t *s);
+
+#endif // SERIAL_H_
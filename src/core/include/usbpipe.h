@@ -0,0 +1,57 @@
+#ifndef USBPIPE_H_
+#define USBPIPE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <core.h>
+
+//
+// Packet pump between USB endpoint pairs and the core queues. A pipe is an
+// OUT and an IN endpoint behind a few ops, the HID interrupt and vendor bulk
+// interfaces on the device, loopback stand-ins on the host. Every pipe feeds
+// the same queues through core_claim, so a command and its response stay on
+// the pipe it came in on, and packets on the others wait on their endpoint
+// until the core is idle. A host talks over one interface at a time.
+//
+// Out and in run in the USB interrupt, kick in the main loop. When kick
+// returns true the interrupt has to be raised so the pipe can move on.
+//
+
+typedef struct
+{
+    bool (*out_ready)(unsigned *bytes);                  // An OUT packet is waiting, of bytes
+    void (*out_read) (uint8_t *d, const unsigned bytes); // Takes it, or drops it for NULL, and rearms
+    bool (*in_free)  (void);                             // The IN endpoint can take another packet
+    void (*in_write) (const uint8_t *d);                 // Loads a packet and arms the endpoint
+} usbEpOps_t;
+
+typedef struct
+{
+    uint32_t  packets_in;
+    uint32_t  packets_out;
+    uint32_t  deferred;      // Times an OUT packet had to wait for room in the queue
+    uint32_t  dropped;       // OUT packets that were not PACKET_BYTES long
+} usbPipeStats_t;
+
+typedef struct
+{
+    const usbEpOps_t *ops;
+
+    // OUT packet left on the endpoint because the inbound queue was full, the
+    // host sees NAKs until the core catches up
+    volatile bool  rxDeferred;
+
+    // The interrupt left nothing on the IN endpoint, no IN event will come
+    // for the next response so the main loop has to kick it off
+    volatile bool  txIdle;
+
+    usbPipeStats_t stats;
+} usbPipe_t;
+
+void usbpipe_init  (usbPipe_t *p, const usbEpOps_t *ops);
+void usbpipe_out   (usbPipe_t *p);
+void usbpipe_in    (usbPipe_t *p);
+bool usbpipe_kick  (usbPipe_t *p);
+bool usbpipe_owner (const usbPipe_t *p);
+
+#endif // USBPIPE_H_
@@ -4,4 +4,7 @@
 #define min(x,y) ((x)<(y) ? (x) : (y))
 #define max(x,y) ((x)<(y) ? (y) : (x))
 
+// Fails the build when cond is false, wherever a declaration can go
+#define STATIC_ASSERT(cond, name) typedef char static_assert_##name[(cond) ? 1 : -1]
+
 #endif
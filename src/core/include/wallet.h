@@ -9,6 +9,11 @@
 #define BASE58_ADDR_BYTES  34  // Base58 output length for a bitcoin address
 #define HARDENED_KEY       0x80000000
 
+#define WALLET_PATH_DEPTH_MAX  6   // Enough for m/44'/0'/account'/chain/index
+#define WALLET_CACHE_NODES     8   // Master plus cached intermediate path nodes
+#define WALLET_POOL_CHAINS     2   // Receive and change chains are pooled
+#define WALLET_POOL_ADDRS      8   // Precomputed addresses per chain
+
 typedef enum
 {
     KEY_MASTER = 0,
@@ -18,13 +23,33 @@ typedef enum
     KEY_TYPE_INVALID,
 } keytype_e;
 
+typedef struct
+{
+    uint8_t  depth;
+    uint32_t index[WALLET_PATH_DEPTH_MAX];  // HARDENED_KEY set for hardened levels
+} wallet_path_t;
+
+typedef struct
+{
+    uint8_t  depth[WALLET_POOL_CHAINS];
+    uint32_t hits;
+    uint32_t misses;
+} wallet_pool_stats_t;
+
 
 void wallet_init                    (void);
 void wallet_address_private_key_get (const uint32_t account, const uint32_t chain, const uint32_t index, uint8_t *priv_key, uint8_t *chain_code);
+void wallet_path_private_key_get    (const wallet_path_t *path, uint8_t *priv_key, uint8_t *chain_code);
+void wallet_path_public_key_get     (const wallet_path_t *path, uint8_t *pub_key_x, uint8_t *pub_key_y, uint8_t *chain_code);
+bool wallet_path_public_key_export  (const wallet_path_t *path, uint8_t *pub_key_x, uint8_t *pub_key_y, uint8_t *chain_code);
 void wallet_private_key_get         (const uint8_t *parent_priv_key, const uint8_t *parent_pub_key_compress, const uint8_t *parent_chain_code, const uint32_t index, uint8_t *priv_key, uint8_t *chain_code);
 void wallet_public_key_get          (const keytype_e type, const uint32_t account, const uint32_t chain, const uint32_t address, uint8_t *pub_key_x, uint8_t *pub_key_y, uint8_t *chaincode);
 void wallet_master_seed_set         (const char *wordlist, const unsigned bytes);
+void wallet_master_seed_load        (const uint8_t *seed, const unsigned bytes);
 void wallet_master_seed_get         (uint8_t seed[MASTER_SEED_BYTES], unsigned *bytes);
+void wallet_address_hash160_get    (const uint32_t account, const uint32_t chain, const uint32_t index, uint8_t *hash160);
+bool wallet_pool_fill               (void);
+void wallet_pool_stats              (wallet_pool_stats_t *stats);
 void wallet_public_key_to_hash160   (const uint8_t *pub_key_x, const uint8_t *pub_key_y, uint8_t *hash160);
 void wallet_public_key_compress     (const uint8_t *pub_key_x, const uint8_t *pub_key_y, uint8_t *compressed);
 void wallet_base58_encode           (const uint8_t *data, const unsigned data_bytes, char *str, const unsigned str_bytes);
@@ -0,0 +1,510 @@
+#include <string.h>
+#include <util.h>
+#include <link.h>
+
+#define POS_SOF   0
+#define POS_TYPE  1
+#define POS_SEQ   2
+#define POS_ACK   3
+#define POS_SACK  4
+
+static uint8_t* core_in_slot  (void);
+static void     core_in_push  (void);
+static bool     core_out_ready(void);
+
+// The queue itself stands for the link when claiming the core queues
+const linkQueue_t link_core_queue = {
+    .in_slot   = core_in_slot,
+    .in_push   = core_in_push,
+    .out_ready = core_out_ready,
+    .out_peek  = core_outpacket,
+    .out_pop   = core_outpacket_pop,
+};
+
+static uint32_t crc32      (const uint8_t *d, unsigned bytes);
+static unsigned frame_bytes(const uint8_t type);
+static void     restart    (link_t *l);
+static void     scan       (link_t *l);
+static void     skip       (link_t *l, const unsigned bytes);
+static bool     frame_in   (link_t *l, const unsigned bytes);
+static void     ack_in     (link_t *l, const uint8_t ack, const uint8_t sack);
+static void     nack_in    (link_t *l, const uint8_t seq);
+static void     data_in    (link_t *l, const uint8_t seq, const uint8_t *payload);
+static void     deliver    (link_t *l);
+static void     frame_out  (link_t *l, const uint8_t type, const uint8_t seq, const uint8_t *payload);
+static bool     next_frame (link_t *l, const uint32_t now);
+static uint32_t rto        (const link_t *l);
+static int      resend_due (const link_t *l, const uint32_t now);
+
+
+// Slots are also looked at from link_due, so the claim waits for the push. Both
+// happen in the same interrupt, no other transport can get in between.
+static uint8_t* core_in_slot(void)
+{
+    return core_claimable(&link_core_queue) ? core_inpacket_slot() : NULL;
+}
+
+static void core_in_push(void)
+{
+    core_claim(&link_core_queue);
+    core_inpacket_push();
+}
+
+static bool core_out_ready(void)
+{
+    return core_owner(&link_core_queue) && core_outpacket_ready();
+}
+
+
+// Standard reflected CRC-32, nibble table to keep it small
+static uint32_t crc32(const uint8_t *d, unsigned bytes)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (bytes--)
+    {
+        crc ^= *d++;
+        crc  = (crc >> 4) ^ table[crc & 0x0F];
+        crc  = (crc >> 4) ^ table[crc & 0x0F];
+    }
+
+    return ~crc;
+}
+
+static unsigned frame_bytes(const uint8_t type)
+{
+    switch (type)
+    {
+        case LINK_DATA:   return LINK_DATA_BYTES;
+        case LINK_ACK:
+        case LINK_NACK:
+        case LINK_RESET:  return LINK_CTRL_BYTES;
+        default:          return 0;
+    }
+}
+
+
+void link_init(link_t *l, const linkQueue_t *q)
+{
+    memset(l, 0, sizeof(link_t));
+    l->q   = q;
+    l->rtt = LINK_RTO_MS / 2;
+}
+
+void link_reset(link_t *l)
+{
+    restart(l);
+
+    l->resetDue  = 1;
+    l->resetWait = true;
+}
+
+static void restart(link_t *l)
+{
+    // Both windows start over, framing and a frame half sent are left alone
+    l->rxNext    = 0;
+    l->rxHeld    = 0;
+    l->ackDue    = false;
+    l->nackDue   = false;
+    l->resetDue  = 0;
+    l->resetWait = false;
+
+    l->txBase    = 0;
+    l->txNext    = 0;
+    l->txSacked  = 0;
+    l->txResend  = 0;
+    l->txRetried = 0;
+}
+
+
+//
+// Receive side
+//
+
+void link_rx(link_t *l, const uint8_t *d, const unsigned bytes)
+{
+    unsigned pos = 0, want, n;
+
+    while (pos < bytes)
+    {
+        // Hunt for the start of a frame
+        if (0 == l->rxBytes)
+        {
+            if (d[pos++] == LINK_SOF)  l->rxFrame[l->rxBytes++] = LINK_SOF;
+            continue;
+        }
+
+        // Up to the type first, then the rest of whatever frame it is
+        want = (l->rxBytes < LINK_HEADER_BYTES) ? LINK_HEADER_BYTES : frame_bytes(l->rxFrame[POS_TYPE]);
+        n    = min(bytes - pos, want - l->rxBytes);
+
+        memcpy(&l->rxFrame[l->rxBytes], &d[pos], n);
+
+        pos        += n;
+        l->rxBytes += n;
+
+        scan(l);
+    }
+
+    deliver(l);
+}
+
+static void scan(link_t *l)
+{
+    unsigned bytes;
+
+    // Leaves less than a whole frame behind, starting at a SOF
+    while (l->rxBytes >= LINK_HEADER_BYTES)
+    {
+        bytes = frame_bytes(l->rxFrame[POS_TYPE]);
+
+        if (0 == bytes)
+        {
+            skip(l, 1);
+        }
+        else if (l->rxBytes < bytes)
+        {
+            return;
+        }
+        else if (!frame_in(l, bytes))
+        {
+            l->stats.crc_errors++;
+            skip(l, 1);
+        }
+        else
+        {
+            skip(l, bytes);
+        }
+    }
+}
+
+static void skip(link_t *l, const unsigned bytes)
+{
+    uint8_t *sof;
+
+    // Drop bytes from the front and hunt for the next frame in what is left
+    sof = memchr(&l->rxFrame[bytes], LINK_SOF, l->rxBytes - bytes);
+
+    if (NULL == sof)
+    {
+        l->rxBytes = 0;
+        return;
+    }
+
+    l->rxBytes -= sof - l->rxFrame;
+    memmove(l->rxFrame, sof, l->rxBytes);
+}
+
+static bool frame_in(link_t *l, const unsigned bytes)
+{
+    const uint8_t *f = l->rxFrame;
+    uint32_t       crc;
+
+    crc = f[bytes - 4] | (f[bytes - 3] << 8) | (f[bytes - 2] << 16) | ((uint32_t) f[bytes - 1] << 24);
+
+    if (crc != crc32(&f[POS_TYPE], bytes - LINK_CRC_BYTES - 1))  return false;
+
+    l->stats.frames_in++;
+
+    switch (f[POS_TYPE])
+    {
+        case LINK_RESET:
+            if (0 == f[POS_SEQ])
+            {
+                // Peer started over, so do we and tell it
+                restart(l);
+                l->resetDue = 2;
+            }
+            else if (l->resetWait)
+            {
+                l->resetWait = false;
+            }
+            break;
+
+        case LINK_NACK:
+            ack_in(l, f[POS_ACK], f[POS_SACK]);
+
+            nack_in(l, f[POS_SEQ]);
+            break;
+
+        case LINK_ACK:
+            ack_in(l, f[POS_ACK], f[POS_SACK]);
+            break;
+
+        case LINK_DATA:
+            ack_in(l, f[POS_ACK], f[POS_SACK]);
+            data_in(l, f[POS_SEQ], &f[LINK_HEADER_BYTES]);
+            break;
+    }
+
+    return true;
+}
+
+static void ack_in(link_t *l, const uint8_t ack, const uint8_t sack)
+{
+    uint8_t  acked    = ack - l->txBase;
+    uint8_t  inflight = l->txNext - l->txBase;
+    uint32_t sample;
+
+    // Stale or from before a reset
+    if (l->resetWait || acked > inflight)  return;
+
+    // Round trip of the oldest frame, unless it was resent and the ack could be for either
+    if (acked > 0 && !(l->txRetried & 1))
+    {
+        sample = l->now - l->txSent[l->txBase % LINK_WINDOW];
+        l->rtt = (7 * l->rtt + sample) / 8;
+    }
+
+    // Getting through again, stop backing off
+    if (acked > 0)  l->backoff = 0;
+
+    l->txBase    = ack;
+    l->txSacked  = (l->txSacked  >> acked) | sack;
+    l->txResend  = (l->txResend  >> acked) & ~l->txSacked;
+    l->txRetried = (l->txRetried >> acked);
+
+    // Only frames actually in flight
+    inflight      = l->txNext - l->txBase;
+    l->txSacked  &= (1 << inflight) - 1;
+    l->txResend  &= (1 << inflight) - 1;
+    l->txRetried &= (1 << inflight) - 1;
+}
+
+static void nack_in(link_t *l, const uint8_t seq)
+{
+    uint8_t n = seq - l->txBase;
+
+    if (n >= (uint8_t)(l->txNext - l->txBase))  return;
+
+    // Every frame past the gap asks again, the resend may well be on its way still
+    if ((l->txRetried & (1 << n)) && (l->now - l->txSent[seq % LINK_WINDOW] < l->rtt))  return;
+
+    l->txResend |= 1 << n;
+}
+
+static void data_in(link_t *l, const uint8_t seq, const uint8_t *payload)
+{
+    uint8_t  ahead = seq - l->rxNext;
+    uint8_t *slot;
+
+    // Already delivered, the ack got lost on the way back
+    if (ahead >= (uint8_t)(256 - LINK_WINDOW))
+    {
+        l->ackDue = true;
+        return;
+    }
+
+    if (ahead >= LINK_WINDOW)
+    {
+        l->stats.dropped++;
+        return;
+    }
+
+    l->ackDue = true;
+
+    if (l->rxHeld & (1 << ahead))  return;
+
+    // Next in line and the queue has room, straight through
+    if (0 == ahead && 0 == l->rxHeld && NULL != (slot = l->q->in_slot()))
+    {
+        memcpy(slot, payload, PACKET_BYTES);
+        l->q->in_push();
+
+        l->rxNext++;
+        return;
+    }
+
+    memcpy(l->rxSlot[seq % LINK_WINDOW], payload, PACKET_BYTES);
+    l->rxHeld |= 1 << ahead;
+
+    // A gap before this one, ask for it
+    if (0 != ahead && !(l->rxHeld & 1))  l->nackDue = true;
+}
+
+static void deliver(link_t *l)
+{
+    uint8_t *slot;
+
+    while ((l->rxHeld & 1) && NULL != (slot = l->q->in_slot()))
+    {
+        memcpy(slot, l->rxSlot[l->rxNext % LINK_WINDOW], PACKET_BYTES);
+        l->q->in_push();
+
+        l->rxHeld >>= 1;
+        l->rxNext++;
+        l->ackDue   = true;
+    }
+}
+
+
+//
+// Send side
+//
+
+unsigned link_tx(link_t *l, uint8_t *d, const unsigned room, const uint32_t now)
+{
+    unsigned pos = 0, n;
+
+    l->now = now;
+
+    deliver(l);
+
+    while (pos < room)
+    {
+        if (l->txPos == l->txBytes && !next_frame(l, now))  break;
+
+        n = min(room - pos, l->txBytes - l->txPos);
+
+        memcpy(&d[pos], &l->txFrame[l->txPos], n);
+
+        pos      += n;
+        l->txPos += n;
+    }
+
+    return pos;
+}
+
+static void frame_out(link_t *l, const uint8_t type, const uint8_t seq, const uint8_t *payload)
+{
+    uint8_t *f     = l->txFrame;
+    unsigned bytes = frame_bytes(type);
+    uint32_t crc;
+
+    // Held frames are only sacked, the window moves as they are delivered
+    f[POS_SOF]  = LINK_SOF;
+    f[POS_TYPE] = type;
+    f[POS_SEQ]  = seq;
+    f[POS_ACK]  = l->rxNext;
+    f[POS_SACK] = l->rxHeld;
+
+    if (NULL != payload)  memcpy(&f[LINK_HEADER_BYTES], payload, PACKET_BYTES);
+
+    crc = crc32(&f[POS_TYPE], bytes - LINK_CRC_BYTES - 1);
+
+    f[bytes - 4] = crc;
+    f[bytes - 3] = crc >> 8;
+    f[bytes - 2] = crc >> 16;
+    f[bytes - 1] = crc >> 24;
+
+    l->txBytes = bytes;
+    l->txPos   = 0;
+    l->ackDue  = false;
+
+    l->stats.frames_out++;
+}
+
+static uint32_t rto(const link_t *l)
+{
+    return min(LINK_RTO_MAX_MS, max(LINK_RTO_MS, 2 * l->rtt) << l->backoff);
+}
+
+static int resend_due(const link_t *l, const uint32_t now)
+{
+    uint8_t  inflight = l->txNext - l->txBase;
+    unsigned n;
+
+    for (n = 0; n < inflight; n++)
+    {
+        if (l->txSacked & (1 << n))  continue;
+
+        if ((l->txResend & (1 << n)) || (now - l->txSent[(uint8_t)(l->txBase + n) % LINK_WINDOW] >= rto(l)))
+        {
+            return n;
+        }
+    }
+
+    return -1;
+}
+
+static bool next_frame(link_t *l, const uint32_t now)
+{
+    uint8_t seq;
+    int     n;
+
+    if (l->resetDue)
+    {
+        frame_out(l, LINK_RESET, l->resetDue - 1, NULL);
+        l->resetDue  = 0;
+        l->resetSent = now;
+        return true;
+    }
+
+    // Nothing else until the peer answered, ask again if it takes too long
+    if (l->resetWait)
+    {
+        if (now - l->resetSent < rto(l))  return false;
+
+        l->resetDue = 1;
+        return next_frame(l, now);
+    }
+
+    if (l->nackDue)
+    {
+        frame_out(l, LINK_NACK, l->rxNext, NULL);
+        l->nackDue = false;
+        l->stats.nacks_out++;
+        return true;
+    }
+
+    // Nacked or timed out frames first, then new ones while the window allows
+    if ((n = resend_due(l, now)) >= 0)
+    {
+        seq = l->txBase + n;
+
+        // Oldest frame timed out rather than nacked, the round trip got longer
+        if (0 == n && !(l->txResend & 1) && l->backoff < 8)  l->backoff++;
+
+        frame_out(l, LINK_DATA, seq, l->txSlot[seq % LINK_WINDOW]);
+
+        l->txResend  &= ~(1 << n);
+        l->txRetried |= 1 << n;
+        l->txSent[seq % LINK_WINDOW] = now;
+        l->stats.resent++;
+        return true;
+    }
+
+    if ((uint8_t)(l->txNext - l->txBase) < LINK_WINDOW && l->q->out_ready())
+    {
+        seq = l->txNext++;
+
+        memcpy(l->txSlot[seq % LINK_WINDOW], l->q->out_peek(), PACKET_BYTES);
+        l->q->out_pop();
+
+        frame_out(l, LINK_DATA, seq, l->txSlot[seq % LINK_WINDOW]);
+
+        l->txSent[seq % LINK_WINDOW] = now;
+        return true;
+    }
+
+    if (l->ackDue)
+    {
+        frame_out(l, LINK_ACK, 0, NULL);
+        return true;
+    }
+
+    return false;
+}
+
+bool link_due(const link_t *l, const uint32_t now)
+{
+    if (l->txPos < l->txBytes || l->resetDue || l->ackDue || l->nackDue)  return true;
+
+    if (l->resetWait)  return now - l->resetSent >= rto(l);
+
+    if (resend_due(l, now) >= 0)  return true;
+
+    if ((uint8_t)(l->txNext - l->txBase) < LINK_WINDOW && l->q->out_ready())  return true;
+
+    // Held frames the queue has room for now
+    return (l->rxHeld & 1) && NULL != l->q->in_slot();
+}
+
+bool link_idle(const link_t *l)
+{
+    return (l->txNext == l->txBase) && (0 == l->rxHeld) && (l->txPos == l->txBytes) && !l->resetWait;
+}
@@ -494,6 +494,146 @@ abort:
 }
 
 
+// One output of a tx paying several, the user goes on to the next or cancels
+bool screen_send_output(unsigned n, unsigned outputs, const uint8_t *output_addr, uint64_t btc)
+{
+    unsigned i, span, outline;
+    char str[16], output_base58[34];
+
+    screen_clear();
+
+    sprintf(str, "Output %u/%u", n, outputs);
+    screen_banner(str);
+
+    satoshi_to_str(str, btc, 14);
+    pixel_str(str, 25, CENTER);
+
+    // Address
+    pixel_str("____________"  , 48, CENTER);
+
+    wallet_base58_encode(output_addr, HASH_ADDR_BYTES + 1, output_base58, sizeof(output_base58));
+
+    for (i = 0, outline = 66; i < 34; i += span, outline += 14)
+    {
+        span = min(34 - i, 12);
+
+        strncpy(str, &output_base58[i], span);
+        str[span] = 0;
+        pixel_str(str, outline, CENTER);
+    }
+
+#if !SKIP_CONFIRMATION
+    button_slider("<<< NO", "NEXT >>>", 120);
+    if (TOUCH_SLIDE_RIGHT != touch_get_slide())  goto abort;
+#endif
+
+    return true;
+
+#if !SKIP_CONFIRMATION
+abort:
+    pixel_clear_lines(BUTTON_LINE_START, BUTTON_LINES);
+    screen_banner("Cancelled");
+    return false;
+#endif
+}
+
+
+// Amount and fee with a count below, the last thing confirmed before signing
+static bool send_totals(char banner[], uint64_t btc, uint64_t fee, const char *line1, const char *line2)
+{
+    char str[14], str_fee[14];
+
+    screen_clear();
+    screen_banner(banner);
+
+    // BTC outputs
+    satoshi_to_str(str, btc, 14);
+    pixel_str(str, 25, CENTER);
+
+    satoshi_to_str(str, fee, 11);
+    sprintf(str_fee, "Fee %s", str);
+
+    pixel_str(str_fee, 39, CENTER);
+
+    pixel_str("____________"  , 48, CENTER);
+
+    pixel_str(line1, 66, CENTER);
+    if (NULL != line2)  pixel_str(line2, 80, CENTER);
+
+    // Confirmation buttons
+#if !SKIP_CONFIRMATION
+    button_slider("<<< NO", "SEND >>>", 120);
+    if (TOUCH_SLIDE_RIGHT != touch_get_slide())  goto abort;
+#endif
+
+    pixel_clear_lines(BUTTON_LINE_START, BUTTON_LINES);
+    screen_banner("Signing");
+    return true;
+
+#if !SKIP_CONFIRMATION
+abort:
+    pixel_clear_lines(BUTTON_LINE_START, BUTTON_LINES);
+    screen_banner("Cancelled");
+    return false;
+#endif
+}
+
+
+// Total of a tx paying several outputs, after each was shown on its own
+bool screen_send_total(unsigned outputs, uint64_t btc, uint64_t fee)
+{
+    char str_count[24];
+
+    sprintf(str_count, "%u outputs", outputs);
+
+    return send_totals("Send BTC?", btc, fee, str_count, NULL);
+}
+
+
+// Totals of a batch of txs, each is signed without asking again
+bool screen_send_batch(unsigned txs, unsigned outputs, uint64_t btc, uint64_t fee)
+{
+    char str_txs[24], str_count[24];
+
+    sprintf(str_txs,   "%u txs", txs);
+    sprintf(str_count, "%u outputs", outputs);
+
+    return send_totals("Send batch?", btc, fee, str_txs, str_count);
+}
+
+
+// A run of raw digests, no amounts to show, only how many
+bool screen_sign_digests(unsigned count)
+{
+    char str_count[24];
+
+    sprintf(str_count, "%u digests", count);
+
+    screen_clear();
+    screen_banner("Sign digests?");
+
+    pixel_str(str_count, 39, CENTER);
+    pixel_str("No BTC moves", 66, CENTER);
+
+    // Confirmation buttons
+#if !SKIP_CONFIRMATION
+    button_slider("<<< NO", "SIGN >>>", 120);
+    if (TOUCH_SLIDE_RIGHT != touch_get_slide())  goto abort;
+#endif
+
+    pixel_clear_lines(BUTTON_LINE_START, BUTTON_LINES);
+    screen_banner("Signing");
+    return true;
+
+#if !SKIP_CONFIRMATION
+abort:
+    pixel_clear_lines(BUTTON_LINE_START, BUTTON_LINES);
+    screen_banner("Cancelled");
+    return false;
+#endif
+}
+
+
 void screen_signing_progress(unsigned done, unsigned total)
 {
     unsigned bits = (PROGRESS_COLS * done) / total;
@@ -0,0 +1,84 @@
+#include <string.h>
+#include <util.h>
+#include <serial.h>
+
+
+void serial_init(serial_t *s)
+{
+    core_release(s);
+    memset(s, 0, sizeof(serial_t));
+}
+
+unsigned serial_rx(serial_t *s, const uint8_t *d, const unsigned bytes)
+{
+    unsigned pos = 0, n;
+
+    while (pos < bytes)
+    {
+        if (NULL == s->rxSlot)
+        {
+            // Core is behind or busy with another transport, what is left stays with this one
+            if (!core_claim(s))                               break;
+            if (NULL == (s->rxSlot = core_inpacket_slot()))  break;
+
+            s->rxBytes = 0;
+        }
+
+        n = min(bytes - pos, PACKET_BYTES - s->rxBytes);
+
+        memcpy(&s->rxSlot[s->rxBytes], &d[pos], n);
+
+        pos        += n;
+        s->rxBytes += n;
+
+        if (s->rxBytes == PACKET_BYTES)
+        {
+            core_inpacket_push();
+            s->rxSlot = NULL;
+        }
+    }
+
+    return pos;
+}
+
+bool serial_rx_room(const serial_t *s)
+{
+    return (NULL != s->rxSlot) || (core_claimable(s) && NULL != core_inpacket_slot());
+}
+
+unsigned serial_tx(serial_t *s, uint8_t *d, const unsigned room)
+{
+    unsigned pos = 0, n;
+
+    while (pos < room)
+    {
+        if (NULL == s->txPacket)
+        {
+            // Only responses to commands that came in here
+            if (!core_owner(s) || !core_outpacket_ready())  break;
+
+            s->txPacket = core_outpacket();
+            s->txBytes  = 0;
+        }
+
+        n = min(room - pos, PACKET_BYTES - s->txBytes);
+
+        memcpy(&d[pos], &s->txPacket[s->txBytes], n);
+
+        pos        += n;
+        s->txBytes += n;
+
+        if (s->txBytes == PACKET_BYTES)
+        {
+            core_outpacket_pop();
+            s->txPacket = NULL;
+        }
+    }
+
+    return pos;
+}
+
+bool serial_tx_ready(const serial_t *s)
+{
+    return (NULL != s->txPacket) || (core_owner(s) && core_outpacket_ready());
+}
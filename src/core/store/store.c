@@ -47,7 +47,8 @@ bool store_present(void)
 
 store_status_e store_load(const unsigned keyslot)
 {
-    store_t store;
+    store_t        store;
+    store_status_e sts;
 
     assert(store_present());
 
@@ -59,12 +60,18 @@ store_status_e store_load(const unsigned keyslot)
 
     if (0 == strncmp(store.verification, VERIFICATION, sizeof(VERIFICATION)))
     {
-        return STORE_OK;
+        // Hand the seed to the wallet, keys are derived from it on demand
+        wallet_master_seed_load(store.master_seed, MASTER_SEED_BYTES);
+        sts = STORE_OK;
     }
     else
     {
-        return STORE_ERR_INVALID_PIN;
+        sts = STORE_ERR_INVALID_PIN;
     }
+
+    memset(&store, 0, sizeof(store));
+
+    return sts;
 }
 
 
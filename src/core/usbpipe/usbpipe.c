@@ -0,0 +1,84 @@
+#include <stddef.h>
+#include <usbpipe.h>
+
+
+void usbpipe_init(usbPipe_t *p, const usbEpOps_t *ops)
+{
+    p->ops        = ops;
+    p->rxDeferred = false;
+    p->txIdle     = true;
+
+    core_release(p);
+}
+
+bool usbpipe_owner(const usbPipe_t *p)
+{
+    return core_owner(p);
+}
+
+void usbpipe_out(usbPipe_t *p)
+{
+    unsigned  bytes;
+    uint8_t  *inpacket;
+
+    // Double buffered endpoints can hold a second packet behind the first
+    while (p->ops->out_ready(&bytes))
+    {
+        if (PACKET_BYTES != bytes)
+        {
+            // Nothing the parser could frame, zero length ones are not counted
+            p->ops->out_read(NULL, bytes);
+            if (bytes > 0)  p->stats.dropped++;
+            continue;
+        }
+
+        // Another transport has the queues until the core is idle, or they are full
+        inpacket = core_claim(p) ? core_inpacket_slot() : NULL;
+
+        if (NULL == inpacket)
+        {
+            // Leave it on the endpoint, usbpipe_kick brings us back
+            if (!p->rxDeferred)  p->stats.deferred++;
+            p->rxDeferred = true;
+            return;
+        }
+
+        p->ops->out_read(inpacket, bytes);
+
+        // Status requests are answered right there, for this pipe as the owner
+        core_inpacket_push();
+        p->stats.packets_in++;
+    }
+
+    p->rxDeferred = false;
+}
+
+void usbpipe_in(usbPipe_t *p)
+{
+    if (!core_owner(p))
+    {
+        p->txIdle = true;
+        return;
+    }
+
+    // Whatever the endpoint has no room for waits for its next IN event
+    while (core_outpacket_ready() && p->ops->in_free())
+    {
+        p->ops->in_write(core_outpacket());
+        core_outpacket_pop();
+        p->stats.packets_out++;
+    }
+
+    p->txIdle = !core_outpacket_ready();
+}
+
+bool usbpipe_kick(usbPipe_t *p)
+{
+    if ((p->txIdle && core_owner(p) && core_outpacket_ready()) || (p->rxDeferred && core_claimable(p) && (NULL != core_inpacket_slot())))
+    {
+        p->txIdle = false;
+        return true;
+    }
+
+    return false;
+}
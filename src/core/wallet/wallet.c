@@ -4,32 +4,96 @@
 #include <crypto.h>
 #include <string.h>
 #include <words.h>
+#include <ctx.h>
+
+#if !HW_CC2538
+#include <stdlib.h>
+#endif
+
+//
+// Derived nodes are held in a small bounded trie. Each node links to its
+// parent slot and keeps its keys plus the HMAC midstate of its chain code, so
+// a sibling derivation under a cached parent costs one HMAC and one add.
+// Slot 0 is always the master node, intermediate path nodes fill the rest and
+// the least recently used leaf of the trie is evicted when the cache is full.
+//
+#define ROOT_NODE 0
+
+typedef struct
+{
+    bool         used;
+    bool         pub_valid;   // Compressed public key computed
+    bool         mid_valid;   // Chain code HMAC midstate computed
+    uint8_t      depth;
+    uint8_t      parent;
+    uint32_t     index;
+    uint32_t     stamp;
+    uint8_t      priv_key         [KEY_BYTES];
+    uint8_t      chain_code       [KEY_BYTES];
+    uint8_t      pub_key_compress [COMPRESS_KEY_BYTES];
+    hmac512mid_t mid;
+} wallet_node_t;
+
+static void     seed_updated   (void);
+static unsigned node_root      (void);
+static unsigned node_find      (const unsigned parent, const uint32_t index);
+static unsigned node_alloc     (const unsigned parent);
+static void     node_child     (const unsigned parent, const uint32_t index, uint8_t *priv_key, uint8_t *chain_code);
+static unsigned node_walk      (const wallet_path_t *path);
+static void     legacy_path    (const keytype_e type, const uint32_t account, const uint32_t chain, const uint32_t index, wallet_path_t *path);
+
+//
+// Address pool, a ring per chain of the next addresses under the most recently
+// used account. Filled one address at a time from idle cycles, so requests for
+// upcoming addresses skip the point multiply. Entries stay until the ring is
+// full and needs room, then the ones up to the highest requested go first.
+//
+typedef struct
+{
+    uint8_t pub_key_x [KEY_BYTES];
+    uint8_t pub_key_y [KEY_BYTES];
+    uint8_t hash160   [HASH_ADDR_BYTES];
+} pool_addr_t;
 
-#define CHAINS 2
-
-static void seed_updated(void);
+typedef struct
+{
+    uint32_t    account;
+    uint32_t    base;     // Address index of the entry at head
+    uint8_t     head;
+    uint8_t     count;
+    uint8_t     used;     // Entries from head up to the highest one requested
+    bool        stray;    // Last request missed elsewhere and the pool was kept
+    uint32_t    stray_account;
+    uint32_t    stray_index;
+    pool_addr_t addr[WALLET_POOL_ADDRS];
+} pool_t;
+
+static pool_addr_t* pool_lookup (const uint32_t account, const uint32_t chain, const uint32_t index);
+static pool_addr_t* pool_push   (const uint32_t chain, const uint8_t *pub_key_x, const uint8_t *pub_key_y);
+static pool_addr_t* address_get (const uint32_t account, const uint32_t chain, const uint32_t index, uint8_t *pub_key_x, uint8_t *pub_key_y);
 
 static const uint8_t  masterSeedKey[] = "Bitcoin seed";
-static const uint8_t  seed_default[]  = {0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15};
 
-static unsigned master_seed_bytes;
-static uint8_t  master_seed              [MASTER_SEED_BYTES];
+struct wallet_ctx
+{
+    unsigned      master_seed_bytes;
+    uint8_t       master_seed [MASTER_SEED_BYTES];
 
-static uint8_t  master_priv_key          [KEY_BYTES];
-static uint8_t  master_chain_code        [KEY_BYTES];
+    wallet_node_t nodes       [WALLET_CACHE_NODES];
+    uint32_t      node_stamp;
 
-static uint8_t  account_priv_key         [KEY_BYTES];  // Hardened
-static uint8_t  account_chain_code       [KEY_BYTES];
+    pool_t        pool        [WALLET_POOL_CHAINS];
+    uint32_t      pool_hits;
+    uint32_t      pool_misses;
+};
 
-static uint8_t  chain_priv_key           [CHAINS][KEY_BYTES];
-static uint8_t  chain_chain_code         [CHAINS][KEY_BYTES];
-static uint8_t  chain_pub_key_compress   [CHAINS][COMPRESS_KEY_BYTES];
+#if HW_CC2538
+#pragma DATA_SECTION(wallet_fw_ctx, ".nonretenvar")
+wallet_ctx_t wallet_fw_ctx;
+#endif
 
-/*
-static uint8_t  master_pub_key_x         [KEY_BYTES];
-static uint8_t  master_pub_key_y         [KEY_BYTES];
-static uint8_t  master_pub_key_compress  [COMPRESS_KEY_BYTES];
-*/
+// Per-context wallet state, see ctx.h
+#define ws (polly_ctx()->wallet)
 
 static uint32_t swap_uint32(uint32_t val);
 
@@ -43,9 +107,9 @@ uint32_t swap_uint32(uint32_t val)
 
 void wallet_init(void)
 {
-	// Default seed
-    memcpy(master_seed, seed_default, sizeof(seed_default));
-    master_seed_bytes = sizeof(seed_default);
+    // No seed until one is loaded from the store or generated
+    ws->master_seed_bytes = 0;
+    memset(ws->master_seed, 0, sizeof(ws->master_seed));
 
     seed_updated();
 }
@@ -53,15 +117,82 @@ void wallet_init(void)
 
 void wallet_address_private_key_get(const uint32_t account, const uint32_t chain, const uint32_t index, uint8_t *priv_key, uint8_t *chain_code)
 {
-    wallet_private_key_get(&chain_priv_key[chain][0], &chain_pub_key_compress[chain][0], &chain_chain_code[chain][0], index, priv_key, chain_code);
+    wallet_path_t path;
+
+    legacy_path(KEY_ADDRESS, account, chain, index, &path);
+
+    wallet_path_private_key_get(&path, priv_key, chain_code);
+}
+
+
+void wallet_path_private_key_get(const wallet_path_t *path, uint8_t *priv_key, uint8_t *chain_code)
+{
+    unsigned parent;
+    uint8_t  code[KEY_BYTES];
+
+    assert(path->depth <= WALLET_PATH_DEPTH_MAX);
+
+    if (0 == path->depth)
+    {
+        parent = node_root();
+
+        memcpy(priv_key, ws->nodes[parent].priv_key, KEY_BYTES);
+        if (NULL != chain_code)  memcpy(chain_code, ws->nodes[parent].chain_code, KEY_BYTES);
+
+        return;
+    }
+
+    // Only the intermediate nodes are cached, the leaf is derived off its parent
+    parent = node_walk(path);
+
+    node_child(parent, path->index[path->depth - 1], priv_key, NULL != chain_code ? chain_code : code);
+
+    memset(code, 0, sizeof(code));
+}
+
+
+void wallet_path_public_key_get(const wallet_path_t *path, uint8_t *pub_key_x, uint8_t *pub_key_y, uint8_t *chain_code)
+{
+    uint8_t priv_key[KEY_BYTES];
+
+    wallet_path_private_key_get(path, priv_key, chain_code);
+
+    crypto_ecdsa_genpubkey(priv_key, pub_key_x, pub_key_y);
+
+    memset(priv_key, 0, sizeof(priv_key));
+}
+
+//
+// Public key of a path for the host. The master key is refused, and chain
+// codes only go out for the account level, the last hardened one, and the
+// chain level below it, as wallet_public_key_get does for m/account'/chain.
+//
+bool wallet_path_public_key_export(const wallet_path_t *path, uint8_t *pub_key_x, uint8_t *pub_key_y, uint8_t *chain_code)
+{
+    unsigned hardened = 0;
+    unsigned i;
+
+    if (0 == path->depth || path->depth > WALLET_PATH_DEPTH_MAX)  return false;
+
+    for (i = 0; i < path->depth; i++)
+    {
+        if (path->index[i] & HARDENED_KEY)  hardened = i + 1;
+    }
+
+    wallet_path_public_key_get(path, pub_key_x, pub_key_y, chain_code);
+
+    // Not returning chain codes for address keys
+    if (path->depth > hardened + 1)  memset(chain_code, 0, KEY_BYTES);
+
+    return true;
 }
 
 #define DATA_BYTES (COMPRESS_KEY_BYTES + 4)
-uint8_t data[DATA_BYTES];
 
 void wallet_private_key_get(const uint8_t *parent_priv_key, const uint8_t *parent_pub_key_compress, const uint8_t *parent_chain_code, const uint32_t index, uint8_t *priv_key, uint8_t *chain_code)
 {
 	uint32_t    index_swap;
+    uint8_t     data[DATA_BYTES];
     uint8_t     hash[SHA512_BYTES];
 
 	index_swap = swap_uint32(index);
@@ -98,49 +229,99 @@ void wallet_private_key_get(const uint8_t *parent_priv_key, const uint8_t *paren
 
 void wallet_public_key_get(const keytype_e type, const uint32_t account, const uint32_t chain, const uint32_t address, uint8_t *pubkey_x, uint8_t *pubkey_y, uint8_t *chaincode)
 {
-    uint8_t priv_key[KEY_BYTES];
-    
-    switch (type)
+    wallet_path_t path;
+
+    assert(type < KEY_TYPE_INVALID);
+
+    if (KEY_ADDRESS == type)
     {
-        case KEY_MASTER:
-            crypto_ecdsa_genpubkey(master_priv_key, pubkey_x, pubkey_y);
+        address_get(account, chain, address, pubkey_x, pubkey_y);
 
-            // Not returning chain codes for master keys
-            if (chaincode != NULL)  memset(chaincode, 0, KEY_BYTES);
+        // Not returning chain codes for address keys
+        if (chaincode != NULL)  memset(chaincode, 0, KEY_BYTES);
 
-            break;
+        return;
+    }
 
-        case KEY_ACCOUNT:
-            crypto_ecdsa_genpubkey(account_priv_key, pubkey_x, pubkey_y);
-            if (chaincode != NULL)  memcpy(chaincode, account_chain_code, KEY_BYTES);
-            break;
+    legacy_path(type, account, chain, address, &path);
 
-        case KEY_CHAIN:
-            crypto_ecdsa_genpubkey(chain_priv_key[chain], pubkey_x, pubkey_y);
-            if (chaincode != NULL)  memcpy(chaincode, chain_chain_code[chain], KEY_BYTES);
-            break;
+    wallet_path_public_key_get(&path, pubkey_x, pubkey_y, chaincode);
 
-        case KEY_ADDRESS:
+    // Not returning chain codes for master keys
+    if (KEY_MASTER == type && chaincode != NULL)  memset(chaincode, 0, KEY_BYTES);
+}
 
-            // Calculate the private key
-            wallet_private_key_get(chain_priv_key[chain],
-                                   chain_pub_key_compress[chain],
-                                   chain_chain_code[chain],
-                                   address,
-                                   priv_key,
-                                   NULL);
 
-            // Calculate the public key
-            crypto_ecdsa_genpubkey(priv_key, pubkey_x, pubkey_y);
+void wallet_address_hash160_get(const uint32_t account, const uint32_t chain, const uint32_t index, uint8_t *hash160)
+{
+    pool_addr_t *a;
+    uint8_t      pub_key_x[KEY_BYTES];
+    uint8_t      pub_key_y[KEY_BYTES];
 
-            // Not returning chain codes for address keys
-            if (chaincode != NULL)  memset(chaincode, 0, KEY_BYTES);
+    a = address_get(account, chain, index, pub_key_x, pub_key_y);
 
-            break;
+    if (NULL != a)
+    {
+        memcpy(hash160, a->hash160, HASH_ADDR_BYTES);
+    }
+    else
+    {
+        wallet_public_key_to_hash160(pub_key_x, pub_key_y, hash160);
+    }
+}
+
+
+bool wallet_pool_fill(void)
+{
+    unsigned      c, chain;
+    uint32_t      index;
+    wallet_path_t path;
+    uint8_t       pub_key_x[KEY_BYTES];
+    uint8_t       pub_key_y[KEY_BYTES];
+
+    if (0 == ws->master_seed_bytes)  return false;
+
+    // Top up the chain with the fewest unrequested addresses first
+    chain = WALLET_POOL_CHAINS;
+
+    for (c = 0; c < WALLET_POOL_CHAINS; c++)
+    {
+        pool_t *p = &ws->pool[c];
+
+        index = p->base + p->count;
+
+        if (p->count >= WALLET_POOL_ADDRS && 0 == p->used)  continue;
+        if (index & HARDENED_KEY)                          continue;
+
+        if (WALLET_POOL_CHAINS == chain || p->count - p->used < ws->pool[chain].count - ws->pool[chain].used)
+        {
+            chain = c;
+        }
+    }
+
+    if (WALLET_POOL_CHAINS == chain)  return false;
+
+    // One address per call keeps the main loop responsive
+    legacy_path(KEY_ADDRESS, ws->pool[chain].account, chain, ws->pool[chain].base + ws->pool[chain].count, &path);
+    wallet_path_public_key_get(&path, pub_key_x, pub_key_y, NULL);
+
+    pool_push(chain, pub_key_x, pub_key_y);
 
-        default:
-            assert(0);
+    return true;
+}
+
+
+void wallet_pool_stats(wallet_pool_stats_t *stats)
+{
+    unsigned c;
+
+    for (c = 0; c < WALLET_POOL_CHAINS; c++)
+    {
+        stats->depth[c] = ws->pool[c].count;
     }
+
+    stats->hits   = ws->pool_hits;
+    stats->misses = ws->pool_misses;
 }
 
 
@@ -162,18 +343,29 @@ void wallet_master_seed_set(const char *wordlist, const unsigned bytes)
     assert(bytes <= WORDLIST_MAX_CHARS);
     
     // Convert the 18 word mnemonic wordlist into 64 byte seed
-    crypto_pbkdf2_hmac256((uint8_t*)wordlist, bytes, "polly", sizeof("polly") - 1, SEED_ROUNDS, master_seed, sizeof(master_seed));
-    master_seed_bytes = MASTER_SEED_BYTES;
+    crypto_pbkdf2_hmac256((uint8_t*)wordlist, bytes, "polly", sizeof("polly") - 1, SEED_ROUNDS, ws->master_seed, sizeof(ws->master_seed));
+    ws->master_seed_bytes = MASTER_SEED_BYTES;
+
+    // Invalidate the wallet, keys are derived from the new seed on demand
+    seed_updated();
+}
+
+
+void wallet_master_seed_load(const uint8_t *seed, const unsigned bytes)
+{
+    assert(bytes <= MASTER_SEED_BYTES);
+
+    memcpy(ws->master_seed, seed, bytes);
+    ws->master_seed_bytes = bytes;
 
-    // Regenerate the wallet based on the new seed
     seed_updated();
 }
 
 
 void wallet_master_seed_get(uint8_t seed[MASTER_SEED_BYTES], unsigned *bytes)
 {
-    memcpy(seed, master_seed, master_seed_bytes);
-    *bytes = master_seed_bytes;
+    memcpy(seed, ws->master_seed, ws->master_seed_bytes);
+    *bytes = ws->master_seed_bytes;
 }
 
 
@@ -231,40 +423,297 @@ void wallet_base58_encode(const uint8_t *data, const unsigned data_bytes, char *
 
 static void seed_updated(void)
 {
-    unsigned i;
-    uint8_t hash[SHA512_BYTES];
-    uint8_t pub_key_x[KEY_BYTES];
-    uint8_t pub_key_y[KEY_BYTES];
-    uint8_t account_pub_key_compress[COMPRESS_KEY_BYTES];
+    // Drop everything derived from the previous seed
+    memset(ws->nodes, 0, sizeof(ws->nodes));
+    ws->node_stamp = 0;
+
+    memset(ws->pool, 0, sizeof(ws->pool));
+    ws->pool_hits   = 0;
+    ws->pool_misses = 0;
+}
+
+static pool_addr_t* pool_lookup(const uint32_t account, const uint32_t chain, const uint32_t index)
+{
+    pool_t   *p = &ws->pool[chain];
+    uint32_t  offset;
+
+    if (p->account != account)                          return NULL;
+    if (index < p->base || index - p->base >= p->count) return NULL;
+
+    // Nothing is dropped here, only marked requested for pool_push to reuse
+    offset = index - p->base;
+
+    if (offset >= p->used)  p->used = offset + 1;
+
+    return &p->addr[(p->head + offset) % WALLET_POOL_ADDRS];
+}
+
+static pool_addr_t* pool_push(const uint32_t chain, const uint8_t *pub_key_x, const uint8_t *pub_key_y)
+{
+    pool_t      *p = &ws->pool[chain];
+    pool_addr_t *a;
+
+    if (p->count >= WALLET_POOL_ADDRS)
+    {
+        // Full, make room by dropping the oldest entry
+        p->head = (p->head + 1) % WALLET_POOL_ADDRS;
+        p->base++;
+        p->count--;
+
+        if (p->used > 0)  p->used--;
+    }
 
-    // Assumes that the new seed is already copied into the masterSeed global
+    a = &p->addr[(p->head + p->count) % WALLET_POOL_ADDRS];
+
+    memcpy(a->pub_key_x, pub_key_x, KEY_BYTES);
+    memcpy(a->pub_key_y, pub_key_y, KEY_BYTES);
+    wallet_public_key_to_hash160(pub_key_x, pub_key_y, a->hash160);
+
+    p->count++;
+
+    return a;
+}
+
+//
+// Public key of an address, from the pool when it is there. Returns the pool
+// entry the key is in, NULL when the chain isn't pooled or the pool was kept.
+//
+static pool_addr_t* address_get(const uint32_t account, const uint32_t chain, const uint32_t index, uint8_t *pub_key_x, uint8_t *pub_key_y)
+{
+    pool_t        *p;
+    pool_addr_t   *a;
+    wallet_path_t  path;
+
+    if (chain >= WALLET_POOL_CHAINS)
+    {
+        legacy_path(KEY_ADDRESS, account, chain, index, &path);
+        wallet_path_public_key_get(&path, pub_key_x, pub_key_y, NULL);
+        return NULL;
+    }
+
+    p = &ws->pool[chain];
+    a = pool_lookup(account, chain, index);
+
+    if (NULL != a)
+    {
+        ws->pool_hits++;
+        p->stray = false;
+
+        memcpy(pub_key_x, a->pub_key_x, KEY_BYTES);
+        memcpy(pub_key_y, a->pub_key_y, KEY_BYTES);
+        return a;
+    }
+
+    ws->pool_misses++;
+
+    legacy_path(KEY_ADDRESS, account, chain, index, &path);
+    wallet_path_public_key_get(&path, pub_key_x, pub_key_y, NULL);
+
+    // The next address in line goes on the end, as an idle cycle would have put it
+    if (p->account == account && index == p->base + p->count)
+    {
+        a = pool_push(chain, pub_key_x, pub_key_y);
+        p->used  = p->count;
+        p->stray = false;
+        return a;
+    }
+
+    // Elsewhere the pool is only restarted once it has nothing unrequested left,
+    // or requests walk on from the previous miss, so out of order ones keep it
+    if (p->used < p->count && !(p->stray && p->stray_account == account && p->stray_index + 1 == index))
+    {
+        p->stray         = true;
+        p->stray_account = account;
+        p->stray_index   = index;
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(pool_t));
+    p->account = account;
+    p->base    = index;
+
+    a = pool_push(chain, pub_key_x, pub_key_y);
+    p->used = 1;
+
+    return a;
+}
+
+static unsigned node_root(void)
+{
+    wallet_node_t *n = &ws->nodes[ROOT_NODE];
+    uint8_t        hash[SHA512_BYTES];
+
+    n->stamp = ++ws->node_stamp;
+
+    if (n->used)  return ROOT_NODE;
+
+    // Keys are only requested once the wallet is unlocked
+    assert(0 != ws->master_seed_bytes);
 
     // Calculate the master private key (exponent) and master chain code
-    crypto_hmac512(masterSeedKey, sizeof(masterSeedKey) - 1, master_seed, master_seed_bytes, hash);
-    
-    memcpy(master_priv_key, hash, 32);
-	memcpy(master_chain_code, &hash[32], 32);
+    crypto_hmac512(masterSeedKey, sizeof(masterSeedKey) - 1, ws->master_seed, ws->master_seed_bytes, hash);
+
+    memcpy(n->priv_key, hash, KEY_BYTES);
+    memcpy(n->chain_code, &hash[KEY_BYTES], KEY_BYTES);
+
+    memset(hash, 0, sizeof(hash));
+
+    n->used   = true;
+    n->depth  = 0;
+    n->parent = ROOT_NODE;
+
+    return ROOT_NODE;
+}
+
+static unsigned node_find(const unsigned parent, const uint32_t index)
+{
+    unsigned i;
+
+    for (i = ROOT_NODE + 1; i < WALLET_CACHE_NODES; i++)
+    {
+        if (ws->nodes[i].used && ws->nodes[i].parent == parent && ws->nodes[i].index == index)
+        {
+            ws->nodes[i].stamp = ++ws->node_stamp;
+            return i;
+        }
+    }
+
+    return WALLET_CACHE_NODES;
+}
+
+static unsigned node_alloc(const unsigned parent)
+{
+    unsigned i, j;
+    unsigned victim = WALLET_CACHE_NODES;
+
+    for (i = ROOT_NODE + 1; i < WALLET_CACHE_NODES; i++)
+    {
+        if (!ws->nodes[i].used)  return i;
+
+        // Never evict the node being extended, or a node with children
+        if (i == parent)  continue;
+
+        for (j = ROOT_NODE + 1; j < WALLET_CACHE_NODES; j++)
+        {
+            if (ws->nodes[j].used && ws->nodes[j].parent == i)  break;
+        }
+
+        if (j != WALLET_CACHE_NODES)  continue;
+
+        if (WALLET_CACHE_NODES == victim || ws->nodes[i].stamp < ws->nodes[victim].stamp)
+        {
+            victim = i;
+        }
+    }
+
+    // The walk path holds at most WALLET_PATH_DEPTH_MAX slots, the rest always has a leaf
+    assert(victim != WALLET_CACHE_NODES);
+
+    memset(&ws->nodes[victim], 0, sizeof(wallet_node_t));
+
+    return victim;
+}
+
+static void node_child(const unsigned parent, const uint32_t index, uint8_t *priv_key, uint8_t *chain_code)
+{
+    wallet_node_t *p = &ws->nodes[parent];
+    uint32_t       index_swap;
+    uint8_t        data[DATA_BYTES];
+    uint8_t        pub_key_x[KEY_BYTES];
+    uint8_t        pub_key_y[KEY_BYTES];
+    uint8_t        hash[SHA512_BYTES];
+
+    index_swap = swap_uint32(index);
+
+    if (index & HARDENED_KEY)
+    {
+        // Hardened derivation
+        data[0] = 0;
+        memcpy(&data[1], p->priv_key, KEY_BYTES);
+    }
+    else
+    {
+        // Normal derivation, the parent public key is computed once and kept
+        if (!p->pub_valid)
+        {
+            crypto_ecdsa_genpubkey(p->priv_key, pub_key_x, pub_key_y);
+            wallet_public_key_compress(pub_key_x, pub_key_y, p->pub_key_compress);
+            p->pub_valid = true;
+        }
+
+        memcpy(data, p->pub_key_compress, COMPRESS_KEY_BYTES);
+    }
+
+    memcpy(&data[COMPRESS_KEY_BYTES], &index_swap, sizeof(uint32_t));
+
+    // The chain code key blocks are compressed once per parent
+    if (!p->mid_valid)
+    {
+        crypto_hmac512_midstate(p->chain_code, KEY_BYTES, &p->mid);
+        p->mid_valid = true;
+    }
+
+    crypto_hmac512_resume(&p->mid, data, DATA_BYTES, hash);
+
+    // I[L] tweaks the parent key, I[R] is the child's chain code
+    crypto_ecdsa_add256(hash, p->priv_key, priv_key);
+    memcpy(chain_code, &hash[KEY_BYTES], KEY_BYTES);
 
-	// Calculate the account keys
-	wallet_private_key_get(master_priv_key, NULL, master_chain_code, HARDENED_KEY | 0, account_priv_key, account_chain_code);
+    memset(hash, 0, sizeof(hash));
+    memset(data, 0, sizeof(data));
+}
 
-    crypto_ecdsa_genpubkey(account_priv_key, pub_key_x, pub_key_y);
-    wallet_public_key_compress(pub_key_x, pub_key_y, account_pub_key_compress);
+static unsigned node_walk(const wallet_path_t *path)
+{
+    unsigned       parent, child, level;
+    wallet_node_t *n;
 
+    parent = node_root();
 
-	// Calculate the chain keys
-    for (i = 0; i < CHAINS; i++)
+    // Follow the path down to the leaf's parent, filling in missing nodes
+    for (level = 0; level + 1 < path->depth; level++)
     {
-        wallet_private_key_get(account_priv_key, account_pub_key_compress, account_chain_code, i, chain_priv_key[i], chain_chain_code[i]);
+        child = node_find(parent, path->index[level]);
+
+        if (WALLET_CACHE_NODES == child)
+        {
+            child = node_alloc(parent);
+            n     = &ws->nodes[child];
+
+            node_child(parent, path->index[level], n->priv_key, n->chain_code);
+
+            n->used   = true;
+            n->depth  = level + 1;
+            n->parent = parent;
+            n->index  = path->index[level];
+            n->stamp  = ++ws->node_stamp;
+        }
 
-        crypto_ecdsa_genpubkey(chain_priv_key[i], pub_key_x, pub_key_y);
-        wallet_public_key_compress(pub_key_x, pub_key_y, chain_pub_key_compress[i]);
+        parent = child;
     }
 
-	/*
-    // Calculate the master public key, and calculate the compressed form
-    crypto_ecdsa_genpubkey(master_priv_key, master_pub_key_x, master_pub_key_y);
+    return parent;
+}
+
+static void legacy_path(const keytype_e type, const uint32_t account, const uint32_t chain, const uint32_t index, wallet_path_t *path)
+{
+    // Original layout is m/account'/chain/index, the key type is the depth
+    path->depth    = type;
+    path->index[0] = HARDENED_KEY | account;
+    path->index[1] = chain;
+    path->index[2] = index;
+}
+
+#if !HW_CC2538
+wallet_ctx_t* wallet_ctx_create(void)
+{
+    // All zero is the same state wallet_init leaves behind
+    return calloc(1, sizeof(wallet_ctx_t));
+}
 
-    wallet_public_key_compress(master_pub_key_x, master_pub_key_y, master_pub_key_compress);
-    */
+void wallet_ctx_destroy(wallet_ctx_t *ctx)
+{
+    memset(ctx, 0, sizeof(wallet_ctx_t));
+    free(ctx);
 }
+#endif
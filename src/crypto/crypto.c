@@ -14,30 +14,17 @@
 
 #define SHA256_BLOCK_BYTES 64
 
-struct sha256ctx
-{
-#if HW_CC2538
-    tSHA256State ctx;
-#else
-	SHA256Context ctx;
-#endif
-};
-
-sha256ctx_t streamctx;
-
 void crypto_init(void)
 {
 	ecdsa_init();
 }
 
-void crypto_sha256_reset(sha256ctx_t **ctx)
+void crypto_sha256_reset(sha256ctx_t *ctx)
 {
-	*ctx = &streamctx;
-
 #if HW_CC2538
-    SHA256Init(&streamctx.ctx);
+    SHA256Init(&ctx->ctx);
 #else
-	SHA256Reset(&streamctx.ctx);
+	SHA256Reset(&ctx->ctx);
 #endif
 }
 
@@ -146,6 +133,66 @@ void crypto_hmac512(const uint8_t *key, const uint32_t key_bytes, const uint8_t
 	hmacResult(&ctx, hash);
 }
 
+void crypto_hmac512_midstate(const uint8_t *key, const uint32_t key_bytes, hmac512mid_t *mid)
+{
+    unsigned      i;
+    SHA512Context ctx;
+    uint8_t       pad[HMAC512_BLOCK_BYTES];
+
+    // Keys are chain codes, never longer than a block
+    assert(key_bytes <= HMAC512_BLOCK_BYTES);
+
+    // Inner block, key ^ ipad
+    memset(pad, 0x36, sizeof(pad));
+
+    for (i = 0; i < key_bytes; i++)
+    {
+        pad[i] ^= key[i];
+    }
+
+    SHA512Reset(&ctx);
+    SHA512Input(&ctx, pad, sizeof(pad));
+    memcpy(mid->inner, ctx.Intermediate_Hash, sizeof(mid->inner));
+
+    // Outer block, key ^ opad
+    memset(pad, 0x5c, sizeof(pad));
+
+    for (i = 0; i < key_bytes; i++)
+    {
+        pad[i] ^= key[i];
+    }
+
+    SHA512Reset(&ctx);
+    SHA512Input(&ctx, pad, sizeof(pad));
+    memcpy(mid->outer, ctx.Intermediate_Hash, sizeof(mid->outer));
+
+    memset(pad, 0, sizeof(pad));
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+void crypto_hmac512_resume(const hmac512mid_t *mid, const uint8_t *msg, const uint32_t msg_bytes, uint8_t *hash)
+{
+    SHA512Context ctx;
+
+    // Pick up after the inner key block
+    SHA512Reset(&ctx);
+    memcpy(ctx.Intermediate_Hash, mid->inner, sizeof(mid->inner));
+    ctx.Length_Low = HMAC512_BLOCK_BYTES * 8;
+
+    SHA512Input(&ctx, msg, msg_bytes);
+    SHA512Result(&ctx, hash);
+
+    // Pick up after the outer key block
+    SHA512Reset(&ctx);
+    memcpy(ctx.Intermediate_Hash, mid->outer, sizeof(mid->outer));
+    ctx.Length_Low = HMAC512_BLOCK_BYTES * 8;
+
+    SHA512Input(&ctx, hash, SHA512_BYTES);
+    SHA512Result(&ctx, hash);
+
+    memset(&ctx, 0, sizeof(ctx));
+}
+
 void crypto_ripemd160(const uint8_t *msg, const uint32_t bytes, uint8_t *hash)
 {
     ripemd160(msg, bytes, hash);
@@ -161,6 +208,21 @@ unsigned crypto_ecdsa_sign(const uint8_t *exp, const uint8_t *sha256_hash, uint8
 	return ecdsa_sign(exp, sha256_hash, sig, sig_bytes);
 }
 
+bool crypto_ecdsa_sign_commit(const uint8_t *exp, const uint8_t *sha256_hash, uint8_t *k, uint8_t *r)
+{
+    return ecdsa_signCommit(exp, sha256_hash, k, r);
+}
+
+bool crypto_ecdsa_sign_finish(const uint8_t *const *exps, const uint8_t *sha256_hashes, const unsigned count, uint8_t *rs, uint8_t *work)
+{
+    return ecdsa_signFinish(exps, sha256_hashes, count, rs, work);
+}
+
+void crypto_ecdsa_der(const uint8_t *rs, uint8_t *sig, uint8_t *sig_bytes)
+{
+    ecdsa_derEncode(rs, sig, sig_bytes);
+}
+
 void crypto_ecdsa_add256(const uint8_t *a, const uint8_t *b, uint8_t *c)
 {
 	ecdsa_addMod(a, b, c);
@@ -246,7 +308,8 @@ void crypto_aes128_loadkey(uint8_t key[16], const unsigned keyslot)
 
 #else
 
-    BROKEN;
+    // No software fallback, host builds never touch the key store
+    assert(0);
 
 #endif
 }
@@ -263,7 +326,8 @@ void crypto_aes128_process(uint8_t *input, uint8_t *output, const unsigned bytes
 
 #else
 
-    BROKEN;
+    // No software fallback, host builds never touch the key store
+    assert(0);
 
 #endif
 }
@@ -277,7 +341,8 @@ void crypto_entropy_timer_reset(void)
 
 #else
 
-    BROKEN
+    // No hardware timer on the host
+    assert(0);
 
 #endif
 }
@@ -289,6 +354,10 @@ uint8_t crypto_entropy_timer_get(void)
     return TimerValueGet(GPTIMER0_BASE, GPTIMER_A) & 0xFF;
 
 #else
-    BROKEN
+
+    // No hardware timer on the host
+    assert(0);
+    return 0;
+
 #endif
 }
@@ -4,8 +4,16 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// HW accelerationof crypto ops
+// HW accelerationof crypto ops, host builds pass -DHW_CC2538=0
+#ifndef HW_CC2538
 #define HW_CC2538      1
+#endif
+
+#if HW_CC2538
+#include <sha256.h>
+#else
+#include <sha.h>
+#endif
 
 #define KEY_BYTES           32
 #define COMPRESS_KEY_BYTES  33
@@ -15,27 +23,52 @@
 
 #define SALT_MAX_BYTES      60
 
+#define HMAC512_BLOCK_BYTES 128
+
 typedef enum
 {
     AES_DECRYPT = 0,
     AES_ENCRYPT,
 } op_e;
 
-typedef struct sha256ctx sha256ctx_t;
+// Streaming SHA 256 state, owned by the caller so streams can run side by side
+typedef struct sha256ctx
+{
+#if HW_CC2538
+    tSHA256State ctx;
+#else
+    SHA256Context ctx;
+#endif
+} sha256ctx_t;
+
+//
+// HMAC-SHA512 midstate, the compressed inner (key ^ ipad) and outer (key ^ opad)
+// blocks. Lets repeated HMACs under the same key skip the two key blocks.
+//
+typedef struct
+{
+    uint64_t inner[SHA512_BYTES / 8];
+    uint64_t outer[SHA512_BYTES / 8];
+} hmac512mid_t;
 
 void     crypto_init            (void);
 
-void     crypto_sha256_reset    (sha256ctx_t **ctx);
+void     crypto_sha256_reset    (sha256ctx_t *ctx);
 void     crypto_sha256_input    (sha256ctx_t *ctx, const uint8_t *msg, const uint32_t bytes);
 void     crypto_sha256_result   (sha256ctx_t *ctx, uint8_t *hash);
 void     crypto_sha256          (const uint8_t *msg, const uint32_t bytes, uint8_t *hash);
 
 void     crypto_hmac512         (const uint8_t *key, const uint32_t key_bytes, const uint8_t *msg, const uint32_t msg_bytes, uint8_t *hash);
+void     crypto_hmac512_midstate(const uint8_t *key, const uint32_t key_bytes, hmac512mid_t *mid);
+void     crypto_hmac512_resume  (const hmac512mid_t *mid, const uint8_t *msg, const uint32_t msg_bytes, uint8_t *hash);
 
 void     crypto_ripemd160       (const uint8_t *msg, const uint32_t bytes, uint8_t *hash);
 
 void     crypto_ecdsa_genpubkey (const uint8_t *exp, uint8_t *x, uint8_t *y);
 unsigned crypto_ecdsa_sign      (const uint8_t *exp, const uint8_t *sha256_hash, uint8_t *sig, uint8_t *sig_bytes);
+bool     crypto_ecdsa_sign_commit(const uint8_t *exp, const uint8_t *sha256_hash, uint8_t *k, uint8_t *r);
+bool     crypto_ecdsa_sign_finish(const uint8_t *const *exps, const uint8_t *sha256_hashes, const unsigned count, uint8_t *rs, uint8_t *work);
+void     crypto_ecdsa_der       (const uint8_t *rs, uint8_t *sig, uint8_t *sig_bytes);
 void     crypto_ecdsa_add256    (const uint8_t *a, const uint8_t *b, uint8_t *c);
 
 void     crypto_pbkdf2_hmac256  (const uint8_t *password, const unsigned pass_bytes, const uint8_t *salt, const unsigned salt_bytes, const unsigned rounds, uint8_t *out, const unsigned out_bytes);
@@ -4,6 +4,10 @@
 #include <sha.h>
 #include <crypto.h>
 
+#if !HW_CC2538
+#include <stdlib.h>
+#endif
+
 // Modulus reduction methods
 #define MONTGOMERY     1
 
@@ -13,7 +17,7 @@
 #define PRECALC_M      1
 
 
-#ifdef HW_CC2538
+#if HW_CC2538
 
 #include <pka.h>
 #include <ecc_curveinfo.h>
@@ -76,12 +80,23 @@ static int bitIsOne (fp_int* v, int j);
 #endif
 
 #if !HW_CC2538
+//
+// Per-call temporaries for the point operations, kept on the caller's stack
+// so point multiplies can run concurrently on host threads
+//
+typedef struct
+{
+    fp_int  a, b, c, d, e, f, g, h;
+    point_t tmpInMem;
+} scratch_t;
+
+static void windowInit       (void);
 static void jacobianToAffine (point_t *r);
-static void pointAdd         (point_t *in1, point_t *in2, point_t *out);
-static void pointDouble      (point_t *in, point_t *out);
+static void pointAdd         (point_t *in1, const point_t *in2, point_t *out, scratch_t *s);
+static void pointDouble      (const point_t *in, point_t *out, scratch_t *s);
 #endif
 
-static void pointGenMul      (fp_int* v, point_t *r);
+static void pointGenMul      (fp_int* v, point_t *r, const bool affine);
 static bool generateK        (const uint8_t *privKey, const uint8_t *s256hash, fp_int *secretK);
 
 const curve_t secp256k1 = {
@@ -104,11 +119,11 @@ fp_digit mp;
 fp_int   mu;
 
 #if !HW_CC2538
-// Point double/add temp variables
-fp_int a, b, c, d, e, f, g, h;
-point_t tmpInMem;
-    
+// Generator in Montgomery form, read only after ecdsa_init
+point_t genMont;
+
  #if (1 == SLIDING_WINDOW)
+// Window table, kG for k == 8..15, read only after ecdsa_init
 point_t M[8];
  #endif
 
@@ -124,6 +139,30 @@ void ecdsa_init(void)
     fp_set       (&gen.z, 1);
 
     fp_div_2     (&or, &ordiv2);
+
+#if !HW_CC2538
+
+    fp_init(&genMont.x);
+    fp_init(&genMont.y);
+    fp_init(&genMont.z);
+
+ #if (1 == MONTGOMERY)
+    fp_init(&mu);
+
+    // Init Montgomery reduction once, the parameters never change
+    fp_montgomery_setup(&p, &mp);
+    fp_montgomery_calc_normalization(&mu, &p);
+
+    fp_mulmod(&gen.x, &mu, &p, &genMont.x);
+    fp_mulmod(&gen.y, &mu, &p, &genMont.y);
+    fp_mulmod(&gen.z, &mu, &p, &genMont.z);
+ #endif
+
+ #if (1 == SLIDING_WINDOW)
+    windowInit();
+ #endif
+
+#endif // !HW_CC2538
 }    
 
 #if (1 == DOUBLE_ADD)
@@ -162,9 +201,9 @@ int bitIsOne(fp_int* v, int j)
 #endif
 
 #if !HW_CC2538
-void pointAdd(point_t *in1, point_t *in2, point_t *out)
+void pointAdd(point_t *in1, const point_t *in2, point_t *out, scratch_t *s)
 {    
-    point_t *pIn1, *pIn2;
+    const point_t *pIn1, *pIn2;
 
     // z = 0 is the point at 'infinity'
     if (fp_cmp_d(&in1->z, 0) == FP_EQ)
@@ -185,21 +224,21 @@ void pointAdd(point_t *in1, point_t *in2, point_t *out)
     // Handle in == out cases
     if (in1 == out)
     {
-        fp_copy(&in1->x, &tmpInMem.x);
-        fp_copy(&in1->y, &tmpInMem.y);
-        fp_copy(&in1->z, &tmpInMem.z);
+        fp_copy(&in1->x, &s->tmpInMem.x);
+        fp_copy(&in1->y, &s->tmpInMem.y);
+        fp_copy(&in1->z, &s->tmpInMem.z);
 
-        pIn1 = &tmpInMem;
+        pIn1 = &s->tmpInMem;
         pIn2 = in2;
     }
     else if (in2 == out)
     {
-        fp_copy(&in2->x, &tmpInMem.x);
-        fp_copy(&in2->y, &tmpInMem.y);
-        fp_copy(&in2->z, &tmpInMem.z);
+        fp_copy(&in2->x, &s->tmpInMem.x);
+        fp_copy(&in2->y, &s->tmpInMem.y);
+        fp_copy(&in2->z, &s->tmpInMem.z);
 
         pIn1 = in1;
-        pIn2 = &tmpInMem;
+        pIn2 = &s->tmpInMem;
     }
     else
     {
@@ -211,52 +250,52 @@ void pointAdd(point_t *in1, point_t *in2, point_t *out)
     // http://www.hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-0.html#addition-add-2007-bl
    
     // A = Z1^2
-    fp_sqr(&pIn1->z, &a);
-    mod(&a);
+    fp_sqr(&pIn1->z, &s->a);
+    mod(&s->a);
     
     // B = Z2^2
-    fp_sqr(&pIn2->z, &b);
-    mod(&b);
+    fp_sqr(&pIn2->z, &s->b);
+    mod(&s->b);
     
     // C = X1*B
-    fp_mul(&pIn1->x, &b, &c);
-    mod(&c);
+    fp_mul(&pIn1->x, &s->b, &s->c);
+    mod(&s->c);
         
     // D = X2*A
-    fp_mul(&pIn2->x, &a, &d);
-    mod(&d);
+    fp_mul(&pIn2->x, &s->a, &s->d);
+    mod(&s->d);
     
     // E = Z2*B
-    fp_mul(&pIn2->z, &b, &e);
-    mod(&e);
+    fp_mul(&pIn2->z, &s->b, &s->e);
+    mod(&s->e);
 
     // E = Y1*E
-    fp_mul(&pIn1->y, &e, &e);
-    mod(&e);
+    fp_mul(&pIn1->y, &s->e, &s->e);
+    mod(&s->e);
 
     // F = Z1*A
-    fp_mul(&pIn1->z, &a, &f);
-    mod(&f);
+    fp_mul(&pIn1->z, &s->a, &s->f);
+    mod(&s->f);
 
     // F = Y2*F
-    fp_mul(&pIn2->y, &f, &f);
-    mod(&f);
+    fp_mul(&pIn2->y, &s->f, &s->f);
+    mod(&s->f);
 
     // D  = D-C
-    fp_sub(&d, &c, &d);
-    mod_sub(&d);
+    fp_sub(&s->d, &s->c, &s->d);
+    mod_sub(&s->d);
 
     // G  = 2*D
-    fp_add(&d, &d, &g);
-    mod_add(&g);
+    fp_add(&s->d, &s->d, &s->g);
+    mod_add(&s->g);
     
     // G  = G^2
-    fp_sqr(&g, &g);
-    mod(&g);
+    fp_sqr(&s->g, &s->g);
+    mod(&s->g);
 
     // H  = D*G
-    fp_mul(&d, &g, &h);
-    mod(&h);
+    fp_mul(&s->d, &s->g, &s->h);
+    mod(&s->h);
 
     // Z3 = Z1+Z2
     fp_add(&pIn1->z, &pIn2->z, &out->z);
@@ -267,70 +306,70 @@ void pointAdd(point_t *in1, point_t *in2, point_t *out)
     mod(&out->z);
 
     // Z3 = Z3-A
-    fp_sub(&out->z, &a, &out->z);
+    fp_sub(&out->z, &s->a, &out->z);
     mod_sub(&out->z);
 
     // Z3 = Z3-B
-    fp_sub(&out->z, &b, &out->z);
+    fp_sub(&out->z, &s->b, &out->z);
     mod_sub(&out->z);
 
     // Z3 = Z3*D
-    fp_mul(&out->z, &d, &out->z);
+    fp_mul(&out->z, &s->d, &out->z);
     mod(&out->z);
 
     // A  = F-E
-    fp_sub(&f, &e, &a);
-    mod_sub(&a);    
+    fp_sub(&s->f, &s->e, &s->a);
+    mod_sub(&s->a);    
     
     // A  = 2*A
-    fp_add(&a, &a, &a);
-    mod_add(&a);
+    fp_add(&s->a, &s->a, &s->a);
+    mod_add(&s->a);
 
     // B  = C*G
-    fp_mul(&c, &g, &b);
-    mod(&b);
+    fp_mul(&s->c, &s->g, &s->b);
+    mod(&s->b);
     
     // X3 = A^2
-    fp_sqr(&a, &out->x);
+    fp_sqr(&s->a, &out->x);
     mod(&out->x);
 
     // C  = 2*B
-    fp_add(&b, &b, &c);
-    mod_add(&c);
+    fp_add(&s->b, &s->b, &s->c);
+    mod_add(&s->c);
         
     // X3 = X3-H
-    fp_sub(&out->x, &h, &out->x);
+    fp_sub(&out->x, &s->h, &out->x);
     mod_sub(&out->x);    
     
     // X3 = X3-C
-    fp_sub(&out->x, &c, &out->x);
+    fp_sub(&out->x, &s->c, &out->x);
     mod_sub(&out->x);   
     
     // Y3 = B-X3
-    fp_sub(&b, &out->x, &out->y);
+    fp_sub(&s->b, &out->x, &out->y);
     mod_sub(&out->y);    
     
     // E  = E*H
-    fp_mul(&e, &h, &e);
-    mod(&e);    
+    fp_mul(&s->e, &s->h, &s->e);
+    mod(&s->e);    
     
     // E  = 2*E
-    fp_add(&e, &e, &e);
-    mod_add(&e);    
+    fp_add(&s->e, &s->e, &s->e);
+    mod_add(&s->e);    
     
     // Y3 = A*Y3
-    fp_mul(&a, &out->y, &out->y);
+    fp_mul(&s->a, &out->y, &out->y);
     mod(&out->y);    
         
     // Y3 = Y3-E
-    fp_sub(&out->y, &e, &out->y);
+    fp_sub(&out->y, &s->e, &out->y);
     mod_sub(&out->y);   
 }
 
 
-void pointDouble(point_t *in, point_t *out)
+void pointDouble(const point_t *in, point_t *out, scratch_t *s)
 {
-    point_t* pIn;
+    const point_t* pIn;
         
     // z = 0 is the point at 'infinity'
     if (fp_cmp_d(&in->z, 0) == FP_EQ)
@@ -344,11 +383,11 @@ void pointDouble(point_t *in, point_t *out)
     // Handle in == out case
     if (in == out)
     {
-        fp_copy(&in->x, &tmpInMem.x);
-        fp_copy(&in->y, &tmpInMem.y);
-        fp_copy(&in->z, &tmpInMem.z);
+        fp_copy(&in->x, &s->tmpInMem.x);
+        fp_copy(&in->y, &s->tmpInMem.y);
+        fp_copy(&in->z, &s->tmpInMem.z);
 
-        pIn = &tmpInMem;
+        pIn = &s->tmpInMem;
     }
     else
     {
@@ -359,83 +398,83 @@ void pointDouble(point_t *in, point_t *out)
     // http://www.hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-0.html#doubling-dbl-2009-l
     
     // A = X1^2
-    fp_sqr(&pIn->x, &a);
-    mod(&a);
+    fp_sqr(&pIn->x, &s->a);
+    mod(&s->a);
 
     // B = Y1^2
-    fp_sqr(&pIn->y, &b);
-    mod(&b);
+    fp_sqr(&pIn->y, &s->b);
+    mod(&s->b);
         
     // C = B^2
-    fp_sqr(&b, &c);
-    mod(&c);
+    fp_sqr(&s->b, &s->c);
+    mod(&s->c);
     
     // D = X1+B
-    fp_add(&pIn->x, &b, &d);
-    mod_add(&d);
+    fp_add(&pIn->x, &s->b, &s->d);
+    mod_add(&s->d);
     
     // D = D^2
-    fp_sqr(&d, &d);
-    mod(&d);  
+    fp_sqr(&s->d, &s->d);
+    mod(&s->d);  
 
     // D = D-A
-    fp_sub(&d, &a, &d);
-    mod_sub(&d);
+    fp_sub(&s->d, &s->a, &s->d);
+    mod_sub(&s->d);
             
     // D = D-C
-    fp_sub(&d, &c, &d);
-    mod_sub(&d);
+    fp_sub(&s->d, &s->c, &s->d);
+    mod_sub(&s->d);
     
     // D = 2*D
-    fp_add(&d, &d, &d);
-    mod_add(&d);
+    fp_add(&s->d, &s->d, &s->d);
+    mod_add(&s->d);
 
     // E = 3*A
     // Note Montgomery reduction requires addition not single digit multiplication here!
-    fp_add(&a, &a, &e);
-    mod_add(&e);
-    fp_add(&a, &e, &e);
-    mod_add(&e);
+    fp_add(&s->a, &s->a, &s->e);
+    mod_add(&s->e);
+    fp_add(&s->a, &s->e, &s->e);
+    mod_add(&s->e);
 
     // A = E^2
-    fp_sqr(&e, &a);
-    mod(&a);
+    fp_sqr(&s->e, &s->a);
+    mod(&s->a);
 
     // X3 = 2*D
-    fp_add(&d, &d, &out->x);
+    fp_add(&s->d, &s->d, &out->x);
     mod_add(&out->x);
     
     // X3 = A-X3
-    fp_sub(&a, &out->x, &out->x);
+    fp_sub(&s->a, &out->x, &out->x);
     mod_sub(&out->x);
     
     // Y3 = D-X3
-    fp_sub(&d, &out->x, &out->y);
+    fp_sub(&s->d, &out->x, &out->y);
     mod_sub(&out->y);
 
     // A = 8*C
     // Note Montgomery reduction requires addition not single digit multiplication here!
-    fp_add(&c, &c, &a);
-    mod_add(&a);
-    fp_add(&c, &a, &a);
-    mod_add(&a);
-    fp_add(&c, &a, &a);
-    mod_add(&a);
-    fp_add(&c, &a, &a);
-    mod_add(&a);
-    fp_add(&c, &a, &a);
-    mod_add(&a);
-    fp_add(&c, &a, &a);
-    mod_add(&a);
-    fp_add(&c, &a, &a);
-    mod_add(&a);
+    fp_add(&s->c, &s->c, &s->a);
+    mod_add(&s->a);
+    fp_add(&s->c, &s->a, &s->a);
+    mod_add(&s->a);
+    fp_add(&s->c, &s->a, &s->a);
+    mod_add(&s->a);
+    fp_add(&s->c, &s->a, &s->a);
+    mod_add(&s->a);
+    fp_add(&s->c, &s->a, &s->a);
+    mod_add(&s->a);
+    fp_add(&s->c, &s->a, &s->a);
+    mod_add(&s->a);
+    fp_add(&s->c, &s->a, &s->a);
+    mod_add(&s->a);
     
     // Y3 = E*Y3
-    fp_mul(&e, &out->y, &out->y);
+    fp_mul(&s->e, &out->y, &out->y);
     mod(&out->y);
     
     // Y3 = Y3-A
-    fp_sub(&out->y, &a, &out->y);
+    fp_sub(&out->y, &s->a, &out->y);
     mod_sub(&out->y);
     
     // Z3 = Y1*Z1
@@ -479,80 +518,19 @@ void jacobianToAffine(point_t *inout)
 }
 #endif // !HW_CC2538
 
-void pointGenMul(fp_int* scalar, point_t *out)
-{   
-#if HW_CC2538
-
-	tECPt      point;
-	uint32_t   loc;
-
-	point.pui32X = out->x.dp;
-	point.pui32Y = out->y.dp;
-
-	PKAECCMultGenPtStart(scalar->dp, (tECCCurveInfo*)&secp256k1_hw, &loc);
-
-	while (PKA_STATUS_OPERATION_INPRG == PKAGetOpsStatus());
-
-	PKAECCMultGenPtGetResult(&point, loc);
-
-	out->x.used = KEY_BYTES / 4;
-	out->y.used = KEY_BYTES / 4;
-
-	out->x.sign = 0;
-	out->y.sign = 0;
-
-#else
-
-    static point_t tU; 
-    
-    fp_init(&tU.x);
-    fp_init(&tU.y);
-    fp_init(&tU.z);
-        
-#if (1 == MONTGOMERY)
-
-    fp_init(&mu);
-        
-    // Init Montgomery reduction
-    fp_montgomery_setup(&p, &mp);
-    fp_montgomery_calc_normalization(&mu, &p); 
-    
-    fp_mulmod(&gen.x, &mu, &p, &tU.x);
-    fp_mulmod(&gen.y, &mu, &p, &tU.y);
-    fp_mulmod(&gen.z, &mu, &p, &tU.z);
+#if !HW_CC2538 && (1 == SLIDING_WINDOW)
+void windowInit(void)
+{
+#if (0 == PRECALC_M)
+    scratch_t s;
+    int       j;
 #endif
+    int       i;
 
-#if (1 == DOUBLE_ADD)
-
-    static point_t qq;
-    int j, maxBits;
-
-    // Q starts at infinity
-    fp_set(&qq.x, 0);
-    fp_set(&qq.y, 0);
-    fp_set(&qq.z, 0);
-
-    maxBits = msbOne(scalar);
-    
-    for (j = 0; j <= maxBits; j++)
-    {
-        if (bitIsOne(scalar, j) > 0)
-        {
-            pointAdd(&qq, &tU, &qq);
-        }            
-   
-        pointDouble(&tU, &tU);
-    }
-
-    fp_copy(&qq.x, &out->x);
-    fp_copy(&qq.y, &out->y);
-    fp_copy(&qq.z, &out->z);
-
-#elif (1 == SLIDING_WINDOW)
+#if (0 == PRECALC_M)
+    memset(&s, 0, sizeof(s));
+#endif
 
-    int i, j, first, bitbuf, bitcpy, bitcnt, mode, digidx;
-    fp_digit buf;
-    
     for (i = 0; i < 8; i++) 
     {
         fp_init(&M[i].x);
@@ -794,17 +772,85 @@ void pointGenMul(fp_int* scalar, point_t *out)
 
     // calc the M tab, which holds kG for k==8..15
     // M[0] == 8G
-    pointDouble(&tU, &M[0]);
-    pointDouble(&M[0], &M[0]);
-    pointDouble(&M[0], &M[0]);
+    pointDouble(&genMont, &M[0], &s);
+    pointDouble(&M[0], &M[0], &s);
+    pointDouble(&M[0], &M[0], &s);
     
     // now find (8+k)G for k=1..7
     for (j = 9; j < 16; j++) 
     {
-        pointAdd(&M[j-9], &tU, &M[j-8]);
+        pointAdd(&M[j-9], &genMont, &M[j-8], &s);
     } 
        
 #endif
+}
+#endif
+
+void pointGenMul(fp_int* scalar, point_t *out, const bool affine)
+{   
+#if HW_CC2538
+
+	tECPt      point;
+	uint32_t   loc;
+
+	point.pui32X = out->x.dp;
+	point.pui32Y = out->y.dp;
+
+	PKAECCMultGenPtStart(scalar->dp, (tECCCurveInfo*)&secp256k1_hw, &loc);
+
+	while (PKA_STATUS_OPERATION_INPRG == PKAGetOpsStatus());
+
+	PKAECCMultGenPtGetResult(&point, loc);
+
+	out->x.used = KEY_BYTES / 4;
+	out->y.used = KEY_BYTES / 4;
+
+	out->x.sign = 0;
+	out->y.sign = 0;
+
+#else
+
+    scratch_t s;
+
+#if (1 == DOUBLE_ADD)
+
+    point_t tU, qq;
+    int j, maxBits;
+
+    memset(&s, 0, sizeof(s));
+
+    fp_copy(&genMont.x, &tU.x);
+    fp_copy(&genMont.y, &tU.y);
+    fp_copy(&genMont.z, &tU.z);
+
+    // Q starts at infinity
+    fp_set(&qq.x, 0);
+    fp_set(&qq.y, 0);
+    fp_set(&qq.z, 0);
+
+    maxBits = msbOne(scalar);
+    
+    for (j = 0; j <= maxBits; j++)
+    {
+        if (bitIsOne(scalar, j) > 0)
+        {
+            pointAdd(&qq, &tU, &qq, &s);
+        }            
+   
+        pointDouble(&tU, &tU, &s);
+    }
+
+    fp_copy(&qq.x, &out->x);
+    fp_copy(&qq.y, &out->y);
+    fp_copy(&qq.z, &out->z);
+
+#elif (1 == SLIDING_WINDOW)
+
+    int i, j, first, bitbuf, bitcpy, bitcnt, mode, digidx;
+    fp_digit buf;
+
+    // tfm trusts the used count of its outputs, start the temporaries out clean
+    memset(&s, 0, sizeof(s));
 
     // setup sliding window
     mode   = 0;
@@ -841,7 +887,7 @@ void pointGenMul(fp_int* scalar, point_t *out)
         // if the bit is zero and mode == 1 then we double
         if (mode == 1 && i == 0) 
         {
-            pointDouble(out, out);
+            pointDouble(out, out, &s);
             continue;
         }
 
@@ -867,11 +913,11 @@ void pointGenMul(fp_int* scalar, point_t *out)
                 // double first
                 for (j = 0; j < WINSIZE; j++) 
                 {
-                    pointDouble(out, out);
+                    pointDouble(out, out, &s);
                 }
                 
                 // then add, bitbuf will be 8..15 [8..2^WINSIZE] guaranteed
-                pointAdd(out, &M[bitbuf-8], out);
+                pointAdd(out, &M[bitbuf-8], out, &s);
             }
             
             // empty window and reset
@@ -889,7 +935,7 @@ void pointGenMul(fp_int* scalar, point_t *out)
             // only double if we have had at least one add first
             if (first == 0) 
             {
-                pointDouble(out, out);
+                pointDouble(out, out, &s);
             }
              
             bitbuf <<= 1;
@@ -898,15 +944,15 @@ void pointGenMul(fp_int* scalar, point_t *out)
                 if (first == 1)
                 {
                     // first add, so copy
-                    fp_copy(&tU.x, &out->x);
-                    fp_copy(&tU.y, &out->y);
-                    fp_copy(&tU.z, &out->z);
+                    fp_copy(&genMont.x, &out->x);
+                    fp_copy(&genMont.y, &out->y);
+                    fp_copy(&genMont.z, &out->z);
                     first = 0;
                 } 
                 else 
                 {
                     // then add
-                    pointAdd(out, &tU, out);
+                    pointAdd(out, &genMont, out, &s);
                 }
             }
         }
@@ -916,8 +962,8 @@ void pointGenMul(fp_int* scalar, point_t *out)
 #error "Pick a point multiplication method"
 #endif
 
-    // Remap to affine coordinates
-    jacobianToAffine(out);
+    // Remap to affine coordinates, batch callers do this themselves
+    if (affine)  jacobianToAffine(out);
 
 #endif // HW_CC2538
 
@@ -1011,101 +1057,184 @@ bool generateK(const uint8_t *privKey, const uint8_t *s256hash, fp_int *secretK)
 
 unsigned ecdsa_sign(const uint8_t *privKey, const uint8_t *s256hash, uint8_t *sig, uint8_t *sigBytes)
 {
-    point_t pt;
-    fp_int  k, r, s, pk, hash;
-    unsigned bytes;
+    uint8_t rs[2 * KEY_BYTES];
+    uint8_t work[KEY_BYTES];
+    bool    ok;
 
-    fp_read_unsigned_bin(&pk, privKey, KEY_BYTES);
-    fp_read_unsigned_bin(&hash, s256hash, SHA256HashSize);
+    // A batch of one
+    ok = ecdsa_signCommit(privKey, s256hash, &rs[KEY_BYTES], rs) &&
+         ecdsa_signFinish(&privKey, s256hash, 1, rs, work);
+
+    if (ok)
+    {
+        ecdsa_derEncode(rs, sig, sigBytes);
+
+        // Signature type = SIGHASH_ALL, not part of the DER length
+        sig[(*sigBytes)++] = 0x01;
+    }
+
+    memset(rs, 0, sizeof(rs));
+
+    return ok ? 0 : 1;
+}
+
+//
+// First half of a signature, the nonce and r. Batches commit to every
+// signature before finishing any, so they share one inversion of the nonces.
+//
+bool ecdsa_signCommit(const uint8_t *privKey, const uint8_t *s256hash, uint8_t *k, uint8_t *r)
+{
+    point_t pt;
+    fp_int  kk, rr;
+    bool    ok = false;
 
     // Use deterministic values of 'k' to prevent problems with RNG attacks - see RFC 6979
-    if (generateK(privKey, s256hash, &k) == false)  return 1;
+    if (generateK(privKey, s256hash, &kk) == false)  goto done;
 
     // Calculate the curve point
-    pointGenMul(&k, &pt);
+    pointGenMul(&kk, &pt, true);
 
     // Calculate r
-    fp_mod(&pt.x, &or, &r);
+    fp_mod(&pt.x, &or, &rr);
 
-    if (fp_iszero(&r))  return 1;
-    
-    // Calculate s
-    fp_invmod(&k, &or, &k);
-    fp_mulmod(&r, &pk, &or, &s); 
-    fp_add(&hash, &s, &s);
+    if (fp_iszero(&rr))  goto done;
 
-    if (fp_cmp(&s, &or) != FP_LT)
-    {
-        fp_sub(&s, &or, &s);
-    }
+    fp_to_unsigned_bin_full(&kk, k);
+    fp_to_unsigned_bin_full(&rr, r);
 
-    fp_mulmod(&k, &s, &or, &s);
-    
-    if (fp_iszero(&s))  return 1;
+    ok = true;
 
-    // Ensure that 's' is even - see https://bitcointalk.org/index.php?topic=285142.msg3295518#msg3295518
-    if (fp_cmp(&s, &ordiv2) == FP_GT)
-    {
-        fp_sub(&or, &s, &s);
-    }
-            
-    //
-    // Finally, DER encode the signature
-    //
-    
-    sig[0] = 0x30;
-    sig[1] = 0x00; // The overall length, will fill in at the end
-    sig[2] = 0x02; // First component, the r value
+done:
+    memset(&kk, 0, sizeof(kk));
+    memset(&pt, 0, sizeof(pt));
 
-    *sigBytes = 3;
-    
-    // DER encoded numbers are 2's complement, must add 0x00 byte to r/s with leading byte >= 0x80 
-    bytes = fp_count_bytes(&r);
-    
-    if (fp_isbitset(&r, (bytes * 8) - 1))
+    return ok;
+}
+
+//
+// Second half of count signatures. rs holds r then k for each signature on
+// the way in, r then s on the way out. The nonces are inverted together
+// with Montgomery's trick, work takes KEY_BYTES per signature of running
+// products and is wiped before returning.
+//
+bool ecdsa_signFinish(const uint8_t *const *privKeys, const uint8_t *s256hashes, const unsigned count, uint8_t *rs, uint8_t *work)
+{
+    fp_int   k, inv, kinv, t, r, pk, hash, s;
+    unsigned i;
+    bool     ok = true;
+
+    assert(count > 0);
+
+    // Running products of the nonces
+    for (i = 0; i < count; i++)
     {
-        sig[(*sigBytes)++] = bytes + 1;
-        sig[(*sigBytes)++] = 0x00;
+        fp_read_unsigned_bin(&k, &rs[(2 * i + 1) * KEY_BYTES], KEY_BYTES);
+
+        if (i > 0)
+        {
+            fp_read_unsigned_bin(&t, &work[(i - 1) * KEY_BYTES], KEY_BYTES);
+            fp_mulmod(&t, &k, &or, &k);
+        }
 
-        fp_to_unsigned_bin(&r, &sig[*sigBytes]);
+        fp_to_unsigned_bin_full(&k, &work[i * KEY_BYTES]);
     }
-    else
+
+    // One inversion for the whole batch
+    fp_read_unsigned_bin(&t, &work[(count - 1) * KEY_BYTES], KEY_BYTES);
+    fp_invmod(&t, &or, &inv);
+
+    for (i = count; i-- > 0; )
     {
-        sig[(*sigBytes)++] = bytes;
+        fp_read_unsigned_bin(&k, &rs[(2 * i + 1) * KEY_BYTES], KEY_BYTES);
 
-        fp_to_unsigned_bin(&r, &sig[*sigBytes]);
-    }
+        // 1/k for this one, and 1/(k0..ki-1) for the next one down
+        if (i > 0)
+        {
+            fp_read_unsigned_bin(&t, &work[(i - 1) * KEY_BYTES], KEY_BYTES);
+            fp_mulmod(&inv, &t, &or, &kinv);
+            fp_mulmod(&inv, &k, &or, &inv);
+        }
+        else
+        {
+            fp_copy(&inv, &kinv);
+        }
 
-    *sigBytes += bytes;
+        fp_read_unsigned_bin(&r,    &rs[2 * i * KEY_BYTES],           KEY_BYTES);
+        fp_read_unsigned_bin(&pk,   privKeys[i],                      KEY_BYTES);
+        fp_read_unsigned_bin(&hash, &s256hashes[i * SHA256HashSize],  SHA256HashSize);
 
-    // DER encoded numbers are 2's complement, must add 0x00 byte to r/s with leading byte >= 0x80 
-    sig[(*sigBytes)++] = 0x02; // Second component, the s value
+        // Calculate s
+        fp_mulmod(&r, &pk, &or, &s);
+        fp_add(&hash, &s, &s);
 
-    bytes = fp_count_bytes(&s);
+        if (fp_cmp(&s, &or) != FP_LT)
+        {
+            fp_sub(&s, &or, &s);
+        }
 
-    if (fp_isbitset(&s, (bytes * 8) - 1))
-    {
-        sig[(*sigBytes)++] = bytes + 1;
-        sig[(*sigBytes)++] = 0x00;
+        fp_mulmod(&kinv, &s, &or, &s);
+
+        if (fp_iszero(&s))  ok = false;
 
-        fp_to_unsigned_bin(&s, &sig[*sigBytes]);
+        // Ensure that 's' is even - see https://bitcointalk.org/index.php?topic=285142.msg3295518#msg3295518
+        if (fp_cmp(&s, &ordiv2) == FP_GT)
+        {
+            fp_sub(&or, &s, &s);
+        }
+
+        fp_to_unsigned_bin_full(&s, &rs[(2 * i + 1) * KEY_BYTES]);
     }
-    else
+
+    memset(work, 0, count * KEY_BYTES);
+    memset(&k,    0, sizeof(k));
+    memset(&inv,  0, sizeof(inv));
+    memset(&kinv, 0, sizeof(kinv));
+    memset(&t,    0, sizeof(t));
+    memset(&pk,   0, sizeof(pk));
+
+    return ok;
+}
+
+//
+// DER encodes r then s, each KEY_BYTES big endian, without a signature type
+//
+void ecdsa_derEncode(const uint8_t *rs, uint8_t *sig, uint8_t *sigBytes)
+{
+    const uint8_t *x;
+    unsigned       part, skip, bytes;
+
+    sig[0] = 0x30;
+    sig[1] = 0x00; // The overall length, will fill in at the end
+
+    *sigBytes = 2;
+
+    for (part = 0; part < 2; part++)
     {
-        sig[(*sigBytes)++] = bytes;
+        x = &rs[part * KEY_BYTES];
 
-        fp_to_unsigned_bin(&s, &sig[*sigBytes]);
-    }
+        for (skip = 0; skip < KEY_BYTES - 1 && 0 == x[skip]; skip++);
 
-    *sigBytes += bytes;
+        bytes = KEY_BYTES - skip;
 
-    sig[(*sigBytes)++] = 0x01; // Signature type = SIGHASH_ALL
+        sig[(*sigBytes)++] = 0x02; // r, then s
 
-    // Enter in the final length of all the DER encoded stuff, 
-    // minus the header, length byte, and signature type
-    sig[1] = *sigBytes - 3;
-    
-    return 0; 
+        // DER encoded numbers are 2's complement, must add 0x00 byte to r/s with leading byte >= 0x80 
+        if (x[skip] & 0x80)
+        {
+            sig[(*sigBytes)++] = bytes + 1;
+            sig[(*sigBytes)++] = 0x00;
+        }
+        else
+        {
+            sig[(*sigBytes)++] = bytes;
+        }
+
+        memcpy(&sig[*sigBytes], &x[skip], bytes);
+        *sigBytes += bytes;
+    }
+
+    // Enter in the final length of all the DER encoded stuff, minus the header and length byte
+    sig[1] = *sigBytes - 2;
 }
 
 void reverse_stream(uint8_t *x, const uint32_t bytes)
@@ -1141,7 +1270,7 @@ void ecdsa_genPublicKey(uint8_t *pubKeyX, uint8_t *pubKeyY, const uint8_t* expon
     fp_read_unsigned_bin(&exp, exponent, KEY_BYTES);
 
     // Calculate the public key 
-    pointGenMul(&exp, &out);
+    pointGenMul(&exp, &out, true);
 
     // Convert to byte stream    
     assert (fp_count_bits(&out.x) <= (KEY_BYTES * 8));
@@ -1167,3 +1296,124 @@ void ecdsa_addMod(const uint8_t *inA, const uint8_t *inB, uint8_t *out)
 	
     fp_to_unsigned_bin_full(&bigA, out);
 }
+
+#if !HW_CC2538
+bool ecdsa_decompress(const uint8_t *compressed, uint8_t *pubKeyY)
+{
+    fp_int x, y, e, t;
+
+    fp_init(&x);
+    fp_init(&y);
+    fp_init(&e);
+    fp_init(&t);
+
+    if (compressed[0] != 0x02 && compressed[0] != 0x03)  return false;
+
+    fp_read_unsigned_bin(&x, &compressed[1], KEY_BYTES);
+
+    if (fp_cmp(&x, &p) != FP_LT)  return false;
+
+    // y^2 = x^3 + 7
+    fp_sqrmod(&x, &p, &t);
+    fp_mulmod(&t, &x, &p, &t);
+    fp_add_d (&t, 7, &t);
+    fp_mod   (&t, &p, &t);
+
+    // p == 3 mod 4, so the root is (y^2)^((p + 1) / 4)
+    fp_add_d (&p, 1, &e);
+    fp_div_2d(&e, 2, &e, NULL);
+    fp_exptmod(&t, &e, &p, &y);
+
+    // Not on the curve
+    fp_sqrmod(&y, &p, &e);
+    if (fp_cmp(&e, &t) != FP_EQ)  return false;
+
+    // Pick the root with the requested parity
+    if ((fp_isodd(&y) ? 0x03 : 0x02) != compressed[0])
+    {
+        fp_sub(&p, &y, &y);
+    }
+
+    fp_to_unsigned_bin_full(&y, pubKeyY);
+
+    return true;
+}
+
+void ecdsa_batchTweakAdd(const uint8_t *pubKeyX, const uint8_t *pubKeyY, const uint8_t *tweaks, const unsigned count, uint8_t *outX, uint8_t *outY)
+{
+    scratch_t  s;
+    point_t    base, *pt;
+    fp_int     k, inv, zinv, t0, t1, *prefix;
+    unsigned   i;
+
+    assert(count > 0);
+
+    // tfm trusts the used count of its outputs, start everything out clean
+    memset(&s,    0, sizeof(s));
+    memset(&base, 0, sizeof(base));
+    fp_init(&k);
+    fp_init(&inv);
+    fp_init(&zinv);
+    fp_init(&t0);
+    fp_init(&t1);
+
+    pt     = calloc(count, sizeof(point_t));
+    prefix = calloc(count, sizeof(fp_int));
+
+    assert(NULL != pt && NULL != prefix);
+
+    // Base point into Montgomery form, z == 1 is mu
+    fp_read_unsigned_bin(&t0, pubKeyX, KEY_BYTES);
+    fp_read_unsigned_bin(&t1, pubKeyY, KEY_BYTES);
+    fp_mulmod(&t0, &mu, &p, &base.x);
+    fp_mulmod(&t1, &mu, &p, &base.y);
+    fp_copy  (&mu, &base.z);
+
+    // Tweak * G + base for every point, left in Jacobian coordinates
+    for (i = 0; i < count; i++)
+    {
+        fp_read_unsigned_bin(&k, &tweaks[i * KEY_BYTES], KEY_BYTES);
+
+        pointGenMul(&k, &pt[i], false);
+        pointAdd(&pt[i], &base, &pt[i], &s);
+
+        // Map z back to normal and keep the running product
+        fp_montgomery_reduce(&pt[i].z, &p, mp);
+
+        if (0 == i)  fp_copy(&pt[i].z, &prefix[i]);
+        else         fp_mulmod(&prefix[i - 1], &pt[i].z, &p, &prefix[i]);
+    }
+
+    // One inversion for the whole batch (Montgomery's trick)
+    fp_invmod(&prefix[count - 1], &p, &inv);
+
+    for (i = count; i-- > 0; )
+    {
+        if (i > 0)
+        {
+            fp_mulmod(&inv, &prefix[i - 1], &p, &zinv);
+            fp_mulmod(&inv, &pt[i].z, &p, &inv);
+        }
+        else
+        {
+            fp_copy(&inv, &zinv);
+        }
+
+        // 1/z^2 and 1/z^3, then the same remap as jacobianToAffine
+        fp_sqrmod(&zinv, &p, &t1);
+        fp_mulmod(&zinv, &t1, &p, &t0);
+
+        fp_mul(&pt[i].x, &t1, &pt[i].x);
+        mod(&pt[i].x);
+
+        fp_mul(&pt[i].y, &t0, &pt[i].y);
+        mod(&pt[i].y);
+
+        fp_to_unsigned_bin_full(&pt[i].x, &outX[i * KEY_BYTES]);
+        fp_to_unsigned_bin_full(&pt[i].y, &outY[i * KEY_BYTES]);
+    }
+
+    free(pt);
+    free(prefix);
+}
+#endif
@@ -3,10 +3,20 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <crypto.h>
 
 void     ecdsa_init         (void);
 void     ecdsa_genPublicKey (uint8_t *pubKeyX, uint8_t *pubKeyY, const uint8_t* exponent);
 unsigned ecdsa_sign         (const uint8_t *privKey, const uint8_t *s256hash, uint8_t *sig, uint8_t *sigBytes);
+bool     ecdsa_signCommit   (const uint8_t *privKey, const uint8_t *s256hash, uint8_t *k, uint8_t *r);
+bool     ecdsa_signFinish   (const uint8_t *const *privKeys, const uint8_t *s256hashes, const unsigned count, uint8_t *rs, uint8_t *work);
+void     ecdsa_derEncode    (const uint8_t *rs, uint8_t *sig, uint8_t *sigBytes);
 void     ecdsa_addMod       (const uint8_t *inA, const uint8_t *inB, uint8_t *out);
 
+#if !HW_CC2538
+// Software only, for host tools
+bool     ecdsa_decompress   (const uint8_t *compressed, uint8_t *pubKeyY);
+void     ecdsa_batchTweakAdd(const uint8_t *pubKeyX, const uint8_t *pubKeyY, const uint8_t *tweaks, const unsigned count, uint8_t *outX, uint8_t *outY);
+#endif
+
 #endif
@@ -0,0 +1,511 @@
+//
+// Host address export, regenerates a range of receive or change addresses.
+//
+// Starts from an account level xpub (public derivation) or a test seed (the
+// device's m/account'/chain/index layout) and writes one line per address:
+//
+//   <index> <hash160 hex> <base58 address>
+//
+// The range is cut into blocks that are dealt out to per-thread deques, idle
+// threads steal half of the largest remaining deque. Each block gets its
+// child points from a single batched affine normalization. Output goes out in
+// index order one window of blocks at a time, so memory stays bounded for any
+// range. Addresses go through wallet_base58_encode, the same as the device.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0 -pthread
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/addrgen.c src/core/ctx.c src/core/wallet/wallet.c
+//       src/crypto/crypto.c src/crypto/ecdsa/ecdsa.c src/crypto/sha/*.c
+//       src/crypto/ripemd160/*.c $(find src/crypto/tfm -name '*.c') -o addrgen
+//
+// Usage: addrgen (-x xpub | -s seed hex [-a account]) [-c chain] [-f first]
+//                [-n count] [-t threads] [-o file] [-v]
+//
+// -v re-derives every address through the wallet's private key path and
+// compares, seed mode only.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <ctx.h>
+#include <wallet.h>
+#include <crypto.h>
+#include <ecdsa.h>
+#include <cmd.h>
+
+#define BLOCK_ADDRS       256
+#define WINDOW_BLOCKS     16   // Per thread
+#define HASH160_BYTES     20
+#define BASE58_ADDR_BYTES 34   // Fixed width, as the device prints them
+#define RECORD_BYTES      (10 + 1 + (HASH160_BYTES * 2) + 1 + BASE58_ADDR_BYTES + 1)
+
+#define XPUB_BYTES        78
+#define XPUB_CHARS        111  // Upper bound, real ones are 111 or less
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    unsigned        lo;        // Next block the owner takes
+    unsigned        hi;        // One past the last block, thieves take from here
+} deque_t;
+
+typedef struct
+{
+    // Chain node every address hangs off
+    uint8_t            chain_x[KEY_BYTES];
+    uint8_t            chain_y[KEY_BYTES];
+    hmac512mid_t       chain_mid;
+    uint8_t            chain_compress[COMPRESS_KEY_BYTES];
+
+    // Range
+    uint32_t           first;
+    uint32_t           count;
+
+    // Current window
+    uint32_t           window_first;
+    unsigned           window_blocks;
+    char              *out;
+    unsigned          *out_bytes;
+
+    unsigned           threads;
+    deque_t           *deques;
+    pthread_barrier_t  start;
+    pthread_barrier_t  done;
+    volatile bool      quit;
+
+    // Verification
+    bool               verify;
+    uint8_t            seed[MASTER_SEED_BYTES];
+    unsigned           seed_bytes;
+    uint32_t           account;
+    uint32_t           chain;
+    unsigned long      mismatches;
+} job_t;
+
+typedef struct
+{
+    pthread_t  thread;
+    unsigned   id;
+    job_t     *job;
+} worker_t;
+
+
+static const char base58[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: addrgen (-x xpub | -s seed hex [-a account]) [-c chain] [-f first] [-n count] [-t threads] [-o file] [-v]\n");
+    exit(2);
+}
+
+static uint32_t be32(const uint8_t *b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static bool xpub_decode(const char *str, uint8_t *chain_code, uint8_t *pub_key_compress)
+{
+    uint8_t  raw[XPUB_BYTES + 4];
+    uint8_t  hash[SHA256_BYTES];
+    unsigned i, j, carry;
+    const char *c;
+
+    memset(raw, 0, sizeof(raw));
+
+    // Base58 to a big endian number, byte at a time
+    for (c = str; *c; c++)
+    {
+        const char *d = strchr(base58, *c);
+
+        if (NULL == d)  return false;
+
+        carry = d - base58;
+
+        for (j = sizeof(raw); j-- > 0; )
+        {
+            carry += raw[j] * 58;
+            raw[j] = carry & 0xFF;
+            carry >>= 8;
+        }
+
+        if (carry)  return false;
+    }
+
+    crypto_sha256(raw, XPUB_BYTES, hash);
+    crypto_sha256(hash, SHA256_BYTES, hash);
+
+    if (memcmp(hash, &raw[XPUB_BYTES], 4))  return false;
+
+    // Only mainnet public (0x0488B21E) extended keys
+    if (0x0488B21E != be32(raw))  return false;
+
+    // version 4, depth 1, fingerprint 4, child 4, chain code 32, key 33
+    memcpy(chain_code, &raw[13], KEY_BYTES);
+    memcpy(pub_key_compress, &raw[45], COMPRESS_KEY_BYTES);
+
+    for (i = 0; i < sizeof(raw); i++)  raw[i] = 0;
+
+    return true;
+}
+
+static void child_tweak(const hmac512mid_t *mid, const uint8_t *parent_compress, const uint32_t index, uint8_t *tweak, uint8_t *chain_code)
+{
+    uint8_t data[COMPRESS_KEY_BYTES + 4];
+    uint8_t hash[SHA512_BYTES];
+
+    memcpy(data, parent_compress, COMPRESS_KEY_BYTES);
+    data[COMPRESS_KEY_BYTES + 0] = index >> 24;
+    data[COMPRESS_KEY_BYTES + 1] = index >> 16;
+    data[COMPRESS_KEY_BYTES + 2] = index >> 8;
+    data[COMPRESS_KEY_BYTES + 3] = index;
+
+    crypto_hmac512_resume(mid, data, sizeof(data), hash);
+
+    memcpy(tweak, hash, KEY_BYTES);
+    if (NULL != chain_code)  memcpy(chain_code, &hash[KEY_BYTES], KEY_BYTES);
+}
+
+static unsigned block_run(job_t *job, const unsigned block, char *out)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    uint8_t   tweaks[BLOCK_ADDRS * KEY_BYTES];
+    uint8_t   xs[BLOCK_ADDRS * KEY_BYTES];
+    uint8_t   ys[BLOCK_ADDRS * KEY_BYTES];
+    uint8_t   addr[HASH160_BYTES + 1];
+    char      b58[BASE58_ADDR_BYTES];
+    uint32_t  first, count, i, j;
+    unsigned  bytes = 0;
+
+    first = job->window_first + block * BLOCK_ADDRS;
+
+    // Past the end of the range, the batch add needs at least one key
+    if (first >= job->first + job->count)  return 0;
+
+    count = job->first + job->count - first;
+    if (count > BLOCK_ADDRS)  count = BLOCK_ADDRS;
+
+    for (i = 0; i < count; i++)
+    {
+        child_tweak(&job->chain_mid, job->chain_compress, first + i, &tweaks[i * KEY_BYTES], NULL);
+    }
+
+    ecdsa_batchTweakAdd(job->chain_x, job->chain_y, tweaks, count, xs, ys);
+
+    for (i = 0; i < count; i++)
+    {
+        addr[0] = 0x00;
+        wallet_public_key_to_hash160(&xs[i * KEY_BYTES], &ys[i * KEY_BYTES], &addr[1]);
+        wallet_base58_encode(addr, sizeof(addr), b58, sizeof(b58));
+
+        bytes += sprintf(&out[bytes], "%u ", first + i);
+
+        for (j = 0; j < HASH160_BYTES; j++)
+        {
+            out[bytes++] = hex[addr[1 + j] >> 4];
+            out[bytes++] = hex[addr[1 + j] & 0xF];
+        }
+
+        out[bytes++] = ' ';
+        memcpy(&out[bytes], b58, BASE58_ADDR_BYTES);
+        bytes += BASE58_ADDR_BYTES;
+        out[bytes++] = '\n';
+
+        if (job->verify)
+        {
+            uint8_t x[KEY_BYTES], y[KEY_BYTES];
+
+            // Private derivation, the device's path
+            wallet_public_key_get(KEY_ADDRESS, job->account, job->chain, first + i, x, y, NULL);
+
+            if (memcmp(x, &xs[i * KEY_BYTES], KEY_BYTES) || memcmp(y, &ys[i * KEY_BYTES], KEY_BYTES))
+            {
+                __atomic_add_fetch(&job->mismatches, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    return bytes;
+}
+
+static bool block_take(job_t *job, const unsigned id, unsigned *block)
+{
+    deque_t  *own = &job->deques[id];
+    deque_t  *victim;
+    unsigned  i, best, left, take;
+
+    pthread_mutex_lock(&own->lock);
+
+    if (own->lo < own->hi)
+    {
+        *block = own->lo++;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+
+    pthread_mutex_unlock(&own->lock);
+
+    // Out of work, steal half of the fullest deque from its far end
+    for (;;)
+    {
+        best = job->threads;
+        left = 0;
+
+        for (i = 0; i < job->threads; i++)
+        {
+            unsigned n;
+
+            if (i == id)  continue;
+
+            pthread_mutex_lock(&job->deques[i].lock);
+            n = job->deques[i].hi - job->deques[i].lo;
+            pthread_mutex_unlock(&job->deques[i].lock);
+
+            if (n > left)
+            {
+                left = n;
+                best = i;
+            }
+        }
+
+        if (job->threads == best)  return false;
+
+        victim = &job->deques[best];
+
+        pthread_mutex_lock(&victim->lock);
+
+        left = victim->hi - victim->lo;
+
+        if (0 == left)
+        {
+            // Someone beat us to it, look again
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+
+        take = (left + 1) / 2;
+        victim->hi -= take;
+
+        pthread_mutex_lock(&own->lock);
+        own->lo = victim->hi;
+        own->hi = victim->hi + take;
+        *block  = own->lo++;
+        pthread_mutex_unlock(&own->lock);
+
+        pthread_mutex_unlock(&victim->lock);
+
+        return true;
+    }
+}
+
+static void* worker(void *arg)
+{
+    worker_t   *w   = arg;
+    job_t      *job = w->job;
+    polly_ctx_t ctx;
+    unsigned    block;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.wallet = wallet_ctx_create();
+    polly_ctx_set(&ctx);
+
+    if (job->verify)
+    {
+        wallet_master_seed_load(job->seed, job->seed_bytes);
+    }
+
+    for (;;)
+    {
+        pthread_barrier_wait(&job->start);
+
+        if (job->quit)  break;
+
+        while (block_take(job, w->id, &block))
+        {
+            job->out_bytes[block] = block_run(job, block, &job->out[block * BLOCK_ADDRS * RECORD_BYTES]);
+        }
+
+        pthread_barrier_wait(&job->done);
+    }
+
+    wallet_ctx_destroy(ctx.wallet);
+
+    return NULL;
+}
+
+static unsigned hex_decode(const char *str, uint8_t *out, const unsigned max)
+{
+    unsigned i, bytes = strlen(str) / 2;
+
+    if (strlen(str) % 2 || bytes > max || 0 == bytes)  usage();
+
+    for (i = 0; i < bytes; i++)
+    {
+        if (1 != sscanf(&str[i * 2], "%2hhx", &out[i]))  usage();
+    }
+
+    return bytes;
+}
+
+int main(int argc, char **argv)
+{
+    job_t         job;
+    worker_t     *w;
+    polly_ctx_t   ctx;
+    const char   *xpub = NULL, *seed = NULL, *path = NULL;
+    FILE         *f = stdout;
+    uint8_t       chain_code[KEY_BYTES];
+    uint8_t       tweak[KEY_BYTES];
+    uint8_t       acct_x[KEY_BYTES], acct_y[KEY_BYTES];
+    uint8_t       acct_compress[COMPRESS_KEY_BYTES];
+    hmac512mid_t  acct_mid;
+    wallet_path_t wp;
+    unsigned      i, blocks, per;
+    int           opt;
+
+    memset(&job, 0, sizeof(job));
+    job.count   = 1000;
+    job.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while (-1 != (opt = getopt(argc, argv, "x:s:a:c:f:n:t:o:v")))
+    {
+        switch (opt)
+        {
+            case 'x': xpub        = optarg;                         break;
+            case 's': seed        = optarg;                         break;
+            case 'a': job.account = strtoul(optarg, NULL, 0);       break;
+            case 'c': job.chain   = strtoul(optarg, NULL, 0);       break;
+            case 'f': job.first   = strtoul(optarg, NULL, 0);       break;
+            case 'n': job.count   = strtoul(optarg, NULL, 0);       break;
+            case 't': job.threads = strtoul(optarg, NULL, 0);       break;
+            case 'o': path        = optarg;                         break;
+            case 'v': job.verify  = true;                           break;
+            default:  usage();
+        }
+    }
+
+    if ((NULL == xpub) == (NULL == seed))                     usage();
+    if (job.verify && NULL == seed)                           usage();
+    if (0 == job.threads || 0 == job.count)                   usage();
+    if (job.chain & HARDENED_KEY)                             usage();
+    if ((uint64_t)job.first + job.count > HARDENED_KEY)       usage();
+
+    crypto_init();
+
+    // Work out the chain node every address hangs off
+    if (NULL != xpub)
+    {
+        if (strlen(xpub) > XPUB_CHARS || !xpub_decode(xpub, chain_code, acct_compress))
+        {
+            fprintf(stderr, "addrgen: bad xpub\n");
+            return 1;
+        }
+
+        memcpy(acct_x, &acct_compress[1], KEY_BYTES);
+
+        if (!ecdsa_decompress(acct_compress, acct_y))
+        {
+            fprintf(stderr, "addrgen: xpub key is not on the curve\n");
+            return 1;
+        }
+
+        // account / chain by public derivation
+        crypto_hmac512_midstate(chain_code, KEY_BYTES, &acct_mid);
+        child_tweak(&acct_mid, acct_compress, job.chain, tweak, chain_code);
+        ecdsa_batchTweakAdd(acct_x, acct_y, tweak, 1, job.chain_x, job.chain_y);
+    }
+    else
+    {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.wallet = wallet_ctx_create();
+        polly_ctx_set(&ctx);
+
+        job.seed_bytes = hex_decode(seed, job.seed, sizeof(job.seed));
+        wallet_master_seed_load(job.seed, job.seed_bytes);
+
+        wp.depth    = 2;
+        wp.index[0] = HARDENED_KEY | job.account;
+        wp.index[1] = job.chain;
+
+        wallet_path_public_key_get(&wp, job.chain_x, job.chain_y, chain_code);
+
+        wallet_ctx_destroy(ctx.wallet);
+    }
+
+    wallet_public_key_compress(job.chain_x, job.chain_y, job.chain_compress);
+    crypto_hmac512_midstate(chain_code, KEY_BYTES, &job.chain_mid);
+
+    if (NULL != path && NULL == (f = fopen(path, "w")))
+    {
+        perror("addrgen");
+        return 1;
+    }
+
+    // Workers and the window buffers
+    job.deques    = calloc(job.threads, sizeof(deque_t));
+    job.out       = malloc((size_t)job.threads * WINDOW_BLOCKS * BLOCK_ADDRS * RECORD_BYTES);
+    job.out_bytes = calloc(job.threads * WINDOW_BLOCKS, sizeof(unsigned));
+    w             = calloc(job.threads, sizeof(worker_t));
+
+    pthread_barrier_init(&job.start, NULL, job.threads + 1);
+    pthread_barrier_init(&job.done,  NULL, job.threads + 1);
+
+    for (i = 0; i < job.threads; i++)
+    {
+        pthread_mutex_init(&job.deques[i].lock, NULL);
+
+        w[i].id  = i;
+        w[i].job = &job;
+        pthread_create(&w[i].thread, NULL, worker, &w[i]);
+    }
+
+    for (job.window_first = job.first; job.window_first - job.first < job.count; )
+    {
+        blocks = (job.first + job.count - job.window_first + BLOCK_ADDRS - 1) / BLOCK_ADDRS;
+        if (blocks > job.threads * WINDOW_BLOCKS)  blocks = job.threads * WINDOW_BLOCKS;
+
+        job.window_blocks = blocks;
+
+        // Deal out contiguous runs, stealing evens out the rest
+        per = (blocks + job.threads - 1) / job.threads;
+
+        for (i = 0; i < job.threads; i++)
+        {
+            job.deques[i].lo = i * per < blocks ? i * per : blocks;
+            job.deques[i].hi = (i + 1) * per < blocks ? (i + 1) * per : blocks;
+        }
+
+        pthread_barrier_wait(&job.start);
+        pthread_barrier_wait(&job.done);
+
+        for (i = 0; i < blocks; i++)
+        {
+            fwrite(&job.out[i * BLOCK_ADDRS * RECORD_BYTES], 1, job.out_bytes[i], f);
+        }
+
+        job.window_first += blocks * BLOCK_ADDRS;
+    }
+
+    job.quit = true;
+    pthread_barrier_wait(&job.start);
+
+    for (i = 0; i < job.threads; i++)
+    {
+        pthread_join(w[i].thread, NULL);
+    }
+
+    if (f != stdout)  fclose(f);
+
+    if (job.verify)
+    {
+        fprintf(stderr, "addrgen: %lu mismatches against private derivation\n", job.mismatches);
+    }
+
+    return job.mismatches ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+//
+// Build time report of the command arena in cmd.c.
+//
+// The command families share one arena, sized by the compiler to the largest
+// of them and held to ARENA_BYTES_MAX by asserts in cmd.c. This prints what
+// each family takes, the arena itself and the whole command context, for the
+// compiler and flags it is built with. cmd.c is built right into it since
+// the types are private there, nothing of cmd.c is run.
+//
+// Sizes follow the host ABI, pointers and 64 bit alignment can make them a
+// little larger than on the device. VAL_STATS reports the device's own.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       -Isrc/cc2538_bootloader/bootloader -Isrc/cc2538/driver/source -Isrc/cc2538/driver/inc
+//       -ffunction-sections -fdata-sections -Wl,--gc-sections
+//       tools/host/arena_layout.c -o arena_layout
+//
+// Usage: arena_layout
+//
+
+#include <stdio.h>
+
+#include "../../src/core/cmd/cmd.c"
+
+static void row(const char *name, const size_t bytes)
+{
+    printf("  %-14s %6u  %5.1f%%%s\n", name, (unsigned) bytes, 100.0 * bytes / ARENA_BYTES_MAX,
+           bytes == sizeof(cmdArena_t) ? "  largest" : "");
+}
+
+int main(void)
+{
+    const signPhase_t *sign = NULL;
+
+    printf("arena            %6u of %u bytes, %u left\n", (unsigned) sizeof(cmdArena_t), ARENA_BYTES_MAX,
+           (unsigned) (ARENA_BYTES_MAX - sizeof(cmdArena_t)));
+
+    row("sign",    sizeof(signPhase_t));
+    row("fwdl",    sizeof(fwdl_info_t));
+    row("digests", sizeof(digestRun_t));
+
+    printf("sign phase\n");
+    printf("  info           %6u\n", (unsigned) sizeof(sign->info));
+    printf("  prevtx         %6u\n", (unsigned) sizeof(sign->prevtx));
+    printf("  sha contexts   %6u\n", (unsigned) (sizeof(sign->ptxHash) + sizeof(sign->txHash) + sizeof(sign->prefixHash)));
+
+    printf("command context  %6u, %u outside the arena\n", (unsigned) sizeof(struct cmd_ctx),
+           (unsigned) (sizeof(struct cmd_ctx) - sizeof(cmdArena_t)));
+
+    return 0;
+}
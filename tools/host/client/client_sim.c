@@ -0,0 +1,390 @@
+//
+// Host library against the simulator transport.
+//
+// The device end runs the real command parser on its own thread, with a
+// stand-in handler for IDENTIFY, SIGN_TX, PREV_TX and GET_SIGNED_TX that
+// checks what it is sent but signs nothing. Packets take the given latency to
+// cross either way. First identify and status requests are sent mixed and
+// checked against what comes back, status replies overtaking included. Then
+// a whole signing flow runs stop and wait, one command at a time as the old
+// host did, and pipelined, and the two are timed with the per command stats.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0 -pthread
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       -Itools/host/client tools/host/client/client_sim.c tools/host/client/pollyhost.c
+//       tools/host/client/transport.c src/core/link/link.c src/core/cmd/cmdparser.c
+//       src/core/ctx.c -o client_sim
+//
+// Usage: client_sim [-i inputs] [-l latency us] [-c device us per packet]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <ctx.h>
+#include <cmdparser.h>
+#include <screen.h>
+#include <pollyhost.h>
+#include <util.h>
+
+#define OUTPUTS            2
+#define PREV_TX_MIN_BYTES  200
+#define PREV_TX_MAX_BYTES  700
+#define MIXED_REQS         24
+#define POLL_MS            2
+
+// Device end, only touched on the simulator thread
+static polly_ctx_t  dev_ctx;
+static uint8_t      dev_resp[1 + 16 + MAX_INPUTS * 148 + OUTPUTS * 34];
+static unsigned     dev_inputs;
+static uint32_t     dev_session;
+static uint32_t     dev_covered;    // Bit n, input n had its prev tx
+static bool         dev_bad;
+static unsigned     dev_polls;
+static unsigned     dev_cost_us;
+
+static unsigned     inputs  = 16;
+static unsigned     latency = 1000;
+
+
+//
+// Device end
+//
+
+void screen_rx(light_e state) { (void)state; }
+void screen_tx(light_e state) { (void)state; }
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static unsigned resp_gen(uint8_t *dest, const unsigned offset, const unsigned bytes)
+{
+    memcpy(dest, &dev_resp[offset], bytes);
+    return bytes;
+}
+
+static uint8_t prev_tx_byte(const unsigned input, const unsigned i)
+{
+    return (input * 131) ^ (i * 7) ^ (i >> 8);
+}
+
+static void dev_init(void)
+{
+    memset(&dev_ctx, 0, sizeof(dev_ctx));
+    dev_ctx.parser = parser_ctx_create();
+    polly_ctx_set(&dev_ctx);
+    cmdparser_init();
+
+    dev_inputs  = 0;
+    dev_covered = 0;
+    dev_polls   = 0;
+}
+
+static resp_e sign_tx(const unsigned bytes, int *resp_bytes)
+{
+    dev_covered = 0;
+    dev_polls   = 0;
+    dev_session++;
+    dev_bad    |= (SIGN_TX_BYTES(dev_inputs, OUTPUTS, 1) != bytes);
+
+    memcpy(&dev_resp[1], &dev_session, sizeof(dev_session));
+    *resp_bytes = SIGN_TX_RESP_BYTES;
+
+    return RESP_NEW;
+}
+
+resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes, resp_gen_f *resp_gen_out)
+{
+    static unsigned  input, pos;
+    static uint8_t   stream_cmd;
+    const uint8_t   *d = (const uint8_t *) cmd;
+    uint64_t         t;
+    int              i;
+    identifyResp_t   id;
+
+    (void)resp;
+
+    *resp_bytes   = SMALL_RESP_BYTES;
+    *resp_gen_out = resp_gen;
+    dev_resp[0]   = CMD_ACK_SUCCESS;
+
+    // What the device would spend on each packet of a stream
+    for (t = now_us(); streaming && now_us() - t < dev_cost_us; );
+
+    if (streaming && start)
+    {
+        stream_cmd = d[0];
+        pos        = 0;
+    }
+
+    if (streaming && CMD_SIGN_TX == stream_cmd)
+    {
+        // Many outputs, only the size is checked
+        if (start)  dev_inputs = d[1];
+
+        pos += chunk_bytes;
+
+        if (pos < (unsigned) total_bytes)  return RESP_NONE;
+
+        return sign_tx(total_bytes, resp_bytes);
+    }
+
+    if (streaming && CMD_PREV_TX == stream_cmd)
+    {
+        // One header entry, then the tx, every byte is checked
+        if (start)
+        {
+            dev_bad |= (1 != d[1]);
+
+            input = d[2];
+            d    += 1 + 1 + sizeof(prevTxHeader_t);
+            i     = chunk_bytes - (1 + 1 + sizeof(prevTxHeader_t));
+        }
+        else
+        {
+            i = chunk_bytes;
+        }
+
+        for (; i > 0; i--, pos++)  dev_bad |= (*d++ != prev_tx_byte(input, pos));
+
+        if (pos + 1 + 1 + sizeof(prevTxHeader_t) < (size_t) total_bytes)  return RESP_NONE;
+
+        if (input < dev_inputs)  dev_covered |= 1u << input;
+        else                     dev_bad      = true;
+
+        return RESP_NEW;
+    }
+
+    if (streaming)
+    {
+        // Answered once, at the end
+        pos += chunk_bytes;
+
+        if (pos < (unsigned) total_bytes)  return RESP_NONE;
+
+        dev_resp[0] = CMD_ACK_INVALID;
+        return RESP_NEW;
+    }
+
+    switch (cmd->cmd)
+    {
+        case CMD_IDENTIFY:
+            memset(&id, 0, sizeof(id));
+            memcpy(id.model, "sim", 3);
+            id.protocol         = PROTOCOL_VERSION;
+            id.stream_max_bytes = STREAM_MAX_BYTES;
+            id.pipeline_depth   = PACKET_QUEUE_DEPTH;
+            memcpy(&dev_resp[1], &id, sizeof(id));
+            *resp_bytes = ID_RESP_BYTES;
+            break;
+
+        case CMD_STATUS:
+            // Reaches the main loop while the last reply is still on its way
+            dev_resp[0] = CMD_ACK_STATUS;
+            cmdparser_status_read((statusResp_t *) &dev_resp[1]);
+            *resp_bytes = STATUS_RESP_BYTES;
+            break;
+
+        case CMD_SIGN_TX:
+            dev_inputs = d[1];
+            return sign_tx(total_bytes, resp_bytes);
+
+        case CMD_GET_SIGNED_TX:
+            // The user looks at it, then it is signed
+            if (0 == dev_inputs || dev_covered != (uint32_t) ((1ull << dev_inputs) - 1))
+            {
+                dev_resp[0] = CMD_ACK_INVALID;
+            }
+            else if (dev_polls++ < 2)
+            {
+                dev_resp[0] = (1 == dev_polls) ? CMD_ACK_USER : CMD_ACK_BUSY;
+            }
+            else
+            {
+                *resp_bytes = 1 + 10 + dev_inputs * 148 + OUTPUTS * 34;
+                for (i = 1; i < *resp_bytes; i++)  dev_resp[i] = i;
+            }
+            break;
+
+        default:
+            dev_resp[0] = CMD_ACK_INVALID;
+            break;
+    }
+
+    return RESP_NEW;
+}
+
+
+//
+// Host end
+//
+
+// Status and identify requests mixed, each has to get its own kind of response
+static bool check_mixed(ph_t *h)
+{
+    static const uint8_t identify = CMD_IDENTIFY, status = CMD_STATUS;
+    static phReq_t       req[MIXED_REQS];
+    static uint8_t       resp[MIXED_REQS][ID_RESP_BYTES];
+    bool                 ok = true;
+    unsigned             i;
+
+    for (i = 0; i < MIXED_REQS; i++)
+    {
+        ph_submit(h, &req[i], (i % 3) ? &identify : &status, SMALL_BYTES, false, resp[i], sizeof(resp[i]));
+    }
+
+    for (i = 0; i < MIXED_REQS; i++)
+    {
+        ph_wait(h, &req[i]);
+
+        if (PH_OK != req[i].status)
+        {
+            printf("request %u: %s\n", i, ph_strerror(req[i].status));
+            ok = false;
+        }
+        else if ((i % 3) ? (CMD_ACK_SUCCESS != resp[i][0] || ID_RESP_BYTES != req[i].respBytes)
+                         : (CMD_ACK_STATUS != resp[i][0] || STATUS_RESP_BYTES != req[i].respBytes))
+        {
+            printf("request %u: got %u, %u bytes\n", i, resp[i][0], req[i].respBytes);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static int sign_flow(ph_t *h, unsigned *tx_bytes)
+{
+    static phInput_t      in[MAX_INPUTS];
+    static phOutput_t     out[OUTPUTS];
+    static phPrevTx_t     ptx[MAX_INPUTS];
+    static prevTxHeader_t header[MAX_INPUTS];
+    static uint8_t        tx[MAX_INPUTS][PREV_TX_MAX_BYTES];
+    static uint8_t        signed_tx[sizeof(dev_resp)];
+    phInput_t             change = { 0, 1, 7, { 0 } };
+    uint32_t              session;
+    unsigned              i, j;
+    int                   status;
+
+    for (i = 0; i < inputs; i++)
+    {
+        in[i].account = 0;
+        in[i].chain   = 0;
+        in[i].keyid   = i;
+        memset(in[i].pubkey, 0x02 + i, sizeof(in[i].pubkey));
+
+        header[i].inputIdx  = i;
+        header[i].outputIdx = i % 3;
+
+        ptx[i].tx            = tx[i];
+        ptx[i].txBytes       = PREV_TX_MIN_BYTES + (i * 97) % (PREV_TX_MAX_BYTES - PREV_TX_MIN_BYTES);
+        ptx[i].header        = &header[i];
+        ptx[i].headerEntries = 1;
+
+        for (j = 0; j < ptx[i].txBytes; j++)  tx[i][j] = prev_tx_byte(i, j);
+    }
+
+    for (i = 0; i < OUTPUTS; i++)
+    {
+        memset(out[i].addr, 0xA0 + i, sizeof(out[i].addr));
+        out[i].satoshis = 100000 * (i + 1);
+    }
+
+    if (PH_OK != (status = ph_sign_tx(h, in, inputs, out, OUTPUTS, &change, 5000, &session)))  return status;
+    if (PH_OK != (status = ph_prev_tx(h, ptx, inputs)))                                        return status;
+
+    return ph_get_signed_tx(h, signed_tx, sizeof(signed_tx), tx_bytes, POLL_MS);
+}
+
+static bool run(const char *name, const unsigned inflight)
+{
+    phTransport_t  t = ph_transport_sim(dev_init, NULL, latency);
+    ph_t           h;
+    identifyResp_t id;
+    uint64_t       start;
+    unsigned       tx_bytes = 0;
+    int            status;
+    bool           ok;
+
+    if (PH_OK != ph_open(&h, &t, inflight))
+    {
+        printf("%s: no transport\n", name);
+        return false;
+    }
+
+    dev_bad = false;
+
+    ok = PH_OK == (status = ph_identify(&h, &id)) && PROTOCOL_VERSION == id.protocol;
+    ok = ok && check_mixed(&h);
+
+    if (ok)
+    {
+        ph_stats_reset(&h);
+
+        start  = now_us();
+        status = sign_flow(&h, &tx_bytes);
+        ok     = PH_OK == status && !dev_bad;
+
+        printf("\n%s, %u in flight: %s, %u byte tx in %.1f ms\n", name, inflight, ph_strerror(status), tx_bytes, (now_us() - start) / 1000.0);
+        ph_stats_print(&h, stdout);
+    }
+    else
+    {
+        printf("%s: %s\n", name, ph_strerror(status));
+    }
+
+    ph_close(&h);
+    parser_ctx_destroy(dev_ctx.parser);
+
+    return ok && !dev_bad;
+}
+
+
+int main(int argc, char **argv)
+{
+    bool ok;
+    int  opt;
+
+    while ((opt = getopt(argc, argv, "i:l:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i': inputs      = atoi(optarg);  break;
+            case 'l': latency     = atoi(optarg);  break;
+            case 'c': dev_cost_us = atoi(optarg);  break;
+            default:
+                fprintf(stderr, "usage: %s [-i inputs] [-l latency us] [-c device us per packet]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (0 == inputs || inputs > MAX_INPUTS)
+    {
+        fprintf(stderr, "1 to %u inputs\n", MAX_INPUTS);
+        return 1;
+    }
+
+    printf("%u inputs, %u us each way, %u us a stream packet on the device\n", inputs, latency, dev_cost_us);
+
+    ok = run("stop and wait", 1);
+    ok = run("pipelined", PH_INFLIGHT_MAX) && ok;
+
+    if (!ok)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    return 0;
+}
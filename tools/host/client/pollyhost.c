@@ -0,0 +1,721 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pollyhost.h>
+#include <util.h>
+
+#define CTRL_START          0x80
+#define CTRL_CONT           0x88
+#define CTRL_START_STREAM   0xC0
+#define CTRL_CONT_STREAM    0xC8
+
+#define START_HEADER_BYTES  5
+#define CONT_HEADER_BYTES   1
+
+#define READ_POLL_MS        50   // Reader wakes at least this often to see timeouts and close
+
+static const char *CMD_NAME[PH_STATS_CMDS] =
+{
+    [CMD_RESET]           = "RESET",
+    [CMD_IDENTIFY]        = "IDENTIFY",
+    [CMD_GET_PUBLIC_KEY]  = "GET_PUBLIC_KEY",
+    [CMD_SIGN_TX]         = "SIGN_TX",
+    [CMD_PREV_TX]         = "PREV_TX",
+    [CMD_GET_SIGNED_TX]   = "GET_SIGNED_TX",
+    [CMD_ENTROPY]         = "ENTROPY",
+    [CMD_FW_DOWNLOAD]     = "FW_DOWNLOAD",
+    [CMD_GET_PUBLIC_KEY_PATH] = "GET_PUBLIC_KEY_PATH",
+    [CMD_PREV_TX_CACHED]  = "PREV_TX_CACHED",
+    [CMD_SIGN_PROGRESS]   = "SIGN_PROGRESS",
+    [CMD_GET_INPUT_SIG]   = "GET_INPUT_SIG",
+    [CMD_STATUS]          = "STATUS",
+    [CMD_SIGN_SESSION]    = "SIGN_SESSION",
+    [CMD_SIGN_BATCH]      = "SIGN_BATCH",
+    [CMD_BATCH_PROGRESS]  = "BATCH_PROGRESS",
+    [CMD_SIGN_DIGESTS]    = "SIGN_DIGESTS",
+    [CMD_DIGESTS]         = "DIGESTS",
+};
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+//
+// Request bookkeeping, all with the lock held
+//
+
+static void stats_add(ph_t *h, const phReq_t *r)
+{
+    phStats_t *s;
+    uint64_t   us = now_us() - r->submitted;
+    unsigned   b  = 0;
+
+    if (r->cmd[0] >= PH_STATS_CMDS)  return;
+
+    s = &h->stats[r->cmd[0]];
+
+    if (0 == s->calls || us < s->min_us)  s->min_us = us;
+    if (us > s->max_us)                   s->max_us = us;
+
+    while ((us >> (b + 1)) && b < PH_STATS_BUCKETS - 1)  b++;
+
+    s->calls++;
+    s->errors    += PH_OK != r->status;
+    s->bytes_out += r->cmdBytes;
+    s->bytes_in  += r->respBytes;
+    s->total_us  += us;
+    s->bucket[b]++;
+}
+
+static void finish(ph_t *h, phReq_t *r, const int status)
+{
+    r->status = status;
+
+    stats_add(h, r);
+
+    // Answered or failed while still going out, the writer lets it go once it is off its hands
+    if (r == h->txCur)  h->txCurDone = true;
+    else                r->done      = true;
+
+    pthread_cond_broadcast(&h->rxDone);
+}
+
+static void unlink_rx(ph_t *h, phReq_t *r)
+{
+    phReq_t **pp = &h->rxHead;
+
+    while (*pp != r)  pp = &(*pp)->nextRx;
+
+    *pp = r->nextRx;
+
+    if (h->rxTail == r)
+    {
+        for (h->rxTail = h->rxHead; h->rxTail && h->rxTail->nextRx; h->rxTail = h->rxTail->nextRx);
+    }
+
+    h->inflight--;
+}
+
+static void fail_all(ph_t *h, const int status)
+{
+    phReq_t *r;
+
+    if (PH_OK == h->error)  h->error = status;
+
+    for (r = h->rxHead; NULL != r; r = r->nextRx)  finish(h, r, h->error);
+
+    h->txHead = h->txTail = NULL;
+    h->rxHead = h->rxTail = NULL;
+    h->rxCur  = NULL;
+    h->inflight = 0;
+
+    pthread_cond_broadcast(&h->txWake);
+    pthread_cond_broadcast(&h->rxDone);
+}
+
+//
+// Oldest request the response starting with ack belongs to. Status replies
+// can overtake other responses, everything else comes back in order.
+//
+static phReq_t* match(ph_t *h, const uint8_t ack)
+{
+    phReq_t *r;
+
+    for (r = h->rxHead; NULL != r; r = r->nextRx)
+    {
+        if ((CMD_ACK_STATUS == ack) == (CMD_STATUS == r->cmd[0]))  return r;
+    }
+
+    return NULL;
+}
+
+static void store(phReq_t *r, const uint8_t *d, const unsigned bytes)
+{
+    if (r->respPos < r->respMax)
+    {
+        memcpy(&r->resp[r->respPos], d, min(bytes, r->respMax - r->respPos));
+    }
+
+    r->respPos += bytes;
+}
+
+
+//
+// Threads
+//
+
+static void packet_in(ph_t *h, const uint8_t *p, unsigned *left)
+{
+    unsigned bytes, n;
+
+    if (CTRL_START == p[0])
+    {
+        bytes = p[1] | (p[2] << 8) | (p[3] << 16) | ((unsigned) p[4] << 24);
+        n     = min(bytes, PACKET_BYTES - START_HEADER_BYTES);
+
+        // A response cut off by a new one, the device was reset under us
+        if (NULL != h->rxCur)
+        {
+            unlink_rx(h, h->rxCur);
+            finish(h, h->rxCur, PH_ERR_PROTOCOL);
+        }
+
+        h->rxCur = (bytes > 0) ? match(h, p[START_HEADER_BYTES]) : NULL;
+        *left    = bytes - n;
+
+        if (NULL == h->rxCur)
+        {
+            h->unmatched++;
+            return;
+        }
+
+        h->rxCur->respBytes = bytes;
+        h->rxCur->respPos   = 0;
+        store(h->rxCur, &p[START_HEADER_BYTES], n);
+    }
+    else if (CTRL_CONT == p[0] && *left > 0)
+    {
+        n      = min(*left, PACKET_BYTES - CONT_HEADER_BYTES);
+        *left -= n;
+
+        if (NULL == h->rxCur)  return;
+
+        store(h->rxCur, &p[CONT_HEADER_BYTES], n);
+    }
+    else
+    {
+        // Empty packets and leftovers of a response nobody waits for
+        return;
+    }
+
+    if (0 == *left && NULL != h->rxCur)
+    {
+        unlink_rx(h, h->rxCur);
+        finish(h, h->rxCur, (h->rxCur->respBytes > h->rxCur->respMax) ? PH_ERR_SIZE : PH_OK);
+        h->rxCur = NULL;
+    }
+}
+
+static void* reader(void *arg)
+{
+    ph_t     *h    = arg;
+    unsigned  left = 0;
+    uint8_t   packet[PACKET_BYTES];
+    int       got;
+
+    for (;;)
+    {
+        got = h->t.read(h->t.ctx, packet, READ_POLL_MS);
+
+        pthread_mutex_lock(&h->lock);
+
+        if (h->closing)  break;
+
+        if (got < 0)
+        {
+            fail_all(h, PH_ERR_IO);
+            break;
+        }
+
+        if (got > 0)
+        {
+            h->lastMoved = now_us();
+            packet_in(h, packet, &left);
+        }
+        else if (NULL != h->rxHead && now_us() - h->lastMoved > h->timeoutMs * 1000ull)
+        {
+            fail_all(h, PH_ERR_TIMEOUT);
+        }
+
+        pthread_mutex_unlock(&h->lock);
+    }
+
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+}
+
+// Packet n of a command, false past the last one
+static bool packet_out(const phReq_t *r, const unsigned n, uint8_t *p)
+{
+    unsigned pos, bytes;
+
+    memset(p, 0, PACKET_BYTES);
+
+    if (0 == n)
+    {
+        p[0] = r->stream ? CTRL_START_STREAM : CTRL_START;
+        p[1] = r->cmdBytes;
+        p[2] = r->cmdBytes >> 8;
+        p[3] = r->cmdBytes >> 16;
+        p[4] = r->cmdBytes >> 24;
+
+        bytes = min(r->cmdBytes, PACKET_BYTES - START_HEADER_BYTES);
+        memcpy(&p[START_HEADER_BYTES], r->cmd, bytes);
+        return true;
+    }
+
+    pos = (PACKET_BYTES - START_HEADER_BYTES) + (n - 1) * (PACKET_BYTES - CONT_HEADER_BYTES);
+
+    if (pos >= r->cmdBytes)  return false;
+
+    p[0]  = r->stream ? CTRL_CONT_STREAM : CTRL_CONT;
+    bytes = min(r->cmdBytes - pos, PACKET_BYTES - CONT_HEADER_BYTES);
+    memcpy(&p[CONT_HEADER_BYTES], &r->cmd[pos], bytes);
+
+    return true;
+}
+
+static void* writer(void *arg)
+{
+    ph_t     *h = arg;
+    phReq_t  *r;
+    uint8_t   packet[PACKET_BYTES];
+    unsigned  n;
+    int       err;
+
+    pthread_mutex_lock(&h->lock);
+
+    for (;;)
+    {
+        while (!h->closing && PH_OK == h->error && NULL == h->txHead)
+        {
+            pthread_cond_wait(&h->txWake, &h->lock);
+        }
+
+        if (h->closing || PH_OK != h->error)  break;
+
+        r         = h->txHead;
+        h->txHead = r->nextTx;
+        h->txCur  = r;
+
+        if (NULL == h->txHead)  h->txTail = NULL;
+
+        pthread_mutex_unlock(&h->lock);
+
+        // The whole command back to back, whatever is still coming back for earlier ones
+        for (n = 0, err = 0; 0 == err && packet_out(r, n, packet); n++)
+        {
+            err = h->t.write(h->t.ctx, packet);
+
+            pthread_mutex_lock(&h->lock);
+            h->lastMoved = now_us();
+            err = err || (PH_OK != h->error);
+            pthread_mutex_unlock(&h->lock);
+        }
+
+        pthread_mutex_lock(&h->lock);
+
+        h->txCur = NULL;
+
+        if (h->txCurDone)
+        {
+            h->txCurDone = false;
+            r->done      = true;
+            pthread_cond_broadcast(&h->rxDone);
+        }
+
+        if (err)  fail_all(h, PH_ERR_IO);
+    }
+
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+}
+
+
+//
+// Client
+//
+
+int ph_open(ph_t *h, const phTransport_t *t, const unsigned inflight_max)
+{
+    memset(h, 0, sizeof(ph_t));
+
+    if (NULL == t->ctx)  return PH_ERR_IO;
+
+    h->t           = *t;
+    h->inflightMax = inflight_max ? inflight_max : PH_INFLIGHT_MAX;
+    h->timeoutMs   = PH_TIMEOUT_MS;
+
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->txWake, NULL);
+    pthread_cond_init(&h->rxDone, NULL);
+
+    pthread_create(&h->reader, NULL, reader, h);
+    pthread_create(&h->writer, NULL, writer, h);
+
+    return PH_OK;
+}
+
+void ph_close(ph_t *h)
+{
+    pthread_mutex_lock(&h->lock);
+    h->closing = true;
+    pthread_cond_broadcast(&h->txWake);
+    pthread_mutex_unlock(&h->lock);
+
+    pthread_join(h->reader, NULL);
+    pthread_join(h->writer, NULL);
+
+    pthread_mutex_lock(&h->lock);
+    fail_all(h, PH_ERR_CLOSED);
+    pthread_mutex_unlock(&h->lock);
+
+    h->t.close(h->t.ctx);
+
+    pthread_cond_destroy(&h->rxDone);
+    pthread_cond_destroy(&h->txWake);
+    pthread_mutex_destroy(&h->lock);
+}
+
+int ph_submit(ph_t *h, phReq_t *r, const uint8_t *cmd, const unsigned cmd_bytes, const bool stream, uint8_t *resp, const unsigned resp_max)
+{
+    memset(r, 0, sizeof(phReq_t));
+
+    r->cmd      = cmd;
+    r->cmdBytes = cmd_bytes;
+    r->stream   = stream;
+    r->resp     = resp;
+    r->respMax  = resp_max;
+
+    pthread_mutex_lock(&h->lock);
+
+    // Only so many ahead of their responses, a stop and wait host is 1
+    while (PH_OK == h->error && !h->closing && h->inflight >= h->inflightMax)
+    {
+        pthread_cond_wait(&h->rxDone, &h->lock);
+    }
+
+    if (PH_OK != h->error || h->closing || 0 == cmd_bytes)
+    {
+        r->status = (PH_OK != h->error) ? h->error : h->closing ? PH_ERR_CLOSED : PH_ERR_INVALID;
+        r->done   = true;
+        pthread_mutex_unlock(&h->lock);
+        return r->status;
+    }
+
+    // Time out from here if nothing else was going on
+    if (NULL == h->rxHead)  h->lastMoved = now_us();
+
+    r->submitted = now_us();
+
+    if (NULL == h->txTail)  h->txHead = r;
+    else                    h->txTail->nextTx = r;
+    h->txTail = r;
+
+    if (NULL == h->rxTail)  h->rxHead = r;
+    else                    h->rxTail->nextRx = r;
+    h->rxTail = r;
+
+    h->inflight++;
+
+    pthread_cond_signal(&h->txWake);
+    pthread_mutex_unlock(&h->lock);
+
+    return PH_OK;
+}
+
+int ph_wait(ph_t *h, phReq_t *r)
+{
+    pthread_mutex_lock(&h->lock);
+
+    while (!r->done)  pthread_cond_wait(&h->rxDone, &h->lock);
+
+    pthread_mutex_unlock(&h->lock);
+
+    return r->status;
+}
+
+int ph_call(ph_t *h, const uint8_t *cmd, const unsigned cmd_bytes, const bool stream, uint8_t *resp, const unsigned resp_max, unsigned *resp_bytes)
+{
+    phReq_t r;
+    int     status;
+
+    if (PH_OK == ph_submit(h, &r, cmd, cmd_bytes, stream, resp, resp_max))  ph_wait(h, &r);
+
+    status = r.status;
+
+    if (NULL != resp_bytes)  *resp_bytes = r.respBytes;
+
+    return status;
+}
+
+
+//
+// Commands
+//
+
+static int ack_status(const uint8_t ack)
+{
+    switch (ack)
+    {
+        case CMD_ACK_SUCCESS:  return PH_OK;
+        case CMD_ACK_INVALID:  return PH_ERR_INVALID;
+        case CMD_ACK_DENIED:   return PH_ERR_DENIED;
+        case CMD_ACK_BUSY:     return PH_ERR_BUSY;
+        default:               return PH_ERR_PROTOCOL;
+    }
+}
+
+static uint8_t* put_le(uint8_t *d, uint64_t v, const unsigned bytes)
+{
+    unsigned i;
+
+    for (i = 0; i < bytes; i++, v >>= 8)  *d++ = v;
+
+    return d;
+}
+
+int ph_identify(ph_t *h, identifyResp_t *id)
+{
+    const uint8_t cmd = CMD_IDENTIFY;
+    uint8_t       resp[ID_RESP_BYTES];
+    unsigned      bytes;
+    int           status;
+
+    status = ph_call(h, &cmd, SMALL_BYTES, false, resp, sizeof(resp), &bytes);
+
+    if (PH_OK != status)                return status;
+    if (CMD_ACK_SUCCESS != resp[0])     return ack_status(resp[0]);
+    if (ID_RESP_BYTES != bytes)         return PH_ERR_PROTOCOL;
+
+    memcpy(id, &resp[1], sizeof(identifyResp_t));
+
+    return PH_OK;
+}
+
+int ph_sign_tx(ph_t *h, const phInput_t *in, const unsigned inputs, const phOutput_t *out, const unsigned outputs, const phInput_t *change, const uint64_t change_satoshis, uint32_t *session)
+{
+    const unsigned bytes = SIGN_TX_BYTES(inputs, outputs, NULL != change);
+    uint8_t        resp[SIGN_TX_RESP_BYTES];
+    uint8_t       *cmd, *d;
+    unsigned       i, got;
+    int            status;
+
+    if (inputs > MAX_INPUTS || 0 == outputs || outputs > MAX_PAY_OUTPUTS)  return PH_ERR_INVALID;
+
+    if (NULL == (cmd = malloc(bytes)))  return PH_ERR_IO;
+
+    d    = cmd;
+    *d++ = CMD_SIGN_TX;
+    *d++ = inputs;
+
+    for (i = 0; i < inputs; i++)
+    {
+        *d++ = in[i].account;
+        *d++ = in[i].chain;
+        d    = put_le(d, in[i].keyid, 4);
+        memcpy(d, in[i].pubkey, COMPRESS_KEY_BYTES);
+        d   += COMPRESS_KEY_BYTES;
+    }
+
+    *d++ = outputs;
+
+    for (i = 0; i < outputs; i++)
+    {
+        memcpy(d, out[i].addr, HASH_ADDR_BYTES);
+        d = put_le(d + HASH_ADDR_BYTES, out[i].satoshis, 8);
+    }
+
+    if (NULL != change)
+    {
+        *d++ = change->account;
+        *d++ = change->chain;
+        d    = put_le(d, change->keyid, 4);
+        d    = put_le(d, change_satoshis, 8);
+    }
+
+    // Streamed only when it does not fit the command buffer, many outputs
+    status = ph_call(h, cmd, bytes, bytes > sizeof(cmd_t), resp, sizeof(resp), &got);
+
+    free(cmd);
+
+    if (PH_OK != status)                               return status;
+    if (CMD_ACK_SUCCESS != resp[0])                    return ack_status(resp[0]);
+    if (SIGN_TX_RESP_BYTES != got)                     return PH_ERR_PROTOCOL;
+
+    if (NULL != session)  memcpy(session, &resp[1], sizeof(uint32_t));
+
+    return PH_OK;
+}
+
+//
+// Every prev tx goes in its own stream, all of them submitted back to back.
+// The first failure is returned once all are answered.
+//
+int ph_prev_tx(ph_t *h, const phPrevTx_t *ptx, const unsigned count)
+{
+    phReq_t  *req;
+    uint8_t **cmd, *resp, *d;
+    unsigned  i, j, bytes, sent;
+    int       status = PH_OK;
+
+    req  = calloc(count, sizeof(phReq_t));
+    cmd  = calloc(count, sizeof(uint8_t*));
+    resp = calloc(count, SMALL_RESP_BYTES);
+
+    if (NULL == req || NULL == cmd || NULL == resp)
+    {
+        status = PH_ERR_IO;
+        goto done;
+    }
+
+    for (sent = 0; sent < count; sent++)
+    {
+        bytes = 1 + 1 + ptx[sent].headerEntries * sizeof(prevTxHeader_t) + ptx[sent].txBytes;
+
+        if (NULL == (d = cmd[sent] = malloc(bytes)))
+        {
+            status = PH_ERR_IO;
+            break;
+        }
+
+        *d++ = CMD_PREV_TX;
+        *d++ = ptx[sent].headerEntries;
+
+        for (j = 0; j < ptx[sent].headerEntries; j++)
+        {
+            *d++ = ptx[sent].header[j].inputIdx;
+            d    = put_le(d, ptx[sent].header[j].outputIdx, 4);
+        }
+
+        memcpy(d, ptx[sent].tx, ptx[sent].txBytes);
+
+        if (PH_OK != ph_submit(h, &req[sent], cmd[sent], bytes, true, &resp[sent], SMALL_RESP_BYTES))  break;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (i < sent)  ph_wait(h, &req[i]);
+
+        if (PH_OK != status)  continue;
+
+        if      (i >= sent)                       status = PH_ERR_IO;
+        else if (PH_OK != req[i].status)          status = req[i].status;
+        else if (CMD_ACK_SUCCESS != resp[i])      status = ack_status(resp[i]);
+    }
+
+done:
+    for (i = 0; NULL != cmd && i < count; i++)  free(cmd[i]);
+
+    free(resp);
+    free(cmd);
+    free(req);
+
+    return status;
+}
+
+//
+// Asks until the user made up their mind and the signing is done, every
+// poll_ms, then returns the signed tx
+//
+int ph_get_signed_tx(ph_t *h, uint8_t *tx, const unsigned tx_max, unsigned *tx_bytes, const unsigned poll_ms)
+{
+    const uint8_t cmd = CMD_GET_SIGNED_TX;
+    uint8_t      *resp;
+    unsigned      bytes;
+    int           status;
+
+    if (NULL == (resp = malloc(tx_max + 1)))  return PH_ERR_IO;
+
+    for (;;)
+    {
+        status = ph_call(h, &cmd, SMALL_BYTES, false, resp, tx_max + 1, &bytes);
+
+        if (PH_OK != status)  break;
+
+        if (CMD_ACK_USER == resp[0] || (CMD_ACK_BUSY == resp[0] && SMALL_RESP_BYTES == bytes))
+        {
+            usleep(poll_ms * 1000);
+            continue;
+        }
+
+        status = ack_status(resp[0]);
+
+        if (PH_OK == status && bytes < 2)  status = PH_ERR_PROTOCOL;
+
+        if (PH_OK == status)
+        {
+            memcpy(tx, &resp[1], bytes - 1);
+            *tx_bytes = bytes - 1;
+        }
+
+        break;
+    }
+
+    free(resp);
+
+    return status;
+}
+
+
+//
+// Stats
+//
+
+void ph_stats_reset(ph_t *h)
+{
+    pthread_mutex_lock(&h->lock);
+    memset(h->stats, 0, sizeof(h->stats));
+    h->unmatched = 0;
+    pthread_mutex_unlock(&h->lock);
+}
+
+// Upper end of the bucket holding the pct percentile, capped at the max
+uint32_t ph_stats_pct(const phStats_t *s, const unsigned pct)
+{
+    uint64_t seen = 0, want = ((uint64_t) s->calls * pct + 99) / 100;
+    unsigned b;
+
+    for (b = 0; b < PH_STATS_BUCKETS; b++)
+    {
+        seen += s->bucket[b];
+
+        if (seen >= want && seen > 0)  return min(2u << b, s->max_us);
+    }
+
+    return s->max_us;
+}
+
+void ph_stats_print(const ph_t *h, FILE *f)
+{
+    const phStats_t *s;
+    unsigned         i;
+
+    fprintf(f, "command               calls  errors    mean us     min us     p50 us     p99 us     max us\n");
+
+    for (i = 0; i < PH_STATS_CMDS; i++)
+    {
+        s = &h->stats[i];
+
+        if (0 == s->calls)  continue;
+
+        fprintf(f, "%-20s %6u %7u %10.0f %10u %10u %10u %10u\n", CMD_NAME[i] ? CMD_NAME[i] : "?", s->calls, s->errors,
+                (double) s->total_us / s->calls, s->min_us, ph_stats_pct(s, 50), ph_stats_pct(s, 99), s->max_us);
+    }
+
+    if (h->unmatched)  fprintf(f, "%u responses matched no command\n", h->unmatched);
+}
+
+const char* ph_strerror(const int status)
+{
+    switch (status)
+    {
+        case PH_OK:            return "ok";
+        case PH_ERR_IO:        return "transport failed";
+        case PH_ERR_TIMEOUT:   return "timed out";
+        case PH_ERR_SIZE:      return "response too large";
+        case PH_ERR_CLOSED:    return "closed";
+        case PH_ERR_INVALID:   return "invalid";
+        case PH_ERR_DENIED:    return "denied";
+        case PH_ERR_BUSY:      return "busy";
+        case PH_ERR_PROTOCOL:  return "protocol error";
+        default:               return "unknown";
+    }
+}
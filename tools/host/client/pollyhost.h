@@ -0,0 +1,178 @@
+#ifndef POLLYHOST_H_
+#define POLLYHOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <core.h>
+#include <cmd.h>
+#include <prevtx.h>
+
+//
+// Host side of the command framing in cmdparser.c, over any transport that
+// moves whole 64 byte packets.
+//
+// Commands are submitted and answered asynchronously. A writer thread puts
+// the packets of every submitted command out back to back, without waiting
+// on responses, and a reader thread puts responses together straight into
+// the buffer of the command they belong to. Responses come back in command
+// order, except CMD_ACK_STATUS which can overtake and goes to the oldest
+// CMD_STATUS waiting. Flow control is left to the transport, a write blocks
+// while the device holds packets off.
+//
+// Requests are owned by the caller and must stay put, together with the
+// command and response buffers, until ph_wait returns for them.
+//
+// Built from pollyhost.c and transport.c, with src/core/link/link.c for the
+// framed serial port and src/core/cmd/cmdparser.c and src/core/ctx.c for the
+// simulator, with -pthread. client_sim.c shows the whole line.
+//
+
+#define PH_STATS_CMDS       64     // Commands with their own latency stats, by command byte
+#define PH_STATS_BUCKETS    24     // Log2 microsecond latency buckets, up to 16 s
+#define PH_TIMEOUT_MS       5000   // Longest time without a packet moving while a call waits
+#define PH_INFLIGHT_MAX     8      // Commands submitted ahead of their responses, by default
+
+typedef enum
+{
+    PH_OK           =  0,
+    PH_ERR_IO       = -1,   // Transport failed, the client is unusable
+    PH_ERR_TIMEOUT  = -2,   // Nothing moved for the timeout, the client is unusable
+    PH_ERR_SIZE     = -3,   // Response larger than the buffer, it was cut short
+    PH_ERR_CLOSED   = -4,
+    PH_ERR_INVALID  = -5,   // CMD_ACK_INVALID
+    PH_ERR_DENIED   = -6,   // CMD_ACK_DENIED
+    PH_ERR_BUSY     = -7,   // CMD_ACK_BUSY where the call could not wait it out
+    PH_ERR_PROTOCOL = -8,   // Response that makes no sense for the command
+} phStatus_e;
+
+//
+// Moves whole packets. Write blocks until the packet is taken, read waits up
+// to timeout_ms and returns 1 with a packet, 0 without one, or -1. Reads and
+// writes come from different threads.
+//
+typedef struct
+{
+    void  *ctx;
+    int  (*write)(void *ctx, const uint8_t *packet);
+    int  (*read) (void *ctx, uint8_t *packet, const int timeout_ms);
+    void (*close)(void *ctx);
+} phTransport_t;
+
+typedef struct phReq
+{
+    // Command
+    const uint8_t *cmd;
+    unsigned       cmdBytes;
+    bool           stream;        // CTRL_START_STREAM, the handler gets it a packet at a time
+
+    // Response, respBytes is the size the device sent even if it was cut short
+    uint8_t       *resp;
+    unsigned       respMax;
+    unsigned       respBytes;
+    unsigned       respPos;
+
+    volatile int   status;        // phStatus_e
+    volatile bool  done;
+    uint64_t       submitted;     // Microseconds, for the stats
+
+    struct phReq  *nextTx;
+    struct phReq  *nextRx;
+} phReq_t;
+
+typedef struct
+{
+    uint32_t  calls;
+    uint32_t  errors;
+    uint64_t  bytes_out;
+    uint64_t  bytes_in;
+    uint64_t  total_us;
+    uint32_t  min_us;
+    uint32_t  max_us;
+    uint32_t  bucket[PH_STATS_BUCKETS];   // Bucket n, at least 2^n and under 2^(n + 1) us
+} phStats_t;
+
+typedef struct
+{
+    phTransport_t    t;
+    unsigned         inflightMax;
+    unsigned         timeoutMs;
+
+    pthread_t        writer;
+    pthread_t        reader;
+    pthread_mutex_t  lock;
+    pthread_cond_t   txWake;      // Writer, more to send or room to send it
+    pthread_cond_t   rxDone;      // Callers, a request finished
+
+    phReq_t         *txHead, *txTail;   // Not fully written yet
+    phReq_t         *txCur;             // Being written, outside the lock
+    bool             txCurDone;         // and already answered or failed
+    phReq_t         *rxHead, *rxTail;   // Waiting on a response, in submit order
+    phReq_t         *rxCur;             // Response being put together
+    unsigned         inflight;
+    uint64_t         lastMoved;         // Microseconds, any packet either way
+    int              error;             // Once set every call fails with it
+    volatile bool    closing;
+
+    uint32_t         unmatched;         // Responses nobody asked for
+    phStats_t        stats[PH_STATS_CMDS];
+} ph_t;
+
+//
+// Inputs and outputs of ph_sign_tx, the same fields SIGN_TX carries
+//
+typedef struct
+{
+    uint8_t   account;
+    uint8_t   chain;
+    uint32_t  keyid;
+    uint8_t   pubkey[COMPRESS_KEY_BYTES];
+} phInput_t;
+
+typedef struct
+{
+    uint8_t   addr[HASH_ADDR_BYTES];
+    uint64_t  satoshis;
+} phOutput_t;
+
+//
+// One prev tx for ph_prev_tx, with the inputs that spend from it
+//
+typedef struct
+{
+    const uint8_t        *tx;
+    unsigned              txBytes;
+    const prevTxHeader_t *header;
+    uint8_t               headerEntries;
+} phPrevTx_t;
+
+// Transports, NULL ctx on failure
+
+phTransport_t ph_transport_hidraw (const char *path);
+phTransport_t ph_transport_serial (const char *path, const unsigned baud, const bool framed);
+phTransport_t ph_transport_sim    (void (*init)(void), void (*poll)(void), const unsigned latency_us);
+
+// Client
+
+int      ph_open        (ph_t *h, const phTransport_t *t, const unsigned inflight_max);
+void     ph_close       (ph_t *h);
+int      ph_submit      (ph_t *h, phReq_t *r, const uint8_t *cmd, const unsigned cmd_bytes, const bool stream, uint8_t *resp, const unsigned resp_max);
+int      ph_wait        (ph_t *h, phReq_t *r);
+int      ph_call        (ph_t *h, const uint8_t *cmd, const unsigned cmd_bytes, const bool stream, uint8_t *resp, const unsigned resp_max, unsigned *resp_bytes);
+
+// Commands
+
+int      ph_identify      (ph_t *h, identifyResp_t *id);
+int      ph_sign_tx       (ph_t *h, const phInput_t *in, const unsigned inputs, const phOutput_t *out, const unsigned outputs, const phInput_t *change, const uint64_t change_satoshis, uint32_t *session);
+int      ph_prev_tx       (ph_t *h, const phPrevTx_t *ptx, const unsigned count);
+int      ph_get_signed_tx (ph_t *h, uint8_t *tx, const unsigned tx_max, unsigned *tx_bytes, const unsigned poll_ms);
+
+// Stats
+
+void     ph_stats_reset (ph_t *h);
+void     ph_stats_print (const ph_t *h, FILE *f);
+uint32_t ph_stats_pct   (const phStats_t *s, const unsigned pct);
+const char* ph_strerror (const int status);
+
+#endif // POLLYHOST_H_
@@ -0,0 +1,588 @@
+//
+// Transports for the host library: Linux hidraw, a serial port carrying
+// packets as they are or in link frames, and an in-process simulator running
+// the real command parser on a thread.
+//
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <pthread.h>
+#include <pollyhost.h>
+#include <link.h>
+#include <util.h>
+
+#define WRITE_TIMEOUT_MS   PH_TIMEOUT_MS
+#define RING_PACKETS       16              // Packets buffered each way by the framed serial and simulator
+#define SIM_TICK_US        20
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void deadline(struct timespec *ts, const uint64_t us)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+
+    ts->tv_sec  += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static int fd_write(const int fd, const uint8_t *d, const unsigned bytes)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    unsigned      pos = 0;
+    int           got;
+
+    while (pos < bytes)
+    {
+        if (poll(&pfd, 1, WRITE_TIMEOUT_MS) <= 0)  return -1;
+
+        got = write(fd, &d[pos], bytes - pos);
+
+        if (got < 0)  return -1;
+
+        pos += got;
+    }
+
+    return 0;
+}
+
+
+//
+// Packet ring shared by two threads, with the time each packet may be taken
+//
+
+typedef struct
+{
+    uint8_t   packet[RING_PACKETS][PACKET_BYTES];
+    uint64_t  due[RING_PACKETS];
+    unsigned  head, tail;
+} ring_t;
+
+static bool     ring_full (const ring_t *r)  { return r->head - r->tail == RING_PACKETS; }
+static bool     ring_empty(const ring_t *r)  { return r->head == r->tail; }
+static uint8_t* ring_slot (ring_t *r)        { return r->packet[r->head % RING_PACKETS]; }
+static uint8_t* ring_peek (ring_t *r)        { return r->packet[r->tail % RING_PACKETS]; }
+
+static void ring_push(ring_t *r, const uint64_t due)
+{
+    r->due[r->head % RING_PACKETS] = due;
+    r->head++;
+}
+
+static bool ring_due(const ring_t *r, const uint64_t now)
+{
+    return !ring_empty(r) && r->due[r->tail % RING_PACKETS] <= now;
+}
+
+
+//
+// hidraw, report 0 carries the packet as is
+//
+
+typedef struct
+{
+    int  fd;
+} hidCtx_t;
+
+static int hid_write(void *ctx, const uint8_t *packet)
+{
+    hidCtx_t *c = ctx;
+    uint8_t   report[1 + PACKET_BYTES];
+
+    // The device has no numbered reports, the leading 0 is taken off by the kernel
+    report[0] = 0;
+    memcpy(&report[1], packet, PACKET_BYTES);
+
+    return fd_write(c->fd, report, sizeof(report));
+}
+
+static int hid_read(void *ctx, uint8_t *packet, const int timeout_ms)
+{
+    hidCtx_t     *c   = ctx;
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    int           got;
+
+    got = poll(&pfd, 1, timeout_ms);
+
+    if (got <= 0)  return got;
+
+    got = read(c->fd, packet, PACKET_BYTES);
+
+    if (got < 0)  return -1;
+
+    return PACKET_BYTES == got;
+}
+
+static void hid_close(void *ctx)
+{
+    hidCtx_t *c = ctx;
+
+    close(c->fd);
+    free(c);
+}
+
+phTransport_t ph_transport_hidraw(const char *path)
+{
+    phTransport_t t = { NULL, hid_write, hid_read, hid_close };
+    hidCtx_t     *c;
+
+    if (NULL == (c = malloc(sizeof(hidCtx_t))))  return t;
+
+    if ((c->fd = open(path, O_RDWR | O_NONBLOCK)) < 0)
+    {
+        free(c);
+        return t;
+    }
+
+    t.ctx = c;
+    return t;
+}
+
+
+//
+// Serial, packets back to back as blue.c takes them without the link, or in
+// link frames with a thread of their own running the link. The link queue
+// callbacks take no context, so there is one framed port per process.
+//
+
+typedef struct
+{
+    int              fd;
+    bool             framed;
+
+    // Unframed, the packet being read so far
+    uint8_t          rx[PACKET_BYTES];
+    unsigned         rxBytes;
+
+    // Framed
+    link_t           link;
+    pthread_t        io;
+    pthread_mutex_t  lock;
+    pthread_cond_t   moved;
+    ring_t           rxRing;
+    ring_t           txRing;
+    volatile bool    stop;
+    bool             failed;
+} serialCtx_t;
+
+static serialCtx_t *framed;
+
+static uint8_t* link_in_slot(void)
+{
+    return ring_full(&framed->rxRing) ? NULL : ring_slot(&framed->rxRing);
+}
+
+static void link_in_push(void)
+{
+    ring_push(&framed->rxRing, 0);
+    pthread_cond_broadcast(&framed->moved);
+}
+
+static bool     link_out_ready(void)  { return !ring_empty(&framed->txRing); }
+static uint8_t* link_out_peek (void)  { return ring_peek(&framed->txRing); }
+
+static void link_out_pop(void)
+{
+    framed->txRing.tail++;
+    pthread_cond_broadcast(&framed->moved);
+}
+
+static const linkQueue_t link_host_queue = {
+    .in_slot   = link_in_slot,
+    .in_push   = link_in_push,
+    .out_ready = link_out_ready,
+    .out_peek  = link_out_peek,
+    .out_pop   = link_out_pop,
+};
+
+static void* link_io(void *arg)
+{
+    serialCtx_t  *c = arg;
+    struct pollfd pfd;
+    uint8_t       in[256], out[256];
+    unsigned      outBytes = 0, outPos = 0;
+    int           got;
+
+    pthread_mutex_lock(&c->lock);
+    link_reset(&c->link);
+
+    while (!c->stop)
+    {
+        if (outPos == outBytes)
+        {
+            outBytes = link_tx(&c->link, out, sizeof(out), now_us() / 1000);
+            outPos   = 0;
+        }
+
+        pthread_mutex_unlock(&c->lock);
+
+        pfd.fd     = c->fd;
+        pfd.events = POLLIN | ((outPos < outBytes) ? POLLOUT : 0);
+
+        got = poll(&pfd, 1, 2);
+
+        pthread_mutex_lock(&c->lock);
+
+        if (got < 0 || (pfd.revents & (POLLERR | POLLHUP)))
+        {
+            c->failed = true;
+            pthread_cond_broadcast(&c->moved);
+            break;
+        }
+
+        if (pfd.revents & POLLIN)
+        {
+            got = read(c->fd, in, sizeof(in));
+
+            if (got > 0)  link_rx(&c->link, in, got);
+        }
+
+        if ((pfd.revents & POLLOUT) && outPos < outBytes)
+        {
+            got = write(c->fd, &out[outPos], outBytes - outPos);
+
+            if (got > 0)  outPos += got;
+        }
+    }
+
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static int framed_write(serialCtx_t *c, const uint8_t *packet)
+{
+    struct timespec ts;
+
+    deadline(&ts, WRITE_TIMEOUT_MS * 1000ull);
+
+    pthread_mutex_lock(&c->lock);
+
+    while (ring_full(&c->txRing) && !c->failed)
+    {
+        if (pthread_cond_timedwait(&c->moved, &c->lock, &ts))  c->failed = true;
+    }
+
+    if (!c->failed)
+    {
+        memcpy(ring_slot(&c->txRing), packet, PACKET_BYTES);
+        ring_push(&c->txRing, 0);
+    }
+
+    pthread_mutex_unlock(&c->lock);
+
+    return c->failed ? -1 : 0;
+}
+
+static int framed_read(serialCtx_t *c, uint8_t *packet, const int timeout_ms)
+{
+    struct timespec ts;
+    int             got = 0;
+
+    deadline(&ts, timeout_ms * 1000ull);
+
+    pthread_mutex_lock(&c->lock);
+
+    while (ring_empty(&c->rxRing) && !c->failed)
+    {
+        if (pthread_cond_timedwait(&c->moved, &c->lock, &ts))  break;
+    }
+
+    if (!ring_empty(&c->rxRing))
+    {
+        memcpy(packet, ring_peek(&c->rxRing), PACKET_BYTES);
+        c->rxRing.tail++;
+        got = 1;
+    }
+    else if (c->failed)
+    {
+        got = -1;
+    }
+
+    pthread_mutex_unlock(&c->lock);
+
+    return got;
+}
+
+static int serial_write(void *ctx, const uint8_t *packet)
+{
+    serialCtx_t *c = ctx;
+
+    if (c->framed)  return framed_write(c, packet);
+
+    return fd_write(c->fd, packet, PACKET_BYTES);
+}
+
+static int serial_read(void *ctx, uint8_t *packet, const int timeout_ms)
+{
+    serialCtx_t  *c   = ctx;
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    int           got;
+
+    if (c->framed)  return framed_read(c, packet, timeout_ms);
+
+    // Packets have no boundaries on the wire, they are counted off 64 bytes at a time
+    while (c->rxBytes < PACKET_BYTES)
+    {
+        got = poll(&pfd, 1, timeout_ms);
+
+        if (got <= 0)  return got;
+
+        got = read(c->fd, &c->rx[c->rxBytes], PACKET_BYTES - c->rxBytes);
+
+        if (got < 0)  return -1;
+
+        c->rxBytes += got;
+    }
+
+    memcpy(packet, c->rx, PACKET_BYTES);
+    c->rxBytes = 0;
+
+    return 1;
+}
+
+static void serial_close(void *ctx)
+{
+    serialCtx_t *c = ctx;
+
+    if (c->framed)
+    {
+        c->stop = true;
+        pthread_join(c->io, NULL);
+        pthread_cond_destroy(&c->moved);
+        pthread_mutex_destroy(&c->lock);
+        framed = NULL;
+    }
+
+    close(c->fd);
+    free(c);
+}
+
+static speed_t baud_speed(const unsigned baud)
+{
+    switch (baud)
+    {
+        case 9600:    return B9600;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 460800:  return B460800;
+        case 921600:  return B921600;
+        default:      return B0;
+    }
+}
+
+phTransport_t ph_transport_serial(const char *path, const unsigned baud, const bool framed_link)
+{
+    phTransport_t  t = { NULL, serial_write, serial_read, serial_close };
+    serialCtx_t   *c;
+    struct termios tio;
+
+    if (framed_link && NULL != framed)  return t;
+    if (B0 == baud_speed(baud))         return t;
+
+    if (NULL == (c = calloc(1, sizeof(serialCtx_t))))  return t;
+
+    if ((c->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0)  goto error;
+
+    // Raw, with the RTS/CTS flow control the device side uses
+    if (0 == tcgetattr(c->fd, &tio))
+    {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, baud_speed(baud));
+        tio.c_cflag |= CRTSCTS | CLOCAL | CREAD;
+        tcsetattr(c->fd, TCSANOW, &tio);
+    }
+
+    c->framed = framed_link;
+
+    if (framed_link)
+    {
+        framed = c;
+
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_cond_init(&c->moved, NULL);
+        link_init(&c->link, &link_host_queue);
+
+        if (pthread_create(&c->io, NULL, link_io, c))
+        {
+            framed = NULL;
+            close(c->fd);
+            goto error;
+        }
+    }
+
+    t.ctx = c;
+    return t;
+
+error:
+    free(c);
+    return t;
+}
+
+
+//
+// Simulator, the device side runs the real parser on its own thread with its
+// own context, init sets that up and poll runs after each core_poll for any
+// work of the handler. Packets take latency_us to cross either way, at most
+// RING_PACKETS at a time, and only go into the device queue when it has room.
+//
+
+typedef struct
+{
+    void           (*init)(void);
+    void           (*poll)(void);
+    unsigned         latency;
+
+    pthread_t        dev;
+    pthread_mutex_t  lock;
+    pthread_cond_t   moved;
+    ring_t           down;
+    ring_t           up;
+    volatile bool    stop;
+} simCtx_t;
+
+static void* sim_device(void *arg)
+{
+    simCtx_t *c = arg;
+    uint8_t  *slot;
+
+    c->init();
+
+    while (!c->stop)
+    {
+        // What the transport interrupt does
+        pthread_mutex_lock(&c->lock);
+
+        while (ring_due(&c->down, now_us()) && NULL != (slot = core_inpacket_slot()))
+        {
+            memcpy(slot, ring_peek(&c->down), PACKET_BYTES);
+            c->down.tail++;
+            core_inpacket_push();
+            pthread_cond_broadcast(&c->moved);
+        }
+
+        pthread_mutex_unlock(&c->lock);
+
+        // The main loop
+        core_poll();
+        if (NULL != c->poll)  c->poll();
+
+        pthread_mutex_lock(&c->lock);
+
+        while (core_outpacket_ready() && !ring_full(&c->up))
+        {
+            memcpy(ring_slot(&c->up), core_outpacket(), PACKET_BYTES);
+            ring_push(&c->up, now_us() + c->latency);
+            core_outpacket_pop();
+            pthread_cond_broadcast(&c->moved);
+        }
+
+        pthread_mutex_unlock(&c->lock);
+
+        usleep(SIM_TICK_US);
+    }
+
+    return NULL;
+}
+
+static int sim_write(void *ctx, const uint8_t *packet)
+{
+    simCtx_t *c = ctx;
+
+    pthread_mutex_lock(&c->lock);
+
+    while (ring_full(&c->down))  pthread_cond_wait(&c->moved, &c->lock);
+
+    memcpy(ring_slot(&c->down), packet, PACKET_BYTES);
+    ring_push(&c->down, now_us() + c->latency);
+
+    pthread_mutex_unlock(&c->lock);
+
+    return 0;
+}
+
+static int sim_read(void *ctx, uint8_t *packet, const int timeout_ms)
+{
+    simCtx_t        *c   = ctx;
+    const uint64_t   end = now_us() + timeout_ms * 1000ull;
+    uint64_t         now, wait;
+    struct timespec  ts;
+    int              got = 0;
+
+    pthread_mutex_lock(&c->lock);
+
+    while (!ring_due(&c->up, now = now_us()) && now < end)
+    {
+        // Until the next packet lands or the timeout, whichever is first
+        wait = end - now;
+
+        if (!ring_empty(&c->up))  wait = min(wait, c->up.due[c->up.tail % RING_PACKETS] - now);
+
+        deadline(&ts, wait);
+        pthread_cond_timedwait(&c->moved, &c->lock, &ts);
+    }
+
+    if (ring_due(&c->up, now_us()))
+    {
+        memcpy(packet, ring_peek(&c->up), PACKET_BYTES);
+        c->up.tail++;
+        got = 1;
+    }
+
+    pthread_mutex_unlock(&c->lock);
+
+    return got;
+}
+
+static void sim_close(void *ctx)
+{
+    simCtx_t *c = ctx;
+
+    c->stop = true;
+    pthread_join(c->dev, NULL);
+    pthread_cond_destroy(&c->moved);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+phTransport_t ph_transport_sim(void (*init)(void), void (*poll)(void), const unsigned latency_us)
+{
+    phTransport_t t = { NULL, sim_write, sim_read, sim_close };
+    simCtx_t     *c;
+
+    if (NULL == (c = calloc(1, sizeof(simCtx_t))))  return t;
+
+    c->init    = init;
+    c->poll    = poll;
+    c->latency = latency_us;
+
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->moved, NULL);
+
+    if (pthread_create(&c->dev, NULL, sim_device, c))
+    {
+        free(c);
+        return t;
+    }
+
+    t.ctx = c;
+    return t;
+}
@@ -0,0 +1,194 @@
+//
+// Host raw digest signing benchmark.
+//
+// Signs batches of 1, 16 and 256 digests under a few key paths three ways:
+// a key derived and a signature made for every digest, a key derived once
+// per path, and a key once per path with the batch sharing one nonce
+// inversion (commit every digest, then finish the batch). Reports digests/s
+// for each. The batched signatures are checked against one at a time ones.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/digest_bench.c src/core/ctx.c src/core/wallet/wallet.c
+//       src/crypto/crypto.c src/crypto/ecdsa/ecdsa.c src/crypto/sha/*.c
+//       src/crypto/ripemd160/*.c $(find src/crypto/tfm -name '*.c') -o digest_bench
+//
+// Usage: digest_bench [seconds per run]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ctx.h>
+#include <cmd.h>
+#include <wallet.h>
+#include <crypto.h>
+
+#define PATHS        4      // Distinct keys the digests are spread over
+#define BATCH_MAX    256
+
+typedef enum
+{
+    MODE_EACH,              // Key and signature per digest
+    MODE_KEYS,              // Key per path, signature per digest
+    MODE_BATCH,             // Key per path, one inversion per batch
+} mode_e;
+
+static uint8_t        hash[BATCH_MAX * DIGEST_BYTES];
+static uint8_t        key[PATHS][KEY_BYTES];
+static const uint8_t *keyOf[BATCH_MAX];
+static uint8_t        rs[BATCH_MAX * 2 * KEY_BYTES];
+static uint8_t        work[BATCH_MAX * KEY_BYTES];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void path_get(wallet_path_t *path, const unsigned i)
+{
+    path->depth    = 2;
+    path->index[0] = DIGEST_PATH_MIN;
+    path->index[1] = i % PATHS;
+}
+
+static void batch_sign(const mode_e mode, const unsigned count)
+{
+    wallet_path_t path;
+    uint8_t       priv_key[KEY_BYTES];
+    uint8_t       sig[ECDSA_SIG_BYTES_MAX];
+    uint8_t       sig_bytes;
+    unsigned      i;
+
+    if (MODE_EACH != mode)
+    {
+        for (i = 0; i < PATHS && i < count; i++)
+        {
+            path_get(&path, i);
+            wallet_path_private_key_get(&path, key[i], NULL);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        switch (mode)
+        {
+            case MODE_EACH:
+                path_get(&path, i);
+                wallet_path_private_key_get(&path, priv_key, NULL);
+                if (0 != crypto_ecdsa_sign(priv_key, &hash[i * DIGEST_BYTES], sig, &sig_bytes))  goto error;
+                break;
+
+            case MODE_KEYS:
+                if (0 != crypto_ecdsa_sign(key[i % PATHS], &hash[i * DIGEST_BYTES], sig, &sig_bytes))  goto error;
+                break;
+
+            case MODE_BATCH:
+                keyOf[i] = key[i % PATHS];
+                if (!crypto_ecdsa_sign_commit(keyOf[i], &hash[i * DIGEST_BYTES],
+                                              &rs[(2 * i + 1) * KEY_BYTES], &rs[2 * i * KEY_BYTES]))  goto error;
+                break;
+        }
+    }
+
+    if (MODE_BATCH == mode && !crypto_ecdsa_sign_finish(keyOf, hash, count, rs, work))  goto error;
+
+    return;
+
+error:
+    fprintf(stderr, "sign failed\n");
+    exit(1);
+}
+
+static double run(const mode_e mode, const unsigned count, const double seconds)
+{
+    unsigned long digests = 0;
+    double        start, elapsed;
+
+    start = now();
+
+    do
+    {
+        batch_sign(mode, count);
+        digests += count;
+        elapsed  = now() - start;
+    } while (elapsed < seconds);
+
+    return digests / elapsed;
+}
+
+// The batch must come out as the same signatures as one at a time
+static void check(const unsigned count)
+{
+    uint8_t  sig[ECDSA_SIG_BYTES_MAX], der[ECDSA_SIG_BYTES_MAX];
+    uint8_t  sig_bytes, der_bytes;
+    unsigned i;
+
+    batch_sign(MODE_BATCH, count);
+
+    for (i = 0; i < count; i++)
+    {
+        crypto_ecdsa_sign(key[i % PATHS], &hash[i * DIGEST_BYTES], sig, &sig_bytes);
+        crypto_ecdsa_der(&rs[2 * i * KEY_BYTES], der, &der_bytes);
+
+        // Less the hash type byte a tx signature carries
+        if (der_bytes != sig_bytes - 1 || memcmp(der, sig, der_bytes))
+        {
+            fprintf(stderr, "batch of %u: signature %u differs\n", count, i);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned sizes[] = { 1, 16, 256 };
+    double         seconds = argc > 1 ? atof(argv[1]) : 3.0;
+    double         each, keys, batch;
+    polly_ctx_t    ctx;
+    uint8_t        seed[MASTER_SEED_BYTES];
+    uint32_t       i;
+
+    crypto_init();
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.wallet = wallet_ctx_create();
+    polly_ctx_set(&ctx);
+
+    for (i = 0; i < sizeof(seed); i++)
+    {
+        seed[i] = i;
+    }
+
+    wallet_master_seed_load(seed, sizeof(seed));
+
+    for (i = 0; i < BATCH_MAX; i++)
+    {
+        crypto_sha256((uint8_t*)&i, sizeof(i), &hash[i * DIGEST_BYTES]);
+    }
+
+    printf("batch   each/s   key per path/s   shared inversion/s   speedup\n");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        check(sizes[i]);
+
+        each  = run(MODE_EACH,  sizes[i], seconds);
+        keys  = run(MODE_KEYS,  sizes[i], seconds);
+        batch = run(MODE_BATCH, sizes[i], seconds);
+
+        printf("%5u %8.1f %16.1f %20.1f %9.2f\n", sizes[i], each, keys, batch, batch / each);
+    }
+
+    wallet_ctx_destroy(ctx.wallet);
+
+    return 0;
+}
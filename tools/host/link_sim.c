@@ -0,0 +1,342 @@
+//
+// Lossy link simulator for the framed serial link.
+//
+// Two link ends run in one process on a simulated clock, joined by a wire
+// that carries 46 bytes per millisecond each way (460800 baud), with a fixed
+// latency, and corrupts or drops bytes at random. The device end sits on the
+// real packet queues and command parser with an echo handler, the host end
+// sends commands of random size, starting the session with a link reset, and
+// checks every echo.
+//
+// The loss rate is given per data frame, it is spread over the bytes so every
+// frame is equally likely to be hit. Without -l a range of rates is run.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/link_sim.c src/core/link/link.c src/core/cmd/cmdparser.c
+//       src/core/ctx.c -lm -o link_sim
+//
+// Usage: link_sim [-l loss %] [-d latency ms] [-n commands]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <ctx.h>
+#include <cmd.h>
+#include <cmdparser.h>
+#include <link.h>
+#include <screen.h>
+#include <util.h>
+
+#define BYTES_PER_MS   46
+#define WIRE_BYTES     (1 << 16)
+
+#define CTRL_START     0x80
+#define CTRL_CONT      0x88
+
+typedef struct
+{
+    uint8_t   byte[WIRE_BYTES];
+    uint32_t  due[WIRE_BYTES];      // Arrival time of each byte
+    uint32_t  head, tail;
+    double    error;                // Chance a byte is corrupted or lost
+    unsigned  latency;
+} wire_t;
+
+static uint32_t  now;
+
+static uint8_t   echo[sizeof(cmd_t)];
+
+// Host end, packets of the command being sent and the response coming back
+static uint8_t   host_out[(sizeof(cmd_t) / 63 + 2) * PACKET_BYTES];
+static unsigned  host_out_count, host_out_pos;
+static unsigned  host_sent, host_done, commands;
+static uint8_t   host_in[PACKET_BYTES];
+static uint8_t   host_resp[sizeof(cmd_t)];
+static unsigned  host_resp_bytes, host_resp_pos;
+static unsigned  host_packets;
+static int       failed;
+
+
+//
+// Device end
+//
+
+void screen_rx(light_e state) { (void)state; }
+void screen_tx(light_e state) { (void)state; }
+
+static unsigned echo_gen(uint8_t *dest, const unsigned offset, const unsigned bytes)
+{
+    memcpy(dest, &echo[offset], bytes);
+    return bytes;
+}
+
+resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes, resp_gen_f *resp_gen)
+{
+    (void)chunk_bytes;
+    (void)start;
+    (void)resp;
+
+    if (streaming)  return RESP_NONE;
+
+    memcpy(echo, cmd, total_bytes);
+
+    *resp_bytes = total_bytes;
+    *resp_gen   = echo_gen;
+
+    return RESP_NEW;
+}
+
+
+//
+// Host end
+//
+
+// Command i is made again from its seed when its echo comes back
+static unsigned make_cmd(uint8_t *cmd, unsigned i)
+{
+    unsigned seed = i + 1, bytes, j;
+
+    bytes = 1 + rand_r(&seed) % sizeof(cmd_t);
+
+    for (j = 0; j < bytes; j++)  cmd[j] = rand_r(&seed);
+
+    cmd[0] = CMD_RESET;
+
+    return bytes;
+}
+
+static unsigned frame(uint8_t *out, const uint8_t *cmd, const unsigned bytes)
+{
+    unsigned pos = 0, n, packets = 0;
+
+    while (pos < bytes || 0 == packets)
+    {
+        memset(out, 0, PACKET_BYTES);
+
+        if (0 == packets)
+        {
+            out[0] = CTRL_START;
+            out[1] = bytes;
+            out[2] = bytes >> 8;
+            n      = min(bytes, PACKET_BYTES - 5);
+            memcpy(&out[5], cmd, n);
+        }
+        else
+        {
+            out[0] = CTRL_CONT;
+            n      = min(bytes - pos, PACKET_BYTES - 1);
+            memcpy(&out[1], &cmd[pos], n);
+        }
+
+        pos += n;
+        out += PACKET_BYTES;
+        packets++;
+    }
+
+    return packets;
+}
+
+static bool host_out_ready(void)
+{
+    uint8_t cmd[sizeof(cmd_t)];
+
+    if (host_out_pos == host_out_count && host_sent < commands)
+    {
+        host_out_count = frame(host_out, cmd, make_cmd(cmd, host_sent++));
+        host_out_pos   = 0;
+    }
+
+    return host_out_pos < host_out_count;
+}
+
+static uint8_t* host_out_peek(void)  { return &host_out[host_out_pos * PACKET_BYTES]; }
+static void     host_out_pop(void)   { host_out_pos++; host_packets++; }
+static uint8_t* host_in_slot(void)   { return host_in; }
+
+static void host_in_push(void)
+{
+    uint8_t  cmd[sizeof(cmd_t)];
+    unsigned n;
+
+    host_packets++;
+
+    if (0 == host_resp_bytes)
+    {
+        if (host_in[0] != CTRL_START)  goto error;
+
+        host_resp_bytes = host_in[1] | (host_in[2] << 8);
+        n               = min(host_resp_bytes, PACKET_BYTES - 5);
+        memcpy(host_resp, &host_in[5], n);
+    }
+    else
+    {
+        if (host_in[0] != CTRL_CONT)  goto error;
+
+        n = min(host_resp_bytes - host_resp_pos, PACKET_BYTES - 1);
+        memcpy(&host_resp[host_resp_pos], &host_in[1], n);
+    }
+
+    host_resp_pos += n;
+
+    if (host_resp_pos < host_resp_bytes)  return;
+
+    if (make_cmd(cmd, host_done) != host_resp_bytes || memcmp(cmd, host_resp, host_resp_bytes))  goto error;
+
+    host_done++;
+    host_resp_bytes = host_resp_pos = 0;
+    return;
+
+error:
+    printf("command %u: MISMATCH\n", host_done);
+    failed = 1;
+}
+
+static const linkQueue_t host_queue = {
+    .in_slot   = host_in_slot,
+    .in_push   = host_in_push,
+    .out_ready = host_out_ready,
+    .out_peek  = host_out_peek,
+    .out_pop   = host_out_pop,
+};
+
+
+//
+// Wire
+//
+
+static void wire_put(wire_t *w, const uint8_t *d, unsigned bytes)
+{
+    double r;
+
+    while (bytes--)
+    {
+        r = rand() / (RAND_MAX + 1.0);
+
+        // Half the errors flip bits, the other half lose the byte
+        if (r < w->error / 2)  { d++; continue; }
+
+        w->byte[w->head % WIRE_BYTES] = (r < w->error) ? *d ^ (1 + rand() % 255) : *d;
+        w->due [w->head % WIRE_BYTES] = now + w->latency;
+        w->head++;
+        d++;
+    }
+}
+
+static void wire_get(wire_t *w, link_t *l)
+{
+    while (w->tail != w->head && (int32_t)(now - w->due[w->tail % WIRE_BYTES]) >= 0)
+    {
+        link_rx(l, &w->byte[w->tail % WIRE_BYTES], 1);
+        w->tail++;
+    }
+}
+
+
+static void run(double loss, unsigned latency, unsigned count)
+{
+    static wire_t down, up;
+    polly_ctx_t   ctx;
+    link_t        dev, host;
+    uint8_t       buf[BYTES_PER_MS];
+    unsigned      n;
+    double        secs, rate;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.parser = parser_ctx_create();
+    polly_ctx_set(&ctx);
+    cmdparser_init();
+
+    memset(&down, 0, sizeof(down));
+    memset(&up,   0, sizeof(up));
+
+    down.error   = up.error   = 1.0 - pow(1.0 - loss, 1.0 / LINK_DATA_BYTES);
+    down.latency = up.latency = latency;
+
+    commands = count;
+    host_sent = host_done = host_out_count = host_out_pos = 0;
+    host_resp_bytes = host_resp_pos = 0;
+    host_packets = 0;
+    failed = 0;
+    now = 0;
+
+    link_init(&dev,  &link_core_queue);
+    link_init(&host, &host_queue);
+    link_reset(&host);
+
+    while (host_done < commands && !failed && now < 3600 * 1000)
+    {
+        now++;
+
+        // Each end gets one millisecond of wire time
+        n = link_tx(&host, buf, BYTES_PER_MS, now);
+        wire_put(&down, buf, n);
+
+        n = link_tx(&dev, buf, BYTES_PER_MS, now);
+        wire_put(&up, buf, n);
+
+        wire_get(&down, &dev);
+        wire_get(&up,   &host);
+
+        core_poll();
+    }
+
+    // Payload both ways, against what the wire could carry both ways
+    secs = now / 1000.0;
+    rate = host_packets * (double) PACKET_BYTES / secs;
+
+    if (failed || host_done < commands)
+    {
+        printf("%5.1f%%  FAILED after %u of %u commands\n", loss * 100, host_done, commands);
+    }
+    else
+    {
+        printf("%5.1f%%  %6.0f B/s %5.1f%%   %5u %5u %5u %5u %5u\n", loss * 100, rate, 100.0 * rate / (2 * BYTES_PER_MS * 1000),
+               host.stats.resent + dev.stats.resent, host.stats.crc_errors + dev.stats.crc_errors,
+               host.stats.nacks_out + dev.stats.nacks_out, host.stats.dropped + dev.stats.dropped, now);
+    }
+
+    parser_ctx_destroy(ctx.parser);
+}
+
+
+int main(int argc, char **argv)
+{
+    const double rates[] = { 0, 0.001, 0.01, 0.02, 0.05, 0.10, 0.20 };
+    double       loss    = -1;
+    unsigned     latency = 5, count = 2000, i;
+    int          opt;
+
+    while ((opt = getopt(argc, argv, "l:d:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': loss    = atof(optarg) / 100;  break;
+            case 'd': latency = atoi(optarg);        break;
+            case 'n': count   = atoi(optarg);        break;
+            default:
+                fprintf(stderr, "usage: %s [-l loss %%] [-d latency ms] [-n commands]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    printf("window %u, rto from %u ms, latency %u ms, %u commands, wire %u B/s each way\n",
+           LINK_WINDOW, LINK_RTO_MS, latency, count, BYTES_PER_MS * 1000);
+    printf("  loss   payload, of wire   resent   crc  nacks  drop    ms\n");
+
+    if (loss >= 0)
+    {
+        run(loss, latency, count);
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)  run(rates[i], latency, count);
+
+    return 0;
+}
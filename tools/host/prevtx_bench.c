@@ -0,0 +1,209 @@
+//
+// Host PREV_TX parser benchmark.
+//
+// Builds a ~100 KB previous transaction, then streams it through the parser
+// in packet sized pieces (the way the device sees it) and in one piece, and
+// reports MB/s for each. The tx hash is checked against a straight double
+// SHA256 of the same bytes, and the saved output against what was put in.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/prevtx_bench.c src/core/cmd/prevtx.c
+//       src/crypto/crypto.c src/crypto/ecdsa/ecdsa.c src/crypto/sha/*.c
+//       src/crypto/ripemd160/*.c $(find src/crypto/tfm -name '*.c') -o prevtx_bench
+//
+// Usage: prevtx_bench [seconds per run]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <prevtx.h>
+
+#define TX_TARGET_BYTES   (100 * 1024)
+#define IN_SCRIPT_BYTES   107            // Typical P2PKH signature script
+#define OUTPUTS           4
+#define SAVE_OUTPUT       2
+#define PACKET_PAYLOAD    63             // CTRL_CONT_STREAM payload
+
+static uint8_t  *stream;
+static unsigned  stream_bytes;
+static unsigned  tx_offset;
+
+static uint64_t  saved_value;
+static uint8_t   saved_script[PK_SCRIPT_BYTES];
+static unsigned  saved;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool save(const uint8_t inputIdx, const uint32_t outputIdx, const uint64_t value, const uint8_t *script, const unsigned script_bytes)
+{
+    if (0 != inputIdx || SAVE_OUTPUT != outputIdx)  return false;
+
+    saved_value = value;
+    memcpy(saved_script, script, script_bytes);
+    saved++;
+
+    return true;
+}
+
+static uint8_t* put(uint8_t *d, const void *src, const unsigned bytes)
+{
+    memcpy(d, src, bytes);
+    return d + bytes;
+}
+
+static uint8_t* put_varint(uint8_t *d, const unsigned value)
+{
+    if (value < 0xFD)
+    {
+        *d++ = value;
+    }
+    else
+    {
+        *d++ = 0xFD;
+        *d++ = value;
+        *d++ = value >> 8;
+    }
+
+    return d;
+}
+
+static void build(void)
+{
+    static const uint8_t version[4]  = { 1, 0, 0, 0 };
+    static const uint8_t sequence[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+    uint8_t  script[IN_SCRIPT_BYTES];
+    uint8_t  hash[32];
+    uint8_t *d;
+    unsigned inputs, i;
+    uint64_t value;
+
+    inputs = TX_TARGET_BYTES / (32 + 4 + 1 + IN_SCRIPT_BYTES + 4);
+
+    stream = malloc(TX_TARGET_BYTES + 1024);
+    d      = stream;
+
+    // Command and header, input 0 spends output SAVE_OUTPUT
+    *d++ = CMD_PREV_TX;
+    *d++ = 1;
+    *d++ = 0;
+    *d++ = SAVE_OUTPUT; *d++ = 0; *d++ = 0; *d++ = 0;
+
+    tx_offset = d - stream;
+
+    d = put(d, version, 4);
+    d = put_varint(d, inputs);
+
+    for (i = 0; i < inputs; i++)
+    {
+        memset(hash, i, sizeof(hash));
+        memset(script, i * 7, sizeof(script));
+
+        d = put(d, hash, 32);
+        d = put(d, &i, 4);
+        d = put_varint(d, IN_SCRIPT_BYTES);
+        d = put(d, script, IN_SCRIPT_BYTES);
+        d = put(d, sequence, 4);
+    }
+
+    d = put_varint(d, OUTPUTS);
+
+    for (i = 0; i < OUTPUTS; i++)
+    {
+        value = 100000ULL * (i + 1);
+        memset(script, 0xA0 + i, PK_SCRIPT_BYTES);
+
+        d = put(d, &value, 8);
+        d = put_varint(d, PK_SCRIPT_BYTES);
+        d = put(d, script, PK_SCRIPT_BYTES);
+    }
+
+    memset(d, 0, 4);
+    d += 4;
+
+    stream_bytes = d - stream;
+}
+
+static bool parse(prevtx_t *p, sha256ctx_t *ctx, const unsigned piece, uint8_t *hash)
+{
+    unsigned pos = 0, n, ate;
+    prevtx_status_e sts = PREVTX_MORE;
+
+    prevtx_reset(p, ctx, save);
+
+    while (pos < stream_bytes)
+    {
+        n   = stream_bytes - pos < piece ? stream_bytes - pos : piece;
+        sts = prevtx_input(p, &stream[pos], n, &ate);
+
+        if (PREVTX_ERROR == sts)  return false;
+
+        pos += ate;
+    }
+
+    if (PREVTX_DONE != sts)  return false;
+
+    memcpy(hash, p->hash, TX_HASH_BYTES);
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned pieces[] = { PACKET_PAYLOAD, 1, 7, 4096, 0 };
+
+    double       seconds = argc > 1 ? atof(argv[1]) : 2.0;
+    prevtx_t     p;
+    sha256ctx_t  ctx;
+    uint8_t      expect[TX_HASH_BYTES], hash[TX_HASH_BYTES], script[PK_SCRIPT_BYTES];
+    unsigned     i, runs;
+    double       start, elapsed;
+
+    crypto_init();
+    build();
+
+    crypto_sha256(&stream[tx_offset], stream_bytes - tx_offset, expect);
+    crypto_sha256(expect, sizeof(expect), expect);
+
+    memset(script, 0xA0 + SAVE_OUTPUT, sizeof(script));
+
+    printf("prev tx %u bytes\n", stream_bytes - tx_offset);
+
+    for (i = 0; pieces[i]; i++)
+    {
+        saved = 0;
+
+        if (!parse(&p, &ctx, pieces[i], hash) || memcmp(hash, expect, TX_HASH_BYTES) ||
+            1 != saved || saved_value != 100000ULL * (SAVE_OUTPUT + 1) || memcmp(saved_script, script, PK_SCRIPT_BYTES))
+        {
+            printf("%5u byte pieces: MISMATCH\n", pieces[i]);
+            return 1;
+        }
+
+        runs  = 0;
+        start = now();
+
+        do
+        {
+            parse(&p, &ctx, pieces[i], hash);
+            runs++;
+            elapsed = now() - start;
+        } while (elapsed < seconds);
+
+        printf("%5u byte pieces: %8.2f MB/s\n", pieces[i], (double)stream_bytes * runs / elapsed / 1e6);
+    }
+
+    return 0;
+}
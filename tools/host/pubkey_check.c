@@ -0,0 +1,163 @@
+//
+// Host check of what GET_PUBLIC_KEY and GET_PUBLIC_KEY_PATH hand out.
+//
+// For random seeds and random paths, the exported public key has to match the
+// wallet's own derivation, the master key has to be refused, and chain codes
+// may only come with account and chain level keys. The master chain code must
+// never be among them. The path export must also agree with the legacy
+// m/account'/chain/index key types.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/pubkey_check.c src/core/ctx.c src/core/wallet/wallet.c
+//       src/crypto/crypto.c src/crypto/ecdsa/ecdsa.c src/crypto/sha/*.c
+//       src/crypto/ripemd160/*.c $(find src/crypto/tfm -name '*.c') -o pubkey_check
+//
+// Usage: pubkey_check [seeds] [paths per seed]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ctx.h>
+#include <wallet.h>
+#include <crypto.h>
+
+static const uint8_t ZERO[KEY_BYTES];
+
+static unsigned failed;
+
+static void fail(const char *what, const wallet_path_t *path)
+{
+    unsigned i;
+
+    printf("%s: m", what);
+
+    for (i = 0; i < path->depth; i++)
+    {
+        printf("/%u%s", path->index[i] & ~HARDENED_KEY, (path->index[i] & HARDENED_KEY) ? "'" : "");
+    }
+
+    printf("\n");
+    failed++;
+}
+
+static void check_path(const wallet_path_t *path, const uint8_t *master_code)
+{
+    uint8_t  x[KEY_BYTES], y[KEY_BYTES], code[KEY_BYTES];
+    uint8_t  want_x[KEY_BYTES], want_y[KEY_BYTES], want_code[KEY_BYTES];
+    unsigned hardened = 0, i;
+
+    for (i = 0; i < path->depth; i++)
+    {
+        if (path->index[i] & HARDENED_KEY)  hardened = i + 1;
+    }
+
+    memset(code, 0xEE, sizeof(code));
+
+    if (!wallet_path_public_key_export(path, x, y, code))
+    {
+        fail("refused", path);
+        return;
+    }
+
+    wallet_path_public_key_get(path, want_x, want_y, want_code);
+
+    if (memcmp(x, want_x, KEY_BYTES) || memcmp(y, want_y, KEY_BYTES))  fail("wrong key", path);
+    if (0 == memcmp(code, master_code, KEY_BYTES))                     fail("master chain code", path);
+
+    if (path->depth <= hardened + 1)
+    {
+        if (memcmp(code, want_code, KEY_BYTES))  fail("wrong chain code", path);
+    }
+    else if (memcmp(code, ZERO, KEY_BYTES))
+    {
+        fail("address chain code", path);
+    }
+}
+
+static void check_legacy(const uint32_t account, const uint32_t chain, const uint32_t index)
+{
+    wallet_path_t path = { 0, { HARDENED_KEY | account, chain, index } };
+    uint8_t       x[KEY_BYTES], y[KEY_BYTES], code[KEY_BYTES];
+    uint8_t       px[KEY_BYTES], py[KEY_BYTES], pcode[KEY_BYTES];
+    keytype_e     type;
+
+    wallet_public_key_get(KEY_MASTER, account, chain, index, x, y, code);
+
+    if (memcmp(code, ZERO, KEY_BYTES))  fail("legacy master chain code", &path);
+
+    for (type = KEY_ACCOUNT; type <= KEY_ADDRESS; type++)
+    {
+        path.depth = type;
+
+        wallet_public_key_get(type, account, chain, index, x, y, code);
+        wallet_path_public_key_export(&path, px, py, pcode);
+
+        if (memcmp(x, px, KEY_BYTES) || memcmp(y, py, KEY_BYTES) || memcmp(code, pcode, KEY_BYTES))
+        {
+            fail("differs from legacy", &path);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned seeds = argc > 1 ? atoi(argv[1]) : 4;
+    const unsigned paths = argc > 2 ? atoi(argv[2]) : 200;
+    polly_ctx_t    ctx;
+    wallet_path_t  path;
+    uint8_t        seed[MASTER_SEED_BYTES];
+    uint8_t        master_key[KEY_BYTES], master_code[KEY_BYTES];
+    uint8_t        x[KEY_BYTES], y[KEY_BYTES], code[KEY_BYTES];
+    unsigned       s, p, i;
+
+    crypto_init();
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.wallet = wallet_ctx_create();
+    polly_ctx_set(&ctx);
+
+    srand(1);
+
+    for (s = 0; s < seeds; s++)
+    {
+        for (i = 0; i < sizeof(seed); i++)  seed[i] = rand();
+
+        wallet_master_seed_load(seed, sizeof(seed));
+
+        path.depth = 0;
+        wallet_path_private_key_get(&path, master_key, master_code);
+
+        if (wallet_path_public_key_export(&path, x, y, code))  fail("master key exported", &path);
+
+        for (p = 0; p < paths; p++)
+        {
+            path.depth = 1 + rand() % WALLET_PATH_DEPTH_MAX;
+
+            for (i = 0; i < path.depth; i++)
+            {
+                path.index[i] = (rand() % 4) | ((rand() % 3) ? 0 : HARDENED_KEY);
+            }
+
+            check_path(&path, master_code);
+        }
+
+        check_legacy(rand() % 4, rand() % 2, rand() % 100);
+    }
+
+    memset(master_key, 0, sizeof(master_key));
+    wallet_ctx_destroy(ctx.wallet);
+
+    if (failed)
+    {
+        printf("FAILED, %u checks\n", failed);
+        return 1;
+    }
+
+    printf("%u seeds, %u paths each, no master or address chain codes handed out\n", seeds, paths);
+    return 0;
+}
@@ -0,0 +1,435 @@
+//
+// Host stand-in for the Bluetooth UART link, over a pseudo terminal.
+//
+// The device side runs the same serial layer and command parser as the
+// firmware, fed from the pty master the way blue.c feeds them from its uDMA
+// rings: bytes come in whatever pieces the read returns, and when the core has
+// no room they wait in an rx ring and the pty is not read until it drains.
+// Commands are answered by an echo handler, large echoes go out through a
+// response generator.
+//
+// Without arguments a host thread on the pty slave sends commands of random
+// size in random write sizes, mixed with CMD_STATUS requests, while a reader
+// thread checks every echo. Throughput is reported at the end. With -s the
+// device side only serves and prints the slave path, for a host program to
+// open.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0 -pthread
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/serial_pty.c src/core/serial/serial.c src/core/cmd/cmdparser.c
+//       src/core/ctx.c -o serial_pty
+//
+// Usage: serial_pty [-s] [-n commands]
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+
+#include <ctx.h>
+#include <cmd.h>
+#include <cmdparser.h>
+#include <serial.h>
+#include <screen.h>
+#include <util.h>
+
+#define RX_RING_BYTES  512
+#define IO_BYTES       256
+
+#define CTRL_START     0x80
+#define CTRL_CONT      0x88
+
+static int       master;
+static int       slave;
+static volatile  int stop;
+
+static uint8_t   echo[sizeof(cmd_t)];
+
+static unsigned  commands = 1000;
+static unsigned  statuses;
+static int       failed;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+//
+// Device side
+//
+
+void screen_rx(light_e state) { (void)state; }
+void screen_tx(light_e state) { (void)state; }
+
+static unsigned echo_gen(uint8_t *dest, const unsigned offset, const unsigned bytes)
+{
+    memcpy(dest, &echo[offset], bytes);
+    return bytes;
+}
+
+resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes, resp_gen_f *resp_gen)
+{
+    (void)chunk_bytes;
+    (void)start;
+    (void)resp;
+
+    if (streaming)  return RESP_NONE;
+
+    // Status requests the interrupt side let through, answered like cmd.c does
+    if (cmd->cmd == CMD_STATUS)
+    {
+        echo[0] = CMD_ACK_STATUS;
+        cmdparser_status_read((statusResp_t *) &echo[1]);
+
+        *resp_bytes = STATUS_RESP_BYTES;
+        *resp_gen   = echo_gen;
+
+        return RESP_NEW;
+    }
+
+    memcpy(echo, cmd, total_bytes);
+
+    *resp_bytes = total_bytes;
+    *resp_gen   = echo_gen;
+
+    return RESP_NEW;
+}
+
+static void* device(void *arg)
+{
+    polly_ctx_t    ctx;
+    serial_t       serial;
+    uint8_t        ring[RX_RING_BYTES];
+    uint32_t       head = 0, tail = 0;
+    uint8_t        out[IO_BYTES];
+    unsigned       outBytes = 0, outPos = 0;
+    struct pollfd  pfd;
+    unsigned       n, pos, taken;
+    int            got;
+
+    (void)arg;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.parser = parser_ctx_create();
+    polly_ctx_set(&ctx);
+
+    cmdparser_init();
+    serial_init(&serial);
+
+    // The device never waits on the host, like the DMA it only moves what it can
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    while (!stop)
+    {
+        // Only read while the ring has room, the pty buffer holds the sender off otherwise
+        pfd.fd     = master;
+        pfd.events = (head - tail < RX_RING_BYTES) ? POLLIN : 0;
+
+        if (outPos < outBytes || serial_tx_ready(&serial))  pfd.events |= POLLOUT;
+
+        poll(&pfd, 1, 10);
+
+        if (pfd.revents & POLLIN)
+        {
+            pos = head % RX_RING_BYTES;
+            got = read(master, &ring[pos], min(RX_RING_BYTES - (head - tail), RX_RING_BYTES - pos));
+
+            if (got > 0)  head += got;
+        }
+
+        // What the interrupt does on the device
+        while (tail != head)
+        {
+            n     = min(head - tail, RX_RING_BYTES - (tail % RX_RING_BYTES));
+            taken = serial_rx(&serial, &ring[tail % RX_RING_BYTES], n);
+            tail += taken;
+
+            if (taken < n)  break;
+        }
+
+        core_poll();
+
+        // And what blue_process_events does with the responses
+        if (outPos == outBytes)
+        {
+            outBytes = serial_tx(&serial, out, sizeof(out));
+            outPos   = 0;
+        }
+
+        if (outPos < outBytes)
+        {
+            got = write(master, &out[outPos], outBytes - outPos);
+
+            if (got > 0)  outPos += got;
+        }
+    }
+
+    parser_ctx_destroy(ctx.parser);
+    return NULL;
+}
+
+
+//
+// Host side
+//
+
+static void put_all(int fd, const uint8_t *d, unsigned bytes)
+{
+    unsigned pos = 0, n;
+    int      got;
+
+    // Random write sizes, the device must not care where the pieces break
+    while (pos < bytes)
+    {
+        n   = 1 + rand() % 200;
+        n   = min(bytes - pos, n);
+        got = write(fd, &d[pos], n);
+
+        if (got > 0)  pos += got;
+    }
+}
+
+static void get_all(int fd, uint8_t *d, unsigned bytes)
+{
+    unsigned pos = 0;
+    int      got;
+
+    while (pos < bytes)
+    {
+        got = read(fd, &d[pos], bytes - pos);
+
+        if (got > 0)  pos += got;
+    }
+}
+
+static unsigned frame(uint8_t *out, const uint8_t *cmd, const unsigned bytes)
+{
+    unsigned pos = 0, n, packets = 0;
+
+    while (pos < bytes || 0 == packets)
+    {
+        memset(out, 0, PACKET_BYTES);
+
+        if (0 == packets)
+        {
+            out[0] = CTRL_START;
+            out[1] = bytes;
+            out[2] = bytes >> 8;
+            out[3] = bytes >> 16;
+            out[4] = bytes >> 24;
+            n      = min(bytes, PACKET_BYTES - 5);
+            memcpy(&out[5], cmd, n);
+        }
+        else
+        {
+            out[0] = CTRL_CONT;
+            n      = min(bytes - pos, PACKET_BYTES - 1);
+            memcpy(&out[1], &cmd[pos], n);
+        }
+
+        pos += n;
+        out += PACKET_BYTES;
+        packets++;
+    }
+
+    return packets;
+}
+
+// Command i is made again from its seed, so the reader needs no copy of it
+static unsigned make_cmd(uint8_t *cmd, unsigned i)
+{
+    unsigned seed = i + 1, bytes, j;
+
+    bytes = 1 + rand_r(&seed) % sizeof(cmd_t);
+
+    for (j = 0; j < bytes; j++)  cmd[j] = rand_r(&seed);
+
+    // Not a status request, those are answered without an echo
+    cmd[0] = CMD_RESET;
+
+    return bytes;
+}
+
+// Reads one response, status replies that come ahead of it are counted and skipped
+static unsigned response(int fd, uint8_t *resp)
+{
+    uint8_t  packet[PACKET_BYTES];
+    unsigned bytes, pos, n;
+
+    for (;;)
+    {
+        get_all(fd, packet, PACKET_BYTES);
+
+        if (packet[0] != CTRL_START)  return 0;
+
+        bytes = packet[1] | (packet[2] << 8) | (packet[3] << 16) | (packet[4] << 24);
+
+        if (packet[5] == CMD_ACK_STATUS && bytes == STATUS_RESP_BYTES)
+        {
+            statuses++;
+            continue;
+        }
+
+        break;
+    }
+
+    n = min(bytes, PACKET_BYTES - 5);
+    memcpy(resp, &packet[5], n);
+
+    for (pos = n; pos < bytes; pos += n)
+    {
+        get_all(fd, packet, PACKET_BYTES);
+
+        if (packet[0] != CTRL_CONT)  return 0;
+
+        n = min(bytes - pos, PACKET_BYTES - 1);
+        memcpy(&resp[pos], &packet[1], n);
+    }
+
+    return bytes;
+}
+
+static void* reader(void *arg)
+{
+    static uint8_t cmd[sizeof(cmd_t)], resp[sizeof(cmd_t)];
+    unsigned       i, bytes;
+
+    (void)arg;
+
+    for (i = 0; i < commands; i++)
+    {
+        bytes = make_cmd(cmd, i);
+
+        if (response(slave, resp) != bytes || memcmp(cmd, resp, bytes))
+        {
+            printf("command %u (%u bytes): MISMATCH\n", i, bytes);
+            failed = 1;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int host(const char *path)
+{
+    static uint8_t cmd[sizeof(cmd_t)], packets[(sizeof(cmd_t) / 63 + 2) * PACKET_BYTES];
+    uint8_t        status_req[PACKET_BYTES], status_cmd = CMD_STATUS, packet[PACKET_BYTES];
+    struct termios tio;
+    pthread_t      thread;
+    unsigned       i, bytes, count, asked = 0;
+    unsigned long  total = 0;
+    double         start, elapsed;
+
+    if ((slave = open(path, O_RDWR | O_NOCTTY)) < 0)  return 1;
+
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    frame(status_req, &status_cmd, 1);
+
+    start = now();
+
+    pthread_create(&thread, NULL, reader, NULL);
+
+    for (i = 0; i < commands && !failed; i++)
+    {
+        bytes = make_cmd(cmd, i);
+        count = frame(packets, cmd, bytes);
+
+        put_all(slave, packets, count * PACKET_BYTES);
+
+        // A status request right behind, its reply may come before or after the echo
+        if (0 == i % 4)
+        {
+            put_all(slave, status_req, PACKET_BYTES);
+            asked++;
+        }
+
+        total += count * PACKET_BYTES;
+    }
+
+    pthread_join(thread, NULL);
+
+    // Status replies still outstanding come on their own
+    while (!failed && statuses < asked)
+    {
+        get_all(slave, packet, PACKET_BYTES);
+
+        if (packet[0] != CTRL_START || packet[5] != CMD_ACK_STATUS)  failed = 1;
+
+        statuses++;
+    }
+
+    elapsed = now() - start;
+
+    if (!failed)
+    {
+        printf("%u commands, %u status replies, %.0f bytes/s each way\n", commands, statuses, total / elapsed);
+    }
+
+    close(slave);
+
+    return failed;
+}
+
+
+int main(int argc, char **argv)
+{
+    pthread_t thread;
+    int       serve = 0, opt, ret = 0;
+    char      path[128];
+
+    while ((opt = getopt(argc, argv, "sn:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': serve    = 1;                   break;
+            case 'n': commands = atoi(optarg);        break;
+            default:
+                fprintf(stderr, "usage: %s [-s] [-n commands]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) || unlockpt(master) ||
+        ptsname_r(master, path, sizeof(path)))
+    {
+        perror("pty");
+        return 1;
+    }
+
+    pthread_create(&thread, NULL, device, NULL);
+
+    if (serve)
+    {
+        printf("%s\n", path);
+        fflush(stdout);
+        pthread_join(thread, NULL);
+    }
+    else
+    {
+        ret  = host(path);
+        stop = 1;
+        pthread_join(thread, NULL);
+    }
+
+    close(master);
+
+    return ret;
+}
@@ -0,0 +1,155 @@
+//
+// Host signing throughput benchmark, one wallet context per thread.
+//
+// Each worker binds its own polly_ctx_t, loads the same test seed and then
+// derives an address key and signs a hash in a loop. Runs 1, 2, 4 ... up to
+// the requested thread count so the scaling is visible in one run.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0 -pthread
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/sign_bench.c src/core/ctx.c src/core/wallet/wallet.c
+//       src/crypto/crypto.c src/crypto/ecdsa/ecdsa.c src/crypto/sha/*.c
+//       src/crypto/ripemd160/*.c $(find src/crypto/tfm -name '*.c') -o sign_bench
+//
+// Usage: sign_bench [max threads] [seconds per run]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <ctx.h>
+#include <wallet.h>
+#include <crypto.h>
+
+typedef struct
+{
+    pthread_t          thread;
+    unsigned           id;
+    unsigned          *run;
+    unsigned long      ops;
+} worker_t;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* worker(void *arg)
+{
+    worker_t   *w = arg;
+    polly_ctx_t ctx;
+    uint8_t     seed[MASTER_SEED_BYTES];
+    uint8_t     hash[SHA256_BYTES];
+    uint8_t     priv_key[KEY_BYTES];
+    uint8_t     sig[73];
+    uint8_t     sig_bytes;
+    uint32_t    index = 0;
+    unsigned    i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.wallet = wallet_ctx_create();
+    polly_ctx_set(&ctx);
+
+    for (i = 0; i < sizeof(seed); i++)
+    {
+        seed[i] = i;
+    }
+
+    wallet_master_seed_load(seed, sizeof(seed));
+
+    while (__atomic_load_n(w->run, __ATOMIC_RELAXED))
+    {
+        // A fresh key and hash every round, like signing the inputs of a tx
+        wallet_address_private_key_get(0, 0, index, priv_key, NULL);
+
+        crypto_sha256((uint8_t*)&index, sizeof(index), hash);
+
+        if (0 != crypto_ecdsa_sign(priv_key, hash, sig, &sig_bytes))
+        {
+            fprintf(stderr, "thread %u: sign failed at %u\n", w->id, index);
+            exit(1);
+        }
+
+        index++;
+        w->ops++;
+    }
+
+    wallet_ctx_destroy(ctx.wallet);
+
+    return NULL;
+}
+
+static double run(const unsigned threads, const double seconds)
+{
+    worker_t          *w;
+    unsigned           go = 1;
+    unsigned long      ops = 0;
+    double             start, elapsed;
+    unsigned           i;
+
+    w = calloc(threads, sizeof(worker_t));
+
+    start = now();
+
+    for (i = 0; i < threads; i++)
+    {
+        w[i].id  = i;
+        w[i].run = &go;
+        pthread_create(&w[i].thread, NULL, worker, &w[i]);
+    }
+
+    while (now() - start < seconds)
+    {
+        struct timespec ts = { 0, 10000000 };
+        nanosleep(&ts, NULL);
+    }
+
+    __atomic_store_n(&go, 0, __ATOMIC_RELAXED);
+
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(w[i].thread, NULL);
+        ops += w[i].ops;
+    }
+
+    elapsed = now() - start;
+
+    free(w);
+
+    return ops / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned threads = argc > 1 ? atoi(argv[1]) : 4;
+    double   seconds = argc > 2 ? atof(argv[2]) : 3.0;
+    double   base = 0, rate;
+    unsigned t;
+
+    // Curve constants are shared read only by every context
+    crypto_init();
+
+    printf("threads   signs/s   speedup\n");
+
+    for (t = 1; t <= threads; t *= 2)
+    {
+        rate = run(t, seconds);
+
+        if (1 == t)  base = rate;
+
+        printf("%7u %9.1f %9.2f\n", t, rate, rate / base);
+
+        if (t < threads && t * 2 > threads)  t = threads / 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,456 @@
+//
+// Loopback stand-in for the USB endpoints.
+//
+// The device side runs the same pipes and command parser as the firmware, the
+// HID interrupt pipe and the vendor bulk pipe, on endpoint ops backed by
+// memory instead of the USB FIFOs. A host end on a simulated 1 ms frame clock
+// moves packets in and out of them at the rates full speed USB allows each
+// interface: the HID OUT endpoint is polled every 2 frames and the IN one
+// every frame, one packet each, while bulk fits up to 19 packets a frame in
+// either direction. The device is taken to keep up with the bus, so the rates
+// are what the transport allows, not what the signing code manages.
+//
+// First commands of random size are echoed over either interface in random
+// order, checking every echo and that responses follow the interface the
+// command came in on. The main loop misses turns at random meanwhile, so the
+// queue fills and packets are left on the endpoints. Then prev tx sized and firmware sized streams are sent
+// over each interface, answered with a checksum, and the rates compared.
+//
+// Build from the repository root, the lines below are one command:
+//
+//   gcc -std=gnu99 -O2 -fshort-enums -DHW_CC2538=0
+//       -Isrc/core -Isrc/core/include -Isrc/crypto -Isrc/crypto/include -Isrc/words
+//       tools/host/usb_loopback.c src/core/usbpipe/usbpipe.c src/core/cmd/cmdparser.c
+//       src/core/ctx.c -o usb_loopback
+//
+// Usage: usb_loopback [-n commands]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ctx.h>
+#include <cmd.h>
+#include <cmdparser.h>
+#include <usbpipe.h>
+#include <screen.h>
+#include <util.h>
+
+#define HID_OUT_INTERVAL   2      // Frames, bInterval of EP2
+#define BULK_PER_FRAME     19     // 64 byte bulk transactions in a full speed frame
+
+#define CTRL_START         0x80
+#define CTRL_CONT          0x88
+#define CTRL_START_STREAM  0xC0
+#define CTRL_CONT_STREAM   0xC8
+
+#define PREV_TX_BYTES      400
+#define PREV_TX_COUNT      50
+#define FIRMWARE_BYTES     (200 * 1024)
+
+enum { HID, BULK, PIPES };
+
+static const char *pipe_name[PIPES] = { "hid", "bulk" };
+
+// Endpoint pair as the device sees it, both sides double buffered at most
+typedef struct
+{
+    uint8_t   out[2][PACKET_BYTES];
+    unsigned  outHead, outCount, outDepth;
+    bool      outEvent;
+    uint8_t   in[2][PACKET_BYTES];
+    unsigned  inHead, inCount, inDepth;
+} loopEp_t;
+
+static loopEp_t   ep[PIPES];
+static usbPipe_t  usbpipe[PIPES];
+
+static uint8_t    echo[sizeof(cmd_t)];
+static uint32_t   stream_sum;
+static unsigned   stream_got;
+
+// Host end, one command out then its response back
+static uint8_t    host_cmd[sizeof(cmd_t)];
+static unsigned   host_cmd_bytes, host_cmd_pos, host_packets_out;
+static bool       host_stream;
+static int        host_pipe;
+static uint8_t    host_resp[sizeof(cmd_t)];
+static unsigned   host_resp_bytes, host_resp_pos;
+static bool       host_resp_done;
+static int        failed;
+static bool       device_busy;   // Main loop misses turns at random, so OUT packets wait on the endpoint
+
+
+//
+// Device end
+//
+
+void screen_rx(light_e state) { (void)state; }
+void screen_tx(light_e state) { (void)state; }
+
+static unsigned echo_gen(uint8_t *dest, const unsigned offset, const unsigned bytes)
+{
+    memcpy(dest, &echo[offset], bytes);
+    return bytes;
+}
+
+static uint32_t sum_add(uint32_t sum, const uint8_t *d, unsigned bytes)
+{
+    while (bytes--)  sum = sum * 31 + *d++;
+    return sum;
+}
+
+// Byte i of a stream, so the host never has to hold a whole firmware image
+static uint8_t stream_byte(const unsigned i)
+{
+    return (i * 7) ^ (i >> 8) ^ (i >> 16);
+}
+
+resp_e cmd_handler(const cmd_t *cmd, const int chunk_bytes, const int total_bytes, const bool streaming, const bool start, cmdResp_t *resp, int *resp_bytes, resp_gen_f *resp_gen)
+{
+    (void)resp;
+
+    if (streaming)
+    {
+        if (start)  stream_sum = stream_got = 0;
+
+        stream_sum  = sum_add(stream_sum, (const uint8_t *) cmd, chunk_bytes);
+        stream_got += chunk_bytes;
+
+        if (stream_got < (unsigned) total_bytes)  return RESP_NONE;
+
+        memcpy(echo, &stream_sum, sizeof(stream_sum));
+        *resp_bytes = sizeof(stream_sum);
+    }
+    else
+    {
+        memcpy(echo, cmd, total_bytes);
+        *resp_bytes = total_bytes;
+    }
+
+    *resp_gen = echo_gen;
+
+    return RESP_NEW;
+}
+
+static bool ep_out_ready(loopEp_t *e, unsigned *bytes)
+{
+    if (0 == e->outCount)  return false;
+
+    *bytes = PACKET_BYTES;
+    return true;
+}
+
+static void ep_out_read(loopEp_t *e, uint8_t *d, const unsigned bytes)
+{
+    if (NULL != d)  memcpy(d, e->out[e->outHead], bytes);
+
+    e->outHead = (e->outHead + 1) % 2;
+    e->outCount--;
+}
+
+static bool ep_in_free(loopEp_t *e)
+{
+    return e->inCount < e->inDepth;
+}
+
+static void ep_in_write(loopEp_t *e, const uint8_t *d)
+{
+    memcpy(e->in[(e->inHead + e->inCount) % 2], d, PACKET_BYTES);
+    e->inCount++;
+}
+
+static bool hid_out_ready (unsigned *bytes)                  { return ep_out_ready(&ep[HID], bytes); }
+static void hid_out_read  (uint8_t *d, const unsigned bytes) { ep_out_read(&ep[HID], d, bytes); }
+static bool hid_in_free   (void)                             { return ep_in_free(&ep[HID]); }
+static void hid_in_write  (const uint8_t *d)                 { ep_in_write(&ep[HID], d); }
+static bool bulk_out_ready(unsigned *bytes)                  { return ep_out_ready(&ep[BULK], bytes); }
+static void bulk_out_read (uint8_t *d, const unsigned bytes) { ep_out_read(&ep[BULK], d, bytes); }
+static bool bulk_in_free  (void)                             { return ep_in_free(&ep[BULK]); }
+static void bulk_in_write (const uint8_t *d)                 { ep_in_write(&ep[BULK], d); }
+
+static const usbEpOps_t ops[PIPES] = {
+    { hid_out_ready,  hid_out_read,  hid_in_free,  hid_in_write  },
+    { bulk_out_ready, bulk_out_read, bulk_in_free, bulk_in_write },
+};
+
+// Same order as usbirqHookProcessEvents in hid.c
+static void device_irq(void)
+{
+    int i;
+
+    for (i = 0; i < PIPES; i++)
+    {
+        if (ep[i].outEvent || usbpipe[i].rxDeferred)
+        {
+            ep[i].outEvent = false;
+            usbpipe_out(&usbpipe[i]);
+        }
+    }
+
+    for (i = 0; i < PIPES; i++)  usbpipe_in(&usbpipe[i]);
+}
+
+// Main loop, as hid_process_events
+static void device_loop(void)
+{
+    if (device_busy && 0 == rand() % 3)  return;
+
+    core_poll();
+
+    if (usbpipe_kick(&usbpipe[HID]) | usbpipe_kick(&usbpipe[BULK]))  device_irq();
+}
+
+
+//
+// Host end
+//
+
+static bool host_packet(uint8_t *out)
+{
+    unsigned n, i, header;
+
+    if (host_cmd_pos == host_cmd_bytes && host_packets_out > 0)  return false;
+
+    memset(out, 0, PACKET_BYTES);
+
+    if (0 == host_packets_out)
+    {
+        out[0] = host_stream ? CTRL_START_STREAM : CTRL_START;
+        out[1] = host_cmd_bytes;
+        out[2] = host_cmd_bytes >> 8;
+        out[3] = host_cmd_bytes >> 16;
+        out[4] = host_cmd_bytes >> 24;
+        header = 5;
+    }
+    else
+    {
+        out[0] = host_stream ? CTRL_CONT_STREAM : CTRL_CONT;
+        header = 1;
+    }
+
+    n = min(host_cmd_bytes - host_cmd_pos, PACKET_BYTES - header);
+
+    for (i = 0; i < n; i++)
+    {
+        out[header + i] = host_stream ? stream_byte(host_cmd_pos + i) : host_cmd[host_cmd_pos + i];
+    }
+
+    host_cmd_pos += n;
+    host_packets_out++;
+
+    return true;
+}
+
+static void host_in_push(const uint8_t *in)
+{
+    unsigned n;
+
+    if (0 == host_resp_bytes)
+    {
+        if (in[0] != CTRL_START)  goto error;
+
+        host_resp_bytes = in[1] | (in[2] << 8);
+        n               = min(host_resp_bytes, PACKET_BYTES - 5);
+        memcpy(host_resp, &in[5], n);
+    }
+    else
+    {
+        if (in[0] != CTRL_CONT)  goto error;
+
+        n = min(host_resp_bytes - host_resp_pos, PACKET_BYTES - 1);
+        memcpy(&host_resp[host_resp_pos], &in[1], n);
+    }
+
+    host_resp_pos += n;
+    host_resp_done = host_resp_pos == host_resp_bytes;
+    return;
+
+error:
+    printf("unexpected packet %02x\n", in[0]);
+    failed = 1;
+}
+
+// One transaction each way on the host pipe, false when the endpoint NAKs
+static bool host_out(const int p)
+{
+    loopEp_t *e = &ep[p];
+
+    if (p != host_pipe || e->outCount == e->outDepth)                     return false;
+    if (!host_packet(e->out[(e->outHead + e->outCount) % 2]))             return false;
+
+    e->outCount++;
+    e->outEvent = true;
+    device_irq();
+    return true;
+}
+
+static bool host_in(const int p)
+{
+    loopEp_t *e = &ep[p];
+
+    if (0 == e->inCount)  return false;
+
+    // Responses only ever come back on the interface the command went out on
+    if (p != host_pipe)
+    {
+        printf("response on %s, command went out on %s\n", pipe_name[p], pipe_name[host_pipe]);
+        failed = 1;
+    }
+
+    host_in_push(e->in[e->inHead]);
+    e->inHead = (e->inHead + 1) % 2;
+    e->inCount--;
+    device_irq();
+    return true;
+}
+
+// Frames taken to send the command and get its whole response back
+static unsigned transact(const int p)
+{
+    unsigned frames = 0, slot;
+
+    host_pipe        = p;
+    host_cmd_pos     = host_packets_out = 0;
+    host_resp_bytes  = host_resp_pos = 0;
+    host_resp_done   = false;
+
+    while (!host_resp_done && !failed && frames < 3600 * 1000)
+    {
+        if (0 == frames % HID_OUT_INTERVAL)  host_out(HID);
+        host_in(HID);
+        device_loop();
+
+        for (slot = 0; slot < BULK_PER_FRAME; slot++)
+        {
+            if (!host_in(BULK) && !host_out(BULK))  break;
+            device_loop();
+        }
+
+        frames++;
+    }
+
+    return frames;
+}
+
+static void check(const unsigned count)
+{
+    unsigned seed = 1, bytes, i, j;
+    int      p;
+
+    for (i = 0; i < count && !failed; i++)
+    {
+        p     = rand_r(&seed) % PIPES;
+        bytes = 1 + rand_r(&seed) % sizeof(cmd_t);
+
+        for (j = 0; j < bytes; j++)  host_cmd[j] = rand_r(&seed);
+
+        host_cmd[0]    = CMD_RESET;
+        host_cmd_bytes = bytes;
+        host_stream    = false;
+
+        transact(p);
+
+        if (host_resp_bytes != bytes || memcmp(host_cmd, host_resp, bytes))
+        {
+            printf("command %u on %s: MISMATCH\n", i, pipe_name[p]);
+            failed = 1;
+        }
+    }
+}
+
+static double upload(const int p, const unsigned bytes, const unsigned count)
+{
+    uint32_t sum = 0, got;
+    unsigned frames = 0, i, j;
+    uint8_t  b;
+
+    for (j = 0; j < bytes; j++)
+    {
+        b   = stream_byte(j);
+        sum = sum_add(sum, &b, 1);
+    }
+
+    for (i = 0; i < count && !failed; i++)
+    {
+        host_cmd_bytes = bytes;
+        host_stream    = true;
+
+        frames += transact(p);
+
+        memcpy(&got, host_resp, sizeof(got));
+
+        if (host_resp_bytes != sizeof(sum) || got != sum)
+        {
+            printf("stream %u on %s: checksum MISMATCH\n", i, pipe_name[p]);
+            failed = 1;
+        }
+    }
+
+    return (double) bytes * count * 1000 / frames;
+}
+
+int main(int argc, char **argv)
+{
+    polly_ctx_t ctx;
+    unsigned    count = 1000;
+    double      rate[2][PIPES];
+    int         opt, p;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count = atoi(optarg);  break;
+            default:
+                fprintf(stderr, "usage: %s [-n commands]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.parser = parser_ctx_create();
+    polly_ctx_set(&ctx);
+    cmdparser_init();
+
+    // EP2 OUT single, EP3 IN, EP4 OUT and EP5 IN double buffered as in hid.c
+    ep[HID].outDepth  = 1;
+    ep[HID].inDepth   = 2;
+    ep[BULK].outDepth = 2;
+    ep[BULK].inDepth  = 2;
+
+    for (p = 0; p < PIPES; p++)  usbpipe_init(&usbpipe[p], &ops[p]);
+
+    device_busy = true;
+    check(count);
+    device_busy = false;
+
+    for (p = 0; p < PIPES && !failed; p++)
+    {
+        rate[0][p] = upload(p, PREV_TX_BYTES, PREV_TX_COUNT);
+        rate[1][p] = upload(p, FIRMWARE_BYTES, 1);
+    }
+
+    if (failed)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("%u echoes checked over both interfaces\n", count);
+    printf("upload                 hid B/s    bulk B/s   speedup\n");
+    printf("%2u prev txs of %4u B %10.0f %11.0f %8.1fx\n", PREV_TX_COUNT, PREV_TX_BYTES, rate[0][HID], rate[0][BULK], rate[0][BULK] / rate[0][HID]);
+    printf("firmware of %3u KB   %10.0f %11.0f %8.1fx\n", FIRMWARE_BYTES / 1024, rate[1][HID], rate[1][BULK], rate[1][BULK] / rate[1][HID]);
+
+    for (p = 0; p < PIPES; p++)
+    {
+        printf("%-4s  in %6u  out %6u  deferred %5u  dropped %u\n", pipe_name[p], usbpipe[p].stats.packets_in,
+               usbpipe[p].stats.packets_out, usbpipe[p].stats.deferred, usbpipe[p].stats.dropped);
+    }
+
+    parser_ctx_destroy(ctx.parser);
+
+    return 0;
+}